@@ -0,0 +1,879 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "haarwavelet.h"
+#include "haarwaveletbank.h"
+#include "haarwaveletevaluators.h"
+#include "haarwaveletinstrumentation.h"
+#include "haarwaveletscanner.h"
+#include "haarwaveletutilities.h"
+
+
+
+/*
+ * Benchmarks of the hot paths of haarcommon over synthetic inputs: random images from 24x24 up to 4K and random
+ * banks of each kind of wavelet, all generated from a seed so that every run measures the same work.
+ *
+ * Results are written as JSON, one result per line. Each result has the median time of one run, its primary
+ * throughput (and unit) and, where they apply, windows/s, features/s and MB/s. With --baseline, the primary
+ * throughput of each result is compared with the one of the same result in a previous output, and the program
+ * exits with 1 if any of them dropped by more than the tolerance. Builds with HAARCOMMON_INSTRUMENTATION also write
+ * the counters and timers of the whole run.
+ *
+ * Usage: haarcommon_bench [--quick] [--filter substring] [--output file] [--baseline file] [--tolerance 0.10]
+ *                         [--seed n]
+ */
+
+
+
+namespace
+{
+
+/**
+ * xorshift64* generator, so that inputs don't depend on the random generator of the OpenCV build.
+ */
+class Random
+{
+public:
+    explicit Random(const unsigned long long seed) : state(seed ? seed : 0x9E3779B97F4A7C15ULL) {}
+
+    unsigned long long next()
+    {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545F4914F6CDD1DULL;
+    }
+
+    /**
+     * Uniform integer in [low, high].
+     */
+    int uniform(const int low, const int high)
+    {
+        return low + (int)(next() % (unsigned long long)(high - low + 1));
+    }
+
+    /**
+     * Uniform float in [low, high).
+     */
+    float uniform(const float low, const float high)
+    {
+        return low + (high - low) * (float)((next() >> 40) / 16777216.0);
+    }
+
+private:
+    unsigned long long state;
+};
+
+const cv::Size WINDOW_SIZE(24, 24);
+
+cv::Mat randomImage(Random & random, const cv::Size & size)
+{
+    cv::Mat image(size, cv::DataType<unsigned char>::type);
+    for (int y = 0; y < size.height; ++y)
+    {
+        unsigned char * row = image.ptr<unsigned char>(y);
+        for (int x = 0; x < size.width; ++x)
+        {
+            row[x] = (unsigned char)random.uniform(0, 255);
+        }
+    }
+    return image;
+}
+
+cv::Rect randomRect(Random & random, const cv::Size & size)
+{
+    const int x = random.uniform(0, size.width - 1);
+    const int y = random.uniform(0, size.height - 1);
+    return cv::Rect(x, y, random.uniform(1, size.width - x), random.uniform(1, size.height - y));
+}
+
+std::vector<float> randomWeights(Random & random, const unsigned int count)
+{
+    std::vector<float> weights(count);
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        weights[i] = random.uniform(-2.0f, 2.0f);
+    }
+    return weights;
+}
+
+/**
+ * Appends a random wavelet of 2 to 4 rectangles inside the detection window.
+ */
+void addRandomWavelet(Random & random, std::vector<HaarWavelet> & wavelets)
+{
+    std::vector<cv::Rect> rects(random.uniform(2, 4));
+    for (unsigned int r = 0; r < rects.size(); ++r)
+    {
+        rects[r] = randomRect(random, WINDOW_SIZE);
+    }
+    wavelets.push_back(HaarWavelet(rects, randomWeights(random, rects.size())));
+}
+
+void addRandomWavelet(Random & random, std::vector<MyHaarWavelet> & wavelets)
+{
+    std::vector<cv::Rect> rects(random.uniform(2, 4));
+    std::vector<float> means(rects.size());
+    for (unsigned int r = 0; r < rects.size(); ++r)
+    {
+        rects[r] = randomRect(random, WINDOW_SIZE);
+        means[r] = random.uniform(0.0f, 1.0f);
+    }
+    wavelets.push_back(MyHaarWavelet(rects, randomWeights(random, rects.size()), means));
+}
+
+void addRandomWavelet(Random & random, std::vector<DualWeightHaarWavelet> & wavelets)
+{
+    std::vector<cv::Rect> rects(random.uniform(2, 4));
+    for (unsigned int r = 0; r < rects.size(); ++r)
+    {
+        rects[r] = randomRect(random, WINDOW_SIZE);
+    }
+    const std::vector<float> weights = randomWeights(random, rects.size());
+    wavelets.push_back(DualWeightHaarWavelet(rects, weights, randomWeights(random, rects.size())));
+}
+
+template <typename HaarWaveletType>
+std::vector<HaarWaveletType> randomWavelets(Random & random, const unsigned int count)
+{
+    std::vector<HaarWaveletType> wavelets;
+    wavelets.reserve(count);
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        addRandomWavelet(random, wavelets);
+    }
+    return wavelets;
+}
+
+/**
+ * Random window positions of sum.
+ */
+std::vector<cv::Point> randomOrigins(Random & random, const cv::Mat & sum, const unsigned int count)
+{
+    std::vector<cv::Point> origins(count);
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        origins[i] = cv::Point(random.uniform(0, sum.cols - 1 - WINDOW_SIZE.width),
+                               random.uniform(0, sum.rows - 1 - WINDOW_SIZE.height));
+    }
+    return origins;
+}
+
+/**
+ * Integral images of a synthetic frame, in the reference (double) representation.
+ */
+struct Frame
+{
+    Frame(Random & random, const cv::Size & size)
+    {
+        image = randomImage(random, size);
+        cv::integral(image, sum, squareSum, cv::DataType<double>::type);
+    }
+
+    std::string name() const
+    {
+        std::ostringstream os;
+        os << image.cols << 'x' << image.rows;
+        return os.str();
+    }
+
+    cv::Mat image;
+    cv::Mat sum;
+    cv::Mat squareSum;
+};
+
+const char * kindName(const HaarWavelet *) { return "plain"; }
+const char * kindName(const MyHaarWavelet *) { return "means"; }
+const char * kindName(const DualWeightHaarWavelet *) { return "dual"; }
+
+const char * evaluatorName(const IntensityNormalizedWaveletEvaluator &) { return "intensity"; }
+const char * evaluatorName(const VarianceNormalizedWaveletEvaluator &) { return "variance"; }
+
+size_t fileSize(const std::string & filename)
+{
+    std::ifstream ifs(filename.c_str(), std::ifstream::in | std::ifstream::binary | std::ifstream::ate);
+    return ifs.is_open() ? (size_t)ifs.tellg() : 0;
+}
+
+//Results of the benchmarked code are accumulated here, so that it is not optimized away.
+volatile double sink = 0;
+
+
+
+/**
+ * A piece of work to time. run() must do the same work every time it is called.
+ */
+class Task
+{
+public:
+    virtual ~Task() {}
+    virtual void run() = 0;
+};
+
+class RectangleTask : public Task
+{
+public:
+    RectangleTask(const cv::Mat & sum_, const std::vector<cv::Rect> & rects_) : sum(sum_), rects(rects_) {}
+
+    void run()
+    {
+        double total = 0;
+        for (std::vector<cv::Rect>::const_iterator it = rects.begin(); it != rects.end(); ++it)
+        {
+            total += evaluator.singleRectangleValue(*it, sum);
+        }
+        sink += total;
+    }
+
+private:
+    const IntensityNormalizedWaveletEvaluator evaluator;
+    const cv::Mat & sum;
+    const std::vector<cv::Rect> & rects;
+};
+
+template <typename Evaluator>
+class EvaluateTask : public Task
+{
+public:
+    EvaluateTask(const PreparedWaveletBank & prepared_, const Frame & frame_, const std::vector<cv::Point> & origins_)
+        : prepared(prepared_),
+          frame(frame_),
+          origins(origins_),
+          results(prepared_.bank().size() * prepared_.bank().outputs()) {}
+
+    void run()
+    {
+        for (std::vector<cv::Point>::const_iterator it = origins.begin(); it != origins.end(); ++it)
+        {
+            evaluator(prepared, frame.sum, frame.squareSum, *it, &results[0]);
+            sink += results[0];
+        }
+    }
+
+private:
+    const Evaluator evaluator;
+    const PreparedWaveletBank & prepared;
+    const Frame & frame;
+    const std::vector<cv::Point> & origins;
+    std::vector<float> results;
+};
+
+void srfs(const IntensityNormalizedWaveletEvaluator & evaluator,
+          const AbstractHaarWavelet & w,
+          const Frame & frame,
+          float * values,
+          const unsigned int length)
+{
+    evaluator.srfs(w, frame.sum, values, length);
+}
+
+void srfs(const VarianceNormalizedWaveletEvaluator & evaluator,
+          const AbstractHaarWavelet & w,
+          const Frame & frame,
+          float * values,
+          const unsigned int length)
+{
+    evaluator.srfs(w, frame.sum, frame.squareSum, values, length);
+}
+
+template <typename Evaluator, typename HaarWaveletType>
+class SrfsTask : public Task
+{
+public:
+    SrfsTask(const std::vector<HaarWaveletType> & wavelets_, const Frame & frame_)
+        : wavelets(wavelets_),
+          frame(frame_),
+          values(4) {}
+
+    void run()
+    {
+        typename std::vector<HaarWaveletType>::const_iterator it = wavelets.begin();
+        const typename std::vector<HaarWaveletType>::const_iterator end = wavelets.end();
+        for (; it != end; ++it)
+        {
+            srfs(evaluator, *it, frame, &values[0], values.size());
+            sink += values[0];
+        }
+    }
+
+private:
+    const Evaluator evaluator;
+    const std::vector<HaarWaveletType> & wavelets;
+    const Frame & frame;
+    std::vector<float> values;
+};
+
+template <typename HaarWaveletType>
+class WriteTask : public Task
+{
+public:
+    WriteTask(const std::string & filename_, const std::vector<HaarWaveletType> & wavelets_)
+        : filename(filename_),
+          wavelets(wavelets_) {}
+
+    void run()
+    {
+        if (!writeHaarWavelets(filename, wavelets))
+        {
+            throw std::string("could not write ") + filename;
+        }
+    }
+
+private:
+    const std::string & filename;
+    const std::vector<HaarWaveletType> & wavelets;
+};
+
+template <typename HaarWaveletType>
+class LoadTask : public Task
+{
+public:
+    explicit LoadTask(const std::string & filename_) : filename(filename_) {}
+
+    void run()
+    {
+        wavelets.clear();
+        if (!loadHaarWavelets(filename, wavelets))
+        {
+            throw std::string("could not read ") + filename;
+        }
+        sink += wavelets.size();
+    }
+
+private:
+    const std::string & filename;
+    std::vector<HaarWaveletType> wavelets;
+};
+
+class IntensityScanTask : public Task
+{
+public:
+    IntensityScanTask(const PreparedWaveletBank & prepared_, const Frame & frame_, const int stride_)
+        : prepared(prepared_),
+          frame(frame_),
+          stride(stride_) {}
+
+    void run()
+    {
+        responseMaps(evaluator, prepared, frame.sum, frame.squareSum, stride, maps);
+        sink += maps[0].at<float>(0, 0);
+    }
+
+private:
+    const IntensityNormalizedWaveletEvaluator evaluator;
+    const PreparedWaveletBank & prepared;
+    const Frame & frame;
+    const int stride;
+    std::vector<cv::Mat> maps;
+};
+
+class VarianceScanTask : public Task
+{
+public:
+    VarianceScanTask(const PreparedWaveletBank & prepared_, const Frame & frame_, const int stride_)
+        : prepared(prepared_),
+          frame(frame_),
+          stride(stride_) {}
+
+    void run()
+    {
+        responseMaps(evaluator, prepared, frame.sum, frame.squareSum, stride, statistics, maps);
+        sink += maps[0].at<float>(0, 0);
+    }
+
+private:
+    const VarianceNormalizedWaveletEvaluator evaluator;
+    const PreparedWaveletBank & prepared;
+    const Frame & frame;
+    const int stride;
+    WindowStatisticsMap statistics;
+    std::vector<cv::Mat> maps;
+};
+
+
+
+/**
+ * Amount of work done by one run of a task, from which the throughputs are derived.
+ */
+struct Work
+{
+    Work() : items(0), windows(0), features(0), bytes(0) {}
+
+    double items;       //in the primary unit
+    double windows;
+    double features;
+    double bytes;
+};
+
+struct Result
+{
+    std::string name;
+    std::string unit;
+    unsigned int runs;
+    double seconds;     //median of the runs
+    Work work;
+
+    double rate(const double amount) const
+    {
+        return amount / seconds;
+    }
+};
+
+struct Options
+{
+    Options() : quick(false), tolerance(0.10), seed(1) {}
+
+    bool quick;
+    std::string filter;
+    std::string output;
+    std::string baseline;
+    double tolerance;
+    unsigned long seed;
+};
+
+class Suite
+{
+public:
+    explicit Suite(const Options & options_) : options(options_) {}
+
+    bool selected(const std::string & name) const
+    {
+        return name.find(options.filter) != std::string::npos;
+    }
+
+    /**
+     * Runs task once to warm up, then until it has run at least 3 times and for the minimum time, and records
+     * the median time of one run.
+     */
+    void time(const std::string & name, Task & task, const std::string & unit, const Work & work)
+    {
+        if (!selected(name))
+        {
+            return;
+        }
+
+        const double minimum = options.quick ? 0.05 : 0.5;
+        const unsigned int maximumRuns = 1000;
+
+        task.run();
+
+        std::vector<double> seconds;
+        double total = 0;
+        while (seconds.size() < maximumRuns && (seconds.size() < 3 || total < minimum))
+        {
+            const long long begin = cv::getTickCount();
+            task.run();
+            const double elapsed = (cv::getTickCount() - begin) / cv::getTickFrequency();
+            seconds.push_back(std::max(elapsed, 1e-9));
+            total += elapsed;
+        }
+        std::sort(seconds.begin(), seconds.end());
+
+        Result result;
+        result.name = name;
+        result.unit = unit;
+        result.runs = seconds.size();
+        result.seconds = seconds[seconds.size() / 2];
+        result.work = work;
+        results.push_back(result);
+
+        std::cerr << name << ": " << result.rate(work.items) << ' ' << unit << std::endl;
+    }
+
+    const std::vector<Result> & all() const
+    {
+        return results;
+    }
+
+private:
+    const Options & options;
+    std::vector<Result> results;
+};
+
+
+
+void rectangleBenchmarks(Suite & suite, Random & random, const std::vector<Frame> & frames, const bool quick)
+{
+    const unsigned int count = quick ? 10000 : 100000;
+    for (std::vector<Frame>::const_iterator frame = frames.begin(); frame != frames.end(); ++frame)
+    {
+        std::vector<cv::Rect> rects(count);
+        for (unsigned int i = 0; i < count; ++i)
+        {
+            rects[i] = randomRect(random, frame->image.size());
+        }
+
+        Work work;
+        work.items = count;
+        RectangleTask task(frame->sum, rects);
+        suite.time("singleRectangleValue/" + frame->name(), task, "rectangles/s", work);
+    }
+}
+
+template <typename Evaluator>
+void evaluateBenchmark(Suite & suite,
+                       const std::string & kind,
+                       const PreparedWaveletBank & prepared,
+                       const Frame & frame,
+                       const std::vector<cv::Point> & origins)
+{
+    std::ostringstream name;
+    name << "evaluate/" << evaluatorName(Evaluator()) << '/' << kind << '/' << prepared.bank().size();
+
+    Work work;
+    work.windows = origins.size();
+    work.features = (double)origins.size() * prepared.bank().size() * prepared.bank().outputs();
+    work.items = work.features;
+
+    EvaluateTask<Evaluator> task(prepared, frame, origins);
+    suite.time(name.str(), task, "features/s", work);
+}
+
+template <typename Evaluator, typename HaarWaveletType>
+void srfsBenchmark(Suite & suite, const std::string & kind, const std::vector<HaarWaveletType> & wavelets, const Frame & frame)
+{
+    std::ostringstream name;
+    name << "srfs/" << evaluatorName(Evaluator()) << '/' << kind << '/' << wavelets.size();
+
+    size_t features = 0;
+    typename std::vector<HaarWaveletType>::const_iterator it = wavelets.begin();
+    for (; it != wavelets.end(); ++it)
+    {
+        features += it->dimensions();
+    }
+
+    Work work;
+    work.features = features;
+    work.items = features;
+
+    SrfsTask<Evaluator, HaarWaveletType> task(wavelets, frame);
+    suite.time(name.str(), task, "features/s", work);
+}
+
+template <typename HaarWaveletType>
+void ioBenchmarks(Suite & suite, const std::string & kind, const std::vector<HaarWaveletType> & wavelets)
+{
+    std::ostringstream suffix;
+    suffix << kind << '/' << wavelets.size();
+    const std::string writeName = "writeHaarWavelets/" + suffix.str();
+    const std::string loadName = "loadHaarWavelets/" + suffix.str();
+    if (!suite.selected(writeName) && !suite.selected(loadName))
+    {
+        return;
+    }
+
+    const std::string filename = "haarcommon_bench.tmp";
+    if (!writeHaarWavelets(filename, wavelets))
+    {
+        throw std::string("could not write ") + filename;
+    }
+
+    Work work;
+    work.features = wavelets.size();
+    work.bytes = fileSize(filename);
+    work.items = work.bytes / 1e6;
+
+    WriteTask<HaarWaveletType> write(filename, wavelets);
+    suite.time(writeName, write, "MB/s", work);
+
+    LoadTask<HaarWaveletType> load(filename);
+    suite.time(loadName, load, "MB/s", work);
+
+    std::remove(filename.c_str());
+}
+
+template <typename HaarWaveletType>
+void bankBenchmarks(Suite & suite, Random & random, const Frame & window, const Frame & frame, const bool quick)
+{
+    const std::string kind = kindName((const HaarWaveletType *)0);
+
+    std::vector<unsigned int> sizes;
+    sizes.push_back(1000);
+    sizes.push_back(10000);
+    if (!quick)
+    {
+        sizes.push_back(200000);
+    }
+
+    for (std::vector<unsigned int>::const_iterator size = sizes.begin(); size != sizes.end(); ++size)
+    {
+        const std::vector<HaarWaveletType> wavelets = randomWavelets<HaarWaveletType>(random, *size);
+        const CompiledWaveletBank bank(wavelets);
+        const PreparedWaveletBank prepared(bank, frame.sum.step1(), WINDOW_SIZE);
+
+        //About the same amount of features per run whatever the size of the bank
+        const std::vector<cv::Point> origins = randomOrigins(random, frame.sum, std::max(1u, (quick ? 200000u : 2000000u) / *size));
+
+        evaluateBenchmark<IntensityNormalizedWaveletEvaluator>(suite, kind, prepared, frame, origins);
+        evaluateBenchmark<VarianceNormalizedWaveletEvaluator>(suite, kind, prepared, frame, origins);
+
+        if (*size <= 10000)
+        {
+            srfsBenchmark<IntensityNormalizedWaveletEvaluator>(suite, kind, wavelets, window);
+            srfsBenchmark<VarianceNormalizedWaveletEvaluator>(suite, kind, wavelets, window);
+        }
+
+        ioBenchmarks(suite, kind, wavelets);
+    }
+}
+
+void scanBenchmarks(Suite & suite, Random & random, const std::vector<Frame> & frames, const bool quick)
+{
+    const int stride = 2;
+    const CompiledWaveletBank bank(randomWavelets<HaarWavelet>(random, quick ? 8 : 32));
+
+    for (std::vector<Frame>::const_iterator frame = frames.begin(); frame != frames.end(); ++frame)
+    {
+        const PreparedWaveletBank prepared(bank, frame->sum.step1(), WINDOW_SIZE);
+        const cv::Size size = scanner::responseMapSize(prepared, frame->sum, stride);
+
+        Work work;
+        work.windows = size.area();
+        work.features = (double)size.area() * bank.size() * bank.outputs();
+        work.items = work.windows;
+
+        IntensityScanTask intensity(prepared, *frame, stride);
+        suite.time("scan/intensity/" + frame->name(), intensity, "windows/s", work);
+
+        VarianceScanTask variance(prepared, *frame, stride);
+        suite.time("scan/variance/" + frame->name(), variance, "windows/s", work);
+    }
+}
+
+
+
+void writeJson(std::ostream & os, const Result & r)
+{
+    os << "{\"name\": \"" << r.name << "\""
+       << ", \"unit\": \"" << r.unit << "\""
+       << ", \"throughput\": " << r.rate(r.work.items)
+       << ", \"seconds\": " << r.seconds
+       << ", \"runs\": " << r.runs;
+    if (r.work.windows)
+    {
+        os << ", \"windows/s\": " << r.rate(r.work.windows);
+    }
+    if (r.work.features)
+    {
+        os << ", \"features/s\": " << r.rate(r.work.features);
+    }
+    if (r.work.bytes)
+    {
+        os << ", \"MB/s\": " << r.rate(r.work.bytes) / 1e6;
+    }
+    os << "}";
+}
+
+/**
+ * Reads the primary throughput of each result of a previous output of this program.
+ */
+std::map<std::string, double> readBaseline(const std::string & filename)
+{
+    std::ifstream ifs(filename.c_str());
+    if (!ifs.is_open())
+    {
+        throw std::string("could not read ") + filename;
+    }
+
+    const std::string nameKey = "\"name\": \"";
+    const std::string throughputKey = "\"throughput\": ";
+
+    std::map<std::string, double> baseline;
+    std::string line;
+    while (std::getline(ifs, line))
+    {
+        const size_t name = line.find(nameKey);
+        const size_t throughput = line.find(throughputKey);
+        if (name == std::string::npos || throughput == std::string::npos)
+        {
+            continue;
+        }
+        const size_t begin = name + nameKey.size();
+        baseline[line.substr(begin, line.find('"', begin) - begin)] = std::strtod(line.c_str() + throughput + throughputKey.size(), 0);
+    }
+    return baseline;
+}
+
+/**
+ * Writes the results, and their comparison with the baseline if any. Returns the amount of regressions.
+ */
+unsigned int report(std::ostream & os, const Options & options, const std::vector<Result> & results)
+{
+    os.precision(6);
+    os << "{\n\"seed\": " << options.seed << ",\n\"quick\": " << (options.quick ? "true" : "false") << ",\n\"results\": [\n";
+    for (unsigned int i = 0; i < results.size(); ++i)
+    {
+        writeJson(os, results[i]);
+        os << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    os << "]";
+
+    if (instrumentation::enabled())
+    {
+        const instrumentation::Snapshot s = instrumentation::snapshot();
+        os << ",\n\"instrumentation\": {";
+        for (int i = 0; i < instrumentation::COUNTERS; ++i)
+        {
+            os << (i ? ", " : "") << "\"" << instrumentation::name((instrumentation::Counter)i) << "\": " << s.counters[i];
+        }
+        for (int i = 0; i < instrumentation::TIMERS; ++i)
+        {
+            const char * name = instrumentation::name((instrumentation::Timer)i);
+            os << ", \"" << name << "_cycles\": " << s.cycles[i] << ", \"" << name << "_calls\": " << s.calls[i];
+        }
+        os << "}";
+    }
+
+    unsigned int regressions = 0;
+    if (!options.baseline.empty())
+    {
+        const std::map<std::string, double> baseline = readBaseline(options.baseline);
+
+        os << ",\n\"tolerance\": " << options.tolerance << ",\n\"comparison\": [\n";
+        bool first = true;
+        for (std::vector<Result>::const_iterator it = results.begin(); it != results.end(); ++it)
+        {
+            const std::map<std::string, double>::const_iterator previous = baseline.find(it->name);
+            if (previous == baseline.end() || previous->second <= 0)
+            {
+                continue;
+            }
+
+            const double current = it->rate(it->work.items);
+            const double ratio = current / previous->second;
+            const bool regression = ratio < 1.0 - options.tolerance;
+            regressions += regression;
+
+            os << (first ? "" : ",\n")
+               << "{\"name\": \"" << it->name << "\""
+               << ", \"baseline\": " << previous->second
+               << ", \"current\": " << current
+               << ", \"ratio\": " << ratio
+               << ", \"regression\": " << (regression ? "true" : "false") << "}";
+            first = false;
+        }
+        os << (first ? "" : "\n") << "],\n\"regressions\": " << regressions;
+    }
+    os << "\n}\n";
+
+    return regressions;
+}
+
+bool parse(const int argc, char ** argv, Options & options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string argument = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (argument == "--quick")
+        {
+            options.quick = true;
+        }
+        else if (argument == "--filter" && hasValue)
+        {
+            options.filter = argv[++i];
+        }
+        else if (argument == "--output" && hasValue)
+        {
+            options.output = argv[++i];
+        }
+        else if (argument == "--baseline" && hasValue)
+        {
+            options.baseline = argv[++i];
+        }
+        else if (argument == "--tolerance" && hasValue)
+        {
+            options.tolerance = std::strtod(argv[++i], 0);
+        }
+        else if (argument == "--seed" && hasValue)
+        {
+            options.seed = std::strtoul(argv[++i], 0, 10);
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+
+
+
+int main(int argc, char ** argv)
+{
+    Options options;
+    if (!parse(argc, argv, options))
+    {
+        std::cerr << "Usage: " << argv[0] << " [--quick] [--filter substring] [--output file] [--baseline file]"
+                  << " [--tolerance 0.10] [--seed n]" << std::endl;
+        return 2;
+    }
+
+    try
+    {
+        Random random(options.seed);
+        Suite suite(options);
+
+        std::vector<cv::Size> sizes;
+        sizes.push_back(cv::Size(24, 24));
+        sizes.push_back(cv::Size(320, 240));
+        sizes.push_back(cv::Size(640, 480));
+        if (!options.quick)
+        {
+            sizes.push_back(cv::Size(1920, 1080));
+            sizes.push_back(cv::Size(3840, 2160));
+        }
+
+        std::vector<Frame> frames;
+        for (std::vector<cv::Size>::const_iterator size = sizes.begin(); size != sizes.end(); ++size)
+        {
+            frames.push_back(Frame(random, *size));
+        }
+        const Frame & window = frames[0];
+        const Frame & frame = frames[2];
+
+        rectangleBenchmarks(suite, random, frames, options.quick);
+        bankBenchmarks<HaarWavelet>(suite, random, window, frame, options.quick);
+        bankBenchmarks<MyHaarWavelet>(suite, random, window, frame, options.quick);
+        bankBenchmarks<DualWeightHaarWavelet>(suite, random, window, frame, options.quick);
+        scanBenchmarks(suite, random, std::vector<Frame>(frames.begin() + 1, frames.end()), options.quick);
+
+        unsigned int regressions = 0;
+        if (options.output.empty())
+        {
+            regressions = report(std::cout, options, suite.all());
+        }
+        else
+        {
+            std::ofstream ofs(options.output.c_str(), std::ofstream::out | std::ofstream::trunc);
+            if (!ofs.is_open())
+            {
+                throw std::string("could not write ") + options.output;
+            }
+            regressions = report(ofs, options, suite.all());
+        }
+        return regressions ? 1 : 0;
+    }
+    catch (const std::string & message)
+    {
+        std::cerr << message << std::endl;
+    }
+    catch (const int code)
+    {
+        std::cerr << "haarcommon threw " << code << std::endl;
+    }
+    return 2;
+}
@@ -40,7 +40,7 @@ HaarWavelet::HaarWavelet(std::vector<cv::Rect> rects_,
 
 bool HaarWavelet::read(std::istream &input)
 {
-    int rectangles;
+    int rectangles = 0;
     input >> rectangles;
 
     for (int i = 0; i < rectangles; i++)
@@ -53,6 +53,10 @@ bool HaarWavelet::read(std::istream &input)
               >> rect_.width
               >> rect_.height
               >> weight_;
+        if (!input) //don't go on with a corrupt amount of rectangles
+        {
+            break;
+        }
 
         rects.push_back(rect_);
         weights.push_back(weight_);
@@ -191,6 +195,15 @@ DualWeightHaarWavelet::DualWeightHaarWavelet(const DualWeightHaarWavelet &w)
     weightsNegative = w.weightsNegative;
 }
 
+DualWeightHaarWavelet::DualWeightHaarWavelet(std::vector<cv::Rect> rects_,
+                                             std::vector<float> weightsPositive_,
+                                             std::vector<float> weightsNegative_)
+{
+    rects = rects_;
+    weightsPositive = weightsPositive_;
+    weightsNegative = weightsNegative_;
+}
+
 std::vector<float>::const_iterator DualWeightHaarWavelet::weightsPositive_begin() const
 {
     return weightsPositive.begin();
@@ -213,7 +226,7 @@ const std::vector<float>::const_iterator DualWeightHaarWavelet::weightsNegative_
 
 bool DualWeightHaarWavelet::read(std::istream &input)
 {
-    int rectangles;
+    int rectangles = 0;
     input >> rectangles;
 
     for (int i = 0; i < rectangles; i++)
@@ -266,3 +279,118 @@ bool DualWeightHaarWavelet::write(std::ostream &output) const
 
     return true;
 }
+
+
+
+//======================================== MultiHeadHaarWavelet ========================================
+
+
+
+MultiHeadHaarWavelet::MultiHeadHaarWavelet() : heads_(0) {}
+
+MultiHeadHaarWavelet::MultiHeadHaarWavelet(std::vector<cv::Rect> rects_,
+                                           const unsigned int heads,
+                                           std::vector<float> weights_,
+                                           std::vector<float> means_) : heads_(heads),
+                                                                        weights(weights_),
+                                                                        means(means_)
+{
+    if (weights.size() != heads_ * rects_.size() || (!means.empty() && means.size() != weights.size()))
+    {
+        throw 44;
+    }
+    rects = rects_;
+}
+
+unsigned int MultiHeadHaarWavelet::heads() const
+{
+    return heads_;
+}
+
+bool MultiHeadHaarWavelet::hasMeans() const
+{
+    return !means.empty();
+}
+
+std::vector<float>::const_iterator MultiHeadHaarWavelet::weights_begin(const unsigned int head) const
+{
+    return weights.begin() + head * dimensions();
+}
+
+const std::vector<float>::const_iterator MultiHeadHaarWavelet::weights_end(const unsigned int head) const
+{
+    return weights.begin() + (head + 1) * dimensions();
+}
+
+std::vector<float>::const_iterator MultiHeadHaarWavelet::means_begin(const unsigned int head) const
+{
+    return means.begin() + head * dimensions();
+}
+
+const std::vector<float>::const_iterator MultiHeadHaarWavelet::means_end(const unsigned int head) const
+{
+    return means.begin() + (head + 1) * dimensions();
+}
+
+/**
+ * The format is the amount of rectangles, the amount of heads, 1 if there are means (else 0), the rectangles
+ * (x y width height each), then the weights of each head and the means of each head.
+ */
+bool MultiHeadHaarWavelet::read(std::istream &input)
+{
+    int rectangles = 0, withMeans = 0;
+    input >> rectangles >> heads_ >> withMeans;
+
+    for (int i = 0; i < rectangles; i++)
+    {
+        cv::Rect rect_;
+        input >> rect_.x
+              >> rect_.y
+              >> rect_.width
+              >> rect_.height;
+        rects.push_back(rect_);
+    }
+
+    weights.resize(heads_ * dimensions());
+    for (unsigned int i = 0; i < weights.size(); i++)
+    {
+        input >> weights[i];
+    }
+
+    means.resize(withMeans ? weights.size() : 0);
+    for (unsigned int i = 0; i < means.size(); i++)
+    {
+        input >> means[i];
+    }
+
+    return true;
+}
+
+bool MultiHeadHaarWavelet::write(std::ostream &output) const
+{
+    if (dimensions() == 0 || heads_ == 0) //won't store a meaningless wavelet
+    {
+        return false;
+    }
+
+    output << dimensions() << ' ' << heads_ << ' ' << (hasMeans() ? 1 : 0);
+
+    for (unsigned int i = 0; i < dimensions(); i++)
+    {
+        output << ' '
+               << rects[i].x << ' '
+               << rects[i].y << ' '
+               << rects[i].width << ' '
+               << rects[i].height;
+    }
+    for (unsigned int i = 0; i < weights.size(); i++)
+    {
+        output << ' ' << weights[i];
+    }
+    for (unsigned int i = 0; i < means.size(); i++)
+    {
+        output << ' ' << means[i];
+    }
+
+    return true;
+}
@@ -188,6 +188,13 @@ public:
      */
     DualWeightHaarWavelet(const DualWeightHaarWavelet &w);
 
+    /**
+     * Constructs a DualWeightHaarWavelet with one weight of each set per rectangle.
+     */
+    DualWeightHaarWavelet(std::vector<cv::Rect> rects_,
+                          std::vector<float> weightsPositive_,
+                          std::vector<float> weightsNegative_);
+
     std::vector<float>::const_iterator weightsPositive_begin() const;
     const std::vector<float>::const_iterator weightsPositive_end() const;
 
@@ -219,4 +226,77 @@ protected:
 
 
 
+/**
+ * @brief The MultiHeadHaarWavelet class represents a Haar wavelet with several sets of weights (heads) over the same
+ * rectangles, e.g. the wavelets of several one-vs-rest classifiers.
+ *
+ * The SRFS is computed once and each head responds with the weighted sum of the SRFS by its weights or, if the
+ * wavelet has means, with the absolute value of the weighted sum of the SRFS minus the means of the head (as a
+ * MyHaarWavelet). A DualWeightHaarWavelet is a two-head wavelet without means.
+ */
+class MultiHeadHaarWavelet : public AbstractHaarWavelet
+{
+public:
+
+    /**
+     * Constructs an "empty" instance of this object.
+     */
+    MultiHeadHaarWavelet();
+
+    /**
+     * Destroys this instance of MultiHeadHaarWavelet.
+     */
+    ~MultiHeadHaarWavelet() {}
+
+    /**
+     * @param weights_ the weights of each head in turn, heads * rects_.size() weights in all.
+     * @param means_ empty, or the means of each head in turn, laid out as weights_.
+     *
+     * Weights or means of any other size throw 44.
+     */
+    MultiHeadHaarWavelet(std::vector<cv::Rect> rects_,
+                         const unsigned int heads,
+                         std::vector<float> weights_,
+                         std::vector<float> means_ = std::vector<float>());
+
+    /**
+     * Amount of weight sets, i.e. of responses of this wavelet.
+     */
+    unsigned int heads() const;
+
+    bool hasMeans() const;
+
+    std::vector<float>::const_iterator weights_begin(const unsigned int head) const;
+    const std::vector<float>::const_iterator weights_end(const unsigned int head) const;
+
+    std::vector<float>::const_iterator means_begin(const unsigned int head) const;
+    const std::vector<float>::const_iterator means_end(const unsigned int head) const;
+
+    /**
+     * Reads som data and sets this HaarWavelet with it.
+     */
+    virtual bool read(std::istream &input);
+
+    /**
+     * Writes this Haar wavelet into the given std::ostream.
+     */
+    virtual bool write(std::ostream &output) const;
+
+protected:
+
+    unsigned int heads_;
+
+    /**
+     * Weights of each head, one head after the other.
+     */
+    std::vector<float> weights;
+
+    /**
+     * Means of each head, as weights, or nothing.
+     */
+    std::vector<float> means;
+};
+
+
+
 #endif // HAARWAVELET_H
@@ -0,0 +1,317 @@
+#include "haarwaveletbank.h"
+
+#include <limits>
+
+#include "haarwaveletgenerator.h"
+
+
+
+CompiledWaveletBank::CompiledWaveletBank() : kind_(PLAIN) {}
+
+CompiledWaveletBank::CompiledWaveletBank(const std::vector<HaarWavelet> &wavelets) : kind_(PLAIN)
+{
+    unsigned int totalRectangles = 0;
+    for (std::vector<HaarWavelet>::const_iterator w = wavelets.begin(); w != wavelets.end(); ++w)
+    {
+        totalRectangles += w->dimensions();
+    }
+    allocate(wavelets.size(), totalRectangles);
+
+    unsigned int r = 0;
+    for (unsigned int i = 0; i < wavelets.size(); ++i)
+    {
+        rectanglesBegin_[i] = r;
+        std::vector<float>::const_iterator weight = wavelets[i].weights_begin();
+        for (std::vector<cv::Rect>::const_iterator it = wavelets[i].rects_begin(); it != wavelets[i].rects_end(); ++it, ++weight, ++r)
+        {
+            addRectangle(r, *it);
+            weights_[r] = *weight;
+        }
+    }
+    rectanglesBegin_[wavelets.size()] = r;
+}
+
+CompiledWaveletBank::CompiledWaveletBank(const std::vector<MyHaarWavelet> &wavelets) : kind_(MEANS)
+{
+    unsigned int totalRectangles = 0;
+    for (std::vector<MyHaarWavelet>::const_iterator w = wavelets.begin(); w != wavelets.end(); ++w)
+    {
+        totalRectangles += w->dimensions();
+    }
+    allocate(wavelets.size(), totalRectangles);
+
+    unsigned int r = 0;
+    for (unsigned int i = 0; i < wavelets.size(); ++i)
+    {
+        rectanglesBegin_[i] = r;
+        std::vector<float>::const_iterator weight = wavelets[i].weights_begin();
+        std::vector<float>::const_iterator mean = wavelets[i].means_begin();
+        for (std::vector<cv::Rect>::const_iterator it = wavelets[i].rects_begin(); it != wavelets[i].rects_end(); ++it, ++weight, ++mean, ++r)
+        {
+            addRectangle(r, *it);
+            weights_[r] = *weight;
+            means_[r] = *mean;
+        }
+    }
+    rectanglesBegin_[wavelets.size()] = r;
+}
+
+CompiledWaveletBank::CompiledWaveletBank(const std::vector<DualWeightHaarWavelet> &wavelets) : kind_(DUAL_WEIGHT)
+{
+    unsigned int totalRectangles = 0;
+    for (std::vector<DualWeightHaarWavelet>::const_iterator w = wavelets.begin(); w != wavelets.end(); ++w)
+    {
+        totalRectangles += w->dimensions();
+    }
+    allocate(wavelets.size(), totalRectangles);
+
+    unsigned int r = 0;
+    for (unsigned int i = 0; i < wavelets.size(); ++i)
+    {
+        rectanglesBegin_[i] = r;
+        std::vector<float>::const_iterator weightPositive = wavelets[i].weightsPositive_begin();
+        std::vector<float>::const_iterator weightNegative = wavelets[i].weightsNegative_begin();
+        for (std::vector<cv::Rect>::const_iterator it = wavelets[i].rects_begin(); it != wavelets[i].rects_end(); ++it, ++weightPositive, ++weightNegative, ++r)
+        {
+            addRectangle(r, *it);
+            weights_[r] = *weightPositive;
+            weightsNegative_[r] = *weightNegative;
+        }
+    }
+    rectanglesBegin_[wavelets.size()] = r;
+}
+
+CompiledWaveletBank::CompiledWaveletBank(const WaveletGenerator &generator, const size_t begin, const size_t end)
+    : kind_(PLAIN)
+{
+    if (begin > end || end > generator.size())
+    {
+        throw 41;
+    }
+
+    unsigned int totalRectangles = 0;
+    for (size_t i = begin; i < end; ++i)
+    {
+        totalRectangles += generator.templates()[generator.templateIndex(i)].weights.size();
+    }
+    allocate(end - begin, totalRectangles);
+
+    std::vector<cv::Rect> rects(generator.maxRectangles());
+    unsigned int r = 0;
+    for (size_t i = begin; i < end; ++i)
+    {
+        rectanglesBegin_[i - begin] = r;
+        const unsigned int count = generator.rectangles(i, &rects[0], &weights_[r]);
+        for (unsigned int j = 0; j < count; ++j, ++r)
+        {
+            addRectangle(r, rects[j]);
+        }
+    }
+    rectanglesBegin_[end - begin] = r;
+}
+
+void CompiledWaveletBank::view(const Kind kind,
+                               const unsigned int wavelets,
+                               const unsigned int rectangles,
+                               const unsigned int * rectanglesBegin,
+                               const RectangleCorners * corners,
+                               const float * weights,
+                               const float * second,
+                               const float * normalization)
+{
+    kind_ = kind;
+    rectanglesBegin_.view(rectanglesBegin, wavelets + 1);
+    corners_.view(corners, rectangles);
+    weights_.view(weights, rectangles);
+    normalization_.view(normalization, rectangles);
+    means_.resize(0);
+    weightsNegative_.resize(0);
+    if (kind_ == MEANS)
+    {
+        means_.view(second, rectangles);
+    }
+    if (kind_ == DUAL_WEIGHT)
+    {
+        weightsNegative_.view(second, rectangles);
+    }
+}
+
+CompiledWaveletBank::Kind CompiledWaveletBank::kind() const
+{
+    return kind_;
+}
+
+unsigned int CompiledWaveletBank::size() const
+{
+    return rectanglesBegin_.size() ? rectanglesBegin_.size() - 1 : 0;
+}
+
+unsigned int CompiledWaveletBank::rectangles() const
+{
+    return corners_.size();
+}
+
+unsigned int CompiledWaveletBank::outputs() const
+{
+    return kind_ == DUAL_WEIGHT ? 2 : 1;
+}
+
+const unsigned int * CompiledWaveletBank::rectanglesBegin() const
+{
+    return rectanglesBegin_.data();
+}
+
+const RectangleCorners * CompiledWaveletBank::corners() const
+{
+    return corners_.data();
+}
+
+const float * CompiledWaveletBank::weights() const
+{
+    return weights_.data();
+}
+
+const float * CompiledWaveletBank::weightsNegative() const
+{
+    return weightsNegative_.data();
+}
+
+const float * CompiledWaveletBank::means() const
+{
+    return means_.data();
+}
+
+const float * CompiledWaveletBank::normalization() const
+{
+    return normalization_.data();
+}
+
+CompiledWaveletBank CompiledWaveletBank::scaled(const float scale) const
+{
+    CompiledWaveletBank bank(*this);
+    for (unsigned int r = 0; r < rectangles(); ++r)
+    {
+        cv::Rect rect;
+        rect.x = cvRound(corners_[r].left * scale);
+        rect.y = cvRound(corners_[r].top * scale);
+        rect.width  = std::max(cvRound(corners_[r].right * scale) - rect.x, 1);
+        rect.height = std::max(cvRound(corners_[r].bottom * scale) - rect.y, 1);
+        bank.addRectangle(r, rect);
+    }
+    return bank;
+}
+
+void CompiledWaveletBank::allocate(const unsigned int wavelets, const unsigned int rectangles)
+{
+    rectanglesBegin_.resize(wavelets + 1);
+    rectanglesBegin_[0] = 0;
+    corners_.resize(rectangles);
+    weights_.resize(rectangles);
+    normalization_.resize(rectangles);
+    if (kind_ == MEANS)
+    {
+        means_.resize(rectangles);
+    }
+    if (kind_ == DUAL_WEIGHT)
+    {
+        weightsNegative_.resize(rectangles);
+    }
+}
+
+void CompiledWaveletBank::addRectangle(const unsigned int index, const cv::Rect &r)
+{
+    corners_[index].left   = r.x;
+    corners_[index].top    = r.y;
+    corners_[index].right  = r.x + r.width;
+    corners_[index].bottom = r.y + r.height;
+    normalization_[index]  = 1.0f / (r.area() * std::numeric_limits<unsigned char>::max());
+}
+
+
+
+//======================================== PreparedWaveletBank ========================================
+
+
+
+namespace
+{
+
+RectangleOffsets rectangleOffsets(const int x, const int y, const int width, const int height, const size_t step)
+{
+    RectangleOffsets o;
+    o.topLeft     = y * step + x;
+    o.topRight    = y * step + x + width;
+    o.bottomLeft  = (y + height) * step + x;
+    o.bottomRight = (y + height) * step + x + width;
+    return o;
+}
+
+}
+
+PreparedWaveletBank::PreparedWaveletBank() : bank_(0), step_(0), scale_(1.0) {}
+
+PreparedWaveletBank::PreparedWaveletBank(const CompiledWaveletBank &bank,
+                                         const size_t step,
+                                         const cv::Size &windowSize,
+                                         const float scale) : bank_(&bank),
+                                                              step_(step),
+                                                              scale_(scale),
+                                                              offsets_(bank.rectangles()),
+                                                              areas_(bank.rectangles())
+{
+    //Scaled the same way the evaluators scale a cv::Rect
+    windowSize_.width  = windowSize.width * scale;
+    windowSize_.height = windowSize.height * scale;
+    window_ = rectangleOffsets(0, 0, windowSize_.width, windowSize_.height, step);
+
+    const RectangleCorners * corners = bank.corners();
+    for (unsigned int r = 0; r < bank.rectangles(); ++r)
+    {
+        const int x = corners[r].left * scale;
+        const int y = corners[r].top * scale;
+        const int width  = (corners[r].right - corners[r].left) * scale;
+        const int height = (corners[r].bottom - corners[r].top) * scale;
+        if (x < 0 || y < 0 || x + width > windowSize_.width || y + height > windowSize_.height)
+        {
+            throw 33;
+        }
+
+        offsets_[r] = rectangleOffsets(x, y, width, height, step);
+        areas_[r] = width * height;
+    }
+}
+
+const CompiledWaveletBank & PreparedWaveletBank::bank() const
+{
+    return *bank_;
+}
+
+size_t PreparedWaveletBank::step() const
+{
+    return step_;
+}
+
+float PreparedWaveletBank::scale() const
+{
+    return scale_;
+}
+
+cv::Size PreparedWaveletBank::windowSize() const
+{
+    return windowSize_;
+}
+
+const RectangleOffsets & PreparedWaveletBank::window() const
+{
+    return window_;
+}
+
+const RectangleOffsets * PreparedWaveletBank::offsets() const
+{
+    return offsets_.data();
+}
+
+const float * PreparedWaveletBank::areas() const
+{
+    return areas_.data();
+}
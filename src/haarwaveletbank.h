@@ -0,0 +1,328 @@
+#ifndef HAARWAVELETBANK_H
+#define HAARWAVELETBANK_H
+
+#include <vector>
+#include <algorithm>
+
+#include <opencv2/core/core.hpp>
+
+#include "haarwavelet.h"
+#include "haarwaveletinstrumentation.h"
+
+class WaveletGenerator;
+
+
+
+/**
+ * A fixed size array allocated with cv::fastMalloc, so it is aligned to CV_MALLOC_ALIGN bytes.
+ * Only meant to hold plain old data.
+ */
+template <typename T>
+class AlignedBuffer
+{
+public:
+    AlignedBuffer() : data_(0), size_(0), owned_(true) {}
+
+    explicit AlignedBuffer(const size_t size) : data_(0), size_(0), owned_(true)
+    {
+        resize(size);
+    }
+
+    /**
+     * Copies are always owned, even when other is a view.
+     */
+    AlignedBuffer(const AlignedBuffer &other) : data_(0), size_(0), owned_(true)
+    {
+        *this = other;
+    }
+
+    ~AlignedBuffer()
+    {
+        release();
+    }
+
+    AlignedBuffer & operator=(const AlignedBuffer &other)
+    {
+        if (this != &other)
+        {
+            resize(other.size_);
+            std::copy(other.data_, other.data_ + other.size_, data_);
+        }
+        return *this;
+    }
+
+    /**
+     * Makes this buffer use, without owning or copying, size elements of read-only memory
+     * (e.g. a memory mapped file). Previous contents are lost. The buffer must not be written to until resized.
+     */
+    void view(const T * data, const size_t size)
+    {
+        release();
+        data_ = const_cast<T *>(data);
+        size_ = size;
+        owned_ = false;
+    }
+
+    /**
+     * Changes the amount of elements of this buffer. Previous contents are lost.
+     */
+    void resize(const size_t size)
+    {
+        if (size == size_ && owned_)
+        {
+            return;
+        }
+        release();
+        data_ = size ? static_cast<T *>(cv::fastMalloc(size * sizeof(T))) : 0;
+        size_ = size;
+        if (size)
+        {
+            HAARCOMMON_COUNT(ALLOCATIONS, 1);
+        }
+    }
+
+    size_t size() const { return size_; }
+
+    T * data() { return data_; }
+    const T * data() const { return data_; }
+
+    T & operator[](const size_t index) { return data_[index]; }
+    const T & operator[](const size_t index) const { return data_[index]; }
+
+private:
+    void release()
+    {
+        if (owned_)
+        {
+            cv::fastFree(data_);
+        }
+        data_ = 0;
+        size_ = 0;
+        owned_ = true;
+    }
+
+    T * data_;
+    size_t size_;
+    bool owned_;
+};
+
+
+
+/**
+ * Coordinates of the top-left and bottom-right corners of a rectangle, as used to index an integral image.
+ */
+struct RectangleCorners
+{
+    int left;
+    int top;
+    int right;  //left + width
+    int bottom; //top + height
+};
+
+
+
+/**
+ * @brief The CompiledWaveletBank class stores a collection of Haar wavelets in contiguous arrays
+ * (structure of arrays), so that evaluating the whole bank walks memory linearly.
+ *
+ * Rectangles of all wavelets are stored one after the other. The rectangles of the i-th wavelet are the ones
+ * in the range [rectanglesBegin()[i], rectanglesBegin()[i + 1]) of the per-rectangle arrays.
+ */
+class CompiledWaveletBank
+{
+public:
+
+    /**
+     * Kind of Haar wavelet the bank was compiled from.
+     */
+    enum Kind
+    {
+        PLAIN,       //HaarWavelet
+        MEANS,       //MyHaarWavelet
+        DUAL_WEIGHT  //DualWeightHaarWavelet
+    };
+
+    /**
+     * Constructs an empty bank.
+     */
+    CompiledWaveletBank();
+
+    explicit CompiledWaveletBank(const std::vector<HaarWavelet> &wavelets);
+    explicit CompiledWaveletBank(const std::vector<MyHaarWavelet> &wavelets);
+    explicit CompiledWaveletBank(const std::vector<DualWeightHaarWavelet> &wavelets);
+
+    /**
+     * Compiles the wavelets [begin, end) of generator into a PLAIN bank, writing their rectangles straight into the
+     * bank's arrays instead of building HaarWavelets first. Invalid ranges throw 41.
+     */
+    CompiledWaveletBank(const WaveletGenerator &generator, const size_t begin, const size_t end);
+
+    Kind kind() const;
+
+    /**
+     * Amount of wavelets in this bank.
+     */
+    unsigned int size() const;
+
+    /**
+     * Total amount of rectangles in this bank.
+     */
+    unsigned int rectangles() const;
+
+    /**
+     * Amount of values each wavelet produces when evaluated: 2 for DUAL_WEIGHT banks, 1 otherwise.
+     */
+    unsigned int outputs() const;
+
+    /**
+     * Index of the first rectangle of each wavelet. It has size() + 1 elements.
+     */
+    const unsigned int * rectanglesBegin() const;
+
+    const RectangleCorners * corners() const;
+
+    /**
+     * Weights of each rectangle. For DUAL_WEIGHT banks, these are the positive weights.
+     */
+    const float * weights() const;
+
+    /**
+     * Negative weights of each rectangle. Only available for DUAL_WEIGHT banks.
+     */
+    const float * weightsNegative() const;
+
+    /**
+     * Means of each rectangle. Only available for MEANS banks.
+     */
+    const float * means() const;
+
+    /**
+     * The SRFS normalization factor of each rectangle: 1 / (area * 255).
+     */
+    const float * normalization() const;
+
+    /**
+     * Returns a copy of this bank with all rectangles scaled by scale. Each corner is rounded to the nearest pixel,
+     * so adjacent rectangles stay adjacent, and the normalization factors are recomputed from the scaled areas.
+     */
+    CompiledWaveletBank scaled(const float scale) const;
+
+private:
+    friend class MappedWaveletBank;
+
+    /**
+     * Makes this bank view, without copying, arrays stored elsewhere. See MappedWaveletBank.
+     * @param second the means of MEANS banks or the negative weights of DUAL_WEIGHT banks. Unused for PLAIN banks.
+     */
+    void view(const Kind kind,
+              const unsigned int wavelets,
+              const unsigned int rectangles,
+              const unsigned int * rectanglesBegin,
+              const RectangleCorners * corners,
+              const float * weights,
+              const float * second,
+              const float * normalization);
+
+    void allocate(const unsigned int wavelets, const unsigned int rectangles);
+    void addRectangle(const unsigned int index, const cv::Rect &r);
+
+    Kind kind_;
+    AlignedBuffer<unsigned int> rectanglesBegin_;
+    AlignedBuffer<RectangleCorners> corners_;
+    AlignedBuffer<float> weights_;
+    AlignedBuffer<float> weightsNegative_;
+    AlignedBuffer<float> means_;
+    AlignedBuffer<float> normalization_;
+};
+
+
+
+/**
+ * Positions of the four corners of a rectangle inside an integral image, as element offsets from the
+ * top-left corner of the detection window.
+ */
+struct RectangleOffsets
+{
+    int topLeft;
+    int topRight;
+    int bottomLeft;
+    int bottomRight;
+};
+
+/**
+ * Sum of the rectangle o of an int integral image, p pointing to the top-left corner of its window. The corners are
+ * combined in unsigned arithmetic, so the sum is exact (as long as it fits in an int) even where the integral image
+ * itself has wrapped around.
+ */
+inline int rectangleSum(const int * p, const RectangleOffsets & o)
+{
+    return (int)(((unsigned int)p[o.topLeft] + (unsigned int)p[o.bottomRight])
+                 - ((unsigned int)p[o.topRight] + (unsigned int)p[o.bottomLeft]));
+}
+
+
+
+/**
+ * @brief The PreparedWaveletBank class holds the rectangles of a CompiledWaveletBank converted, for one scale,
+ * into linear offsets inside integral images with a given step. Evaluating the bank at any window
+ * position then takes one pointer addition plus four loads per rectangle.
+ *
+ * The prepared bank keeps a reference to the compiled bank, which must outlive it.
+ */
+class PreparedWaveletBank
+{
+public:
+    /**
+     * Constructs an empty prepared bank.
+     */
+    PreparedWaveletBank();
+
+    /**
+     * @param bank the bank to prepare.
+     * @param step the step (in elements, not bytes) of the integral images the bank will be evaluated against.
+     * @param windowSize size of the detection window, before scaling. Used by the variance normalization.
+     * @param scale how mutch the wavelets should be scaled. If scale > 1, they streach right and down.
+     *
+     * Throws 33 if a scaled rectangle does not lie inside the scaled window.
+     */
+    PreparedWaveletBank(const CompiledWaveletBank &bank, const size_t step, const cv::Size &windowSize, const float scale = 1.0);
+
+    const CompiledWaveletBank & bank() const;
+
+    size_t step() const;
+
+    float scale() const;
+
+    /**
+     * Size of the detection window, after scaling.
+     */
+    cv::Size windowSize() const;
+
+    /**
+     * Offsets of the corners of the scaled detection window.
+     */
+    const RectangleOffsets & window() const;
+
+    /**
+     * Offsets of the corners of each scaled rectangle, in the same order as the rectangles of bank().
+     */
+    const RectangleOffsets * offsets() const;
+
+    /**
+     * Area of each scaled rectangle.
+     */
+    const float * areas() const;
+
+private:
+    const CompiledWaveletBank * bank_;
+    size_t step_;
+    float scale_;
+    cv::Size windowSize_;
+    RectangleOffsets window_;
+    AlignedBuffer<RectangleOffsets> offsets_;
+    AlignedBuffer<float> areas_;
+};
+
+
+
+#endif // HAARWAVELETBANK_H
@@ -0,0 +1,230 @@
+#include "haarwaveletbatch.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "haarwaveletinstrumentation.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+
+
+namespace
+{
+
+#if defined(__SSE2__)
+/**
+ * The four-patch step of accumulate(), for pixels v and squares square already widened to 32 bits.
+ */
+inline void accumulate4(const __m128i v,
+                        const __m128i square,
+                        int * run,
+                        int * squareRun,
+                        const int * above,
+                        const int * squareAbove,
+                        int * sum,
+                        int * squareSum)
+{
+    const __m128i r = _mm_add_epi32(_mm_loadu_si128((const __m128i *)run), v);
+    const __m128i q = _mm_add_epi32(_mm_loadu_si128((const __m128i *)squareRun), square);
+    _mm_storeu_si128((__m128i *)run, r);
+    _mm_storeu_si128((__m128i *)squareRun, q);
+    _mm_storeu_si128((__m128i *)sum, _mm_add_epi32(_mm_loadu_si128((const __m128i *)above), r));
+    _mm_storeu_si128((__m128i *)squareSum, _mm_add_epi32(_mm_loadu_si128((const __m128i *)squareAbove), q));
+}
+#endif
+
+/**
+ * Adds the pixels of a position of count patches to their row sums and writes the elements of the integral images
+ * at that position: the ones right above plus the row sums. count is a multiple of IntegralBatch::LANES.
+ */
+void accumulate(const unsigned char * pixels,
+                int * run,
+                int * squareRun,
+                const int * above,
+                const int * squareAbove,
+                int * sum,
+                int * squareSum,
+                const unsigned int count)
+{
+    unsigned int p = 0;
+#if defined(__AVX512F__)
+    for (; p + 16 <= count; p += 16)
+    {
+        const __m512i v = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *)(pixels + p)));
+        const __m512i r = _mm512_add_epi32(_mm512_loadu_si512(run + p), v);
+        const __m512i q = _mm512_add_epi32(_mm512_loadu_si512(squareRun + p), _mm512_mullo_epi32(v, v));
+        _mm512_storeu_si512(run + p, r);
+        _mm512_storeu_si512(squareRun + p, q);
+        _mm512_storeu_si512(sum + p, _mm512_add_epi32(_mm512_loadu_si512(above + p), r));
+        _mm512_storeu_si512(squareSum + p, _mm512_add_epi32(_mm512_loadu_si512(squareAbove + p), q));
+    }
+#endif
+#if defined(__AVX2__)
+    for (; p + 8 <= count; p += 8)
+    {
+        const __m256i v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(pixels + p)));
+        const __m256i r = _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(run + p)), v);
+        const __m256i q = _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(squareRun + p)), _mm256_mullo_epi32(v, v));
+        _mm256_storeu_si256((__m256i *)(run + p), r);
+        _mm256_storeu_si256((__m256i *)(squareRun + p), q);
+        _mm256_storeu_si256((__m256i *)(sum + p), _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(above + p)), r));
+        _mm256_storeu_si256((__m256i *)(squareSum + p), _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(squareAbove + p)), q));
+    }
+#endif
+#if defined(__SSE2__)
+    //16 pixels at a time: squares of bytes fit in 16 bit lanes, so only the widening to 32 bits is done per four
+    const __m128i zero = _mm_setzero_si128();
+    for (; p + 16 <= count; p += 16)
+    {
+        const __m128i bytes = _mm_loadu_si128((const __m128i *)(pixels + p));
+        const __m128i low  = _mm_unpacklo_epi8(bytes, zero);
+        const __m128i high = _mm_unpackhi_epi8(bytes, zero);
+        const __m128i lowSquares  = _mm_mullo_epi16(low, low);
+        const __m128i highSquares = _mm_mullo_epi16(high, high);
+        accumulate4(_mm_unpacklo_epi16(low, zero), _mm_unpacklo_epi16(lowSquares, zero),
+                    run + p, squareRun + p, above + p, squareAbove + p, sum + p, squareSum + p);
+        accumulate4(_mm_unpackhi_epi16(low, zero), _mm_unpackhi_epi16(lowSquares, zero),
+                    run + p + 4, squareRun + p + 4, above + p + 4, squareAbove + p + 4, sum + p + 4, squareSum + p + 4);
+        accumulate4(_mm_unpacklo_epi16(high, zero), _mm_unpacklo_epi16(highSquares, zero),
+                    run + p + 8, squareRun + p + 8, above + p + 8, squareAbove + p + 8, sum + p + 8, squareSum + p + 8);
+        accumulate4(_mm_unpackhi_epi16(high, zero), _mm_unpackhi_epi16(highSquares, zero),
+                    run + p + 12, squareRun + p + 12, above + p + 12, squareAbove + p + 12, sum + p + 12, squareSum + p + 12);
+    }
+#endif
+    for (; p < count; ++p)
+    {
+        const int v = pixels[p];
+        run[p] += v;
+        squareRun[p] += v * v;
+        sum[p] = above[p] + run[p];
+        squareSum[p] = squareAbove[p] + squareRun[p];
+    }
+}
+
+}
+
+
+
+IntegralBatch::IntegralBatch() : size_(0), stride_(0) {}
+
+IntegralBatch::IntegralBatch(const std::vector<cv::Mat> & patches) : size_(0), stride_(0)
+{
+    assign(patches);
+}
+
+void IntegralBatch::assign(const std::vector<cv::Mat> & patches)
+{
+    assign(patches.empty() ? 0 : &patches[0], patches.size());
+}
+
+void IntegralBatch::assign(const cv::Mat * patches, const unsigned int count)
+{
+    const cv::Size size = count ? patches[0].size() : cv::Size();
+    const double maxSquare = (double)std::numeric_limits<unsigned char>::max() * std::numeric_limits<unsigned char>::max();
+    if ((double)size.area() * maxSquare > std::numeric_limits<int>::max())
+    {
+        throw 43;
+    }
+    for (unsigned int p = 0; p < count; ++p)
+    {
+        if (patches[p].type() != cv::DataType<unsigned char>::type || patches[p].size() != size)
+        {
+            throw 43;
+        }
+    }
+
+    patchSize_ = size;
+    size_ = count;
+    stride_ = (count + LANES - 1) / LANES * LANES;
+
+    const size_t elements = offset(size.height + 1, 0);
+    sum_.resize(elements);
+    squareSum_.resize(elements);
+    pixels_.resize(size.width * stride_);
+    run_.resize(stride_);
+    squareRun_.resize(stride_);
+
+    build(patches);
+}
+
+unsigned int IntegralBatch::size() const
+{
+    return size_;
+}
+
+unsigned int IntegralBatch::stride() const
+{
+    return stride_;
+}
+
+cv::Size IntegralBatch::patchSize() const
+{
+    return patchSize_;
+}
+
+const int * IntegralBatch::sum() const
+{
+    return sum_.data();
+}
+
+const int * IntegralBatch::squareSum() const
+{
+    return squareSum_.data();
+}
+
+int IntegralBatch::sum(const unsigned int patch, const int row, const int col) const
+{
+    return sum_[offset(row, col) + patch];
+}
+
+int IntegralBatch::squareSum(const unsigned int patch, const int row, const int col) const
+{
+    return squareSum_[offset(row, col) + patch];
+}
+
+/**
+ * Row by row, the pixels of all patches are interleaved into pixels_, then accumulated across patches.
+ */
+void IntegralBatch::build(const cv::Mat * patches)
+{
+    HAARCOMMON_TIME(INTEGRAL_CYCLES);
+
+    std::fill(sum_.data(), sum_.data() + offset(1, 0), 0);
+    std::fill(squareSum_.data(), squareSum_.data() + offset(1, 0), 0);
+    std::fill(pixels_.data(), pixels_.data() + pixels_.size(), 0); //padding patches stay empty
+
+    for (int y = 0; y < patchSize_.height; ++y)
+    {
+        std::fill(sum_.data() + offset(y + 1, 0), sum_.data() + offset(y + 1, 1), 0);
+        std::fill(squareSum_.data() + offset(y + 1, 0), squareSum_.data() + offset(y + 1, 1), 0);
+        std::fill(run_.data(), run_.data() + stride_, 0);
+        std::fill(squareRun_.data(), squareRun_.data() + stride_, 0);
+
+        for (unsigned int p = 0; p < size_; ++p)
+        {
+            const unsigned char * row = patches[p].ptr<unsigned char>(y);
+            for (int x = 0; x < patchSize_.width; ++x)
+            {
+                pixels_[x * stride_ + p] = row[x];
+            }
+        }
+
+        for (int x = 0; x < patchSize_.width; ++x)
+        {
+            accumulate(pixels_.data() + x * stride_,
+                       run_.data(),
+                       squareRun_.data(),
+                       sum_.data() + offset(y, x + 1),
+                       squareSum_.data() + offset(y, x + 1),
+                       sum_.data() + offset(y + 1, x + 1),
+                       squareSum_.data() + offset(y + 1, x + 1),
+                       stride_);
+        }
+    }
+}
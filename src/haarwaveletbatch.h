@@ -0,0 +1,85 @@
+#ifndef HAARWAVELETBATCH_H
+#define HAARWAVELETBATCH_H
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "haarwaveletbank.h"
+
+
+
+/**
+ * @brief The IntegralBatch class holds the integral images (sum and square sum) of many patches of the same size,
+ * interleaved in one aligned buffer per kind: the elements at the same position of all patches are contiguous.
+ *
+ * Element (row, col) of the integral images of patch p is at sum()[offset(row, col) + p]. The amount of patches is
+ * padded to a multiple of LANES with empty patches, so that each position starts aligned and can be processed across
+ * patches with SIMD (16 patches per step with SSE2, 8 or 16 per instruction with AVX2 or AVX-512) when building the
+ * batch, and so that evaluating a rectangle over all patches streams through memory. Both integral images hold ints.
+ *
+ * Patches must be single channel 8 bit images of the same size, small enough for their square sums to fit in an int
+ * (up to 33025 pixels), or the batch throws 43. Assigning patches of the same size and amount as before reuses the
+ * buffers.
+ */
+class IntegralBatch
+{
+public:
+    enum
+    {
+        LANES = 16
+    };
+
+    IntegralBatch();
+
+    explicit IntegralBatch(const std::vector<cv::Mat> & patches);
+
+    void assign(const std::vector<cv::Mat> & patches);
+
+    /**
+     * Same as above, for count patches starting at patches.
+     */
+    void assign(const cv::Mat * patches, const unsigned int count);
+
+    /**
+     * Amount of patches.
+     */
+    unsigned int size() const;
+
+    /**
+     * Amount of patches, padded to a multiple of LANES: the distance between consecutive positions.
+     */
+    unsigned int stride() const;
+
+    cv::Size patchSize() const;
+
+    /**
+     * Position of the elements (row, col) of the integral images of all patches.
+     */
+    size_t offset(const int row, const int col) const
+    {
+        return ((size_t)row * (patchSize_.width + 1) + col) * stride_;
+    }
+
+    const int * sum() const;
+    const int * squareSum() const;
+
+    int sum(const unsigned int patch, const int row, const int col) const;
+    int squareSum(const unsigned int patch, const int row, const int col) const;
+
+private:
+    void build(const cv::Mat * patches);
+
+    cv::Size patchSize_;
+    unsigned int size_;
+    unsigned int stride_;
+    AlignedBuffer<int> sum_;
+    AlignedBuffer<int> squareSum_;
+    AlignedBuffer<unsigned char> pixels_; //the current row of all patches, interleaved
+    AlignedBuffer<int> run_;              //sums of the pixels of the current row so far, of all patches
+    AlignedBuffer<int> squareRun_;
+};
+
+
+
+#endif // HAARWAVELETBATCH_H
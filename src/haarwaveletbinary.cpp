@@ -0,0 +1,204 @@
+#include "haarwaveletbinary.h"
+
+#include <cstring>
+#include <fstream>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+
+namespace
+{
+
+const char MAGIC[8] = {'H', 'A', 'A', 'R', 'B', 'A', 'N', 'K'};
+
+/**
+ * Offsets, from the beginning of the file, of each array of a bank.
+ */
+struct Layout
+{
+    Layout(const unsigned int kind, const unsigned int wavelets, const unsigned int rectangles)
+    {
+        rectanglesBegin = sizeof(BinaryBankHeader);
+        corners = align(rectanglesBegin + (wavelets + 1ull) * sizeof(unsigned int));
+        weights = align(corners + (unsigned long long)rectangles * sizeof(RectangleCorners));
+        second = align(weights + (unsigned long long)rectangles * sizeof(float));
+        normalization = kind == CompiledWaveletBank::PLAIN ? second
+                                                           : align(second + (unsigned long long)rectangles * sizeof(float));
+        size = align(normalization + (unsigned long long)rectangles * sizeof(float));
+    }
+
+    static unsigned long long align(const unsigned long long offset)
+    {
+        return (offset + BinaryBankHeader::ALIGNMENT - 1) / BinaryBankHeader::ALIGNMENT * BinaryBankHeader::ALIGNMENT;
+    }
+
+    unsigned long long rectanglesBegin;
+    unsigned long long corners;
+    unsigned long long weights;
+    unsigned long long second;
+    unsigned long long normalization;
+    unsigned long long size;
+};
+
+unsigned long long checksum(const char * begin, const char * end)
+{
+    unsigned long long hash = 14695981039346656037ull;
+    for (; begin != end; ++begin)
+    {
+        hash ^= (unsigned char) *begin;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+}
+
+
+
+bool writeBinaryWaveletBank(const std::string &filename, const CompiledWaveletBank &bank)
+{
+    const Layout layout(bank.kind(), bank.size(), bank.rectangles());
+    std::vector<char> buffer(layout.size, 0);
+
+    std::memcpy(&buffer[layout.rectanglesBegin], bank.rectanglesBegin(), (bank.size() + 1) * sizeof(unsigned int));
+    std::memcpy(&buffer[layout.corners], bank.corners(), bank.rectangles() * sizeof(RectangleCorners));
+    std::memcpy(&buffer[layout.weights], bank.weights(), bank.rectangles() * sizeof(float));
+    if (bank.kind() != CompiledWaveletBank::PLAIN)
+    {
+        const float * second = bank.kind() == CompiledWaveletBank::MEANS ? bank.means() : bank.weightsNegative();
+        std::memcpy(&buffer[layout.second], second, bank.rectangles() * sizeof(float));
+    }
+    std::memcpy(&buffer[layout.normalization], bank.normalization(), bank.rectangles() * sizeof(float));
+
+    BinaryBankHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = BinaryBankHeader::VERSION;
+    header.byteOrder = BinaryBankHeader::BYTE_ORDER_MARK;
+    header.kind = bank.kind();
+    header.wavelets = bank.size();
+    header.rectangles = bank.rectangles();
+    header.size = layout.size;
+    header.checksum = checksum(&buffer[0] + sizeof(header), &buffer[0] + buffer.size());
+    std::memcpy(&buffer[0], &header, sizeof(header));
+
+    std::ofstream ofs;
+    ofs.open(filename.c_str(), std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+
+    if (!ofs.is_open())
+    {
+        return false;
+    }
+
+    ofs.write(&buffer[0], buffer.size());
+    ofs.close();
+
+    return !ofs.fail();
+}
+
+
+
+MappedWaveletBank::MappedWaveletBank() : data_(0), size_(0) {}
+
+MappedWaveletBank::~MappedWaveletBank()
+{
+    close();
+}
+
+bool MappedWaveletBank::open(const std::string &filename, const bool verify)
+{
+    close();
+
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat status;
+    if (fstat(fd, &status) != 0 || (size_t) status.st_size < sizeof(BinaryBankHeader))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    size_ = status.st_size;
+    data_ = mmap(0, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data_ == MAP_FAILED)
+    {
+        data_ = 0;
+        size_ = 0;
+        return false;
+    }
+
+    const char * bytes = static_cast<const char *>(data_);
+    const BinaryBankHeader & header = *reinterpret_cast<const BinaryBankHeader *>(bytes);
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0
+            || header.version != BinaryBankHeader::VERSION
+            || header.byteOrder != BinaryBankHeader::BYTE_ORDER_MARK
+            || header.kind > CompiledWaveletBank::DUAL_WEIGHT
+            || header.size != size_)
+    {
+        close();
+        return false;
+    }
+
+    const Layout layout(header.kind, header.wavelets, header.rectangles);
+    if (layout.size != size_
+            || (verify && checksum(bytes + sizeof(header), bytes + size_) != header.checksum))
+    {
+        close();
+        return false;
+    }
+
+    const unsigned int * rectanglesBegin = reinterpret_cast<const unsigned int *>(bytes + layout.rectanglesBegin);
+    if (rectanglesBegin[0] != 0 || rectanglesBegin[header.wavelets] != header.rectangles)
+    {
+        close();
+        return false;
+    }
+    for (unsigned int w = 0; w < header.wavelets; ++w) //so every wavelet's rectangles lie inside the arrays
+    {
+        if (rectanglesBegin[w] > rectanglesBegin[w + 1])
+        {
+            close();
+            return false;
+        }
+    }
+
+    bank_.view((CompiledWaveletBank::Kind) header.kind,
+               header.wavelets,
+               header.rectangles,
+               rectanglesBegin,
+               reinterpret_cast<const RectangleCorners *>(bytes + layout.corners),
+               reinterpret_cast<const float *>(bytes + layout.weights),
+               reinterpret_cast<const float *>(bytes + layout.second),
+               reinterpret_cast<const float *>(bytes + layout.normalization));
+    return true;
+}
+
+void MappedWaveletBank::close()
+{
+    bank_ = CompiledWaveletBank(); //releases the views before unmapping
+    if (data_)
+    {
+        munmap(data_, size_);
+    }
+    data_ = 0;
+    size_ = 0;
+}
+
+bool MappedWaveletBank::isOpen() const
+{
+    return data_ != 0;
+}
+
+const CompiledWaveletBank & MappedWaveletBank::bank() const
+{
+    return bank_;
+}
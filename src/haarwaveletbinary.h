@@ -0,0 +1,85 @@
+#ifndef HAARWAVELETBINARY_H
+#define HAARWAVELETBINARY_H
+
+#include <string>
+
+#include "haarwaveletbank.h"
+
+
+
+/**
+ * @brief The BinaryBankHeader struct starts a binary wavelet bank file.
+ *
+ * The header is followed by the arrays of a CompiledWaveletBank, each starting at a multiple of
+ * BinaryBankHeader::ALIGNMENT bytes from the beginning of the file, in this order: rectanglesBegin
+ * (wavelets + 1 unsigned ints), corners, weights, the means (MEANS banks) or negative weights (DUAL_WEIGHT banks)
+ * if the bank has them, and normalization. All values are stored in the byte order of the machine that wrote the
+ * file; byteOrder tells whether it matches the one reading it.
+ */
+struct BinaryBankHeader
+{
+    enum {
+        VERSION = 1,
+        ALIGNMENT = 64,
+        BYTE_ORDER_MARK = 0x01020304
+    };
+
+    char magic[8];              //"HAARBANK"
+    unsigned int version;
+    unsigned int byteOrder;
+    unsigned int kind;          //a CompiledWaveletBank::Kind
+    unsigned int wavelets;
+    unsigned int rectangles;
+    unsigned int reserved;
+    unsigned long long size;    //of the whole file, in bytes
+    unsigned long long checksum; //FNV-1a of everything following the header
+    char padding[16];
+};
+
+
+
+/**
+ * Writes bank in the binary format. Returns false if the file couldn't be written.
+ */
+bool writeBinaryWaveletBank(const std::string &filename, const CompiledWaveletBank &bank);
+
+
+
+/**
+ * @brief The MappedWaveletBank class maps a binary wavelet bank file into memory and exposes it, without copying
+ * or parsing, as a CompiledWaveletBank that can be passed to the evaluators.
+ *
+ * The mapping is read-only and lives as long as this object; the bank must not be used after it is closed.
+ * Copying the bank (e.g. calling scaled()) produces an ordinary, independent CompiledWaveletBank.
+ */
+class MappedWaveletBank
+{
+public:
+    MappedWaveletBank();
+    ~MappedWaveletBank();
+
+    /**
+     * Maps filename. Returns false, leaving this object closed, if the file can't be read, was written by an
+     * incompatible version or machine, is truncated, has rectangle ranges out of order or out of bounds or, when
+     * verify is true, its checksum doesn't match.
+     */
+    bool open(const std::string &filename, const bool verify = true);
+
+    void close();
+
+    bool isOpen() const;
+
+    const CompiledWaveletBank & bank() const;
+
+private:
+    MappedWaveletBank(const MappedWaveletBank &);
+    MappedWaveletBank & operator=(const MappedWaveletBank &);
+
+    void * data_;
+    size_t size_;
+    CompiledWaveletBank bank_;
+};
+
+
+
+#endif // HAARWAVELETBINARY_H
@@ -0,0 +1,401 @@
+#ifndef HAARWAVELETCASCADE_H
+#define HAARWAVELETCASCADE_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <limits>
+
+#include <opencv2/core/core.hpp>
+
+#include "haarwavelet.h"
+#include "haarwaveletbank.h"
+#include "haarwaveletevaluators.h"
+#include "haarwaveletinstrumentation.h"
+#include "haarwaveletscanner.h"
+#include "haarwaveletutilities.h"
+
+
+
+/**
+ * @brief The CascadeStage struct is a stage of a WaveletCascade: a boosted sum of decision stumps, one per wavelet.
+ * The i-th stump adds below[i] to the stage sum if the response of wavelets[i] is below thresholds[i], else above[i].
+ * A window passes the stage if the sum is at least threshold.
+ */
+template <typename HaarWaveletType>
+struct CascadeStage
+{
+    CascadeStage() : threshold(0) {}
+
+    std::vector<HaarWaveletType> wavelets;
+    std::vector<float> thresholds;
+    std::vector<float> below;
+    std::vector<float> above;
+    float threshold;
+};
+
+
+
+/**
+ * @brief The WaveletCascade class is an attentional cascade of stages (Viola and Jones, 2001). A window is rejected
+ * as soon as it fails a stage, so most windows are rejected after evaluating only the first, small stages.
+ *
+ * The wavelets of each stage are compiled into a CompiledWaveletBank and evaluated by the evaluators. HaarWavelet and
+ * MyHaarWavelet are supported. The cascade must be prepared for the step of the integral images before being
+ * evaluated, and again after a stage is added. A cascade without stages can't be evaluated: evaluate() and detect()
+ * throw 37.
+ */
+template <typename HaarWaveletType>
+class WaveletCascade
+{
+public:
+    WaveletCascade() : maxStageSize_(0), step_(0), scale_(1.0) {}
+
+    WaveletCascade(const WaveletCascade & other)
+    {
+        *this = other;
+    }
+
+    WaveletCascade & operator=(const WaveletCascade & other)
+    {
+        if (this != &other)
+        {
+            stages_ = other.stages_;
+            banks_ = other.banks_;
+            maxStageSize_ = other.maxStageSize_;
+            prepared_.clear();
+            step_ = 0;
+            if (other.step_)
+            {
+                prepare(other.step_, other.windowSize_, other.scale_);
+            }
+        }
+        return *this;
+    }
+
+    /**
+     * Appends a stage. Throws if the stage has a different amount of wavelets, thresholds and stump values.
+     */
+    void addStage(const CascadeStage<HaarWaveletType> & stage)
+    {
+        if (stage.thresholds.size() != stage.wavelets.size()
+                || stage.below.size() != stage.wavelets.size()
+                || stage.above.size() != stage.wavelets.size())
+        {
+            throw 37;
+        }
+
+        stages_.push_back(stage);
+        banks_.push_back(CompiledWaveletBank(stage.wavelets));
+        maxStageSize_ = std::max<unsigned int>(maxStageSize_, stage.wavelets.size());
+
+        prepared_.clear(); //they point to banks_, which may have been reallocated
+        step_ = 0;
+    }
+
+    /**
+     * Prepares all stages for integral images whose step (in elements) is step.
+     * @param windowSize size of the detection window, before scaling.
+     */
+    void prepare(const size_t step, const cv::Size & windowSize, const float scale = 1.0)
+    {
+        step_ = step;
+        windowSize_ = windowSize;
+        scale_ = scale;
+        prepared_.resize(banks_.size());
+        for (unsigned int i = 0; i < banks_.size(); ++i)
+        {
+            prepared_[i] = PreparedWaveletBank(banks_[i], step, windowSize, scale);
+        }
+    }
+
+    unsigned int stages() const
+    {
+        return stages_.size();
+    }
+
+    const CascadeStage<HaarWaveletType> & stage(const unsigned int i) const
+    {
+        return stages_[i];
+    }
+
+    /**
+     * Amount of wavelets of the largest stage: the scratch buffers of evaluate() must hold at least this many values.
+     */
+    unsigned int maxStageSize() const
+    {
+        return maxStageSize_;
+    }
+
+    /**
+     * Evaluates the cascade at the window of sum and squareSum whose top-left corner is origin, stopping at the
+     * first stage the window fails. scratch holds length values (at least maxStageSize()).
+     * @param score if given, receives the sum of the last stage evaluated.
+     * @return the amount of stages passed. The window is accepted if it equals stages().
+     */
+    template <typename Evaluator>
+    unsigned int evaluate(const Evaluator & evaluator,
+                          const cv::Mat & sum,
+                          const cv::Mat & squareSum,
+                          const cv::Point & origin,
+                          float * scratch,
+                          const unsigned int length,
+                          float * score = 0) const
+    {
+        checkStages();
+        checkScratch(length);
+
+        unsigned int s = 0;
+        float stageSum = 0;
+        for (; s < stages_.size(); ++s)
+        {
+            responses(evaluator, prepared(s), sum, squareSum, 0, origin, scratch);
+            stageSum = this->stageSum(s, scratch);
+            if (stageSum < stages_[s].threshold)
+            {
+                break;
+            }
+        }
+
+        if (score)
+        {
+            *score = stageSum;
+        }
+        return s;
+    }
+
+    /**
+     * Evaluates the cascade at every window position of sum, moving the window by stride pixels, one stage at a time.
+     * Only the windows that passed a stage are kept, compacted, for the next one.
+     * windows receives the top-left corners of the accepted windows, in raster order.
+     */
+    template <typename Evaluator>
+    void detect(const Evaluator & evaluator,
+                const cv::Mat & sum,
+                const cv::Mat & squareSum,
+                const int stride,
+                std::vector<cv::Point> & windows) const
+    {
+        windows.clear();
+        checkStages();
+
+        const cv::Size size = scanner::responseMapSize(prepared(0), sum, stride);
+        windows.reserve(size.area());
+        for (int y = 0; y < size.height; ++y)
+        {
+            for (int x = 0; x < size.width; ++x)
+            {
+                windows.push_back(cv::Point(x * stride, y * stride));
+            }
+        }
+
+        WindowStatisticsMap statistics;
+        if (usesStatistics(evaluator) && size.area())
+        {
+            statistics.compute(sum, squareSum, prepared(0).windowSize(), stride);
+        }
+
+        std::vector<float> scratch(std::max(maxStageSize_, 1u));
+        for (unsigned int s = 0; s < stages_.size() && !windows.empty(); ++s)
+        {
+            std::vector<cv::Point>::iterator kept = windows.begin();
+            for (std::vector<cv::Point>::const_iterator w = windows.begin(); w != windows.end(); ++w)
+            {
+                responses(evaluator, prepared(s), sum, squareSum, size.area() ? &statistics : 0, *w, &scratch[0]);
+                if (stageSum(s, &scratch[0]) >= stages_[s].threshold)
+                {
+                    *kept++ = *w;
+                }
+            }
+            windows.erase(kept, windows.end());
+        }
+    }
+
+private:
+    const PreparedWaveletBank & prepared(const unsigned int s) const
+    {
+        if (!step_)
+        {
+            throw 32;
+        }
+        return prepared_[s];
+    }
+
+    void checkStages() const
+    {
+        if (stages_.empty())
+        {
+            throw 37;
+        }
+    }
+
+    void checkScratch(const unsigned int length) const
+    {
+        if (length < maxStageSize_)
+        {
+            throw 34;
+        }
+    }
+
+    float stageSum(const unsigned int s, const float * responses) const
+    {
+        const CascadeStage<HaarWaveletType> & stage = stages_[s];
+        float sum = 0;
+        for (unsigned int i = 0; i < stage.wavelets.size(); ++i)
+        {
+            sum += responses[i] < stage.thresholds[i] ? stage.below[i] : stage.above[i];
+        }
+        return sum;
+    }
+
+    static bool usesStatistics(const IntensityNormalizedWaveletEvaluator &)
+    {
+        return false;
+    }
+
+    static bool usesStatistics(const VarianceNormalizedWaveletEvaluator &)
+    {
+        return true;
+    }
+
+    static void responses(const IntensityNormalizedWaveletEvaluator & evaluator,
+                          const PreparedWaveletBank & prepared,
+                          const cv::Mat & sum,
+                          const cv::Mat & squareSum,
+                          const WindowStatisticsMap *, //Not used here
+                          const cv::Point & origin,
+                          float * results)
+    {
+        evaluator(prepared, sum, squareSum, origin, results);
+    }
+
+    static void responses(const VarianceNormalizedWaveletEvaluator & evaluator,
+                          const PreparedWaveletBank & prepared,
+                          const cv::Mat & sum,
+                          const cv::Mat & squareSum,
+                          const WindowStatisticsMap * statistics,
+                          const cv::Point & origin,
+                          float * results)
+    {
+        if (statistics)
+        {
+            evaluator(prepared, sum, *statistics, origin, results);
+        }
+        else
+        {
+            evaluator(prepared, sum, squareSum, origin, results);
+        }
+    }
+
+    std::vector< CascadeStage<HaarWaveletType> > stages_;
+    std::vector<CompiledWaveletBank> banks_;
+    unsigned int maxStageSize_;
+
+    size_t step_;
+    cv::Size windowSize_;
+    float scale_;
+    std::vector<PreparedWaveletBank> prepared_; //point to banks_
+};
+
+
+
+/**
+ * Loads a cascade written by writeWaveletCascade. The first line holds the amount of stages. Each stage starts with
+ * a line holding its amount of wavelets and its threshold, followed by one line per wavelet: the threshold and the
+ * below and above values of its stump, then the wavelet as written by HaarWavelet::write (or MyHaarWavelet::write).
+ * cascade is only changed if the whole file is read.
+ */
+template <typename HaarWaveletType>
+bool loadWaveletCascade(const std::string &filename, WaveletCascade<HaarWaveletType> & cascade)
+{
+    std::ifstream ifs;
+    ifs.open(filename.c_str(), std::ifstream::in);
+
+    if ( !ifs.is_open() )
+    {
+        return false;
+    }
+
+    HAARCOMMON_TIME(PARSING_CYCLES);
+    HAARCOMMON_COUNT(BYTES_PARSED, streamSize(ifs));
+
+    unsigned int stages;
+    if ( !(ifs >> stages) )
+    {
+        return false;
+    }
+
+    WaveletCascade<HaarWaveletType> loaded;
+    for (unsigned int s = 0; s < stages; ++s)
+    {
+        CascadeStage<HaarWaveletType> stage;
+        unsigned int wavelets;
+        if ( !(ifs >> wavelets >> stage.threshold) )
+        {
+            return false;
+        }
+
+        //Stumps are appended as they are read, so that a corrupt amount fails on the missing stumps instead of
+        //allocating for all of them upfront.
+        for (unsigned int i = 0; i < wavelets; ++i)
+        {
+            float threshold, below, above;
+            HaarWaveletType wavelet;
+            ifs >> threshold >> below >> above;
+            wavelet.read(ifs);
+            if ( !ifs || !wavelet.dimensions() )
+            {
+                return false;
+            }
+            stage.wavelets.push_back(wavelet);
+            stage.thresholds.push_back(threshold);
+            stage.below.push_back(below);
+            stage.above.push_back(above);
+            HAARCOMMON_COUNT(WAVELETS_PARSED, 1);
+        }
+        loaded.addStage(stage);
+    }
+
+    ifs.close();
+    cascade = loaded;
+
+    return true;
+}
+
+
+
+/**
+ * Writes cascade in the format read by loadWaveletCascade. Floats are written with enough digits to be read back exactly.
+ */
+template <typename HaarWaveletType>
+bool writeWaveletCascade(const std::string &filename, const WaveletCascade<HaarWaveletType> & cascade)
+{
+    std::ofstream ofs;
+    ofs.open(filename.c_str(), std::ofstream::out | std::ofstream::trunc);
+
+    if (!ofs.is_open())
+    {
+        return false;
+    }
+
+    ofs.precision(std::numeric_limits<float>::digits10 + 3);
+    ofs << cascade.stages() << '\n';
+    for (unsigned int s = 0; s < cascade.stages(); ++s)
+    {
+        const CascadeStage<HaarWaveletType> & stage = cascade.stage(s);
+        ofs << stage.wavelets.size() << ' ' << stage.threshold << '\n';
+        for (unsigned int i = 0; i < stage.wavelets.size(); ++i)
+        {
+            ofs << stage.thresholds[i] << ' ' << stage.below[i] << ' ' << stage.above[i] << ' ';
+            stage.wavelets[i].write(ofs);
+            ofs << '\n';
+        }
+    }
+    ofs.close();
+
+    return !ofs.fail();
+}
+
+
+
+#endif // HAARWAVELETCASCADE_H
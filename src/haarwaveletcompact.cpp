@@ -0,0 +1,321 @@
+#include "haarwaveletcompact.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+
+namespace
+{
+
+/**
+ * True if value is finite but too large for half precision.
+ */
+bool overflows(const float value)
+{
+    const float largest = std::numeric_limits<float>::max();
+    return std::abs(value) <= largest && std::abs(half::toFloat(half::fromFloat(value))) > largest;
+}
+
+}
+
+
+
+CompactWaveletBank::CompactWaveletBank() : kind_(CompiledWaveletBank::PLAIN),
+                                           coordinateWidth_(BYTE),
+                                           weightWidth_(HALF),
+                                           size_(0),
+                                           rectangles_(0) {}
+
+CompactWaveletBank::CompactWaveletBank(const CompiledWaveletBank & bank, const cv::Size & windowSize, const bool lossy)
+    : kind_(bank.kind()),
+      windowSize_(windowSize),
+      size_(bank.size()),
+      rectangles_(bank.rectangles())
+{
+    const int largest = std::max(windowSize.width, windowSize.height);
+    if (windowSize.width < 0 || windowSize.height < 0 || largest > std::numeric_limits<unsigned short>::max())
+    {
+        throw 40;
+    }
+    coordinateWidth_ = largest <= std::numeric_limits<unsigned char>::max() ? BYTE : HALF;
+
+    counts_.resize(size_);
+    const unsigned int * begin = bank.rectanglesBegin();
+    for (unsigned int w = 0; w < size_; ++w)
+    {
+        const unsigned int count = begin[w + 1] - begin[w];
+        if (count > std::numeric_limits<unsigned char>::max())
+        {
+            throw 40;
+        }
+        counts_[w] = count;
+    }
+
+    if (coordinateWidth_ == BYTE)
+    {
+        encodeCoordinates<unsigned char>(bank);
+    }
+    else
+    {
+        encodeCoordinates<unsigned short>(bank);
+    }
+
+    const float * second = kind_ == CompiledWaveletBank::MEANS ? bank.means()
+                         : kind_ == CompiledWaveletBank::DUAL_WEIGHT ? bank.weightsNegative()
+                         : 0;
+
+    weightWidth_ = HALF;
+    for (unsigned int r = 0; r < rectangles_ && weightWidth_ == HALF; ++r)
+    {
+        if (lossy)
+        {
+            if (overflows(bank.weights()[r]) || (second && overflows(second[r])))
+            {
+                throw 40;
+            }
+        }
+        else if (!half::exact(bank.weights()[r]) || (second && !half::exact(second[r])))
+        {
+            weightWidth_ = SINGLE;
+        }
+    }
+
+    if (weightWidth_ == HALF)
+    {
+        encodeWeights<unsigned short>(bank.weights(), rectangles_, weights_);
+        encodeWeights<unsigned short>(second, second ? rectangles_ : 0, second_);
+    }
+    else
+    {
+        encodeWeights<float>(bank.weights(), rectangles_, weights_);
+        encodeWeights<float>(second, second ? rectangles_ : 0, second_);
+    }
+
+    computeErrorBounds(bank);
+}
+
+CompactWaveletBank::CompactWaveletBank(const std::vector<HaarWavelet> & wavelets, const cv::Size & windowSize, const bool lossy)
+{
+    *this = CompactWaveletBank(CompiledWaveletBank(wavelets), windowSize, lossy);
+}
+
+CompactWaveletBank::CompactWaveletBank(const std::vector<MyHaarWavelet> & wavelets, const cv::Size & windowSize, const bool lossy)
+{
+    *this = CompactWaveletBank(CompiledWaveletBank(wavelets), windowSize, lossy);
+}
+
+CompactWaveletBank::CompactWaveletBank(const std::vector<DualWeightHaarWavelet> & wavelets, const cv::Size & windowSize, const bool lossy)
+{
+    *this = CompactWaveletBank(CompiledWaveletBank(wavelets), windowSize, lossy);
+}
+
+void CompactWaveletBank::wavelets(std::vector<HaarWavelet> & wavelets) const
+{
+    if (kind_ != CompiledWaveletBank::PLAIN)
+    {
+        throw 40;
+    }
+
+    wavelets.clear();
+    wavelets.reserve(size_);
+    unsigned int r = 0;
+    for (unsigned int w = 0; w < size_; ++w)
+    {
+        std::vector<cv::Rect> rects;
+        std::vector<float> weights;
+        for (unsigned int i = 0; i < counts_[w]; ++i, ++r)
+        {
+            rects.push_back(rect(r));
+            weights.push_back(weight(weights_, r));
+        }
+        wavelets.push_back(HaarWavelet(rects, weights));
+    }
+}
+
+void CompactWaveletBank::wavelets(std::vector<MyHaarWavelet> & wavelets) const
+{
+    if (kind_ != CompiledWaveletBank::MEANS)
+    {
+        throw 40;
+    }
+
+    wavelets.clear();
+    wavelets.reserve(size_);
+    unsigned int r = 0;
+    for (unsigned int w = 0; w < size_; ++w)
+    {
+        std::vector<cv::Rect> rects;
+        std::vector<float> weights, means;
+        for (unsigned int i = 0; i < counts_[w]; ++i, ++r)
+        {
+            rects.push_back(rect(r));
+            weights.push_back(weight(weights_, r));
+            means.push_back(weight(second_, r));
+        }
+        wavelets.push_back(MyHaarWavelet(rects, weights, means));
+    }
+}
+
+void CompactWaveletBank::wavelets(std::vector<DualWeightHaarWavelet> & wavelets) const
+{
+    if (kind_ != CompiledWaveletBank::DUAL_WEIGHT)
+    {
+        throw 40;
+    }
+
+    wavelets.clear();
+    wavelets.reserve(size_);
+    unsigned int r = 0;
+    for (unsigned int w = 0; w < size_; ++w)
+    {
+        std::vector<cv::Rect> rects;
+        std::vector<float> positive, negative;
+        for (unsigned int i = 0; i < counts_[w]; ++i, ++r)
+        {
+            rects.push_back(rect(r));
+            positive.push_back(weight(weights_, r));
+            negative.push_back(weight(second_, r));
+        }
+        wavelets.push_back(DualWeightHaarWavelet(rects, positive, negative));
+    }
+}
+
+CompiledWaveletBank::Kind CompactWaveletBank::kind() const
+{
+    return kind_;
+}
+
+unsigned int CompactWaveletBank::size() const
+{
+    return size_;
+}
+
+unsigned int CompactWaveletBank::rectangles() const
+{
+    return rectangles_;
+}
+
+unsigned int CompactWaveletBank::outputs() const
+{
+    return kind_ == CompiledWaveletBank::DUAL_WEIGHT ? 2 : 1;
+}
+
+cv::Size CompactWaveletBank::windowSize() const
+{
+    return windowSize_;
+}
+
+CompactWaveletBank::Width CompactWaveletBank::coordinateWidth() const
+{
+    return coordinateWidth_;
+}
+
+CompactWaveletBank::Width CompactWaveletBank::weightWidth() const
+{
+    return weightWidth_;
+}
+
+size_t CompactWaveletBank::bytes() const
+{
+    return counts_.size() + coordinates_.size() + weights_.size() + second_.size();
+}
+
+const float * CompactWaveletBank::errorBounds() const
+{
+    return errorBounds_.empty() ? 0 : &errorBounds_[0];
+}
+
+template <typename coordinate_type>
+void CompactWaveletBank::encodeCoordinates(const CompiledWaveletBank & bank)
+{
+    coordinates_.resize(4 * rectangles_ * sizeof(coordinate_type));
+    coordinate_type * c = reinterpret_cast<coordinate_type *>(coordinates_.data());
+
+    const RectangleCorners * corners = bank.corners();
+    for (unsigned int r = 0; r < rectangles_; ++r, c += 4)
+    {
+        if (corners[r].left < 0 || corners[r].top < 0
+                || corners[r].right > windowSize_.width || corners[r].bottom > windowSize_.height)
+        {
+            throw 40;
+        }
+        c[0] = corners[r].left;
+        c[1] = corners[r].top;
+        c[2] = corners[r].right;
+        c[3] = corners[r].bottom;
+    }
+}
+
+template <typename weight_type>
+void CompactWaveletBank::encodeWeights(const float * weights, const unsigned int count, AlignedBuffer<unsigned char> & buffer)
+{
+    buffer.resize(count * sizeof(weight_type));
+    weight_type * w = reinterpret_cast<weight_type *>(buffer.data());
+    for (unsigned int r = 0; r < count; ++r)
+    {
+        if (sizeof(weight_type) == HALF)
+        {
+            w[r] = half::fromFloat(weights[r]);
+        }
+        else
+        {
+            w[r] = weights[r];
+        }
+    }
+}
+
+float CompactWaveletBank::weight(const AlignedBuffer<unsigned char> & buffer, const unsigned int r) const
+{
+    if (weightWidth_ == HALF)
+    {
+        return half::toFloat(reinterpret_cast<const unsigned short *>(buffer.data())[r]);
+    }
+    return reinterpret_cast<const float *>(buffer.data())[r];
+}
+
+/**
+ * With rectangle values s in [0, 1], rounding a weight w to w' and a mean m to m' changes w * (s - m) by at most
+ * |w' - w| * max(|m'|, |1 - m'|) + |w| * |m' - m|. Weights and negative weights of DUAL_WEIGHT banks make separate
+ * responses, so the bound is the larger of theirs.
+ */
+void CompactWaveletBank::computeErrorBounds(const CompiledWaveletBank & bank)
+{
+    errorBounds_.assign(size_, 0.0f);
+    const unsigned int * begin = bank.rectanglesBegin();
+    for (unsigned int w = 0; w < size_; ++w)
+    {
+        double bound = 0.0, second = 0.0;
+        for (unsigned int r = begin[w]; r < begin[w + 1]; ++r)
+        {
+            const double error = std::abs((double)weight(weights_, r) - bank.weights()[r]);
+            if (kind_ == CompiledWaveletBank::MEANS)
+            {
+                const double mean = weight(second_, r);
+                bound += error * std::max(std::abs(mean), std::abs(1.0 - mean))
+                       + std::abs((double)bank.weights()[r]) * std::abs(mean - bank.means()[r]);
+            }
+            else if (kind_ == CompiledWaveletBank::DUAL_WEIGHT)
+            {
+                bound += error;
+                second += std::abs((double)weight(second_, r) - bank.weightsNegative()[r]);
+            }
+            else
+            {
+                bound += error;
+            }
+        }
+        errorBounds_[w] = std::max(bound, second);
+    }
+}
+
+cv::Rect CompactWaveletBank::rect(const unsigned int r) const
+{
+    int c[4];
+    for (int i = 0; i < 4; ++i)
+    {
+        c[i] = coordinateWidth_ == BYTE ? coordinates_[4 * r + i]
+                                        : reinterpret_cast<const unsigned short *>(coordinates_.data())[4 * r + i];
+    }
+    return cv::Rect(c[0], c[1], c[2] - c[0], c[3] - c[1]);
+}
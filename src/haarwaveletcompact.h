@@ -0,0 +1,335 @@
+#ifndef HAARWAVELETCOMPACT_H
+#define HAARWAVELETCOMPACT_H
+
+#include <vector>
+#include <cstring>
+#include <limits>
+
+#include <opencv2/core/core.hpp>
+
+#include "haarwavelet.h"
+#include "haarwaveletbank.h"
+
+
+
+/**
+ * Conversions between float and IEEE 754 half precision (binary16) numbers, stored in unsigned shorts.
+ */
+namespace half
+{
+
+/**
+ * Rounds value to the nearest half, ties to even. Values too large become infinities.
+ */
+inline unsigned short fromFloat(const float value)
+{
+    unsigned int f;
+    std::memcpy(&f, &value, sizeof(f));
+
+    const unsigned int sign = (f >> 16) & 0x8000;
+    const int exponent = (int)((f >> 23) & 0xff) - 127 + 15;
+    unsigned int mantissa = f & 0x7fffff;
+
+    if (((f >> 23) & 0xff) == 0xff) //infinity or NaN
+    {
+        return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+    }
+    if (exponent >= 31)
+    {
+        return sign | 0x7c00;
+    }
+
+    unsigned int h, rest, halfway;
+    if (exponent <= 0) //subnormal half
+    {
+        if (exponent < -10)
+        {
+            return sign;
+        }
+        mantissa |= 0x800000;
+        const int shift = 14 - exponent;
+        h = mantissa >> shift;
+        rest = mantissa & ((1u << shift) - 1);
+        halfway = 1u << (shift - 1);
+    }
+    else
+    {
+        h = (exponent << 10) | (mantissa >> 13);
+        rest = mantissa & 0x1fff;
+        halfway = 0x1000;
+    }
+
+    if (rest > halfway || (rest == halfway && (h & 1)))
+    {
+        ++h; //may carry into the exponent, which is still the right result
+    }
+    return sign | h;
+}
+
+inline float toFloat(const unsigned short h)
+{
+    const unsigned int sign = (h & 0x8000u) << 16;
+    unsigned int exponent = (h >> 10) & 0x1f;
+    unsigned int mantissa = h & 0x3ff;
+
+    unsigned int f;
+    if (exponent == 0x1f)
+    {
+        f = sign | 0x7f800000 | (mantissa << 13);
+    }
+    else if (exponent)
+    {
+        f = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+    else if (!mantissa)
+    {
+        f = sign;
+    }
+    else //subnormal half, normal float
+    {
+        exponent = 113;
+        while (!(mantissa & 0x400))
+        {
+            mantissa <<= 1;
+            --exponent;
+        }
+        f = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+    }
+
+    float value;
+    std::memcpy(&value, &f, sizeof(value));
+    return value;
+}
+
+/**
+ * True if value is a half precision number, i.e. it survives a round trip through half precision.
+ */
+inline bool exact(const float value)
+{
+    return toFloat(fromFloat(value)) == value || value != value;
+}
+
+}
+
+
+
+/**
+ * @brief The CompactWaveletBank class stores a collection of Haar wavelets in as little memory as possible,
+ * so that large banks stay in cache while they are evaluated.
+ *
+ * For each wavelet, only its amount of rectangles is stored, in a byte. For each rectangle, its corners are stored
+ * in bytes if the detection window is at most 255 pixels wide and high, else in 16 bit integers, and its weight
+ * (and mean or negative weight) as half precision numbers if all of them are exactly representable in half
+ * precision, else as floats. Normalization factors are recomputed from the corners. A two-rectangle wavelet takes
+ * 13 bytes in a 24x24 window with half precision weights, against the 52 bytes of a CompiledWaveletBank.
+ *
+ * Conversions to and from the wavelet classes are lossless, unless the bank is built as lossy: weights (and means or
+ * negative weights) are then always rounded to half precision. errorBounds() holds, for each wavelet, the largest
+ * difference the rounding can cause between its responses and those of the exact wavelet when every rectangle value
+ * is in [0, 1], as with IntensityNormalizedWaveletEvaluator. Other normalizations scale the bounds by their largest
+ * rectangle value. Wavelets with rectangles out of the detection window, with more than 255 rectangles or, in lossy
+ * banks, with values too large for half precision can't be stored (throws 40).
+ *
+ * The bank is evaluated directly by IntensityNormalizedWaveletEvaluator and VarianceNormalizedWaveletEvaluator.
+ */
+class CompactWaveletBank
+{
+public:
+    /**
+     * Size of each stored coordinate and weight, in bytes.
+     */
+    enum Width
+    {
+        BYTE = 1,
+        HALF = 2,
+        SINGLE = 4
+    };
+
+    /**
+     * Constructs an empty bank.
+     */
+    CompactWaveletBank();
+
+    /**
+     * @param windowSize size of the detection window, which must contain all rectangles.
+     * @param lossy if true, weights are stored in half precision even if they aren't exactly representable.
+     */
+    CompactWaveletBank(const CompiledWaveletBank & bank, const cv::Size & windowSize, const bool lossy = false);
+    CompactWaveletBank(const std::vector<HaarWavelet> & wavelets, const cv::Size & windowSize, const bool lossy = false);
+    CompactWaveletBank(const std::vector<MyHaarWavelet> & wavelets, const cv::Size & windowSize, const bool lossy = false);
+    CompactWaveletBank(const std::vector<DualWeightHaarWavelet> & wavelets, const cv::Size & windowSize, const bool lossy = false);
+
+    /**
+     * Restores the wavelets of the bank. Throws 40 if the bank holds another kind of wavelets.
+     */
+    void wavelets(std::vector<HaarWavelet> & wavelets) const;
+    void wavelets(std::vector<MyHaarWavelet> & wavelets) const;
+    void wavelets(std::vector<DualWeightHaarWavelet> & wavelets) const;
+
+    CompiledWaveletBank::Kind kind() const;
+
+    /**
+     * Amount of wavelets in this bank.
+     */
+    unsigned int size() const;
+
+    unsigned int rectangles() const;
+
+    /**
+     * Amount of values each wavelet produces when evaluated: 2 for DUAL_WEIGHT banks, 1 otherwise.
+     */
+    unsigned int outputs() const;
+
+    cv::Size windowSize() const;
+
+    /**
+     * Size of each coordinate: BYTE or HALF (16 bits).
+     */
+    Width coordinateWidth() const;
+
+    /**
+     * Size of each weight: HALF or SINGLE.
+     */
+    Width weightWidth() const;
+
+    /**
+     * Memory used by the wavelets, in bytes.
+     */
+    size_t bytes() const;
+
+    /**
+     * The largest error of the responses of each wavelet caused by rounding its weights. All 0 unless the bank is
+     * lossy and some weights weren't halves.
+     */
+    const float * errorBounds() const;
+
+    /**
+     * Evaluates all wavelets in the window whose top-left corner in an integral image of step elements is window.
+     * The value of each rectangle is given by normalize(sum of its pixels, its area). See CompiledWaveletBank for
+     * the layout of results. No validation is done here.
+     */
+    template <typename integral_type, typename Normalizer>
+    void evaluate(const integral_type * window, const size_t step, const Normalizer & normalize, float * results) const
+    {
+        if (coordinateWidth_ == BYTE)
+        {
+            evaluate<integral_type, unsigned char>(window, step, normalize, results);
+        }
+        else
+        {
+            evaluate<integral_type, unsigned short>(window, step, normalize, results);
+        }
+    }
+
+private:
+    template <typename integral_type, typename coordinate_type, typename Normalizer>
+    void evaluate(const integral_type * window, const size_t step, const Normalizer & normalize, float * results) const
+    {
+        if (weightWidth_ == HALF)
+        {
+            evaluate<integral_type, coordinate_type, unsigned short>(window, step, normalize, results);
+        }
+        else
+        {
+            evaluate<integral_type, coordinate_type, float>(window, step, normalize, results);
+        }
+    }
+
+    template <typename integral_type, typename coordinate_type, typename weight_type, typename Normalizer>
+    void evaluate(const integral_type * window, const size_t step, const Normalizer & normalize, float * results) const
+    {
+        switch (kind_)
+        {
+        case CompiledWaveletBank::PLAIN:
+            evaluate<CompiledWaveletBank::PLAIN, integral_type, coordinate_type, weight_type>(window, step, normalize, results);
+            break;
+        case CompiledWaveletBank::MEANS:
+            evaluate<CompiledWaveletBank::MEANS, integral_type, coordinate_type, weight_type>(window, step, normalize, results);
+            break;
+        case CompiledWaveletBank::DUAL_WEIGHT:
+            evaluate<CompiledWaveletBank::DUAL_WEIGHT, integral_type, coordinate_type, weight_type>(window, step, normalize, results);
+            break;
+        }
+    }
+
+    /**
+     * The kind of the bank is a template parameter, so that the tests on it below are resolved at compile time.
+     */
+    template <CompiledWaveletBank::Kind kind, typename integral_type, typename coordinate_type, typename weight_type, typename Normalizer>
+    void evaluate(const integral_type * window, const size_t step, const Normalizer & normalize, float * results) const
+    {
+        const unsigned char * count = counts_.data();
+        const coordinate_type * c = reinterpret_cast<const coordinate_type *>(coordinates_.data());
+        const weight_type * weight = reinterpret_cast<const weight_type *>(weights_.data());
+        const weight_type * second = second_.size() ? reinterpret_cast<const weight_type *>(second_.data()) : weight; //unused by PLAIN banks
+
+        for (unsigned int w = 0; w < size(); ++w, ++count)
+        {
+            double value = 0.0, negative = 0.0;
+            for (unsigned int r = 0; r < *count; ++r, c += 4, ++weight, ++second)
+            {
+                const integral_type * top    = window + c[1] * step;
+                const integral_type * bottom = window + c[3] * step;
+                const double rectangle = (double)top[c[0]] - top[c[2]] - bottom[c[0]] + bottom[c[2]];
+                const float s = normalize(rectangle, (c[2] - c[0]) * (c[3] - c[1]));
+
+                if (kind == CompiledWaveletBank::MEANS)
+                {
+                    value += toFloat(*weight) * (s - toFloat(*second));
+                }
+                else
+                {
+                    value += toFloat(*weight) * s;
+                }
+                if (kind == CompiledWaveletBank::DUAL_WEIGHT)
+                {
+                    negative += toFloat(*second) * s;
+                }
+            }
+
+            *results++ = kind == CompiledWaveletBank::MEANS ? std::abs(value) : value;
+            if (kind == CompiledWaveletBank::DUAL_WEIGHT)
+            {
+                *results++ = negative;
+            }
+        }
+    }
+
+    static float toFloat(const float value)
+    {
+        return value;
+    }
+
+    static float toFloat(const unsigned short value)
+    {
+        return half::toFloat(value);
+    }
+
+    template <typename coordinate_type>
+    void encodeCoordinates(const CompiledWaveletBank & bank);
+
+    template <typename weight_type>
+    void encodeWeights(const float * weights, const unsigned int count, AlignedBuffer<unsigned char> & buffer);
+
+    float weight(const AlignedBuffer<unsigned char> & buffer, const unsigned int r) const;
+    cv::Rect rect(const unsigned int r) const;
+
+    void computeErrorBounds(const CompiledWaveletBank & bank);
+
+    CompiledWaveletBank::Kind kind_;
+    cv::Size windowSize_;
+    Width coordinateWidth_;
+    Width weightWidth_;
+    unsigned int size_;
+    unsigned int rectangles_;
+
+    AlignedBuffer<unsigned char> counts_;      //rectangles of each wavelet
+    AlignedBuffer<unsigned char> coordinates_; //left, top, right, bottom of each rectangle
+    AlignedBuffer<unsigned char> weights_;     //weight (positive weight for DUAL_WEIGHT banks) of each rectangle
+    AlignedBuffer<unsigned char> second_;      //mean or negative weight of each rectangle, or nothing for PLAIN banks
+    std::vector<float> errorBounds_;
+};
+
+
+
+#endif // HAARWAVELETCOMPACT_H
@@ -0,0 +1,268 @@
+#ifndef HAARWAVELETDATASET_H
+#define HAARWAVELETDATASET_H
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "haarwaveletbank.h"
+#include "haarwaveletevaluators.h"
+#include "haarwaveletgenerator.h"
+#include "haarwaveletinstrumentation.h"
+
+
+
+/**
+ * Functions that evaluate a wavelet bank over whole datasets of sample images, in parallel.
+ */
+namespace dataset
+{
+
+/**
+ * Amount of samples each parallel task processes. Tasks are distributed dynamically among the threads
+ * of OpenCV's pool, so it is kept small enough for the load to balance but large enough to amortize scheduling.
+ */
+const int SAMPLES_PER_TASK = 64;
+
+/**
+ * Buffers a worker thread reuses across all the tasks it runs: the integral images of the current sample and the
+ * bank prepared for their step and size.
+ */
+struct Workspace
+{
+    cv::Mat sum;
+    cv::Mat squareSum;
+    PreparedWaveletBank prepared;
+    cv::Size preparedSize;
+};
+
+template <typename Evaluator>
+class ExtractionBody : public cv::ParallelLoopBody
+{
+public:
+    ExtractionBody(const Evaluator & evaluator_,
+                   const CompiledWaveletBank & bank_,
+                   const std::vector<cv::Mat> * images_,
+                   const std::vector<cv::Mat> * sums_,
+                   const std::vector<cv::Mat> * squareSums_,
+                   cv::Mat & features_,
+                   std::vector<Workspace> & workspaces_) : evaluator(evaluator_),
+                                                           bank(bank_),
+                                                           images(images_),
+                                                           sums(sums_),
+                                                           squareSums(squareSums_),
+                                                           features(features_),
+                                                           workspaces(workspaces_) {}
+
+    void operator()(const cv::Range & range) const
+    {
+        const int samples = images ? images->size() : sums->size();
+        const int end = std::min(range.end * SAMPLES_PER_TASK, samples);
+
+        //A thread runs one task at a time, so its slot is its own. Threads the pool doesn't number
+        //within [0, cv::getNumThreads()) fall back to buffers of their own for this task.
+        Workspace local;
+        const int thread = cv::getThreadNum();
+        Workspace & workspace = thread >= 0 && thread < (int)workspaces.size() ? workspaces[thread] : local;
+        cv::Mat & sumBuffer = workspace.sum;
+        cv::Mat & squareSumBuffer = workspace.squareSum;
+        PreparedWaveletBank & prepared = workspace.prepared;
+        cv::Size & preparedSize = workspace.preparedSize;
+
+        for (int i = range.start * SAMPLES_PER_TASK; i < end; ++i)
+        {
+            const cv::Mat * sum, * squareSum;
+            if (images)
+            {
+                HAARCOMMON_TIME(INTEGRAL_CYCLES);
+                cv::integral((*images)[i], sumBuffer, squareSumBuffer, cv::DataType<double>::type);
+                sum = &sumBuffer;
+                squareSum = &squareSumBuffer;
+            }
+            else
+            {
+                sum = &(*sums)[i];
+                squareSum = &(*squareSums)[i];
+            }
+
+            //The window is the whole sample, as when calling the evaluators directly.
+            const cv::Size size(sum->cols - 1, sum->rows - 1);
+            if (sum->step1() != prepared.step() || size != preparedSize)
+            {
+                prepared = PreparedWaveletBank(bank, sum->step1(), size);
+                preparedSize = size;
+            }
+
+            evaluator(prepared, *sum, *squareSum, cv::Point(0, 0), features.ptr<float>(i));
+        }
+    }
+
+private:
+    const Evaluator & evaluator;
+    const CompiledWaveletBank & bank;
+    const std::vector<cv::Mat> * images;
+    const std::vector<cv::Mat> * sums;
+    const std::vector<cv::Mat> * squareSums;
+    cv::Mat & features;
+    std::vector<Workspace> & workspaces;
+};
+
+template <typename Evaluator>
+void extractFeatures(const Evaluator & evaluator,
+                     const CompiledWaveletBank & bank,
+                     const std::vector<cv::Mat> * images,
+                     const std::vector<cv::Mat> * sums,
+                     const std::vector<cv::Mat> * squareSums,
+                     cv::Mat & features)
+{
+    if (!images && squareSums->size() != sums->size())
+    {
+        throw 33;
+    }
+
+    const int samples = images ? images->size() : sums->size();
+    features.create(samples, bank.size() * bank.outputs(), cv::DataType<float>::type);
+
+    std::vector<Workspace> workspaces(std::max(cv::getNumThreads(), 1));
+    const int tasks = (samples + SAMPLES_PER_TASK - 1) / SAMPLES_PER_TASK;
+    cv::parallel_for_(cv::Range(0, tasks),
+                      ExtractionBody<Evaluator>(evaluator, bank, images, sums, squareSums, features, workspaces),
+                      tasks);
+}
+
+/**
+ * Amount of generated wavelets each parallel task compiles into a bank and evaluates over all samples.
+ */
+const size_t WAVELETS_PER_TASK = 256;
+
+template <typename Evaluator>
+class ColumnBody : public cv::ParallelLoopBody
+{
+public:
+    ColumnBody(const Evaluator & evaluator_,
+               const WaveletGenerator & generator_,
+               const size_t begin_,
+               const size_t end_,
+               const std::vector<cv::Mat> & sums_,
+               const std::vector<cv::Mat> & squareSums_,
+               cv::Mat & features_) : evaluator(evaluator_),
+                                      generator(generator_),
+                                      begin(begin_),
+                                      end(end_),
+                                      sums(sums_),
+                                      squareSums(squareSums_),
+                                      features(features_) {}
+
+    void operator()(const cv::Range & range) const
+    {
+        std::vector<float> results;
+
+        for (int task = range.start; task < range.end; ++task)
+        {
+            const size_t first = begin + task * WAVELETS_PER_TASK;
+            const CompiledWaveletBank bank(generator, first, std::min(first + WAVELETS_PER_TASK, end));
+            results.resize(bank.size());
+
+            for (unsigned int i = 0; i < sums.size(); ++i)
+            {
+                evaluator(bank, sums[i], squareSums[i], &results[0]);
+                for (unsigned int w = 0; w < bank.size(); ++w)
+                {
+                    features.at<float>(first - begin + w, i) = results[w];
+                }
+            }
+        }
+    }
+
+private:
+    const Evaluator & evaluator;
+    const WaveletGenerator & generator;
+    const size_t begin;
+    const size_t end;
+    const std::vector<cv::Mat> & sums;
+    const std::vector<cv::Mat> & squareSums;
+    cv::Mat & features;
+};
+
+}
+
+
+
+/**
+ * Evaluates all wavelets of bank over each image of images, in parallel. The whole image is the window.
+ * Row i of features receives the responses of the i-th image, laid out as the results of the evaluators'
+ * CompiledWaveletBank overloads. features is (re)allocated as a samples x (bank.size() * bank.outputs()) CV_32F
+ * matrix only if it doesn't have that size and type already.
+ * The output doesn't depend on the amount of threads.
+ */
+template <typename Evaluator>
+void extractFeatures(const Evaluator & evaluator,
+                     const CompiledWaveletBank & bank,
+                     const std::vector<cv::Mat> & images,
+                     cv::Mat & features)
+{
+    dataset::extractFeatures(evaluator, bank, &images, 0, 0, features);
+}
+
+/**
+ * Same as above, for samples whose integral images were already computed. Throws 33 if there aren't as many
+ * squareSums as sums.
+ */
+template <typename Evaluator>
+void extractFeatures(const Evaluator & evaluator,
+                     const CompiledWaveletBank & bank,
+                     const std::vector<cv::Mat> & sums,
+                     const std::vector<cv::Mat> & squareSums,
+                     cv::Mat & features)
+{
+    dataset::extractFeatures(evaluator, bank, 0, &sums, &squareSums, features);
+}
+
+/**
+ * Evaluates the wavelets [begin, end) of generator over each sample, in parallel, building them from their indices
+ * a few hundred at a time instead of materializing all of them. sums and squareSums are the integral images of the
+ * samples, which must be as many and all of the size of generator.windowSize() (throws 33 otherwise): as in the
+ * other overloads, the whole sample is the window.
+ *
+ * Unlike the other overloads, row j of features holds the responses of the wavelet begin + j to all samples, i.e.
+ * the column of that feature, as training needs it. features is (re)allocated as an (end - begin) x samples CV_32F
+ * matrix only if it doesn't have that size and type already. The output doesn't depend on the amount of threads.
+ */
+template <typename Evaluator>
+void extractFeatures(const Evaluator & evaluator,
+                     const WaveletGenerator & generator,
+                     const size_t begin,
+                     const size_t end,
+                     const std::vector<cv::Mat> & sums,
+                     const std::vector<cv::Mat> & squareSums,
+                     cv::Mat & features)
+{
+    if (begin > end || end > generator.size())
+    {
+        throw 41;
+    }
+    if (squareSums.size() != sums.size())
+    {
+        throw 33;
+    }
+    for (unsigned int i = 0; i < sums.size(); ++i)
+    {
+        if (sums[i].cols != generator.windowSize().width + 1 || sums[i].rows != generator.windowSize().height + 1
+                || squareSums[i].size() != sums[i].size())
+        {
+            throw 33;
+        }
+    }
+
+    features.create(end - begin, sums.size(), cv::DataType<float>::type);
+
+    const int tasks = (end - begin + dataset::WAVELETS_PER_TASK - 1) / dataset::WAVELETS_PER_TASK;
+    cv::parallel_for_(cv::Range(0, tasks),
+                      dataset::ColumnBody<Evaluator>(evaluator, generator, begin, end, sums, squareSums, features),
+                      tasks);
+}
+
+
+
+#endif // HAARWAVELETDATASET_H
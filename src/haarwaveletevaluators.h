@@ -2,17 +2,107 @@
 #define HAARWAVELETEVALUATORS_H
 
 #include "haarwavelet.h"
+#include "haarwaveletbank.h"
+#include "haarwaveletbatch.h"
+#include "haarwaveletcompact.h"
+#include "haarwaveletfixed.h"
+#include "haarwaveletinstrumentation.h"
+#include "haarwaveletquantized.h"
+#include "haarwaveletshared.h"
+#include "haarwaveletstatistics.h"
 #include <cmath>
 #include <numeric>
 #include <limits>
 
 
 
-//TODO It seems possible to better factor those methods with a combination of templates and virtual methods.
-//Consider traits or policies. http://stackoverflow.com/questions/14718055/what-is-the-difference-between-a-trait-and-a-policy
+/**
+ * Kind policies of the evaluation of a CompiledWaveletBank, one per CompiledWaveletBank::Kind. A policy reads the
+ * per-rectangle arrays of the bank once, on construction, and combines the normalized values of the rectangles of
+ * a wavelet into its response(s). The kind of a bank is dispatched once per bank (see WaveletEvaluator::combine()),
+ * so that the loops over rectangles are free of branches on it.
+ */
+template <CompiledWaveletBank::Kind kind>
+struct CompiledKind;
+
+/**
+ * PLAIN banks: the weighted sum of the SRFS.
+ */
+template <>
+struct CompiledKind<CompiledWaveletBank::PLAIN>
+{
+    explicit CompiledKind(const CompiledWaveletBank & bank) : weights(bank.weights()) {}
+
+    void accumulate(const unsigned int r, const float s, double & value, double &) const
+    {
+        value += weights[r] * s;
+    }
+
+    float * store(const double value, const double, float * results) const
+    {
+        *results++ = value;
+        return results;
+    }
+
+    const float * weights;
+};
+
+/**
+ * MEANS banks: the absolute value of the weighted sum of the SRFS minus the means.
+ */
+template <>
+struct CompiledKind<CompiledWaveletBank::MEANS>
+{
+    explicit CompiledKind(const CompiledWaveletBank & bank) : weights(bank.weights()), means(bank.means()) {}
+
+    void accumulate(const unsigned int r, const float s, double & value, double &) const
+    {
+        value += weights[r] * (s - means[r]);
+    }
+
+    float * store(const double value, const double, float * results) const
+    {
+        *results++ = std::abs(value);
+        return results;
+    }
+
+    const float * weights;
+    const float * means;
+};
+
+/**
+ * DUAL_WEIGHT banks: the weighted sums of the SRFS by the positive and by the negative weights.
+ */
+template <>
+struct CompiledKind<CompiledWaveletBank::DUAL_WEIGHT>
+{
+    explicit CompiledKind(const CompiledWaveletBank & bank) : positive(bank.weights()), negative(bank.weightsNegative()) {}
+
+    void accumulate(const unsigned int r, const float s, double & value, double & negativeValue) const
+    {
+        value         += positive[r] * s;
+        negativeValue += negative[r] * s;
+    }
+
+    float * store(const double value, const double negativeValue, float * results) const
+    {
+        *results++ = value;
+        *results++ = negativeValue;
+        return results;
+    }
+
+    const float * positive;
+    const float * negative;
+};
 
 
 
+/**
+ * Integral images may hold double (the reference implementation), int or float elements.
+ * An int sum is exact for 8 bit images of up to 2^31 / 255 (about 8M) pixels and takes half the memory bandwidth
+ * of a double one. Every public entry point checks the type of the integral image once and then runs code
+ * specialized for that type.
+ */
 struct WaveletEvaluator
 {
     /**
@@ -24,107 +114,353 @@ struct WaveletEvaluator
      */
     double singleRectangleValue(const cv::Rect &r, const cv::Mat & s) const
     {
-        if (s.type() != cv::DataType<double>::type)
+        switch (integralType(s))
         {
-            throw 31;
+        case cv::DataType<int>::type:
+            return singleRectangleValue<int>(r, s);
+        case cv::DataType<float>::type:
+            return singleRectangleValue<float>(r, s);
+        default:
+            return singleRectangleValue<double>(r, s);
         }
+    }
 
+    /**
+     * Same as above, for an integral image known to hold integral_type elements. The type is not checked.
+     */
+    template <typename integral_type>
+    double singleRectangleValue(const cv::Rect &r, const cv::Mat & s) const
+    {
         double rectVal = .0;
 
         //As per Lienhart, Maydt, 2002, section 2.2
         const int x_w = r.x + r.width;
         const int y_h = r.y + r.height;
 
-        //TODO is there a faster implementation that avoids invoking s.at() functions?
-        rectVal = s.at<double>(r.y, r.x)     // (x,     y)
-                    - s.at<double>(r.y, x_w) // (x + w, y)
-                    - s.at<double>(y_h, r.x) // (x,     y + h)
-                    + s.at<double>(y_h, x_w);// (x + w, y + h)
+        //See PreparedWaveletBank for a faster implementation that avoids invoking s.at() functions.
+        rectVal = (double)s.at<integral_type>(r.y, r.x)     // (x,     y)
+                    - s.at<integral_type>(r.y, x_w) // (x + w, y)
+                    - s.at<integral_type>(y_h, r.x) // (x,     y + h)
+                    + s.at<integral_type>(y_h, x_w);// (x + w, y + h)
 
         return rectVal;
     }
-};
 
+    /**
+     * Same as above, for a rectangle given by its corners. If scale > 1, the rectangle streaches right and down.
+     */
+    template <typename integral_type>
+    double singleRectangleValue(const RectangleCorners &c, const cv::Mat & s, const float scale = 1.0) const
+    {
+        cv::Rect r(c.left, c.top, c.right - c.left, c.bottom - c.top);
+        r.x *= scale;
+        r.y *= scale;
+        r.height *= scale;
+        r.width  *= scale;
+        return singleRectangleValue<integral_type>(r, s);
+    }
 
+    /**
+     * Same as above, for a rectangle prepared by PreparedWaveletBank. No validation is done here: see checkIntegral().
+     * @param origin pointer to the element of the integral image that corresponds to the top-left corner of the window.
+     */
+    template <typename integral_type>
+    static double singleRectangleValue(const RectangleOffsets &o, const integral_type * origin)
+    {
+        return (double)origin[o.topLeft] - origin[o.topRight] - origin[o.bottomLeft] + origin[o.bottomRight];
+    }
 
-struct IntensityNormalizedWaveletEvaluator : public WaveletEvaluator
-{
     /**
-     * Returns the value of this Haar wavelet when applied to an image in a certain position.
-     * If scale > 1, the Haar wavelet streaches right and down.
+     * Returns the type of the elements of the integral image s. Throws if it is not one of the supported types.
      */
-    virtual float operator()(const HaarWavelet & w,
-                             const cv::Mat & sum,
-                             const cv::Mat &, //Not used here
-                             const float scale = 1.0) const
+    static int integralType(const cv::Mat & s)
+    {
+        const int type = s.type();
+        if (type != cv::DataType<double>::type
+                && type != cv::DataType<int>::type
+                && type != cv::DataType<float>::type)
+        {
+            throw 31;
+        }
+        return type;
+    }
+
+    /**
+     * Checks, once per image, if an integral image can be used with a PreparedWaveletBank
+     * evaluated in a window whose top-left corner is origin.
+     */
+    static void checkIntegral(const PreparedWaveletBank & bank, const cv::Mat & s, const cv::Point & origin)
     {
-        std::vector<float> s(w.dimensions());
-        srfs(w, sum, s, scale);
+        integralType(s);
+
+        if (s.step1() != bank.step())
+        {
+            throw 32;
+        }
 
-        return std::inner_product(w.weights_begin(), w.weights_end(),
-                                  s.begin(), 0.0);
+        checkWindow(bank, s, origin);
     }
 
-    virtual float operator()(const MyHaarWavelet & w,
-                             const cv::Mat & sum,
-                             const cv::Mat &, //Not used here
-                             const float scale = 1.0) const
+    /**
+     * Checks if the window of bank whose top-left corner is origin lies inside the integral image s.
+     */
+    static void checkWindow(const PreparedWaveletBank & bank, const cv::Mat & s, const cv::Point & origin)
     {
-        std::vector<float> s(w.dimensions());
-        srfs(w, sum, s, scale);
+        if (origin.x < 0 || origin.y < 0
+                || origin.x + bank.windowSize().width >= s.cols
+                || origin.y + bank.windowSize().height >= s.rows)
+        {
+            throw 33;
+        }
+    }
 
-        std::transform(s.begin(), s.end(),
-                       w.means_begin(),
-                       s.begin(),
-                       std::minus<float>());
+    /**
+     * Same as above for a CompactWaveletBank, whose rectangles are not tied to a step.
+     */
+    static void checkWindow(const CompactWaveletBank & bank, const cv::Mat & s, const cv::Point & origin)
+    {
+        if (origin.x < 0 || origin.y < 0
+                || origin.x + bank.windowSize().width >= s.cols
+                || origin.y + bank.windowSize().height >= s.rows)
+        {
+            throw 33;
+        }
+    }
 
-        return std::abs(std::inner_product(w.weights_begin(), w.weights_end(),
-                                           s.begin(), 0.0));
+    /**
+     * Checks if a buffer of length values can hold the SRFS of w.
+     */
+    static void checkScratch(const AbstractHaarWavelet & w, const unsigned int length)
+    {
+        if (length < w.dimensions())
+        {
+            throw 34;
+        }
     }
 
-    virtual std::pair<float,float> operator()(const DualWeightHaarWavelet & w,
-                                              const cv::Mat & sum,
-                                              const cv::Mat &, //Not used here
-                                              const float scale = 1.0) const
+    /**
+     * Checks if a buffer of length values can hold the value of each distinct rectangle of bank.
+     */
+    static void checkScratch(const SharedRectangleBank & bank, const unsigned int length)
     {
-        std::vector<float> s(w.dimensions());
-        srfs(w, sum, s, scale);
+        if (length < bank.uniqueRectangles())
+        {
+            throw 34;
+        }
+    }
+
+protected:
+
+    /**
+     * Amount of rectangles of wavelets. Only evaluated when counting them (see haarwaveletinstrumentation.h).
+     */
+    template <typename HaarWaveletType>
+    static unsigned long long rectangles(const std::vector<HaarWaveletType> & wavelets)
+    {
+        unsigned long long total = 0;
+        for (typename std::vector<HaarWaveletType>::const_iterator it = wavelets.begin(); it != wavelets.end(); ++it)
+        {
+            total += it->dimensions();
+        }
+        return total;
+    }
 
-        std::pair<float, float> featureValues;
-        featureValues.first  = std::inner_product(w.weightsPositive_begin(),
-                                                  w.weightsPositive_end(),
-                                                  s.begin(), 0.0);
-        featureValues.second = std::inner_product(w.weightsNegative_begin(),
-                                                  w.weightsNegative_end(),
-                                                  s.begin(), 0.0);
-        return featureValues;
+    static unsigned long long rectangles(const FixedWaveletBank & bank)
+    {
+        return 2ULL * bank.pairs().size() + 3ULL * bank.triples().size() + 4ULL * bank.quadruples().size()
+                + bank.others().bank().rectangles();
     }
 
     /**
-     * Sets the values of the single rectangle feature space.
-     * If scale > 1, the Haar wavelet streaches right and down.
-     * @param w
-     * @param sum integral image of the original image.
-     * @param srfsVector where the resulting values will be writen to. srfsVector.size() must be equal to w.dimensions().
-     * @param scale how mutch w should be scaled.
+     * Combines the normalized values of the rectangles of each wavelet of bank into its response(s), writing them
+     * one wavelet after the other to results: one value per wavelet, or two (positive and negative) for DUAL_WEIGHT
+     * banks. values(r) returns the normalized value of the r-th rectangle of bank. If indices is not null, the
+     * response(s) of the w-th wavelet are written to results + indices[w] instead.
+     *
+     * The kind of bank is dispatched here, once; see CompiledKind.
      */
-    template <typename floating_point_type>
-    void srfs(const AbstractHaarWavelet & w, const cv::Mat & sum, std::vector<floating_point_type> &srfsVector, const float scale = 1.0) const
+    template <typename Values>
+    static void combine(const CompiledWaveletBank & bank, const Values & values, float * results, const unsigned int * indices = 0)
     {
-        int i = 0;
-        for (std::vector<cv::Rect>::const_iterator it = w.rects_begin(); it != w.rects_end(); ++it)
+        switch (bank.kind())
         {
-            cv::Rect r = *it;
-            r.x *= scale;
-            r.y *= scale;
-            r.height *= scale;
-            r.width  *= scale;
-            srfsVector[i] = singleRectangleValue(r, sum);
+        case CompiledWaveletBank::PLAIN:
+            combine<CompiledWaveletBank::PLAIN>(bank, values, results, indices);
+            break;
+        case CompiledWaveletBank::MEANS:
+            combine<CompiledWaveletBank::MEANS>(bank, values, results, indices);
+            break;
+        case CompiledWaveletBank::DUAL_WEIGHT:
+            combine<CompiledWaveletBank::DUAL_WEIGHT>(bank, values, results, indices);
+            break;
+        }
+    }
+
+    /**
+     * Same as above, for a bank known to be of the given kind. The kind is not checked.
+     */
+    template <CompiledWaveletBank::Kind kind, typename Values>
+    static void combine(const CompiledWaveletBank & bank, const Values & values, float * results, const unsigned int * indices = 0)
+    {
+        const CompiledKind<kind> policy(bank);
+        const unsigned int * begin = bank.rectanglesBegin();
+        float * next = results;
 
-            //SRFS works with normalized means (Pavani et al., 2010, section 2.3).
-            //AFAIK, Pavani's classifier only normalized things by the maximum numeric value of each pixel.
-            srfsVector[i] /= it->area() * std::numeric_limits<unsigned char>::max(); //TODO it is probably best to use a fixed number
-            ++i;
+        for (unsigned int w = 0; w < bank.size(); ++w)
+        {
+            double value = 0.0, negative = 0.0;
+            for (unsigned int r = begin[w]; r < begin[w + 1]; ++r)
+            {
+                policy.accumulate(r, values(r), value, negative);
+            }
+            next = policy.store(value, negative, indices ? results + indices[w] : next);
+        }
+    }
+
+    /**
+     * The values of the distinct rectangles of a SharedRectangleBank, looked up by the rectangles of its bank.
+     */
+    struct SharedValues
+    {
+        SharedValues(const SharedRectangleBank & shared, const float * values_) : columns(shared.columns()), values(values_) {}
+
+        float operator()(const unsigned int r) const
+        {
+            return values[columns[r]];
+        }
+
+        const unsigned int * columns;
+        const float * values;
+    };
+
+    /**
+     * Multiplies the weights of bank by the values of its distinct rectangles, writing the responses to results
+     * as combine() does.
+     */
+    static void product(const SharedRectangleBank & shared, const float * values, float * results)
+    {
+        combine(shared.bank(), SharedValues(shared, values), results);
+    }
+
+    /**
+     * Checks if all rectangles of bank lie inside the patches of batch.
+     */
+    static void checkWindow(const CompiledWaveletBank & bank, const IntegralBatch & batch)
+    {
+        for (unsigned int r = 0; r < bank.rectangles(); ++r)
+        {
+            const RectangleCorners & c = bank.corners()[r];
+            if (c.left < 0 || c.top < 0 || c.right > batch.patchSize().width || c.bottom > batch.patchSize().height)
+            {
+                throw 33;
+            }
+        }
+    }
+
+    /**
+     * Evaluates bank over all patches of batch, one rectangle at a time: the corners of the rectangle are looked up
+     * once and the sums of its pixels in all patches are read from four contiguous streams. The normalized value of
+     * the r-th rectangle of bank in patch p is normalize(sum of its pixels, r, p). See the batch overloads of the
+     * evaluators for the layout of results.
+     */
+    template <typename Normalizer>
+    static void evaluateBatch(const CompiledWaveletBank & bank, const IntegralBatch & batch, const Normalizer & normalize, cv::Mat & results)
+    {
+        HAARCOMMON_TIME(EVALUATION_CYCLES);
+        HAARCOMMON_COUNT_WINDOWS(batch.size(), bank.size(), bank.rectangles());
+
+        results.create(bank.size() * bank.outputs(), batch.size(), cv::DataType<float>::type);
+        switch (bank.kind())
+        {
+        case CompiledWaveletBank::PLAIN:
+            evaluateBatch<CompiledWaveletBank::PLAIN>(bank, batch, normalize, results);
+            break;
+        case CompiledWaveletBank::MEANS:
+            evaluateBatch<CompiledWaveletBank::MEANS>(bank, batch, normalize, results);
+            break;
+        case CompiledWaveletBank::DUAL_WEIGHT:
+            evaluateBatch<CompiledWaveletBank::DUAL_WEIGHT>(bank, batch, normalize, results);
+            break;
+        }
+    }
+
+    /**
+     * Same as above, for a bank known to be of the given kind, with results already allocated.
+     */
+    template <CompiledWaveletBank::Kind kind, typename Normalizer>
+    static void evaluateBatch(const CompiledWaveletBank & bank, const IntegralBatch & batch, const Normalizer & normalize, cv::Mat & results)
+    {
+        const CompiledKind<kind> policy(bank);
+        const unsigned int n = batch.size();
+        const unsigned int outputs = bank.outputs();
+        const unsigned int * begin = bank.rectanglesBegin();
+        const RectangleCorners * corners = bank.corners();
+
+        std::vector<double> value(n), negative(n);
+
+        for (unsigned int w = 0; w < bank.size(); ++w)
+        {
+            std::fill(value.begin(), value.end(), 0.0);
+            std::fill(negative.begin(), negative.end(), 0.0);
+
+            for (unsigned int r = begin[w]; r < begin[w + 1]; ++r)
+            {
+                const RectangleCorners & c = corners[r];
+                const int * topLeft     = batch.sum() + batch.offset(c.top, c.left);
+                const int * topRight    = batch.sum() + batch.offset(c.top, c.right);
+                const int * bottomLeft  = batch.sum() + batch.offset(c.bottom, c.left);
+                const int * bottomRight = batch.sum() + batch.offset(c.bottom, c.right);
+
+                for (unsigned int p = 0; p < n; ++p)
+                {
+                    policy.accumulate(r, normalize((double)topLeft[p] - topRight[p] - bottomLeft[p] + bottomRight[p], r, p), value[p], negative[p]);
+                }
+            }
+
+            float * rows[2];
+            for (unsigned int o = 0; o < outputs; ++o)
+            {
+                rows[o] = results.ptr<float>(w * outputs + o);
+            }
+            for (unsigned int p = 0; p < n; ++p)
+            {
+                float responses[2] = {0.0f, 0.0f};
+                policy.store(value[p], negative[p], responses);
+                for (unsigned int o = 0; o < outputs; ++o)
+                {
+                    rows[o][p] = responses[o];
+                }
+            }
+        }
+    }
+
+    /**
+     * Multiplies the weights of each head of w by its SRFS, srfs (minus the means of the head, if w has means),
+     * writing the response of the k-th head to results[k].
+     */
+    static void heads(const MultiHeadHaarWavelet & w, const float * srfs, float * results)
+    {
+        for (unsigned int k = 0; k < w.heads(); ++k)
+        {
+            std::vector<float>::const_iterator weight = w.weights_begin(k);
+            double value = 0.0;
+            if (w.hasMeans())
+            {
+                std::vector<float>::const_iterator mean = w.means_begin(k);
+                for (unsigned int r = 0; r < w.dimensions(); ++r, ++weight, ++mean)
+                {
+                    value += *weight * (srfs[r] - *mean);
+                }
+                results[k] = std::abs(value);
+            }
+            else
+            {
+                for (unsigned int r = 0; r < w.dimensions(); ++r, ++weight)
+                {
+                    value += *weight * srfs[r];
+                }
+                results[k] = value;
+            }
         }
     }
 };
@@ -132,74 +468,1524 @@ struct IntensityNormalizedWaveletEvaluator : public WaveletEvaluator
 
 
 /**
- * Returns the value of this Haar wavelet when applied to an image in a certain position.
- * If scale > 1, the Haar wavelet streaches right and down.
- *
- * The only normalization mentioned in Pavani et al. is the "intensity normalization" (section 2.3).
- * Viola and Jones perform a variance normalization that might be more resilient to lightning conditions.
- * This function implements what Viola and Jones did.
+ * Normalization policies of PolicyWaveletEvaluator. A policy computes, once per image, the statistics it needs
+ * (its Window), and then normalizes the sum of the pixels of each rectangle into a value of the SRFS. Values are
+ * floats, as the ones written by srfs(), so that all ways of evaluating a wavelet agree.
  */
-struct VarianceNormalizedWaveletEvaluator : public WaveletEvaluator
+
+/**
+ * Pavani et al.'s intensity normalization (section 2.3): the mean of the pixels of each rectangle, divided by the
+ * maximum value of a pixel. See IntensityNormalizedWaveletEvaluator.
+ */
+struct IntensityNormalization
 {
-    virtual float operator()(const HaarWavelet & w,
-                             const cv::Mat & sum,
-                             const cv::Mat & squareSum/*, const cv::Mat & tilted*/,
-                             const float scale = 1.0) const
+    struct Window {};
+
+    static Window window(const cv::Mat &, const cv::Mat &)
     {
-        std::vector<float> s(w.dimensions());
-        srfs(w, sum, squareSum, s, scale);
+        return Window();
+    }
 
-        return std::inner_product(w.weights_begin(), w.weights_end(),
-                                  s.begin(), 0.0);
+    /**
+     * @param value sum of the pixels of the rectangle, after scaling.
+     * @param rect the rectangle, as stored in the wavelet (that is, before scaling).
+     */
+    static float rectangle(const double value, const cv::Rect & rect, const cv::Rect &, const Window &)
+    {
+        float s = value;
+        s /= rect.area() * std::numeric_limits<unsigned char>::max();
+        return s;
     }
+};
 
-    virtual float operator()(const MyHaarWavelet & w,
-                             const cv::Mat & sum,
-                             const cv::Mat & squareSum/*, const cv::Mat & tilted*/,
-                             const float scale = 1.0) const
+/**
+ * Viola and Jones' variance normalization, with the mean and standard deviation of the pixels of the whole image.
+ * See VarianceNormalizedWaveletEvaluator.
+ */
+struct VarianceNormalization
+{
+    struct Window
     {
-        std::vector<float> s(w.dimensions());
-        srfs(w, sum, squareSum, s, scale);
+        double mean;
+        double stdDev;
+    };
 
-        std::transform(s.begin(), s.end(),
-                       w.means_begin(),
-                       s.begin(),
-                       std::minus<float>());
+    static Window window(const cv::Mat & sum, const cv::Mat & squareSum)
+    {
+        const double area = (sum.cols - 1) * (sum.rows - 1);
+        const cv::Rect image(0, 0, sum.cols - 1, sum.rows - 1);
+        const WaveletEvaluator evaluator;
+        HAARCOMMON_COUNT(STATISTICS, 1);
 
-        return std::abs(std::inner_product(w.weights_begin(), w.weights_end(),
-                                           s.begin(), 0.0));
+        Window w;
+        w.mean = evaluator.singleRectangleValue(image, sum) / area;
+        w.stdDev = std::sqrt(std::abs(evaluator.singleRectangleValue(image, squareSum) / area - w.mean * w.mean));
+        return w;
     }
 
-    template <typename floating_point_type>
-    void srfs(const AbstractHaarWavelet & w, const cv::Mat & sum, const cv::Mat & squareSum, std::vector<floating_point_type> &srfsVector, const float scale = 1.0) const
+    /**
+     * @param scaled the rectangle, after scaling.
+     */
+    static float rectangle(const double value, const cv::Rect &, const cv::Rect & scaled, const Window & w)
     {
-        //Viola and Jones perform a variance normalization. This is better explained in Lienhart, Maydt, 2002, section 2.2.
-        const double area = (sum.cols - 1) * (sum.rows - 1); //area of the original image
-        const double mean = sum.at<double>(sum.rows - 1, sum.cols - 1) / area; //mean value of all pixels inside the image that originated the integral image
-        const double stdDev = std::sqrt( std::abs(
-                            (squareSum.at<double>(sum.rows - 1, sum.cols - 1) / area ) - (mean * mean)
-                        )); //Viola and Jones' paper show a wrong equation?
-                            //Correct is: STD_DEV = SQRT(E[X^2] - E[X]^2)
+        return w.stdDev ? (value - w.mean * scaled.area()) / (2.0 * w.stdDev) : 0.0;
+    }
+};
 
-        if (stdDev)
-        {
-            int i = 0;
-            for(std::vector<cv::Rect>::const_iterator it = w.rects_begin(); it != w.rects_end(); ++it, ++i)
-            {
-                cv::Rect r = *it;
-                r.x *= scale;
-                r.y *= scale;
-                r.height *= scale;
-                r.width  *= scale;
-
-                //Can't divide by zero. If the subwindow standard deviation is 0, then all rectangles have the same value.
-                //If this happens, then (singleRectangleValue(r, sum) - mean * r.area()) == 0. See the ELSE clause below.
-                srfsVector[i] = (singleRectangleValue(r, sum) - (mean * r.area())) / (2.0 * stdDev);
-            }
-        }
-        else
+/**
+ * No normalization: the SRFS holds the sums of the pixels of the rectangles.
+ */
+struct NoNormalization
+{
+    struct Window {};
+
+    static Window window(const cv::Mat &, const cv::Mat &)
+    {
+        return Window();
+    }
+
+    static float rectangle(const double value, const cv::Rect &, const cv::Rect &, const Window &)
+    {
+        return value;
+    }
+};
+
+
+
+/**
+ * Wavelet kind policies of PolicyWaveletEvaluator. A policy combines the normalized values of the rectangles of a
+ * wavelet, one at a time, into its response.
+ */
+
+/**
+ * HaarWavelet: the weighted sum of the SRFS.
+ */
+struct PlainKind
+{
+    typedef HaarWavelet wavelet_type;
+    typedef float result_type;
+
+    struct Accumulator
+    {
+        explicit Accumulator(const wavelet_type & w) : weight(w.weights_begin()), value(0.0) {}
+
+        std::vector<float>::const_iterator weight;
+        double value;
+    };
+
+    static void add(Accumulator & a, const float s)
+    {
+        a.value += *a.weight++ * s;
+    }
+
+    static result_type result(const Accumulator & a)
+    {
+        return a.value;
+    }
+};
+
+/**
+ * MyHaarWavelet: the absolute value of the weighted sum of the SRFS minus the means.
+ */
+struct MeansKind
+{
+    typedef MyHaarWavelet wavelet_type;
+    typedef float result_type;
+
+    struct Accumulator
+    {
+        explicit Accumulator(const wavelet_type & w) : weight(w.weights_begin()), mean(w.means_begin()), value(0.0) {}
+
+        std::vector<float>::const_iterator weight;
+        std::vector<float>::const_iterator mean;
+        double value;
+    };
+
+    static void add(Accumulator & a, const float s)
+    {
+        a.value += *a.weight++ * (s - *a.mean++);
+    }
+
+    static result_type result(const Accumulator & a)
+    {
+        return std::abs(a.value);
+    }
+};
+
+/**
+ * DualWeightHaarWavelet: the weighted sums of the SRFS by the positive and by the negative weights.
+ */
+struct DualWeightKind
+{
+    typedef DualWeightHaarWavelet wavelet_type;
+    typedef std::pair<float, float> result_type;
+
+    struct Accumulator
+    {
+        explicit Accumulator(const wavelet_type & w) : positive(w.weightsPositive_begin()),
+                                                       negative(w.weightsNegative_begin()),
+                                                       positiveValue(0.0),
+                                                       negativeValue(0.0) {}
+
+        std::vector<float>::const_iterator positive;
+        std::vector<float>::const_iterator negative;
+        double positiveValue;
+        double negativeValue;
+    };
+
+    static void add(Accumulator & a, const float s)
+    {
+        a.positiveValue += *a.positive++ * s;
+        a.negativeValue += *a.negative++ * s;
+    }
+
+    static result_type result(const Accumulator & a)
+    {
+        return result_type(a.positiveValue, a.negativeValue);
+    }
+};
+
+/**
+ * The kind policy of each type of Haar wavelet.
+ */
+template <typename HaarWaveletType> struct WaveletKind;
+template <> struct WaveletKind<HaarWavelet>           { typedef PlainKind type; };
+template <> struct WaveletKind<MyHaarWavelet>         { typedef MeansKind type; };
+template <> struct WaveletKind<DualWeightHaarWavelet> { typedef DualWeightKind type; };
+
+
+
+template <typename Normalization, typename Kind>
+struct PolicyWaveletEvaluator;
+
+/**
+ * The PolicyWaveletEvaluator of a normalization and a type of Haar wavelet, e.g.
+ * StaticWaveletEvaluator<VarianceNormalization, MyHaarWavelet>::type.
+ */
+template <typename Normalization, typename HaarWaveletType>
+struct StaticWaveletEvaluator
+{
+    typedef PolicyWaveletEvaluator<Normalization, typename WaveletKind<HaarWaveletType>::type> type;
+};
+
+
+
+/**
+ * @brief The PolicyWaveletEvaluator struct evaluates Haar wavelets of the kind given by the Kind policy, normalized by
+ * the Normalization policy. Nothing is virtual: each combination of policies compiles to its own inlined loop, with
+ * no scratch buffer.
+ *
+ * NormalizedWaveletEvaluator evaluates single wavelets and collections of wavelets of every type with them.
+ */
+template <typename Normalization, typename Kind>
+struct PolicyWaveletEvaluator : public WaveletEvaluator
+{
+    typedef typename Kind::wavelet_type wavelet_type;
+    typedef typename Kind::result_type result_type;
+    typedef typename Normalization::Window Window;
+
+    /**
+     * Returns the value of this Haar wavelet when applied to an image in a certain position.
+     * If scale > 1, the Haar wavelet streaches right and down.
+     */
+    result_type operator()(const wavelet_type & w,
+                           const cv::Mat & sum,
+                           const cv::Mat & squareSum,
+                           const float scale = 1.0) const
+    {
+        const Window window = Normalization::window(sum, squareSum);
+        switch (integralType(sum))
+        {
+        case cv::DataType<int>::type:
+            return evaluate<int>(w, sum, window, scale);
+        case cv::DataType<float>::type:
+            return evaluate<float>(w, sum, window, scale);
+        default:
+            return evaluate<double>(w, sum, window, scale);
+        }
+    }
+
+    /**
+     * Evaluates a whole collection of Haar wavelets against the same integral images. The statistics of the
+     * normalization are computed only once. The response of wavelets[i] is written to results[i].
+     */
+    void operator()(const std::vector<wavelet_type> & wavelets,
+                    const cv::Mat & sum,
+                    const cv::Mat & squareSum,
+                    result_type * results,
+                    const float scale = 1.0) const
+    {
+        const Window window = Normalization::window(sum, squareSum);
+        switch (integralType(sum))
+        {
+        case cv::DataType<int>::type:
+            evaluate<int>(wavelets, sum, window, results, scale);
+            break;
+        case cv::DataType<float>::type:
+            evaluate<float>(wavelets, sum, window, results, scale);
+            break;
+        default:
+            evaluate<double>(wavelets, sum, window, results, scale);
+            break;
+        }
+    }
+
+    /**
+     * Same as above, for an integral image known to hold integral_type elements and statistics already computed.
+     */
+    template <typename integral_type>
+    void evaluate(const std::vector<wavelet_type> & wavelets,
+                  const cv::Mat & sum,
+                  const Window & window,
+                  result_type * results,
+                  const float scale) const
+    {
+        HAARCOMMON_COUNT_WINDOWS(1, wavelets.size(), rectangles(wavelets));
+        for (typename std::vector<wavelet_type>::const_iterator w = wavelets.begin(); w != wavelets.end(); ++w, ++results)
+        {
+            *results = evaluate<integral_type>(*w, sum, window, scale);
+        }
+    }
+
+    template <typename integral_type>
+    result_type evaluate(const wavelet_type & w,
+                         const cv::Mat & sum,
+                         const Window & window,
+                         const float scale) const
+    {
+        typename Kind::Accumulator a(w);
+        for (std::vector<cv::Rect>::const_iterator it = w.rects_begin(); it != w.rects_end(); ++it)
+        {
+            cv::Rect r = *it;
+            r.x *= scale;
+            r.y *= scale;
+            r.height *= scale;
+            r.width  *= scale;
+            Kind::add(a, Normalization::rectangle(singleRectangleValue<integral_type>(r, sum), *it, r, window));
+        }
+        return Kind::result(a);
+    }
+};
+
+
+
+/**
+ * @brief The NormalizedWaveletEvaluator struct evaluates single Haar wavelets and collections of them of any type,
+ * normalized by the Normalization policy, through the PolicyWaveletEvaluator of each type of wavelet.
+ *
+ * IntensityNormalizedWaveletEvaluator and VarianceNormalizedWaveletEvaluator derive from it and add the evaluation of
+ * banks. They can't be mere typedefs of a PolicyWaveletEvaluator: each of them evaluates all three types of wavelet,
+ * the single wavelet overloads are virtual, and the bank overloads take different arguments for each normalization
+ * (the window statistics of the variance one).
+ */
+template <typename Normalization>
+struct NormalizedWaveletEvaluator : public WaveletEvaluator
+{
+    /**
+     * Returns the value of this Haar wavelet when applied to an image in a certain position.
+     * If scale > 1, the Haar wavelet streaches right and down.
+     */
+    virtual float operator()(const HaarWavelet & w,
+                             const cv::Mat & sum,
+                             const cv::Mat & squareSum,
+                             const float scale = 1.0) const
+    {
+        return PolicyWaveletEvaluator<Normalization, PlainKind>()(w, sum, squareSum, scale);
+    }
+
+    virtual float operator()(const MyHaarWavelet & w,
+                             const cv::Mat & sum,
+                             const cv::Mat & squareSum,
+                             const float scale = 1.0) const
+    {
+        return PolicyWaveletEvaluator<Normalization, MeansKind>()(w, sum, squareSum, scale);
+    }
+
+    virtual std::pair<float,float> operator()(const DualWeightHaarWavelet & w,
+                                              const cv::Mat & sum,
+                                              const cv::Mat & squareSum,
+                                              const float scale = 1.0) const
+    {
+        return PolicyWaveletEvaluator<Normalization, DualWeightKind>()(w, sum, squareSum, scale);
+    }
+
+    /**
+     * Evaluates a whole collection of Haar wavelets against the same integral images. The statistics of the
+     * normalization are computed only once for the whole collection. The response of wavelets[i] is written to
+     * results[i], so results must hold at least wavelets.size() values. No memory is allocated.
+     */
+    void operator()(const std::vector<HaarWavelet> & wavelets,
+                    const cv::Mat & sum,
+                    const cv::Mat & squareSum,
+                    float * results,
+                    const float scale = 1.0) const
+    {
+        PolicyWaveletEvaluator<Normalization, PlainKind>()(wavelets, sum, squareSum, results, scale);
+    }
+
+    /**
+     * Same as above, for MyHaarWavelet.
+     */
+    void operator()(const std::vector<MyHaarWavelet> & wavelets,
+                    const cv::Mat & sum,
+                    const cv::Mat & squareSum,
+                    float * results,
+                    const float scale = 1.0) const
+    {
+        PolicyWaveletEvaluator<Normalization, MeansKind>()(wavelets, sum, squareSum, results, scale);
+    }
+
+    /**
+     * Same as above, for DualWeightHaarWavelet. results must hold at least wavelets.size() pairs.
+     */
+    void operator()(const std::vector<DualWeightHaarWavelet> & wavelets,
+                    const cv::Mat & sum,
+                    const cv::Mat & squareSum,
+                    std::pair<float, float> * results,
+                    const float scale = 1.0) const
+    {
+        PolicyWaveletEvaluator<Normalization, DualWeightKind>()(wavelets, sum, squareSum, results, scale);
+    }
+
+    /**
+     * Same as the single wavelet overloads above, but the SRFS is computed into scratch, which holds length values
+     * (at least w.dimensions()). No memory is allocated.
+     */
+    float operator()(const HaarWavelet & w,
+                     const cv::Mat & sum,
+                     const cv::Mat & squareSum,
+                     float * scratch,
+                     const unsigned int length,
+                     const float scale = 1.0) const
+    {
+        return evaluate<PlainKind>(w, sum, squareSum, scratch, length, scale);
+    }
+
+    float operator()(const MyHaarWavelet & w,
+                     const cv::Mat & sum,
+                     const cv::Mat & squareSum,
+                     float * scratch,
+                     const unsigned int length,
+                     const float scale = 1.0) const
+    {
+        return evaluate<MeansKind>(w, sum, squareSum, scratch, length, scale);
+    }
+
+    std::pair<float,float> operator()(const DualWeightHaarWavelet & w,
+                                      const cv::Mat & sum,
+                                      const cv::Mat & squareSum,
+                                      float * scratch,
+                                      const unsigned int length,
+                                      const float scale = 1.0) const
+    {
+        return evaluate<DualWeightKind>(w, sum, squareSum, scratch, length, scale);
+    }
+
+private:
+    typedef typename Normalization::Window Window;
+
+    template <typename Kind>
+    typename Kind::result_type evaluate(const typename Kind::wavelet_type & w,
+                                        const cv::Mat & sum,
+                                        const cv::Mat & squareSum,
+                                        float * scratch,
+                                        const unsigned int length,
+                                        const float scale) const
+    {
+        checkScratch(w, length);
+
+        const Window window = Normalization::window(sum, squareSum);
+        switch (integralType(sum))
+        {
+        case cv::DataType<int>::type:
+            normalizedSrfs<int>(w, sum, window, scratch, scale);
+            break;
+        case cv::DataType<float>::type:
+            normalizedSrfs<float>(w, sum, window, scratch, scale);
+            break;
+        default:
+            normalizedSrfs<double>(w, sum, window, scratch, scale);
+            break;
+        }
+
+        typename Kind::Accumulator a(w);
+        for (unsigned int i = 0; i < w.dimensions(); ++i)
+        {
+            Kind::add(a, scratch[i]);
+        }
+        return Kind::result(a);
+    }
+
+    /**
+     * Writes the SRFS of w to scratch, each rectangle normalized by the Normalization policy.
+     */
+    template <typename integral_type>
+    void normalizedSrfs(const AbstractHaarWavelet & w,
+                        const cv::Mat & sum,
+                        const Window & window,
+                        float * scratch,
+                        const float scale) const
+    {
+        for (std::vector<cv::Rect>::const_iterator it = w.rects_begin(); it != w.rects_end(); ++it, ++scratch)
+        {
+            cv::Rect r = *it;
+            r.x *= scale;
+            r.y *= scale;
+            r.height *= scale;
+            r.width  *= scale;
+            *scratch = Normalization::rectangle(singleRectangleValue<integral_type>(r, sum), *it, r, window);
+        }
+    }
+};
+
+
+
+struct IntensityNormalizedWaveletEvaluator : public NormalizedWaveletEvaluator<IntensityNormalization>
+{
+    using NormalizedWaveletEvaluator<IntensityNormalization>::operator();
+
+    /**
+     * Evaluates a compiled bank against the integral image. The response(s) of the i-th wavelet are written to
+     * results[i * bank.outputs()] (and results[i * bank.outputs() + 1] for the negative weights of DUAL_WEIGHT banks),
+     * so results must hold at least bank.size() * bank.outputs() values.
+     */
+    void operator()(const CompiledWaveletBank & bank,
+                    const cv::Mat & sum,
+                    const cv::Mat &, //Not used here
+                    float * results,
+                    const float scale = 1.0) const
+    {
+        switch (integralType(sum))
+        {
+        case cv::DataType<int>::type:
+            evaluate<int>(bank, sum, results, scale);
+            break;
+        case cv::DataType<float>::type:
+            evaluate<float>(bank, sum, results, scale);
+            break;
+        default:
+            evaluate<double>(bank, sum, results, scale);
+            break;
+        }
+    }
+
+    /**
+     * Evaluates a prepared bank in the window of sum whose top-left corner is origin.
+     * See the CompiledWaveletBank overload for the layout of results.
+     */
+    void operator()(const PreparedWaveletBank & prepared,
+                    const cv::Mat & sum,
+                    const cv::Mat &, //Not used here
+                    const cv::Point & origin,
+                    float * results) const
+    {
+        checkIntegral(prepared, sum, origin);
+
+        switch (sum.type())
+        {
+        case cv::DataType<int>::type:
+            evaluate(prepared, sum.ptr<int>(origin.y) + origin.x, results);
+            break;
+        case cv::DataType<float>::type:
+            evaluate(prepared, sum.ptr<float>(origin.y) + origin.x, results);
+            break;
+        default:
+            evaluate(prepared, sum.ptr<double>(origin.y) + origin.x, results);
+            break;
+        }
+    }
+
+    /**
+     * Evaluates a prepared FixedWaveletBank in the window of sum whose top-left corner is origin.
+     * The response of each wavelet is written to results at the position the wavelet had in the collection
+     * the bank was built from.
+     */
+    void operator()(const FixedWaveletBank & bank,
+                    const cv::Mat & sum,
+                    const cv::Mat &, //Not used here
+                    const cv::Point & origin,
+                    float * results) const
+    {
+        checkIntegral(bank.others(), sum, origin);
+
+        switch (sum.type())
+        {
+        case cv::DataType<int>::type:
+            evaluate(bank, sum.ptr<int>(origin.y) + origin.x, results);
+            break;
+        case cv::DataType<float>::type:
+            evaluate(bank, sum.ptr<float>(origin.y) + origin.x, results);
+            break;
+        default:
+            evaluate(bank, sum.ptr<double>(origin.y) + origin.x, results);
+            break;
+        }
+    }
+
+    /**
+     * Evaluates a SharedRectangleBank against the integral image. The value of each distinct rectangle is computed
+     * once into scratch, which holds length values (at least bank.uniqueRectangles()). See the CompiledWaveletBank
+     * overload for the layout of results. No memory is allocated.
+     */
+    void operator()(const SharedRectangleBank & bank,
+                    const cv::Mat & sum,
+                    const cv::Mat &, //Not used here
+                    float * scratch,
+                    const unsigned int length,
+                    float * results,
+                    const float scale = 1.0) const
+    {
+        checkScratch(bank, length);
+
+        switch (integralType(sum))
+        {
+        case cv::DataType<int>::type:
+            evaluate<int>(bank, sum, scratch, results, scale);
+            break;
+        case cv::DataType<float>::type:
+            evaluate<float>(bank, sum, scratch, results, scale);
+            break;
+        default:
+            evaluate<double>(bank, sum, scratch, results, scale);
+            break;
+        }
+    }
+
+    /**
+     * Same as above, in the window of sum whose top-left corner is origin. bank must be prepared.
+     */
+    void operator()(const SharedRectangleBank & bank,
+                    const cv::Mat & sum,
+                    const cv::Mat &, //Not used here
+                    const cv::Point & origin,
+                    float * scratch,
+                    const unsigned int length,
+                    float * results) const
+    {
+        checkScratch(bank, length);
+        checkIntegral(bank.prepared(), sum, origin);
+
+        switch (sum.type())
+        {
+        case cv::DataType<int>::type:
+            evaluate(bank, sum.ptr<int>(origin.y) + origin.x, scratch, results);
+            break;
+        case cv::DataType<float>::type:
+            evaluate(bank, sum.ptr<float>(origin.y) + origin.x, scratch, results);
+            break;
+        default:
+            evaluate(bank, sum.ptr<double>(origin.y) + origin.x, scratch, results);
+            break;
+        }
+    }
+
+    /**
+     * Evaluates a prepared QuantizedWaveletBank in the window of sum whose top-left corner is origin, in fixed point.
+     * sum must hold int elements (throws 31 otherwise). The response of the i-th wavelet is written to results[i]
+     * and differs from the one of the CompiledWaveletBank it was quantized from by at most bank.errorBounds()[i]
+     * (plus the rounding of the floating point results).
+     */
+    void operator()(const QuantizedWaveletBank & bank,
+                    const cv::Mat & sum,
+                    const cv::Mat &, //Not used here
+                    const cv::Point & origin,
+                    float * results) const
+    {
+        checkIntegral(bank.prepared(), sum, origin);
+        if (sum.type() != cv::DataType<int>::type)
+        {
+            throw 31;
+        }
+
+        HAARCOMMON_COUNT_WINDOWS(1, bank.size(), bank.bank().rectangles());
+
+        const int * window = sum.ptr<int>(origin.y) + origin.x;
+        const unsigned int * begin = bank.bank().rectanglesBegin();
+        const RectangleOffsets * offsets = bank.prepared().offsets();
+        const short * coefficients = bank.coefficients();
+
+        for (unsigned int w = 0; w < bank.size(); ++w)
+        {
+            int value = 0;
+            for (unsigned int r = begin[w]; r < begin[w + 1]; ++r)
+            {
+                value += coefficients[r] * rectangleSum(window, offsets[r]);
+            }
+            const double response = (double)bank.scales()[w] * value - bank.constants()[w];
+            results[w] = bank.absolute() ? std::abs(response) : response;
+        }
+    }
+
+    /**
+     * Evaluates a CompactWaveletBank in the window of sum whose top-left corner is origin. Results are the same as
+     * those of a PreparedWaveletBank of the same wavelets, with the same layout.
+     */
+    void operator()(const CompactWaveletBank & bank,
+                    const cv::Mat & sum,
+                    const cv::Mat &, //Not used here
+                    const cv::Point & origin,
+                    float * results) const
+    {
+        integralType(sum);
+        checkWindow(bank, sum, origin);
+
+        const CompactNormalization normalize;
+        HAARCOMMON_COUNT_WINDOWS(1, bank.size(), bank.rectangles());
+        switch (sum.type())
+        {
+        case cv::DataType<int>::type:
+            bank.evaluate(sum.ptr<int>(origin.y) + origin.x, sum.step1(), normalize, results);
+            break;
+        case cv::DataType<float>::type:
+            bank.evaluate(sum.ptr<float>(origin.y) + origin.x, sum.step1(), normalize, results);
+            break;
+        default:
+            bank.evaluate(sum.ptr<double>(origin.y) + origin.x, sum.step1(), normalize, results);
+            break;
+        }
+    }
+
+    /**
+     * Evaluates bank over every patch of batch, the whole patch being the window. Row j of results holds the j-th
+     * response (see the CompiledWaveletBank overload for their order) to each patch, equal to what the
+     * CompiledWaveletBank overload gives for the integral images of that patch. results is (re)allocated as a
+     * (bank.size() * bank.outputs()) x batch.size() CV_32F matrix only if it doesn't have that size and type already.
+     */
+    void operator()(const CompiledWaveletBank & bank, const IntegralBatch & batch, cv::Mat & results) const
+    {
+        checkWindow(bank, batch);
+        evaluateBatch(bank, batch, BatchNormalization(bank), results);
+    }
+
+    /**
+     * Evaluates all heads of w, computing its SRFS only once into scratch, which holds length values (at least
+     * w.dimensions()). The response of the k-th head is written to results[k]. No memory is allocated.
+     */
+    void operator()(const MultiHeadHaarWavelet & w,
+                    const cv::Mat & sum,
+                    const cv::Mat &, //Not used here
+                    float * scratch,
+                    const unsigned int length,
+                    float * results,
+                    const float scale = 1.0) const
+    {
+        srfs(w, sum, scratch, length, scale);
+        heads(w, scratch, results);
+    }
+
+    /**
+     * Same as above, with a scratch buffer of its own.
+     */
+    void operator()(const MultiHeadHaarWavelet & w,
+                    const cv::Mat & sum,
+                    const cv::Mat & squareSum,
+                    float * results,
+                    const float scale = 1.0) const
+    {
+        std::vector<float> scratch(w.dimensions());
+        (*this)(w, sum, squareSum, scratch.empty() ? 0 : &scratch[0], scratch.size(), results, scale);
+    }
+
+    /**
+     * Sets the values of the single rectangle feature space.
+     * If scale > 1, the Haar wavelet streaches right and down.
+     * @param w
+     * @param sum integral image of the original image.
+     * @param srfsVector where the resulting values will be writen to. srfsVector.size() must be equal to w.dimensions().
+     * @param scale how mutch w should be scaled.
+     */
+    template <typename floating_point_type>
+    void srfs(const AbstractHaarWavelet & w, const cv::Mat & sum, std::vector<floating_point_type> &srfsVector, const float scale = 1.0) const
+    {
+        srfs(w, sum, srfsVector.empty() ? 0 : &srfsVector[0], srfsVector.size(), scale);
+    }
+
+    /**
+     * Same as above, writing to srfsVector, which holds length values (at least w.dimensions()).
+     */
+    template <typename floating_point_type>
+    void srfs(const AbstractHaarWavelet & w, const cv::Mat & sum, floating_point_type * srfsVector, const unsigned int length, const float scale = 1.0) const
+    {
+        checkScratch(w, length);
+
+        switch (integralType(sum))
+        {
+        case cv::DataType<int>::type:
+            typedSrfs<int>(w, sum, srfsVector, scale);
+            break;
+        case cv::DataType<float>::type:
+            typedSrfs<float>(w, sum, srfsVector, scale);
+            break;
+        default:
+            typedSrfs<double>(w, sum, srfsVector, scale);
+            break;
+        }
+    }
+
+    /**
+     * Value of a single rectangle of the SRFS, i.e. the sum of its pixels normalized by its area.
+     * @param rect the rectangle, as stored in the wavelet (that is, before scaling).
+     */
+    float normalizedRectangleValue(const cv::Rect & rect, const cv::Mat & sum, const float scale = 1.0) const
+    {
+        switch (integralType(sum))
+        {
+        case cv::DataType<int>::type:
+            return normalizedRectangleValue<int>(rect, sum, scale);
+        case cv::DataType<float>::type:
+            return normalizedRectangleValue<float>(rect, sum, scale);
+        default:
+            return normalizedRectangleValue<double>(rect, sum, scale);
+        }
+    }
+
+    /**
+     * Same as above, for an integral image known to hold integral_type elements.
+     */
+    template <typename integral_type>
+    float normalizedRectangleValue(const cv::Rect & rect, const cv::Mat & sum, const float scale = 1.0) const
+    {
+        cv::Rect r = rect;
+        r.x *= scale;
+        r.y *= scale;
+        r.height *= scale;
+        r.width  *= scale;
+        float value = singleRectangleValue<integral_type>(r, sum);
+
+        //SRFS works with normalized means (Pavani et al., 2010, section 2.3).
+        //AFAIK, Pavani's classifier only normalized things by the maximum numeric value of each pixel.
+        value /= rect.area() * std::numeric_limits<unsigned char>::max(); //TODO it is probably best to use a fixed number
+        return value;
+    }
+
+private:
+
+    /**
+     * SRFS normalization of a rectangle of a bank evaluated over an IntegralBatch.
+     */
+    struct BatchNormalization
+    {
+        explicit BatchNormalization(const CompiledWaveletBank & bank) : normalization(bank.normalization()) {}
+
+        float operator()(const double value, const unsigned int r, const unsigned int) const
+        {
+            return value * normalization[r];
+        }
+
+        const float * normalization;
+    };
+
+    /**
+     * SRFS normalization of a rectangle of a CompactWaveletBank, rounded as CompiledWaveletBank::normalization().
+     */
+    struct CompactNormalization
+    {
+        float operator()(const double value, const int area) const
+        {
+            const float normalization = 1.0f / (area * std::numeric_limits<unsigned char>::max());
+            return value * normalization;
+        }
+    };
+
+    template <typename integral_type, typename floating_point_type>
+    void typedSrfs(const AbstractHaarWavelet & w, const cv::Mat & sum, floating_point_type * srfsVector, const float scale) const
+    {
+        for (std::vector<cv::Rect>::const_iterator it = w.rects_begin(); it != w.rects_end(); ++it, ++srfsVector)
+        {
+            *srfsVector = normalizedRectangleValue<integral_type>(*it, sum, scale);
+        }
+    }
+
+    /**
+     * Normalized values of the rectangles of a CompiledWaveletBank in an integral image, see combine().
+     */
+    template <typename integral_type>
+    struct CompiledValues
+    {
+        CompiledValues(const WaveletEvaluator & evaluator_, const CompiledWaveletBank & bank, const cv::Mat & sum_, const float scale_)
+            : evaluator(evaluator_), corners(bank.corners()), normalization(bank.normalization()), sum(sum_), scale(scale_) {}
+
+        float operator()(const unsigned int r) const
+        {
+            return evaluator.singleRectangleValue<integral_type>(corners[r], sum, scale) * normalization[r];
+        }
+
+        const WaveletEvaluator & evaluator;
+        const RectangleCorners * corners;
+        const float * normalization;
+        const cv::Mat & sum;
+        const float scale;
+    };
+
+    template <typename integral_type>
+    void evaluate(const CompiledWaveletBank & bank, const cv::Mat & sum, float * results, const float scale) const
+    {
+        HAARCOMMON_COUNT_WINDOWS(1, bank.size(), bank.rectangles());
+        combine(bank, CompiledValues<integral_type>(*this, bank, sum, scale), results);
+    }
+
+    /**
+     * Normalized values of the rectangles of a PreparedWaveletBank in a window, see combine().
+     */
+    template <typename integral_type>
+    struct PreparedValues
+    {
+        PreparedValues(const PreparedWaveletBank & prepared, const integral_type * window_)
+            : offsets(prepared.offsets()), normalization(prepared.bank().normalization()), window(window_) {}
+
+        float operator()(const unsigned int r) const
+        {
+            return singleRectangleValue(offsets[r], window) * normalization[r];
+        }
+
+        const RectangleOffsets * offsets;
+        const float * normalization;
+        const integral_type * window;
+    };
+
+    template <typename integral_type>
+    void evaluate(const PreparedWaveletBank & prepared, const integral_type * window, float * results) const
+    {
+        HAARCOMMON_COUNT_WINDOWS(1, prepared.bank().size(), prepared.bank().rectangles());
+        combine(prepared.bank(), PreparedValues<integral_type>(prepared, window), results);
+    }
+
+    template <typename integral_type>
+    void evaluate(const SharedRectangleBank & bank, const cv::Mat & sum, float * scratch, float * results, const float scale) const
+    {
+        HAARCOMMON_COUNT_WINDOWS(1, bank.bank().size(), bank.uniqueRectangles());
+        const RectangleCorners * corners = bank.rectangles().corners();
+        const float * normalization = bank.rectangles().normalization();
+        for (unsigned int u = 0; u < bank.uniqueRectangles(); ++u)
+        {
+            scratch[u] = singleRectangleValue<integral_type>(corners[u], sum, scale) * normalization[u];
+        }
+        product(bank, scratch, results);
+    }
+
+    template <typename integral_type>
+    void evaluate(const SharedRectangleBank & bank, const integral_type * window, float * scratch, float * results) const
+    {
+        HAARCOMMON_COUNT_WINDOWS(1, bank.bank().size(), bank.uniqueRectangles());
+        const RectangleOffsets * offsets = bank.prepared().offsets();
+        const float * normalization = bank.rectangles().normalization();
+        for (unsigned int u = 0; u < bank.uniqueRectangles(); ++u)
+        {
+            scratch[u] = singleRectangleValue(offsets[u], window) * normalization[u];
+        }
+        product(bank, scratch, results);
+    }
+
+    template <typename integral_type>
+    void evaluate(const FixedWaveletBank & bank, const integral_type * window, float * results) const
+    {
+        HAARCOMMON_COUNT_WINDOWS(1, bank.size(), rectangles(bank));
+        evaluate(bank.pairs(), window, results);
+        evaluate(bank.triples(), window, results);
+        evaluate(bank.quadruples(), window, results);
+        if (!bank.otherIndices().empty())
+        {
+            combine(bank.others().bank(), PreparedValues<integral_type>(bank.others(), window), results, &bank.otherIndices()[0]);
+        }
+    }
+
+    template <unsigned int N, typename integral_type>
+    static void evaluate(const std::vector< FixedHaarWavelet<N> > & wavelets, const integral_type * window, float * results)
+    {
+        for (typename std::vector< FixedHaarWavelet<N> >::const_iterator it = wavelets.begin(); it != wavelets.end(); ++it)
+        {
+            results[it->index] = it->intensity(window);
+        }
+    }
+};
+
+
+
+/**
+ * Returns the value of this Haar wavelet when applied to an image in a certain position.
+ * If scale > 1, the Haar wavelet streaches right and down.
+ *
+ * The only normalization mentioned in Pavani et al. is the "intensity normalization" (section 2.3).
+ * Viola and Jones perform a variance normalization that might be more resilient to lightning conditions.
+ * This function implements what Viola and Jones did.
+ *
+ * The square sum only feeds the window statistics, so its type may differ from the type of the sum
+ * (e.g. an int sum with a double square sum, as computed by cv::integral).
+ */
+struct VarianceNormalizedWaveletEvaluator : public NormalizedWaveletEvaluator<VarianceNormalization>
+{
+    using NormalizedWaveletEvaluator<VarianceNormalization>::operator();
+
+    /**
+     * Evaluates a compiled bank against the integral images. The window mean and standard deviation are computed
+     * only once. See IntensityNormalizedWaveletEvaluator for the layout of results.
+     */
+    void operator()(const CompiledWaveletBank & bank,
+                    const cv::Mat & sum,
+                    const cv::Mat & squareSum,
+                    float * results,
+                    const float scale = 1.0) const
+    {
+        double mean, stdDev;
+        windowStatistics(sum, squareSum, mean, stdDev);
+
+        switch (integralType(sum))
+        {
+        case cv::DataType<int>::type:
+            evaluate<int>(bank, sum, mean, stdDev, results, scale);
+            break;
+        case cv::DataType<float>::type:
+            evaluate<float>(bank, sum, mean, stdDev, results, scale);
+            break;
+        default:
+            evaluate<double>(bank, sum, mean, stdDev, results, scale);
+            break;
+        }
+    }
+
+    /**
+     * Evaluates a prepared bank in the window of sum and squareSum whose top-left corner is origin.
+     * The window mean and standard deviation are taken from the prepared window size.
+     * See IntensityNormalizedWaveletEvaluator for the layout of results.
+     */
+    void operator()(const PreparedWaveletBank & prepared,
+                    const cv::Mat & sum,
+                    const cv::Mat & squareSum,
+                    const cv::Point & origin,
+                    float * results) const
+    {
+        checkIntegral(prepared, sum, origin);
+        integralType(squareSum);
+        checkWindow(prepared, squareSum, origin);
+
+        double mean, stdDev;
+        windowStatistics(sum, squareSum, cv::Rect(origin, prepared.windowSize()), mean, stdDev);
+
+        evaluate(prepared, sum, origin, mean, stdDev ? 1.0 / (2.0 * stdDev) : 0.0, results);
+    }
+
+    /**
+     * Same as above, taking the window mean and standard deviation from statistics, which must have been computed
+     * for the window size of prepared, over integral images of the same size as sum. origin must be one of the
+     * windows of statistics.
+     */
+    void operator()(const PreparedWaveletBank & prepared,
+                    const cv::Mat & sum,
+                    const WindowStatisticsMap & statistics,
+                    const cv::Point & origin,
+                    float * results) const
+    {
+        checkIntegral(prepared, sum, origin);
+        checkStatistics(prepared, statistics);
+
+        const cv::Point p = statistics.position(origin);
+        evaluate(prepared, sum, origin, statistics.means().at<double>(p.y, p.x), statistics.factors().at<double>(p.y, p.x), results);
+    }
+
+    /**
+     * Evaluates a prepared FixedWaveletBank in the window of sum and squareSum whose top-left corner is origin.
+     * See IntensityNormalizedWaveletEvaluator for the layout of results.
+     */
+    void operator()(const FixedWaveletBank & bank,
+                    const cv::Mat & sum,
+                    const cv::Mat & squareSum,
+                    const cv::Point & origin,
+                    float * results) const
+    {
+        checkIntegral(bank.others(), sum, origin);
+        integralType(squareSum);
+        checkWindow(bank.others(), squareSum, origin);
+
+        double mean, stdDev;
+        windowStatistics(sum, squareSum, cv::Rect(origin, bank.others().windowSize()), mean, stdDev);
+
+        evaluate(bank, sum, origin, mean, stdDev ? 1.0 / (2.0 * stdDev) : 0.0, results);
+    }
+
+    /**
+     * Same as above, taking the window mean and standard deviation from statistics. See the PreparedWaveletBank overload.
+     */
+    void operator()(const FixedWaveletBank & bank,
+                    const cv::Mat & sum,
+                    const WindowStatisticsMap & statistics,
+                    const cv::Point & origin,
+                    float * results) const
+    {
+        checkIntegral(bank.others(), sum, origin);
+        checkStatistics(bank.others(), statistics);
+
+        const cv::Point p = statistics.position(origin);
+        evaluate(bank, sum, origin, statistics.means().at<double>(p.y, p.x), statistics.factors().at<double>(p.y, p.x), results);
+    }
+
+    /**
+     * Evaluates a CompactWaveletBank in the window of sum and squareSum whose top-left corner is origin. Results are
+     * the same as those of a PreparedWaveletBank of the same wavelets, with the same layout.
+     */
+    void operator()(const CompactWaveletBank & bank,
+                    const cv::Mat & sum,
+                    const cv::Mat & squareSum,
+                    const cv::Point & origin,
+                    float * results) const
+    {
+        integralType(sum);
+        integralType(squareSum);
+        checkWindow(bank, sum, origin);
+        checkWindow(bank, squareSum, origin);
+
+        double mean, stdDev;
+        windowStatistics(sum, squareSum, cv::Rect(origin, bank.windowSize()), mean, stdDev);
+
+        const CompactNormalization normalize(mean, stdDev ? 1.0 / (2.0 * stdDev) : 0.0);
+        HAARCOMMON_COUNT_WINDOWS(1, bank.size(), bank.rectangles());
+        switch (sum.type())
+        {
+        case cv::DataType<int>::type:
+            bank.evaluate(sum.ptr<int>(origin.y) + origin.x, sum.step1(), normalize, results);
+            break;
+        case cv::DataType<float>::type:
+            bank.evaluate(sum.ptr<float>(origin.y) + origin.x, sum.step1(), normalize, results);
+            break;
+        default:
+            bank.evaluate(sum.ptr<double>(origin.y) + origin.x, sum.step1(), normalize, results);
+            break;
+        }
+    }
+
+    /**
+     * Evaluates bank over every patch of batch, each patch being normalized by its own mean and standard deviation.
+     * See IntensityNormalizedWaveletEvaluator for the layout of results.
+     */
+    void operator()(const CompiledWaveletBank & bank, const IntegralBatch & batch, cv::Mat & results) const
+    {
+        checkWindow(bank, batch);
+
+        const cv::Size size = batch.patchSize();
+        const double area = size.area();
+        std::vector<double> means(batch.size()), stdDevs(batch.size());
+        for (unsigned int p = 0; p < batch.size(); ++p)
+        {
+            means[p] = batch.sum(p, size.height, size.width) / area;
+            stdDevs[p] = std::sqrt(std::abs(batch.squareSum(p, size.height, size.width) / area - means[p] * means[p]));
+        }
+
+        evaluateBatch(bank, batch, BatchNormalization(bank, means, stdDevs), results);
+    }
+
+    /**
+     * Checks if statistics were computed for the window size of prepared.
+     */
+    static void checkStatistics(const PreparedWaveletBank & prepared, const WindowStatisticsMap & statistics)
+    {
+        if (statistics.windowSize() != prepared.windowSize())
+        {
+            throw 36;
+        }
+    }
+
+    /**
+     * Evaluates a SharedRectangleBank against the integral images, computing the value of each distinct rectangle
+     * once into scratch, which holds length values (at least bank.uniqueRectangles()).
+     * See IntensityNormalizedWaveletEvaluator for the layout of results. No memory is allocated.
+     */
+    void operator()(const SharedRectangleBank & bank,
+                    const cv::Mat & sum,
+                    const cv::Mat & squareSum,
+                    float * scratch,
+                    const unsigned int length,
+                    float * results,
+                    const float scale = 1.0) const
+    {
+        checkScratch(bank, length);
+
+        double mean, stdDev;
+        windowStatistics(sum, squareSum, mean, stdDev);
+
+        switch (integralType(sum))
+        {
+        case cv::DataType<int>::type:
+            evaluate<int>(bank, sum, mean, stdDev, scratch, results, scale);
+            break;
+        case cv::DataType<float>::type:
+            evaluate<float>(bank, sum, mean, stdDev, scratch, results, scale);
+            break;
+        default:
+            evaluate<double>(bank, sum, mean, stdDev, scratch, results, scale);
+            break;
+        }
+    }
+
+    /**
+     * Same as above, in the window of sum and squareSum whose top-left corner is origin. bank must be prepared.
+     */
+    void operator()(const SharedRectangleBank & bank,
+                    const cv::Mat & sum,
+                    const cv::Mat & squareSum,
+                    const cv::Point & origin,
+                    float * scratch,
+                    const unsigned int length,
+                    float * results) const
+    {
+        checkScratch(bank, length);
+        checkIntegral(bank.prepared(), sum, origin);
+        integralType(squareSum);
+        checkWindow(bank.prepared(), squareSum, origin);
+
+        double mean, stdDev;
+        windowStatistics(sum, squareSum, cv::Rect(origin, bank.prepared().windowSize()), mean, stdDev);
+        const double k = stdDev ? 1.0 / (2.0 * stdDev) : 0.0;
+
+        switch (sum.type())
+        {
+        case cv::DataType<int>::type:
+            evaluate(bank, sum.ptr<int>(origin.y) + origin.x, mean, k, scratch, results);
+            break;
+        case cv::DataType<float>::type:
+            evaluate(bank, sum.ptr<float>(origin.y) + origin.x, mean, k, scratch, results);
+            break;
+        default:
+            evaluate(bank, sum.ptr<double>(origin.y) + origin.x, mean, k, scratch, results);
+            break;
+        }
+    }
+
+    /**
+     * Evaluates all heads of w, computing its SRFS only once into scratch, which holds length values (at least
+     * w.dimensions()). See IntensityNormalizedWaveletEvaluator for the layout of results.
+     */
+    void operator()(const MultiHeadHaarWavelet & w,
+                    const cv::Mat & sum,
+                    const cv::Mat & squareSum,
+                    float * scratch,
+                    const unsigned int length,
+                    float * results,
+                    const float scale = 1.0) const
+    {
+        srfs(w, sum, squareSum, scratch, length, scale);
+        heads(w, scratch, results);
+    }
+
+    /**
+     * Same as above, with a scratch buffer of its own.
+     */
+    void operator()(const MultiHeadHaarWavelet & w,
+                    const cv::Mat & sum,
+                    const cv::Mat & squareSum,
+                    float * results,
+                    const float scale = 1.0) const
+    {
+        std::vector<float> scratch(w.dimensions());
+        (*this)(w, sum, squareSum, scratch.empty() ? 0 : &scratch[0], scratch.size(), results, scale);
+    }
+
+    template <typename floating_point_type>
+    void srfs(const AbstractHaarWavelet & w, const cv::Mat & sum, const cv::Mat & squareSum, std::vector<floating_point_type> &srfsVector, const float scale = 1.0) const
+    {
+        srfs(w, sum, squareSum, srfsVector.empty() ? 0 : &srfsVector[0], srfsVector.size(), scale);
+    }
+
+    /**
+     * Same as above, writing to srfsVector, which holds length values (at least w.dimensions()).
+     */
+    template <typename floating_point_type>
+    void srfs(const AbstractHaarWavelet & w, const cv::Mat & sum, const cv::Mat & squareSum, floating_point_type * srfsVector, const unsigned int length, const float scale = 1.0) const
+    {
+        checkScratch(w, length);
+
+        double mean, stdDev;
+        windowStatistics(sum, squareSum, mean, stdDev);
+
+        switch (integralType(sum))
+        {
+        case cv::DataType<int>::type:
+            typedSrfs<int>(w, sum, mean, stdDev, srfsVector, scale);
+            break;
+        case cv::DataType<float>::type:
+            typedSrfs<float>(w, sum, mean, stdDev, srfsVector, scale);
+            break;
+        default:
+            typedSrfs<double>(w, sum, mean, stdDev, srfsVector, scale);
+            break;
+        }
+    }
+
+    /**
+     * Computes the mean and the standard deviation of the pixels of the whole image that originated
+     * the integral images sum and squareSum.
+     */
+    void windowStatistics(const cv::Mat & sum, const cv::Mat & squareSum, double & mean, double & stdDev) const
+    {
+        HAARCOMMON_COUNT(STATISTICS, 1);
+
+        //Viola and Jones perform a variance normalization. This is better explained in Lienhart, Maydt, 2002, section 2.2.
+        const double area = (sum.cols - 1) * (sum.rows - 1); //area of the original image
+        mean = integralValue(sum, sum.rows - 1, sum.cols - 1) / area; //mean value of all pixels inside the image that originated the integral image
+        stdDev = std::sqrt( std::abs(
+                    (integralValue(squareSum, sum.rows - 1, sum.cols - 1) / area ) - (mean * mean)
+                )); //Viola and Jones' paper show a wrong equation?
+                    //Correct is: STD_DEV = SQRT(E[X^2] - E[X]^2)
+    }
+
+    /**
+     * Same as above, for the pixels inside the window of the original image.
+     */
+    void windowStatistics(const cv::Mat & sum, const cv::Mat & squareSum, const cv::Rect & window, double & mean, double & stdDev) const
+    {
+        HAARCOMMON_COUNT(STATISTICS, 1);
+        const double area = window.area();
+        mean = singleRectangleValue(window, sum) / area;
+        stdDev = std::sqrt( std::abs(singleRectangleValue(window, squareSum) / area - (mean * mean)) );
+    }
+
+    /**
+     * Value of a single rectangle of the SRFS, normalized by the window mean and standard deviation.
+     * @param rect the rectangle, as stored in the wavelet (that is, before scaling).
+     */
+    float normalizedRectangleValue(const cv::Rect & rect, const cv::Mat & sum, const double mean, const double stdDev, const float scale = 1.0) const
+    {
+        switch (integralType(sum))
+        {
+        case cv::DataType<int>::type:
+            return normalizedRectangleValue<int>(rect, sum, mean, stdDev, scale);
+        case cv::DataType<float>::type:
+            return normalizedRectangleValue<float>(rect, sum, mean, stdDev, scale);
+        default:
+            return normalizedRectangleValue<double>(rect, sum, mean, stdDev, scale);
+        }
+    }
+
+    /**
+     * Same as above, for an integral image known to hold integral_type elements.
+     */
+    template <typename integral_type>
+    float normalizedRectangleValue(const cv::Rect & rect, const cv::Mat & sum, const double mean, const double stdDev, const float scale = 1.0) const
+    {
+        //Can't divide by zero. If the subwindow standard deviation is 0, then all rectangles have the same value.
+        //If this happens, then (singleRectangleValue(r, sum) - mean * r.area()) == 0.
+        if (!stdDev)
+        {
+            return .0;
+        }
+
+        cv::Rect r = rect;
+        r.x *= scale;
+        r.y *= scale;
+        r.height *= scale;
+        r.width  *= scale;
+
+        return (singleRectangleValue<integral_type>(r, sum) - (mean * r.area())) / (2.0 * stdDev);
+    }
+
+private:
+
+    /**
+     * Variance normalization of a rectangle of a bank evaluated over an IntegralBatch, with the statistics of each patch.
+     */
+    struct BatchNormalization
+    {
+        BatchNormalization(const CompiledWaveletBank & bank_,
+                           const std::vector<double> & means_,
+                           const std::vector<double> & stdDevs_) : bank(bank_), means(means_), stdDevs(stdDevs_) {}
+
+        float operator()(const double value, const unsigned int r, const unsigned int p) const
+        {
+            if (!stdDevs[p]) //see normalizedRectangleValue()
+            {
+                return .0;
+            }
+            const RectangleCorners & c = bank.corners()[r];
+            const double area = (c.right - c.left) * (c.bottom - c.top);
+            return (value - (means[p] * area)) / (2.0 * stdDevs[p]);
+        }
+
+        const CompiledWaveletBank & bank;
+        const std::vector<double> & means;
+        const std::vector<double> & stdDevs;
+    };
+
+    /**
+     * Variance normalization of a rectangle of a CompactWaveletBank.
+     * k is 1 / (2 * standard deviation of the window), or 0 if the standard deviation is 0.
+     */
+    struct CompactNormalization
+    {
+        CompactNormalization(const double mean, const double k) : mean(mean), k(k) {}
+
+        float operator()(const double value, const int area) const
+        {
+            return (value - mean * area) * k;
+        }
+
+        double mean;
+        double k;
+    };
+
+    /**
+     * Value of the element (row, col) of an integral image of any supported type.
+     */
+    double integralValue(const cv::Mat & s, const int row, const int col) const
+    {
+        switch (integralType(s))
+        {
+        case cv::DataType<int>::type:
+            return s.at<int>(row, col);
+        case cv::DataType<float>::type:
+            return s.at<float>(row, col);
+        default:
+            return s.at<double>(row, col);
+        }
+    }
+
+    template <typename integral_type, typename floating_point_type>
+    void typedSrfs(const AbstractHaarWavelet & w, const cv::Mat & sum, const double mean, const double stdDev, floating_point_type * srfsVector, const float scale) const
+    {
+        for (std::vector<cv::Rect>::const_iterator it = w.rects_begin(); it != w.rects_end(); ++it, ++srfsVector)
+        {
+            *srfsVector = normalizedRectangleValue<integral_type>(*it, sum, mean, stdDev, scale);
+        }
+    }
+
+    /**
+     * Normalized values of the rectangles of a CompiledWaveletBank in an integral image, see combine().
+     */
+    template <typename integral_type>
+    struct CompiledValues
+    {
+        CompiledValues(const WaveletEvaluator & evaluator_, const CompiledWaveletBank & bank, const cv::Mat & sum_,
+                       const double mean_, const double stdDev_, const float scale_)
+            : evaluator(evaluator_), corners(bank.corners()), sum(sum_), mean(mean_), stdDev(stdDev_), scale(scale_) {}
+
+        float operator()(const unsigned int r) const
+        {
+            if (!stdDev) //see normalizedRectangleValue()
+            {
+                return .0;
+            }
+            const double scaledArea = (int)((corners[r].right - corners[r].left) * scale)
+                                    * (int)((corners[r].bottom - corners[r].top) * scale);
+            return (evaluator.singleRectangleValue<integral_type>(corners[r], sum, scale) - (mean * scaledArea)) / (2.0 * stdDev);
+        }
+
+        const WaveletEvaluator & evaluator;
+        const RectangleCorners * corners;
+        const cv::Mat & sum;
+        const double mean;
+        const double stdDev;
+        const float scale;
+    };
+
+    /**
+     * Normalized values of the rectangles of a PreparedWaveletBank in a window, see combine().
+     * k is 1 / (2 * standard deviation of the window), or 0 if the standard deviation is 0.
+     */
+    template <typename integral_type>
+    struct PreparedValues
+    {
+        PreparedValues(const PreparedWaveletBank & prepared, const integral_type * window_, const double mean_, const double k_)
+            : offsets(prepared.offsets()), areas(prepared.areas()), window(window_), mean(mean_), k(k_) {}
+
+        float operator()(const unsigned int r) const
+        {
+            return (singleRectangleValue(offsets[r], window) - (mean * areas[r])) * k;
+        }
+
+        const RectangleOffsets * offsets;
+        const float * areas;
+        const integral_type * window;
+        const double mean;
+        const double k;
+    };
+
+    template <typename integral_type>
+    void evaluate(const CompiledWaveletBank & bank, const cv::Mat & sum, const double mean, const double stdDev, float * results, const float scale) const
+    {
+        HAARCOMMON_COUNT_WINDOWS(1, bank.size(), bank.rectangles());
+        combine(bank, CompiledValues<integral_type>(*this, bank, sum, mean, stdDev, scale), results);
+    }
+
+    /**
+     * Dispatches on the type of sum, whose window at origin was already validated.
+     */
+    template <typename Bank>
+    void evaluate(const Bank & bank, const cv::Mat & sum, const cv::Point & origin, const double mean, const double k, float * results) const
+    {
+        switch (sum.type())
+        {
+        case cv::DataType<int>::type:
+            evaluate(bank, sum.ptr<int>(origin.y) + origin.x, mean, k, results);
+            break;
+        case cv::DataType<float>::type:
+            evaluate(bank, sum.ptr<float>(origin.y) + origin.x, mean, k, results);
+            break;
+        default:
+            evaluate(bank, sum.ptr<double>(origin.y) + origin.x, mean, k, results);
+            break;
+        }
+    }
+
+    /**
+     * @param k 1 / (2 * standard deviation of the window), or 0 if the standard deviation is 0.
+     */
+    template <typename integral_type>
+    void evaluate(const PreparedWaveletBank & prepared, const integral_type * window, const double mean, const double k, float * results) const
+    {
+        HAARCOMMON_COUNT_WINDOWS(1, prepared.bank().size(), prepared.bank().rectangles());
+        combine(prepared.bank(), PreparedValues<integral_type>(prepared, window, mean, k), results);
+    }
+
+    template <typename integral_type>
+    void evaluate(const SharedRectangleBank & bank, const cv::Mat & sum, const double mean, const double stdDev, float * scratch, float * results, const float scale) const
+    {
+        HAARCOMMON_COUNT_WINDOWS(1, bank.bank().size(), bank.uniqueRectangles());
+        const RectangleCorners * corners = bank.rectangles().corners();
+        for (unsigned int u = 0; u < bank.uniqueRectangles(); ++u)
+        {
+            scratch[u] = .0;
+            if (stdDev) //see normalizedRectangleValue()
+            {
+                const double scaledArea = (int)((corners[u].right - corners[u].left) * scale)
+                                        * (int)((corners[u].bottom - corners[u].top) * scale);
+                scratch[u] = (singleRectangleValue<integral_type>(corners[u], sum, scale) - (mean * scaledArea)) / (2.0 * stdDev);
+            }
+        }
+        product(bank, scratch, results);
+    }
+
+    /**
+     * @param k 1 / (2 * standard deviation of the window), or 0 if the standard deviation is 0.
+     */
+    template <typename integral_type>
+    void evaluate(const SharedRectangleBank & bank, const integral_type * window, const double mean, const double k, float * scratch, float * results) const
+    {
+        HAARCOMMON_COUNT_WINDOWS(1, bank.bank().size(), bank.uniqueRectangles());
+        const RectangleOffsets * offsets = bank.prepared().offsets();
+        const float * areas = bank.prepared().areas();
+        for (unsigned int u = 0; u < bank.uniqueRectangles(); ++u)
+        {
+            scratch[u] = (singleRectangleValue(offsets[u], window) - (mean * areas[u])) * k;
+        }
+        product(bank, scratch, results);
+    }
+
+    template <typename integral_type>
+    void evaluate(const FixedWaveletBank & bank, const integral_type * window, const double mean, const double k, float * results) const
+    {
+        HAARCOMMON_COUNT_WINDOWS(1, bank.size(), rectangles(bank));
+        evaluate(bank.pairs(), window, mean, k, results);
+        evaluate(bank.triples(), window, mean, k, results);
+        evaluate(bank.quadruples(), window, mean, k, results);
+        if (!bank.otherIndices().empty())
+        {
+            combine(bank.others().bank(), PreparedValues<integral_type>(bank.others(), window, mean, k), results, &bank.otherIndices()[0]);
+        }
+    }
+
+    template <unsigned int N, typename integral_type>
+    static void evaluate(const std::vector< FixedHaarWavelet<N> > & wavelets, const integral_type * window, const double mean, const double k, float * results)
+    {
+        for (typename std::vector< FixedHaarWavelet<N> >::const_iterator it = wavelets.begin(); it != wavelets.end(); ++it)
         {
-            std::fill(srfsVector.begin(), srfsVector.end(), .0);
+            results[it->index] = it->variance(window, mean, k);
         }
     }
 };
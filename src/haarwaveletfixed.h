@@ -0,0 +1,329 @@
+#ifndef HAARWAVELETFIXED_H
+#define HAARWAVELETFIXED_H
+
+#include <vector>
+#include <cmath>
+#include <limits>
+
+#include <opencv2/core/core.hpp>
+
+#include "haarwavelet.h"
+#include "haarwaveletbank.h"
+
+
+
+/**
+ * @brief The FixedHaarWavelet struct is a Haar wavelet with a number of rectangles known at compile time.
+ *
+ * Its data is stored inline and its evaluation is fully unrolled. HaarWavelets are stored with all means equal
+ * to zero, so both HaarWavelet and MyHaarWavelet are evaluated by the same branch-free code.
+ * Rectangles must be converted to offsets with prepare() before the wavelet is evaluated.
+ */
+template <unsigned int N>
+struct FixedHaarWavelet
+{
+    enum { RECTANGLES = N };
+
+    FixedHaarWavelet() : index(0), absolute(false) {}
+
+    /**
+     * Converts a HaarWavelet with exactly N rectangles. Throws otherwise.
+     * @param index_ the position of w in the collection it came from.
+     */
+    explicit FixedHaarWavelet(const HaarWavelet & w, const unsigned int index_ = 0) : index(index_), absolute(false)
+    {
+        set(w);
+        std::fill(means, means + N, 0.0f);
+    }
+
+    /**
+     * Converts a MyHaarWavelet with exactly N rectangles. Throws otherwise.
+     */
+    explicit FixedHaarWavelet(const MyHaarWavelet & w, const unsigned int index_ = 0) : index(index_), absolute(true)
+    {
+        set(w);
+        std::copy(w.means_begin(), w.means_end(), means);
+    }
+
+    /**
+     * Computes the offsets of the rectangles inside integral images whose step (in elements) is step.
+     */
+    void prepare(const size_t step)
+    {
+        for (unsigned int i = 0; i < N; ++i)
+        {
+            offsets[i].topLeft     = corners[i].top * step + corners[i].left;
+            offsets[i].topRight    = corners[i].top * step + corners[i].right;
+            offsets[i].bottomLeft  = corners[i].bottom * step + corners[i].left;
+            offsets[i].bottomRight = corners[i].bottom * step + corners[i].right;
+        }
+    }
+
+    /**
+     * Intensity normalized value of this wavelet in the window whose top-left corner in the integral image is window.
+     * See IntensityNormalizedWaveletEvaluator.
+     */
+    template <typename integral_type>
+    float intensity(const integral_type * window) const
+    {
+        const double value = Unrolled<N>::intensity(*this, window);
+        return absolute ? std::abs(value) : value;
+    }
+
+    /**
+     * Variance normalized value of this wavelet in the window whose top-left corner in the integral image is window.
+     * @param mean mean of the pixels of the window.
+     * @param k 1 / (2 * standard deviation of the pixels of the window), or 0 if the standard deviation is 0.
+     * See VarianceNormalizedWaveletEvaluator.
+     */
+    template <typename integral_type>
+    float variance(const integral_type * window, const double mean, const double k) const
+    {
+        const double value = Unrolled<N>::variance(*this, window, mean, k);
+        return absolute ? std::abs(value) : value;
+    }
+
+    /**
+     * Position of this wavelet in the collection it came from.
+     */
+    unsigned int index;
+
+    /**
+     * True for MyHaarWavelets, whose value is the absolute value of the weighted sum.
+     */
+    bool absolute;
+
+    RectangleCorners corners[N];
+    RectangleOffsets offsets[N];
+    float weights[N];
+    float means[N];
+    float normalization[N]; //1 / (area * 255)
+    float areas[N];
+
+private:
+
+    template <typename HaarWaveletType>
+    void set(const HaarWaveletType & w)
+    {
+        if (w.dimensions() != N)
+        {
+            throw 35;
+        }
+
+        std::copy(w.weights_begin(), w.weights_end(), weights);
+        unsigned int i = 0;
+        for (std::vector<cv::Rect>::const_iterator it = w.rects_begin(); it != w.rects_end(); ++it, ++i)
+        {
+            corners[i].left   = it->x;
+            corners[i].top    = it->y;
+            corners[i].right  = it->x + it->width;
+            corners[i].bottom = it->y + it->height;
+            normalization[i]  = 1.0f / (it->area() * std::numeric_limits<unsigned char>::max());
+            areas[i] = it->area();
+        }
+        prepare(0);
+    }
+
+    /**
+     * Sums the contributions of the first I rectangles, unrolled at compile time.
+     */
+    template <unsigned int I, typename Dummy = void>
+    struct Unrolled
+    {
+        template <typename integral_type>
+        static double rectangle(const FixedHaarWavelet & w, const integral_type * window)
+        {
+            const RectangleOffsets & o = w.offsets[I - 1];
+            return (double)window[o.topLeft] - window[o.topRight] - window[o.bottomLeft] + window[o.bottomRight];
+        }
+
+        template <typename integral_type>
+        static double intensity(const FixedHaarWavelet & w, const integral_type * window)
+        {
+            return Unrolled<I - 1>::intensity(w, window)
+                    + w.weights[I - 1] * (rectangle(w, window) * w.normalization[I - 1] - w.means[I - 1]);
+        }
+
+        template <typename integral_type>
+        static double variance(const FixedHaarWavelet & w, const integral_type * window, const double mean, const double k)
+        {
+            return Unrolled<I - 1>::variance(w, window, mean, k)
+                    + w.weights[I - 1] * ((rectangle(w, window) - mean * w.areas[I - 1]) * k - w.means[I - 1]);
+        }
+    };
+
+    template <typename Dummy>
+    struct Unrolled<0, Dummy>
+    {
+        template <typename integral_type>
+        static double intensity(const FixedHaarWavelet &, const integral_type *)
+        {
+            return 0.0;
+        }
+
+        template <typename integral_type>
+        static double variance(const FixedHaarWavelet &, const integral_type *, const double, const double)
+        {
+            return 0.0;
+        }
+    };
+};
+
+
+
+/**
+ * @brief The FixedWaveletBank class groups the wavelets of a collection by their amount of rectangles, so that
+ * each group is evaluated by the kernel of its FixedHaarWavelet. Wavelets with other than 2, 3 or 4 rectangles
+ * are kept in a CompiledWaveletBank and evaluated the generic way. The evaluators write the response of each
+ * wavelet at its position in the original collection.
+ *
+ * The bank must be prepared for the step of the integral images before being evaluated.
+ */
+class FixedWaveletBank
+{
+public:
+    FixedWaveletBank() : size_(0), step_(0) {}
+
+    explicit FixedWaveletBank(const std::vector<HaarWavelet> & wavelets) : size_(0), step_(0)
+    {
+        group(wavelets);
+    }
+
+    explicit FixedWaveletBank(const std::vector<MyHaarWavelet> & wavelets) : size_(0), step_(0)
+    {
+        group(wavelets);
+    }
+
+    FixedWaveletBank(const FixedWaveletBank & other)
+    {
+        *this = other;
+    }
+
+    FixedWaveletBank & operator=(const FixedWaveletBank & other)
+    {
+        if (this != &other)
+        {
+            size_ = other.size_;
+            pairs_ = other.pairs_;
+            triples_ = other.triples_;
+            quadruples_ = other.quadruples_;
+            others_ = other.others_;
+            otherIndices_ = other.otherIndices_;
+            step_ = 0;
+            prepared_ = PreparedWaveletBank();
+            if (other.step_)
+            {
+                prepare(other.step_, other.windowSize_);
+            }
+        }
+        return *this;
+    }
+
+    /**
+     * Prepares all wavelets for integral images whose step (in elements) is step.
+     * @param windowSize size of the detection window. Used by the variance normalization.
+     */
+    void prepare(const size_t step, const cv::Size & windowSize)
+    {
+        step_ = step;
+        windowSize_ = windowSize;
+        prepare(pairs_, step);
+        prepare(triples_, step);
+        prepare(quadruples_, step);
+        prepared_ = PreparedWaveletBank(others_, step, windowSize);
+    }
+
+    /**
+     * Total amount of wavelets in this bank.
+     */
+    unsigned int size() const
+    {
+        return size_;
+    }
+
+    const std::vector< FixedHaarWavelet<2> > & pairs() const
+    {
+        return pairs_;
+    }
+
+    const std::vector< FixedHaarWavelet<3> > & triples() const
+    {
+        return triples_;
+    }
+
+    const std::vector< FixedHaarWavelet<4> > & quadruples() const
+    {
+        return quadruples_;
+    }
+
+    /**
+     * The wavelets with other amounts of rectangles, prepared. It also holds the step and window size
+     * the bank was prepared for.
+     */
+    const PreparedWaveletBank & others() const
+    {
+        return prepared_;
+    }
+
+    /**
+     * Position in the original collection of each wavelet of others().
+     */
+    const std::vector<unsigned int> & otherIndices() const
+    {
+        return otherIndices_;
+    }
+
+private:
+
+    template <typename HaarWaveletType>
+    void group(const std::vector<HaarWaveletType> & wavelets)
+    {
+        size_ = wavelets.size();
+
+        std::vector<HaarWaveletType> others;
+        for (unsigned int i = 0; i < wavelets.size(); ++i)
+        {
+            switch (wavelets[i].dimensions())
+            {
+            case 2:
+                pairs_.push_back(FixedHaarWavelet<2>(wavelets[i], i));
+                break;
+            case 3:
+                triples_.push_back(FixedHaarWavelet<3>(wavelets[i], i));
+                break;
+            case 4:
+                quadruples_.push_back(FixedHaarWavelet<4>(wavelets[i], i));
+                break;
+            default:
+                others.push_back(wavelets[i]);
+                otherIndices_.push_back(i);
+                break;
+            }
+        }
+        others_ = CompiledWaveletBank(others);
+    }
+
+    template <unsigned int N>
+    static void prepare(std::vector< FixedHaarWavelet<N> > & wavelets, const size_t step)
+    {
+        for (typename std::vector< FixedHaarWavelet<N> >::iterator it = wavelets.begin(); it != wavelets.end(); ++it)
+        {
+            it->prepare(step);
+        }
+    }
+
+    unsigned int size_;
+    std::vector< FixedHaarWavelet<2> > pairs_;
+    std::vector< FixedHaarWavelet<3> > triples_;
+    std::vector< FixedHaarWavelet<4> > quadruples_;
+    CompiledWaveletBank others_;
+    std::vector<unsigned int> otherIndices_;
+
+    size_t step_;
+    cv::Size windowSize_;
+    PreparedWaveletBank prepared_; //points to others_
+};
+
+
+
+#endif // HAARWAVELETFIXED_H
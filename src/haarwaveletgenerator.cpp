@@ -0,0 +1,185 @@
+#include "haarwaveletgenerator.h"
+
+#include <algorithm>
+
+
+
+WaveletTemplate::WaveletTemplate() : cols(0),
+                                     rows(0),
+                                     minCellSize(1, 1),
+                                     maxCellSize(0, 0),
+                                     positionStep(1),
+                                     sizeStep(1) {}
+
+WaveletTemplate::WaveletTemplate(const int cols_,
+                                 const int rows_,
+                                 const std::vector<float> & weights_,
+                                 const cv::Size & minCellSize_,
+                                 const cv::Size & maxCellSize_,
+                                 const int positionStep_,
+                                 const int sizeStep_) : cols(cols_),
+                                                        rows(rows_),
+                                                        weights(weights_),
+                                                        minCellSize(minCellSize_),
+                                                        maxCellSize(maxCellSize_),
+                                                        positionStep(positionStep_),
+                                                        sizeStep(sizeStep_) {}
+
+std::vector<WaveletTemplate> WaveletTemplate::violaJones()
+{
+    std::vector<WaveletTemplate> templates;
+
+    std::vector<float> edge(2);
+    edge[0] = 1;
+    edge[1] = -1;
+    templates.push_back(WaveletTemplate(2, 1, edge));
+    templates.push_back(WaveletTemplate(1, 2, edge));
+
+    std::vector<float> line(3);
+    line[0] = 1;
+    line[1] = -2;
+    line[2] = 1;
+    templates.push_back(WaveletTemplate(3, 1, line));
+    templates.push_back(WaveletTemplate(1, 3, line));
+
+    std::vector<float> diagonal(4);
+    diagonal[0] = 1;
+    diagonal[1] = -1;
+    diagonal[2] = -1;
+    diagonal[3] = 1;
+    templates.push_back(WaveletTemplate(2, 2, diagonal));
+
+    return templates;
+}
+
+
+
+WaveletGenerator::WaveletGenerator() : size_(0), maxRectangles_(0) {}
+
+WaveletGenerator::WaveletGenerator(const cv::Size & windowSize, const std::vector<WaveletTemplate> & templates)
+    : windowSize_(windowSize),
+      templates_(templates),
+      size_(0),
+      maxRectangles_(0)
+{
+    for (unsigned int t = 0; t < templates_.size(); ++t)
+    {
+        const WaveletTemplate & w = templates_[t];
+        if (w.cols <= 0 || w.rows <= 0 || w.weights.size() != (size_t)(w.cols * w.rows)
+                || w.minCellSize.width <= 0 || w.minCellSize.height <= 0
+                || w.maxCellSize.width < 0 || w.maxCellSize.height < 0
+                || w.positionStep <= 0 || w.sizeStep <= 0)
+        {
+            throw 41;
+        }
+        maxRectangles_ = std::max(maxRectangles_, (unsigned int)w.weights.size());
+
+        const int maxWidth  = w.maxCellSize.width  ? std::min(w.maxCellSize.width,  windowSize.width  / w.cols) : windowSize.width  / w.cols;
+        const int maxHeight = w.maxCellSize.height ? std::min(w.maxCellSize.height, windowSize.height / w.rows) : windowSize.height / w.rows;
+
+        for (int height = w.minCellSize.height; height <= maxHeight; height += w.sizeStep)
+        {
+            for (int width = w.minCellSize.width; width <= maxWidth; width += w.sizeStep)
+            {
+                Block b;
+                b.begin = size_;
+                b.templateIndex = t;
+                b.cellSize = cv::Size(width, height);
+                b.positions = (windowSize.width - width * w.cols) / w.positionStep + 1;
+                blocks_.push_back(b);
+
+                size_ += (size_t)b.positions * ((windowSize.height - height * w.rows) / w.positionStep + 1);
+            }
+        }
+    }
+}
+
+size_t WaveletGenerator::size() const
+{
+    return size_;
+}
+
+cv::Size WaveletGenerator::windowSize() const
+{
+    return windowSize_;
+}
+
+const std::vector<WaveletTemplate> & WaveletGenerator::templates() const
+{
+    return templates_;
+}
+
+unsigned int WaveletGenerator::maxRectangles() const
+{
+    return maxRectangles_;
+}
+
+unsigned int WaveletGenerator::templateIndex(const size_t index) const
+{
+    return block(index).templateIndex;
+}
+
+unsigned int WaveletGenerator::rectangles(const size_t index, cv::Rect * rects, float * weights) const
+{
+    const Block & b = block(index);
+    const WaveletTemplate & w = templates_[b.templateIndex];
+
+    const size_t position = index - b.begin;
+    const int x = (position % b.positions) * w.positionStep;
+    const int y = (position / b.positions) * w.positionStep;
+
+    unsigned int r = 0;
+    for (int row = 0; row < w.rows; ++row)
+    {
+        for (int col = 0; col < w.cols; ++col, ++r)
+        {
+            rects[r] = cv::Rect(x + col * b.cellSize.width, y + row * b.cellSize.height, b.cellSize.width, b.cellSize.height);
+            weights[r] = w.weights[r];
+        }
+    }
+    return r;
+}
+
+HaarWavelet WaveletGenerator::wavelet(const size_t index) const
+{
+    std::vector<cv::Rect> rects(maxRectangles_);
+    std::vector<float> weights(maxRectangles_);
+    const unsigned int count = rectangles(index, &rects[0], &weights[0]);
+    rects.resize(count);
+    weights.resize(count);
+    return HaarWavelet(rects, weights);
+}
+
+void WaveletGenerator::wavelets(const size_t begin, const size_t end, std::vector<HaarWavelet> & wavelets) const
+{
+    wavelets.clear();
+    wavelets.reserve(end > begin ? end - begin : 0);
+    for (size_t i = begin; i < end; ++i)
+    {
+        wavelets.push_back(wavelet(i));
+    }
+}
+
+const WaveletGenerator::Block & WaveletGenerator::block(const size_t index) const
+{
+    if (index >= size_)
+    {
+        throw 41;
+    }
+
+    //the last block starting at or before index
+    size_t low = 0, high = blocks_.size();
+    while (high - low > 1)
+    {
+        const size_t middle = (low + high) / 2;
+        if (index < blocks_[middle].begin)
+        {
+            high = middle;
+        }
+        else
+        {
+            low = middle;
+        }
+    }
+    return blocks_[low];
+}
@@ -0,0 +1,126 @@
+#ifndef HAARWAVELETGENERATOR_H
+#define HAARWAVELETGENERATOR_H
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "haarwavelet.h"
+
+
+
+/**
+ * @brief The WaveletTemplate struct describes a family of Haar wavelets: a grid of cols x rows equal cells, each
+ * cell being a rectangle with its own weight, placed at every position and with every cell size of a detection
+ * window.
+ *
+ * Cell sizes go from minCellSize to maxCellSize (a zero width or height means as large as the window allows) in
+ * increments of sizeStep pixels, and positions go from the top-left corner of the window in increments of
+ * positionStep pixels.
+ */
+struct WaveletTemplate
+{
+    WaveletTemplate();
+
+    /**
+     * @param weights_ weight of each cell, row by row (cols_ * rows_ weights).
+     */
+    WaveletTemplate(const int cols_,
+                    const int rows_,
+                    const std::vector<float> & weights_,
+                    const cv::Size & minCellSize_ = cv::Size(1, 1),
+                    const cv::Size & maxCellSize_ = cv::Size(0, 0),
+                    const int positionStep_ = 1,
+                    const int sizeStep_ = 1);
+
+    /**
+     * The five shapes of Viola and Jones: two-rectangle edges (horizontal and vertical), three-rectangle lines
+     * (horizontal and vertical) and the four-rectangle diagonal, all at every position and size.
+     */
+    static std::vector<WaveletTemplate> violaJones();
+
+    int cols;
+    int rows;
+    std::vector<float> weights;
+    cv::Size minCellSize;
+    cv::Size maxCellSize;
+    int positionStep;
+    int sizeStep;
+};
+
+
+
+/**
+ * @brief The WaveletGenerator class enumerates all the Haar wavelets described by a collection of templates in a
+ * detection window, without storing them. Each wavelet is built on demand from its index, in [0, size()).
+ *
+ * Wavelets are numbered by template (in the order given), then by cell height, cell width, vertical position and
+ * horizontal position. The numbering only depends on the window size and the templates, so a trained classifier
+ * can keep the indices of its wavelets instead of the wavelets themselves. Finding a wavelet takes a binary search
+ * over the distinct cell sizes of the templates, which is all the generator stores.
+ *
+ * Invalid templates and indices throw 41.
+ */
+class WaveletGenerator
+{
+public:
+    WaveletGenerator();
+
+    WaveletGenerator(const cv::Size & windowSize, const std::vector<WaveletTemplate> & templates);
+
+    /**
+     * Amount of wavelets described by the templates.
+     */
+    size_t size() const;
+
+    cv::Size windowSize() const;
+
+    const std::vector<WaveletTemplate> & templates() const;
+
+    /**
+     * Largest amount of rectangles of a wavelet of this generator.
+     */
+    unsigned int maxRectangles() const;
+
+    /**
+     * Index of the template the wavelet index belongs to.
+     */
+    unsigned int templateIndex(const size_t index) const;
+
+    /**
+     * Writes the rectangles and weights of the wavelet index to rects and weights, which must hold at least
+     * maxRectangles() elements. Returns the amount of rectangles written. No memory is allocated.
+     */
+    unsigned int rectangles(const size_t index, cv::Rect * rects, float * weights) const;
+
+    HaarWavelet wavelet(const size_t index) const;
+
+    /**
+     * Builds the wavelets [begin, end) into wavelets, which is cleared first.
+     */
+    void wavelets(const size_t begin, const size_t end, std::vector<HaarWavelet> & wavelets) const;
+
+private:
+    /**
+     * All the wavelets of a template with the same cell size, starting at index begin.
+     */
+    struct Block
+    {
+        size_t begin;
+        unsigned int templateIndex;
+        cv::Size cellSize;
+        int positions; //amount of horizontal positions
+    };
+
+    const Block & block(const size_t index) const;
+
+    cv::Size windowSize_;
+    std::vector<WaveletTemplate> templates_;
+    std::vector<Block> blocks_;
+    size_t size_;
+    unsigned int maxRectangles_;
+};
+
+
+
+#endif // HAARWAVELETGENERATOR_H
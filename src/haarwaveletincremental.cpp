@@ -0,0 +1,302 @@
+#include "haarwaveletincremental.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "haarwaveletinstrumentation.h"
+
+
+
+IncrementalIntegralImage::IncrementalIntegralImage(const int sdepth) : sdepth_(sdepth)
+{
+    if (sdepth != cv::DataType<int>::type && sdepth != cv::DataType<double>::type)
+    {
+        throw 31;
+    }
+}
+
+void IncrementalIntegralImage::reset(const cv::Mat & frame)
+{
+    frame_.release();
+    check(frame);
+
+    frame_ = frame.clone();
+    rebuild();
+    dirty_.assign(1, cv::Rect(0, 0, frame_.cols, frame_.rows));
+}
+
+void IncrementalIntegralImage::update(const cv::Mat & frame, const std::vector<cv::Rect> & dirty)
+{
+    if (frame_.empty())
+    {
+        reset(frame);
+        return;
+    }
+    check(frame);
+
+    std::vector<cv::Rect> rects;
+    const cv::Rect bounds(0, 0, frame_.cols, frame_.rows);
+    double pixels = 0.0;
+    int top = frame_.rows, left = frame_.cols;
+    for (std::vector<cv::Rect>::const_iterator it = dirty.begin(); it != dirty.end(); ++it)
+    {
+        const cv::Rect r = *it & bounds;
+        if (r.area() > 0)
+        {
+            rects.push_back(r);
+            pixels += r.area();
+            top = std::min(top, r.y);
+            left = std::min(left, r.x);
+        }
+    }
+
+    dirty_ = rects;
+
+    //Reading the dirty pixels and propagating their deltas below and to the right of (top, left) costs more than
+    //rebuilding the integral images, as reset() does. Only the dirty pixels are taken from frame.
+    if (pixels + (double)(frame_.rows - top) * (frame_.cols - left) > (double)frame_.rows * frame_.cols)
+    {
+        for (std::vector<cv::Rect>::const_iterator r = dirty_.begin(); r != dirty_.end(); ++r)
+        {
+            cv::Mat target = frame_(*r);
+            frame(*r).copyTo(target);
+        }
+        rebuild();
+    }
+    else if (!dirty_.empty())
+    {
+        HAARCOMMON_TIME(INTEGRAL_CYCLES);
+        apply(frame, top, left);
+    }
+}
+
+void IncrementalIntegralImage::update(const cv::Mat & frame, const int threshold, const int tileSize)
+{
+    if (tileSize < 1)
+    {
+        throw 46;
+    }
+    if (frame_.empty())
+    {
+        reset(frame);
+        return;
+    }
+    check(frame);
+    HAARCOMMON_TIME(INTEGRAL_CYCLES);
+
+    //Dirty tiles are merged into runs along each row of tiles, and runs into the run right above them
+    //if they span the same columns.
+    std::vector<cv::Rect> dirty;
+    for (int ty = 0; ty < frame.rows; ty += tileSize)
+    {
+        const int height = std::min(tileSize, frame.rows - ty);
+        for (int tx = 0; tx < frame.cols; tx += tileSize)
+        {
+            const int width = std::min(tileSize, frame.cols - tx);
+
+            bool changed = false;
+            for (int y = ty; y < ty + height && !changed; ++y)
+            {
+                const unsigned char * a = frame.ptr<unsigned char>(y) + tx;
+                const unsigned char * b = frame_.ptr<unsigned char>(y) + tx;
+                for (int x = 0; x < width; ++x)
+                {
+                    if (std::abs(a[x] - b[x]) > threshold)
+                    {
+                        changed = true;
+                        break;
+                    }
+                }
+            }
+            if (!changed)
+            {
+                continue;
+            }
+
+            if (!dirty.empty() && dirty.back().y == ty && dirty.back().x + dirty.back().width == tx)
+            {
+                dirty.back().width += width;
+            }
+            else
+            {
+                dirty.push_back(cv::Rect(tx, ty, width, height));
+            }
+        }
+
+        //merge the runs of this row of tiles into those of the previous row
+        for (std::vector<cv::Rect>::iterator run = dirty.begin(); run != dirty.end(); )
+        {
+            std::vector<cv::Rect>::iterator above = dirty.begin();
+            if (run->y == ty)
+            {
+                for (; above != dirty.end(); ++above)
+                {
+                    if (above->y + above->height == ty && above->x == run->x && above->width == run->width)
+                    {
+                        break;
+                    }
+                }
+            }
+            else
+            {
+                above = dirty.end();
+            }
+
+            if (above != dirty.end())
+            {
+                above->height += run->height;
+                run = dirty.erase(run);
+            }
+            else
+            {
+                ++run;
+            }
+        }
+    }
+
+    update(frame, dirty);
+}
+
+const cv::Mat & IncrementalIntegralImage::sum() const
+{
+    return sum_;
+}
+
+const cv::Mat & IncrementalIntegralImage::squareSum() const
+{
+    return squareSum_;
+}
+
+const cv::Mat & IncrementalIntegralImage::frame() const
+{
+    return frame_;
+}
+
+const std::vector<cv::Rect> & IncrementalIntegralImage::dirty() const
+{
+    return dirty_;
+}
+
+void IncrementalIntegralImage::dirtyWindows(const cv::Size & windowSize, const int stride, std::vector<cv::Rect> & regions) const
+{
+    if (stride < 1)
+    {
+        throw 46;
+    }
+    regions.clear();
+    if (frame_.cols < windowSize.width || frame_.rows < windowSize.height)
+    {
+        return;
+    }
+    const int width  = (frame_.cols - windowSize.width) / stride + 1;
+    const int height = (frame_.rows - windowSize.height) / stride + 1;
+
+    for (std::vector<cv::Rect>::const_iterator r = dirty_.begin(); r != dirty_.end(); ++r)
+    {
+        //windows whose top-left corner lies in [r->x - windowSize.width + 1, r->x + r->width - 1] overlap r
+        const int left   = (std::max(r->x - windowSize.width + 1, 0) + stride - 1) / stride;
+        const int top    = (std::max(r->y - windowSize.height + 1, 0) + stride - 1) / stride;
+        const int right  = std::min((r->x + r->width - 1) / stride, width - 1);
+        const int bottom = std::min((r->y + r->height - 1) / stride, height - 1);
+        if (left <= right && top <= bottom)
+        {
+            regions.push_back(cv::Rect(left, top, right - left + 1, bottom - top + 1));
+        }
+    }
+}
+
+void IncrementalIntegralImage::rebuild()
+{
+    HAARCOMMON_TIME(INTEGRAL_CYCLES);
+    cv::integral(frame_, sum_, squareSum_, sdepth_);
+}
+
+void IncrementalIntegralImage::check(const cv::Mat & frame) const
+{
+    if (frame.type() != cv::DataType<unsigned char>::type
+            || (!frame_.empty() && (frame.rows != frame_.rows || frame.cols != frame_.cols)))
+    {
+        throw 39;
+    }
+}
+
+/**
+ * All dirty rectangles are applied in a single pass over the rows of the integral images, from the first dirty row
+ * down. columnDelta_[j] accumulates the change of the pixels of column j - 1 in the rows above, and delta_[j] the
+ * change of the element of the integral images at column j of the current row, i.e. the sum of columnDelta_ up to
+ * j. delta_ only changes on rows with dirty pixels: all rows below the last of them change by the same amounts.
+ */
+void IncrementalIntegralImage::apply(const cv::Mat & frame, const int top, const int left)
+{
+    columnDelta_.assign(frame_.cols + 1, 0.0);
+    squareColumnDelta_.assign(frame_.cols + 1, 0.0);
+    delta_.assign(frame_.cols + 1, 0.0);
+    squareDelta_.assign(frame_.cols + 1, 0.0);
+
+    bool changed = false;
+    for (int y = top; y < frame_.rows; ++y)
+    {
+        bool dirtyRow = false;
+        for (std::vector<cv::Rect>::const_iterator r = dirty_.begin(); r != dirty_.end(); ++r)
+        {
+            if (y < r->y || y >= r->y + r->height)
+            {
+                continue;
+            }
+            dirtyRow = true;
+
+            //pixels are copied to frame_ right away, so that the overlap of rectangles is only counted once
+            const unsigned char * current = frame.ptr<unsigned char>(y);
+            unsigned char * previous = frame_.ptr<unsigned char>(y);
+            for (int x = r->x; x < r->x + r->width; ++x)
+            {
+                const double a = current[x], b = previous[x];
+                columnDelta_[x + 1] += a - b;
+                squareColumnDelta_[x + 1] += a * a - b * b;
+                previous[x] = current[x];
+            }
+        }
+
+        if (dirtyRow)
+        {
+            double run = 0.0, squareRun = 0.0;
+            changed = false;
+            for (int j = left + 1; j <= frame_.cols; ++j)
+            {
+                run += columnDelta_[j];
+                squareRun += squareColumnDelta_[j];
+                delta_[j] = run;
+                squareDelta_[j] = squareRun;
+                changed = changed || run != 0.0 || squareRun != 0.0;
+            }
+        }
+
+        if (!changed)
+        {
+            continue;
+        }
+        if (sdepth_ == cv::DataType<int>::type)
+        {
+            propagate<int>(y + 1, left);
+        }
+        else
+        {
+            propagate<double>(y + 1, left);
+        }
+    }
+}
+
+template <typename sum_type>
+void IncrementalIntegralImage::propagate(const int row, const int left)
+{
+    sum_type * s = sum_.ptr<sum_type>(row);
+    double * q = squareSum_.ptr<double>(row);
+
+    for (int j = left + 1; j < sum_.cols; ++j)
+    {
+        s[j] += (sum_type) delta_[j];
+        q[j] += squareDelta_[j];
+    }
+}
@@ -0,0 +1,141 @@
+#ifndef HAARWAVELETINCREMENTAL_H
+#define HAARWAVELETINCREMENTAL_H
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "haarwaveletbank.h"
+#include "haarwaveletscanner.h"
+
+
+
+/**
+ * @brief The IncrementalIntegralImage class keeps the integral images (sum and square sum) of the frames of a
+ * video, updating them only where the frames change.
+ *
+ * A pixel only contributes to the elements of the integral images below and to the right of it, and all rows past
+ * the last changed one change by the same amounts. So an update costs one pass over the changed pixels and a single
+ * addition per element of the integral images below and to the right of the topmost and leftmost changed pixels,
+ * however many rectangles changed, instead of rebuilding the whole images. When that would cost more than a
+ * rebuild, the integral images are rebuilt as reset() does, still taking in only the pixels of the dirty rectangles.
+ *
+ * The integral images always match frame(), the last known state of the video. Each update records the rectangles
+ * that changed, so the windows whose responses must be recomputed can be found with dirtyWindows(). Responses of
+ * all other windows remain valid (see updateResponseMaps()).
+ *
+ * Frames must be single channel 8 bit images, all of the same size (throws 39 otherwise).
+ */
+class IncrementalIntegralImage
+{
+public:
+    /**
+     * @param sdepth type of the elements of sum(): int or double (throws 31 otherwise). Square sums are double.
+     */
+    explicit IncrementalIntegralImage(const int sdepth = cv::DataType<double>::type);
+
+    /**
+     * Rebuilds the integral images from frame. The whole frame is dirty.
+     */
+    void reset(const cv::Mat & frame);
+
+    /**
+     * Updates the integral images with the pixels of frame inside the dirty rectangles. Pixels outside of them
+     * are assumed not to have changed. The first frame resets the integral images.
+     */
+    void update(const cv::Mat & frame, const std::vector<cv::Rect> & dirty);
+
+    /**
+     * Same as above, finding the dirty rectangles by comparing frame to frame(), in tiles of tileSize x tileSize
+     * pixels. A tile is dirty if any of its pixels differs by more than threshold, so changes up to threshold
+     * are only taken in when other pixels of the tile change. Throws 46 if tileSize < 1.
+     */
+    void update(const cv::Mat & frame, const int threshold = 0, const int tileSize = 16);
+
+    const cv::Mat & sum() const;
+    const cv::Mat & squareSum() const;
+
+    /**
+     * The frame the integral images were computed from.
+     */
+    const cv::Mat & frame() const;
+
+    /**
+     * The rectangles of frame() that changed in the last update.
+     */
+    const std::vector<cv::Rect> & dirty() const;
+
+    /**
+     * Finds the windows that overlap the rectangles of the last update, as rectangles of elements of response
+     * maps: element (y, x) of a map belongs to the window whose top-left corner is (x * stride, y * stride).
+     * Regions may overlap each other. Throws 46 if stride < 1.
+     * @param windowSize size of the window (already scaled).
+     */
+    void dirtyWindows(const cv::Size & windowSize, const int stride, std::vector<cv::Rect> & regions) const;
+
+private:
+    /**
+     * Recomputes the integral images from frame_.
+     */
+    void rebuild();
+    void check(const cv::Mat & frame) const;
+    void apply(const cv::Mat & frame, const int top, const int left);
+
+    template <typename sum_type>
+    void propagate(const int row, const int left);
+
+    int sdepth_;
+    cv::Mat frame_;
+    cv::Mat sum_, squareSum_;
+    std::vector<cv::Rect> dirty_;
+    std::vector<double> columnDelta_, squareColumnDelta_;
+    std::vector<double> delta_, squareDelta_;
+};
+
+
+
+/**
+ * Brings the response maps of a previous scan of integral up to date after an update, recomputing only the windows
+ * given by integral.dirtyWindows(). If maps don't have the layout produced by responseMaps() for these arguments
+ * (e.g. on the first frame), the whole image is scanned.
+ */
+template <typename Evaluator>
+void updateResponseMaps(const Evaluator & evaluator,
+                        const PreparedWaveletBank & prepared,
+                        const IncrementalIntegralImage & integral,
+                        const int stride,
+                        std::vector<cv::Mat> & maps)
+{
+    const cv::Mat & sum = integral.sum();
+    const cv::Mat & squareSum = integral.squareSum();
+    const cv::Size size = scanner::responseMapSize(prepared, sum, stride);
+    const cv::Size window = prepared.windowSize();
+
+    if (maps.size() != prepared.bank().size() * prepared.bank().outputs() || maps.empty() || maps[0].size() != size)
+    {
+        responseMaps(evaluator, prepared, sum, squareSum, stride, maps);
+        return;
+    }
+
+    std::vector<cv::Rect> regions;
+    integral.dirtyWindows(window, stride, regions);
+
+    std::vector<cv::Mat> part;
+    for (std::vector<cv::Rect>::const_iterator r = regions.begin(); r != regions.end(); ++r)
+    {
+        const cv::Rect area(r->x * stride,
+                            r->y * stride,
+                            (r->width - 1) * stride + window.width + 1,
+                            (r->height - 1) * stride + window.height + 1);
+        responseMaps(evaluator, prepared, sum(area), squareSum(area), stride, part);
+        for (unsigned int m = 0; m < maps.size(); ++m)
+        {
+            cv::Mat target = maps[m](*r);
+            part[m].copyTo(target);
+        }
+    }
+}
+
+
+
+#endif // HAARWAVELETINCREMENTAL_H
@@ -0,0 +1,176 @@
+#include "haarwaveletinstrumentation.h"
+
+#include <algorithm>
+#include <vector>
+
+#if defined(HAARCOMMON_INSTRUMENTATION)
+#include <new>
+#include <pthread.h>
+#include <stdlib.h>
+#endif
+
+
+
+namespace instrumentation
+{
+
+Snapshot::Snapshot()
+{
+    std::fill(counters, counters + COUNTERS, 0ULL);
+    std::fill(cycles, cycles + TIMERS, 0ULL);
+    std::fill(calls, calls + TIMERS, 0ULL);
+}
+
+const char * name(const Counter counter)
+{
+    static const char * const names[] = {"windows", "wavelets", "rectangles", "statistics", "allocations",
+                                         "bytes_parsed", "wavelets_parsed"};
+    return counter < COUNTERS ? names[counter] : "";
+}
+
+const char * name(const Timer timer)
+{
+    static const char * const names[] = {"integral", "statistics", "evaluation", "parsing"};
+    return timer < TIMERS ? names[timer] : "";
+}
+
+#if defined(HAARCOMMON_INSTRUMENTATION)
+
+__thread Block * current = 0;
+
+namespace
+{
+
+pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_once_t once = PTHREAD_ONCE_INIT;
+pthread_key_t key;
+
+std::vector<Block *> blocks; //of the running threads
+Snapshot retired;            //counts of the threads that finished
+Snapshot origin;             //totals at the last reset()
+
+/**
+ * Reads a count that another thread may be writing to.
+ */
+unsigned long long read(const unsigned long long & value)
+{
+    return *static_cast<const volatile unsigned long long *>(&value);
+}
+
+void add(Snapshot & s, const Block & b)
+{
+    for (int i = 0; i < COUNTERS; ++i)
+    {
+        s.counters[i] += read(b.counters[i]);
+    }
+    for (int i = 0; i < TIMERS; ++i)
+    {
+        s.cycles[i] += read(b.cycles[i]);
+        s.calls[i] += read(b.calls[i]);
+    }
+}
+
+/**
+ * Called when a thread that counted something finishes: keeps its counts and frees its block.
+ */
+void detach(void * data)
+{
+    Block * b = static_cast<Block *>(data);
+
+    pthread_mutex_lock(&mutex);
+    add(retired, *b);
+    blocks.erase(std::remove(blocks.begin(), blocks.end(), b), blocks.end());
+    pthread_mutex_unlock(&mutex);
+
+    free(b);
+}
+
+void createKey()
+{
+    pthread_key_create(&key, detach);
+}
+
+/**
+ * Totals of all threads since the library was loaded. The mutex must be held.
+ */
+Snapshot totals()
+{
+    Snapshot s = retired;
+    for (std::vector<Block *>::const_iterator it = blocks.begin(); it != blocks.end(); ++it)
+    {
+        add(s, **it);
+    }
+    return s;
+}
+
+}
+
+Block * attach()
+{
+    pthread_once(&once, createKey);
+
+    //Blocks start at a cache line of their own, so that threads don't share the lines they write to
+    void * memory = 0;
+    if (posix_memalign(&memory, 64, (sizeof(Block) + 63) / 64 * 64))
+    {
+        throw std::bad_alloc();
+    }
+    Block * b = new (memory) Block();
+
+    pthread_mutex_lock(&mutex);
+    blocks.push_back(b);
+    pthread_mutex_unlock(&mutex);
+
+    pthread_setspecific(key, b);
+    current = b;
+    return b;
+}
+
+bool enabled()
+{
+    return true;
+}
+
+Snapshot snapshot()
+{
+    pthread_mutex_lock(&mutex);
+    Snapshot s = totals();
+    const Snapshot o = origin;
+    pthread_mutex_unlock(&mutex);
+
+    for (int i = 0; i < COUNTERS; ++i)
+    {
+        s.counters[i] -= o.counters[i];
+    }
+    for (int i = 0; i < TIMERS; ++i)
+    {
+        s.cycles[i] -= o.cycles[i];
+        s.calls[i] -= o.calls[i];
+    }
+    return s;
+}
+
+void reset()
+{
+    pthread_mutex_lock(&mutex);
+    origin = totals();
+    pthread_mutex_unlock(&mutex);
+}
+
+#else
+
+bool enabled()
+{
+    return false;
+}
+
+Snapshot snapshot()
+{
+    return Snapshot();
+}
+
+void reset() {}
+
+#endif
+
+}
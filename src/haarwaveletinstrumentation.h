@@ -0,0 +1,172 @@
+#ifndef HAARWAVELETINSTRUMENTATION_H
+#define HAARWAVELETINSTRUMENTATION_H
+
+#if defined(HAARCOMMON_INSTRUMENTATION)
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#else
+#include <opencv2/core/core.hpp>
+#endif
+#endif
+
+
+
+/**
+ * Counters and cycle timers of the hot paths, compiled in only when HAARCOMMON_INSTRUMENTATION is defined (see the
+ * HAARCOMMON_INSTRUMENTATION CMake option). It must be defined, or not, for both the library and the code including
+ * its headers.
+ *
+ * Each thread counts into its own block, without locks or atomic operations. snapshot() adds up the blocks of all
+ * threads (plus those of threads that already finished) and reset() starts counting from the current totals again,
+ * so neither of them ever writes to the block of another thread. Counts read while other threads are evaluating
+ * may miss their latest increments.
+ *
+ * The hot paths are counted once per call (per window, per frame or per file), never per rectangle or per wavelet,
+ * and timed only around work done once per frame, per batch or per file, so that instrumentation stays cheap
+ * enough to be left on. Evaluations of single wavelets are not counted, except for the window statistics of the
+ * variance normalization.
+ *
+ * When HAARCOMMON_INSTRUMENTATION is not defined, the macros below expand to nothing (their arguments are not
+ * evaluated), enabled() is false and snapshots are all zeros.
+ */
+namespace instrumentation
+{
+
+enum Counter
+{
+    WINDOWS,         //windows evaluated by a bank
+    WAVELETS,        //wavelets evaluated by a bank, over all windows
+    RECTANGLES,      //rectangle sums looked up in integral images
+    STATISTICS,      //window means and standard deviations computed
+    ALLOCATIONS,     //buffers allocated by AlignedBuffer
+    BYTES_PARSED,    //bytes of wavelet files read by the loaders
+    WAVELETS_PARSED, //wavelets read by the loaders
+    COUNTERS
+};
+
+enum Timer
+{
+    INTEGRAL_CYCLES,   //computing integral images
+    STATISTICS_CYCLES, //computing the statistics of all windows of a frame
+    EVALUATION_CYCLES, //evaluating a bank over a whole frame or batch
+    PARSING_CYCLES,    //loading wavelet files
+    TIMERS
+};
+
+/**
+ * Totals of all threads. Cycles are time stamp counter ticks (cv::getTickCount() ticks on platforms without one).
+ */
+struct Snapshot
+{
+    Snapshot();
+
+    unsigned long long counters[COUNTERS];
+    unsigned long long cycles[TIMERS];
+    unsigned long long calls[TIMERS];
+};
+
+const char * name(const Counter counter);
+const char * name(const Timer timer);
+
+/**
+ * True if the library was built with HAARCOMMON_INSTRUMENTATION.
+ */
+bool enabled();
+
+Snapshot snapshot();
+
+/**
+ * Makes the counts of the following snapshots start from zero.
+ */
+void reset();
+
+#if defined(HAARCOMMON_INSTRUMENTATION)
+
+/**
+ * The counts of one thread.
+ */
+struct Block
+{
+    unsigned long long counters[COUNTERS];
+    unsigned long long cycles[TIMERS];
+    unsigned long long calls[TIMERS];
+};
+
+extern __thread Block * current;
+
+/**
+ * Creates and registers the block of the calling thread.
+ */
+Block * attach();
+
+inline Block & block()
+{
+    Block * b = current;
+    return b ? *b : *attach();
+}
+
+inline unsigned long long cycles()
+{
+#if defined(__i386__) || defined(__x86_64__)
+    return __rdtsc();
+#else
+    return cv::getTickCount();
+#endif
+}
+
+inline void add(const Counter counter, const unsigned long long amount)
+{
+    block().counters[counter] += amount;
+}
+
+/**
+ * Counts windows evaluated by a bank of the given amounts of wavelets and rectangles.
+ */
+inline void addWindows(const unsigned long long windows, const unsigned long long wavelets, const unsigned long long rectangles)
+{
+    Block & b = block();
+    b.counters[WINDOWS] += windows;
+    b.counters[WAVELETS] += windows * wavelets;
+    b.counters[RECTANGLES] += windows * rectangles;
+}
+
+/**
+ * Adds the cycles from its construction to its destruction to a timer.
+ */
+class ScopedTimer
+{
+public:
+    explicit ScopedTimer(const Timer timer_) : timer(timer_), begin(cycles()) {}
+
+    ~ScopedTimer()
+    {
+        Block & b = block();
+        b.cycles[timer] += cycles() - begin;
+        ++b.calls[timer];
+    }
+
+private:
+    ScopedTimer(const ScopedTimer &);
+    ScopedTimer & operator=(const ScopedTimer &);
+
+    const Timer timer;
+    const unsigned long long begin;
+};
+
+#define HAARCOMMON_COUNT(counter, amount) ::instrumentation::add(::instrumentation::counter, (amount))
+#define HAARCOMMON_COUNT_WINDOWS(windows, wavelets, rectangles) ::instrumentation::addWindows((windows), (wavelets), (rectangles))
+#define HAARCOMMON_TIME(timer) ::instrumentation::ScopedTimer haarcommonTimer(::instrumentation::timer)
+
+#else
+
+#define HAARCOMMON_COUNT(counter, amount) ((void)0)
+#define HAARCOMMON_COUNT_WINDOWS(windows, wavelets, rectangles) ((void)0)
+#define HAARCOMMON_TIME(timer) ((void)0)
+
+#endif
+
+}
+
+
+
+#endif // HAARWAVELETINSTRUMENTATION_H
@@ -0,0 +1,712 @@
+#ifndef HAARWAVELETPIPELINE_H
+#define HAARWAVELETPIPELINE_H
+
+#include <vector>
+#include <algorithm>
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "haarwaveletbank.h"
+#include "haarwaveletevaluators.h"
+#include "haarwaveletinstrumentation.h"
+#include "haarwaveletscanner.h"
+#include "haarwaveletstatistics.h"
+
+
+
+/**
+ * @brief The SpscQueue class is a bounded, lock-free queue with a single producer thread and a single consumer
+ * thread. Its capacity is rounded up to a power of two.
+ */
+template <typename T>
+class SpscQueue
+{
+public:
+    explicit SpscQueue(const size_t capacity = 1) : head_(0), tail_(0)
+    {
+        size_t size = 1;
+        while (size < capacity)
+        {
+            size *= 2;
+        }
+        buffer_.resize(size);
+        mask_ = size - 1;
+    }
+
+    size_t capacity() const
+    {
+        return buffer_.size();
+    }
+
+    /**
+     * Appends value, unless the queue is full. Called only by the producer.
+     */
+    bool push(const T & value)
+    {
+        const size_t tail = __atomic_load_n(&tail_, __ATOMIC_RELAXED);
+        if (tail - __atomic_load_n(&head_, __ATOMIC_ACQUIRE) == buffer_.size())
+        {
+            return false;
+        }
+        buffer_[tail & mask_] = value;
+        __atomic_store_n(&tail_, tail + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    /**
+     * Removes the oldest value into value, unless the queue is empty. Called only by the consumer.
+     */
+    bool pop(T & value)
+    {
+        const size_t head = __atomic_load_n(&head_, __ATOMIC_RELAXED);
+        if (head == __atomic_load_n(&tail_, __ATOMIC_ACQUIRE))
+        {
+            return false;
+        }
+        value = buffer_[head & mask_];
+        __atomic_store_n(&head_, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+private:
+    SpscQueue(const SpscQueue &);
+    SpscQueue & operator=(const SpscQueue &);
+
+    std::vector<T> buffer_;
+    size_t mask_;
+    char padding0_[64];
+    size_t head_; //written by the consumer
+    char padding1_[64];
+    size_t tail_; //written by the producer
+    char padding2_[64];
+};
+
+
+
+/**
+ * @brief The BlockingQueue class is an SpscQueue whose consumer can wait for values without busy waiting: a
+ * semaphore counts the values pushed, and pop() spins on it briefly before sleeping, as values usually arrive soon
+ * in a busy pipeline. Throws 45 if the semaphore can't be created.
+ */
+template <typename T>
+class BlockingQueue
+{
+public:
+    explicit BlockingQueue(const size_t capacity = 1) : queue_(capacity)
+    {
+        if (sem_init(&available_, 0, 0))
+        {
+            throw 45;
+        }
+    }
+
+    ~BlockingQueue()
+    {
+        sem_destroy(&available_);
+    }
+
+    /**
+     * Appends value, unless the queue is full. Called only by the producer.
+     */
+    bool push(const T & value)
+    {
+        if (!queue_.push(value))
+        {
+            return false;
+        }
+        sem_post(&available_);
+        return true;
+    }
+
+    /**
+     * Waits for a value and removes it into value. Returns false if woken by wake() instead. Called only by the
+     * consumer.
+     */
+    bool pop(T & value)
+    {
+        int spins = 0;
+        while (sem_trywait(&available_))
+        {
+            if (++spins == SPINS)
+            {
+                while (sem_wait(&available_) && errno == EINTR)
+                {
+                }
+                break;
+            }
+        }
+        return queue_.pop(value);
+    }
+
+    /**
+     * Same as above, but returns false instead of waiting if the queue is empty.
+     */
+    bool tryPop(T & value)
+    {
+        return !sem_trywait(&available_) && queue_.pop(value);
+    }
+
+    /**
+     * Makes the consumer waiting in pop(), or the next one to call it, return false.
+     */
+    void wake()
+    {
+        sem_post(&available_);
+    }
+
+private:
+    BlockingQueue(const BlockingQueue &);
+    BlockingQueue & operator=(const BlockingQueue &);
+
+    enum { SPINS = 1000 };
+
+    SpscQueue<T> queue_;
+    sem_t available_;
+};
+
+
+
+/**
+ * Time, in milliseconds, a frame spent in each stage of a FramePipeline: waiting for the integral stage, computing
+ * its integral images, waiting for an evaluation worker, being evaluated and waiting to be delivered.
+ */
+struct PipelineLatency
+{
+    PipelineLatency() : queued(0), integral(0), dispatched(0), evaluation(0), delivery(0), total(0) {}
+
+    double queued;
+    double integral;
+    double dispatched;
+    double evaluation;
+    double delivery;
+    double total;
+};
+
+/**
+ * Latencies of the frames delivered by a FramePipeline so far.
+ */
+struct PipelineStatistics
+{
+    PipelineStatistics() : frames(0) {}
+
+    unsigned long frames;
+    PipelineLatency mean;
+    PipelineLatency max;
+    PipelineLatency last;
+};
+
+/**
+ * A frame going through a FramePipeline, and all buffers used to process it. Frames are recycled: their buffers are
+ * reused by later frames once released.
+ */
+struct PipelineFrame
+{
+    PipelineFrame() : index(0), error(0), ingested(0), integralStart(0), integralEnd(0), evaluationStart(0), evaluationEnd(0) {}
+
+    /**
+     * Position of the frame in the video, counted from 0.
+     */
+    unsigned long index;
+
+    /**
+     * 0, or the code thrown while computing the integral images or the response maps of the frame (-1 for anything
+     * thrown that is not a code), in which case its maps are not valid.
+     */
+    int error;
+
+    cv::Mat frame;
+    cv::Mat sum;
+    cv::Mat squareSum;
+
+    /**
+     * Response maps of the frame, as computed by responseMaps().
+     */
+    std::vector<cv::Mat> maps;
+
+    PipelineLatency latency;
+
+    //cv::getTickCount() when the frame entered each stage. The evaluation starts with the first shard and ends
+    //with the last one.
+    long long ingested, integralStart, integralEnd, evaluationStart, evaluationEnd;
+
+    //cv::getTickCount() when each evaluation worker started and finished its shard
+    std::vector<long long> shardStart, shardEnd;
+};
+
+
+
+/**
+ * @brief The FramePipeline class scans the frames of a video with a wavelet bank, overlapping the work on successive
+ * frames: while a frame is evaluated, the integral images of the next ones are computed and later frames are being
+ * ingested.
+ *
+ * Frames go through these stages, each running on its own thread and connected by lock-free queues:
+ * - ingestion: push() copies the frame into a free PipelineFrame of the pool;
+ * - integral images: computed by one thread;
+ * - evaluation: the rows of the response maps of each frame are split into one shard per evaluation worker, and
+ *   every worker computes its shard of every frame, with statistics of its own;
+ * - delivery: pop() returns the frames in the order they were pushed, once all shards are done, and release()
+ *   gives them back to the pool.
+ *
+ * Threads waiting for a frame spin briefly, then sleep (see BlockingQueue). All buffers, response maps included,
+ * come from a fixed pool of frames allocated once, so the amount of frames in flight is bounded: push() blocks (and
+ * tryPush() fails) while all frames of the pool are in use, which slows down the producer to the pace of the
+ * slowest stage. Latencies are measured for every frame (see PipelineFrame::latency and statistics()).
+ *
+ * Codes thrown while processing a frame are reported in PipelineFrame::error, and the frame is still delivered.
+ *
+ * push() and tryPush() must be called from a single thread, and so must pop(), tryPop(), release() and statistics().
+ * Frames must be single channel 8 bit images of the size given to the constructor (throws 39 otherwise). Throws 45
+ * if the threads can't be started, and 46 if the stride is below 1.
+ */
+template <typename Evaluator>
+class FramePipeline
+{
+public:
+    /**
+     * @param bank the wavelet bank. It is copied.
+     * @param windowSize size of the detection window.
+     * @param frameSize size of the frames.
+     * @param stride how many pixels the window moves at a time.
+     * @param workers amount of evaluation threads. Defaults to the amount of available cores, less the ingestion and
+     *        integral threads.
+     * @param frames size of the pool, i.e. the maximum amount of frames in flight.
+     * @param sdepth type of the elements of the sums. See WaveletEvaluator.
+     */
+    FramePipeline(const Evaluator & evaluator,
+                  const CompiledWaveletBank & bank,
+                  const cv::Size & windowSize,
+                  const cv::Size & frameSize,
+                  const int stride = 1,
+                  const unsigned int workers = 0,
+                  const unsigned int frames = 0,
+                  const int sdepth = cv::DataType<double>::type)
+        : evaluator_(evaluator),
+          bank_(bank),
+          frameSize_(frameSize),
+          stride_(stride),
+          sdepth_(sdepth),
+          workers_(workers ? workers : std::max(cv::getNumberOfCPUs() - 2, 1)),
+          pool_(frames ? frames : 2 * workers_ + 2),
+          free_(pool_.size()),
+          ingested_(pool_.size()),
+          dispatched_(workers_),
+          evaluated_(workers_),
+          pushed_(0),
+          popped_(0),
+          collected_(0),
+          collecting_(0),
+          stop_(0),
+          windowStatistics_(workers_),
+          parts_(workers_),
+          threads_(workers_ + 1),
+          started_(0)
+    {
+        if (stride < 1)
+        {
+            throw 46;
+        }
+
+        for (unsigned int i = 0; i < pool_.size(); ++i)
+        {
+            pool_[i].sum.create(frameSize.height + 1, frameSize.width + 1, sdepth);
+            pool_[i].squareSum.create(frameSize.height + 1, frameSize.width + 1, cv::DataType<double>::type);
+            pool_[i].shardStart.resize(workers_);
+            pool_[i].shardEnd.resize(workers_);
+            free_.push(i);
+        }
+        prepared_ = PreparedWaveletBank(bank_, pool_[0].sum.step1(), windowSize);
+
+        const cv::Size mapSize = scanner::responseMapSize(prepared_, pool_[0].sum, stride);
+        mapRows_ = mapSize.height;
+        for (unsigned int i = 0; i < pool_.size(); ++i)
+        {
+            pool_[i].maps.resize(bank_.size() * bank_.outputs());
+            for (std::vector<cv::Mat>::iterator m = pool_[i].maps.begin(); m != pool_[i].maps.end(); ++m)
+            {
+                m->create(mapSize, cv::DataType<float>::type);
+            }
+        }
+
+        try
+        {
+            for (unsigned int w = 0; w < workers_; ++w)
+            {
+                dispatched_[w] = new BlockingQueue<unsigned int>(pool_.size());
+                evaluated_[w] = new BlockingQueue<unsigned int>(pool_.size());
+            }
+        }
+        catch (...)
+        {
+            //The destructor won't run: release the queues allocated so far (the others are still null)
+            for (unsigned int w = 0; w < workers_; ++w)
+            {
+                delete dispatched_[w];
+                delete evaluated_[w];
+            }
+            throw;
+        }
+
+        workerArguments_.resize(workers_);
+        if (pthread_create(&threads_[0], 0, &FramePipeline::integralThread, this))
+        {
+            shutdown();
+            throw 45;
+        }
+        ++started_;
+        for (unsigned int w = 0; w < workers_; ++w)
+        {
+            workerArguments_[w].first = this;
+            workerArguments_[w].second = w;
+            if (pthread_create(&threads_[w + 1], 0, &FramePipeline::evaluationThread, &workerArguments_[w]))
+            {
+                shutdown();
+                throw 45;
+            }
+            ++started_;
+        }
+    }
+
+    /**
+     * Stops all threads. Frames in flight are discarded.
+     */
+    ~FramePipeline()
+    {
+        shutdown();
+    }
+
+    unsigned int workers() const
+    {
+        return workers_;
+    }
+
+    /**
+     * Maximum amount of frames in flight.
+     */
+    unsigned int capacity() const
+    {
+        return pool_.size();
+    }
+
+    /**
+     * Feeds a frame to the pipeline, waiting for a free frame of the pool if necessary.
+     */
+    void push(const cv::Mat & frame)
+    {
+        check(frame);
+        unsigned int slot;
+        while (!free_.pop(slot)) //free_ is never woken, so this only waits
+        {
+        }
+        ingest(frame, slot);
+    }
+
+    /**
+     * Same as above, but fails instead of waiting if all frames of the pool are in use.
+     */
+    bool tryPush(const cv::Mat & frame)
+    {
+        check(frame);
+        unsigned int slot;
+        if (!free_.tryPop(slot))
+        {
+            return false;
+        }
+        ingest(frame, slot);
+        return true;
+    }
+
+    /**
+     * Waits for the next frame to be evaluated and returns it. It must be released when no longer needed.
+     * Only call it for frames that were pushed.
+     */
+    const PipelineFrame & pop()
+    {
+        while (collected_ < workers_)
+        {
+            if (evaluated_[collected_]->pop(collecting_))
+            {
+                ++collected_;
+            }
+        }
+        return deliver();
+    }
+
+    /**
+     * Same as above, but returns 0 if the next frame is not ready yet.
+     */
+    const PipelineFrame * tryPop()
+    {
+        while (collected_ < workers_)
+        {
+            if (!evaluated_[collected_]->tryPop(collecting_))
+            {
+                return 0;
+            }
+            ++collected_;
+        }
+        return &deliver();
+    }
+
+    /**
+     * Gives a frame returned by pop() back to the pool.
+     */
+    void release(const PipelineFrame & frame)
+    {
+        free_.push(&frame - &pool_[0]);
+    }
+
+    /**
+     * Latencies of the frames popped so far.
+     */
+    const PipelineStatistics & statistics() const
+    {
+        return statistics_;
+    }
+
+private:
+    FramePipeline(const FramePipeline &);
+    FramePipeline & operator=(const FramePipeline &);
+
+    void check(const cv::Mat & image) const
+    {
+        if (image.type() != cv::DataType<unsigned char>::type || image.size() != frameSize_)
+        {
+            throw 39;
+        }
+    }
+
+    void ingest(const cv::Mat & image, const unsigned int slot)
+    {
+        PipelineFrame & frame = pool_[slot];
+        frame.ingested = cv::getTickCount();
+        frame.index = pushed_++;
+        frame.error = 0;
+        image.copyTo(frame.frame);
+        ingested_.push(slot);
+    }
+
+    /**
+     * Measures the latencies of the frame whose shards were all collected, and hands it over.
+     */
+    PipelineFrame & deliver()
+    {
+        collected_ = 0;
+        ++popped_;
+
+        PipelineFrame & frame = pool_[collecting_];
+        const long long delivered = cv::getTickCount();
+        frame.evaluationStart = *std::min_element(frame.shardStart.begin(), frame.shardStart.end());
+        frame.evaluationEnd = *std::max_element(frame.shardEnd.begin(), frame.shardEnd.end());
+
+        PipelineLatency & l = frame.latency;
+        l.queued     = milliseconds(frame.ingested, frame.integralStart);
+        l.integral   = milliseconds(frame.integralStart, frame.integralEnd);
+        l.dispatched = milliseconds(frame.integralEnd, frame.evaluationStart);
+        l.evaluation = milliseconds(frame.evaluationStart, frame.evaluationEnd);
+        l.delivery   = milliseconds(frame.evaluationEnd, delivered);
+        l.total      = milliseconds(frame.ingested, delivered);
+        accumulate(l);
+        return frame;
+    }
+
+    /**
+     * Stops and joins the threads that were started, and frees the queues of the workers.
+     */
+    void shutdown()
+    {
+        __atomic_store_n(&stop_, 1, __ATOMIC_RELEASE);
+        ingested_.wake();
+        for (unsigned int w = 0; w < workers_; ++w)
+        {
+            dispatched_[w]->wake();
+        }
+        for (unsigned int t = 0; t < started_; ++t)
+        {
+            pthread_join(threads_[t], 0);
+        }
+        for (unsigned int w = 0; w < workers_; ++w)
+        {
+            delete dispatched_[w];
+            delete evaluated_[w];
+        }
+    }
+
+    bool stopped() const
+    {
+        return __atomic_load_n(&stop_, __ATOMIC_ACQUIRE);
+    }
+
+    /**
+     * Waits for a value of queue. Returns false if the pipeline was stopped first.
+     */
+    bool wait(BlockingQueue<unsigned int> & queue, unsigned int & slot) const
+    {
+        while (!stopped())
+        {
+            if (queue.pop(slot))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Records the code thrown while processing frame, unless an earlier one was.
+     */
+    static void report(PipelineFrame & frame, const int code)
+    {
+        int none = 0;
+        __atomic_compare_exchange_n(&frame.error, &none, code, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    }
+
+    static void * integralThread(void * argument)
+    {
+        FramePipeline & pipeline = *static_cast<FramePipeline *>(argument);
+        unsigned int slot;
+        while (pipeline.wait(pipeline.ingested_, slot))
+        {
+            PipelineFrame & frame = pipeline.pool_[slot];
+            frame.integralStart = cv::getTickCount();
+            try
+            {
+                HAARCOMMON_TIME(INTEGRAL_CYCLES);
+                cv::integral(frame.frame, frame.sum, frame.squareSum, pipeline.sdepth_);
+            }
+            catch (const int code)
+            {
+                report(frame, code);
+            }
+            catch (...)
+            {
+                report(frame, -1);
+            }
+            frame.integralEnd = cv::getTickCount();
+
+            //every worker evaluates a shard of every frame. Queues of the workers are as large as the pool, so
+            //this never fails
+            for (unsigned int w = 0; w < pipeline.workers_; ++w)
+            {
+                pipeline.dispatched_[w]->push(slot);
+            }
+        }
+        return 0;
+    }
+
+    static void * evaluationThread(void * argument)
+    {
+        const std::pair<FramePipeline *, unsigned int> & worker = *static_cast<std::pair<FramePipeline *, unsigned int> *>(argument);
+        FramePipeline & pipeline = *worker.first;
+        unsigned int slot;
+        while (pipeline.wait(*pipeline.dispatched_[worker.second], slot))
+        {
+            PipelineFrame & frame = pipeline.pool_[slot];
+            frame.shardStart[worker.second] = cv::getTickCount();
+            if (!__atomic_load_n(&frame.error, __ATOMIC_RELAXED))
+            {
+                try
+                {
+                    pipeline.evaluate(frame, worker.second);
+                }
+                catch (const int code)
+                {
+                    report(frame, code);
+                }
+                catch (...)
+                {
+                    report(frame, -1);
+                }
+            }
+            frame.shardEnd[worker.second] = cv::getTickCount();
+            pipeline.evaluated_[worker.second]->push(slot);
+        }
+        return 0;
+    }
+
+    /**
+     * Computes the rows of the response maps of frame in the shard of worker, writing them straight into the maps.
+     * Only the rows of the integral images under the windows of the shard are read.
+     */
+    void evaluate(PipelineFrame & frame, const unsigned int worker)
+    {
+        const int begin = mapRows_ * (int)worker / (int)workers_;
+        const int end = mapRows_ * (int)(worker + 1) / (int)workers_;
+        if (begin == end)
+        {
+            return;
+        }
+
+        const cv::Rect area(0, begin * stride_, frame.sum.cols, (end - 1 - begin) * stride_ + prepared_.windowSize().height + 1);
+        std::vector<cv::Mat> & part = parts_[worker];
+        part.resize(frame.maps.size());
+        for (unsigned int m = 0; m < part.size(); ++m)
+        {
+            part[m] = frame.maps[m].rowRange(begin, end); //already of the right size, so responseMaps() fills it
+        }
+        responseMaps(evaluator_, prepared_, frame.sum(area), frame.squareSum(area), stride_, windowStatistics_[worker], part);
+    }
+
+    static double milliseconds(const long long begin, const long long end)
+    {
+        return (end - begin) * 1000.0 / cv::getTickFrequency();
+    }
+
+    void accumulate(const PipelineLatency & l)
+    {
+        PipelineStatistics & s = statistics_;
+        ++s.frames;
+        s.last = l;
+        accumulate(s.mean.queued,     s.max.queued,     l.queued);
+        accumulate(s.mean.integral,   s.max.integral,   l.integral);
+        accumulate(s.mean.dispatched, s.max.dispatched, l.dispatched);
+        accumulate(s.mean.evaluation, s.max.evaluation, l.evaluation);
+        accumulate(s.mean.delivery,   s.max.delivery,   l.delivery);
+        accumulate(s.mean.total,      s.max.total,      l.total);
+    }
+
+    void accumulate(double & mean, double & max, const double value) const
+    {
+        mean += (value - mean) / statistics_.frames;
+        max = std::max(max, value);
+    }
+
+    const Evaluator evaluator_;
+    const CompiledWaveletBank bank_;
+    PreparedWaveletBank prepared_; //points to bank_
+    const cv::Size frameSize_;
+    const int stride_;
+    const int sdepth_;
+    const unsigned int workers_;
+
+    int mapRows_;
+
+    std::vector<PipelineFrame> pool_;
+    BlockingQueue<unsigned int> free_;                        //release() -> push()
+    BlockingQueue<unsigned int> ingested_;                    //push() -> integral thread
+    std::vector<BlockingQueue<unsigned int> *> dispatched_;   //integral thread -> each worker
+    std::vector<BlockingQueue<unsigned int> *> evaluated_;    //each worker -> pop()
+
+    unsigned long pushed_;     //only used by the ingesting thread
+    unsigned long popped_;     //only used by the delivering thread
+    unsigned int collected_;   //shards of the next frame already collected by the delivering thread
+    unsigned int collecting_;  //slot of that frame
+    int stop_;
+    PipelineStatistics statistics_;
+
+    std::vector<WindowStatisticsMap> windowStatistics_; //of each worker
+    std::vector< std::vector<cv::Mat> > parts_;         //shard of the response maps of each worker
+
+    std::vector<pthread_t> threads_;
+    unsigned int started_; //threads started so far
+    std::vector< std::pair<FramePipeline *, unsigned int> > workerArguments_;
+};
+
+
+
+#endif // HAARWAVELETPIPELINE_H
@@ -0,0 +1,313 @@
+#ifndef HAARWAVELETQUANTIZED_H
+#define HAARWAVELETQUANTIZED_H
+
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#include <opencv2/core/core.hpp>
+
+#include "haarwaveletbank.h"
+
+#if defined(__SSE4_1__)
+#include <smmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+
+
+/**
+ * @brief The QuantizedWaveletBank class is a fixed-point version of a CompiledWaveletBank of HaarWavelets or
+ * MyHaarWavelets, evaluated with intensity normalization over int integral images.
+ *
+ * The weight and the SRFS normalization of each rectangle are folded into a single int16 coefficient q_r, with a
+ * float scale s per wavelet, and the means of MyHaarWavelets are folded into a per-wavelet constant M. The response
+ * of a wavelet is then
+ *     s * sum_r(q_r * rect_r) - M
+ * (absolute, for MyHaarWavelets) where the sum is accumulated in 32 bit integers. The scale is chosen so that the
+ * accumulator can't overflow for 8 bit images, which leaves the coefficients of wavelets with large rectangles
+ * fewer significant bits.
+ *
+ * errorBounds() holds, for each wavelet, the largest difference the quantization can cause between its response and
+ * the one of IntensityNormalizedWaveletEvaluator, over all 8 bit images. Rounding of the floating point results is
+ * not included.
+ *
+ * The bank must be prepared for the step of the integral images before being evaluated.
+ */
+class QuantizedWaveletBank
+{
+public:
+    QuantizedWaveletBank() {}
+
+    /**
+     * Quantizes bank, which must not be of kind DUAL_WEIGHT (throws 38 otherwise).
+     */
+    explicit QuantizedWaveletBank(const CompiledWaveletBank & bank) : bank_(bank)
+    {
+        quantize();
+    }
+
+    QuantizedWaveletBank(const QuantizedWaveletBank & other)
+    {
+        *this = other;
+    }
+
+    QuantizedWaveletBank & operator=(const QuantizedWaveletBank & other)
+    {
+        if (this != &other)
+        {
+            bank_ = other.bank_;
+            coefficients_ = other.coefficients_;
+            scales_ = other.scales_;
+            constants_ = other.constants_;
+            errorBounds_ = other.errorBounds_;
+            prepared_ = PreparedWaveletBank();
+            if (other.prepared_.step())
+            {
+                prepare(other.prepared_.step(), other.prepared_.windowSize());
+            }
+        }
+        return *this;
+    }
+
+    /**
+     * Prepares the bank for integral images whose step (in elements) is step.
+     * @param windowSize size of the detection window.
+     */
+    void prepare(const size_t step, const cv::Size & windowSize)
+    {
+        prepared_ = PreparedWaveletBank(bank_, step, windowSize);
+    }
+
+    /**
+     * The bank that was quantized. Its rectangles are shared by this bank.
+     */
+    const CompiledWaveletBank & bank() const
+    {
+        return bank_;
+    }
+
+    /**
+     * The offsets of the rectangles, and the step and window size the bank was prepared for.
+     */
+    const PreparedWaveletBank & prepared() const
+    {
+        return prepared_;
+    }
+
+    unsigned int size() const
+    {
+        return bank_.size();
+    }
+
+    /**
+     * True if responses are absolute values (banks of MyHaarWavelets).
+     */
+    bool absolute() const
+    {
+        return bank_.kind() == CompiledWaveletBank::MEANS;
+    }
+
+    /**
+     * The coefficient q_r of each rectangle, in the order of bank().
+     */
+    const short * coefficients() const
+    {
+        return coefficients_.data();
+    }
+
+    /**
+     * The scale s of each wavelet.
+     */
+    const float * scales() const
+    {
+        return scales_.empty() ? 0 : &scales_[0];
+    }
+
+    /**
+     * The constant M of each wavelet.
+     */
+    const float * constants() const
+    {
+        return constants_.empty() ? 0 : &constants_[0];
+    }
+
+    /**
+     * The largest error of the response of each wavelet caused by the quantization.
+     */
+    const float * errorBounds() const
+    {
+        return errorBounds_.empty() ? 0 : &errorBounds_[0];
+    }
+
+private:
+
+    void quantize()
+    {
+        if (bank_.kind() == CompiledWaveletBank::DUAL_WEIGHT)
+        {
+            throw 38;
+        }
+
+        const unsigned int * begin = bank_.rectanglesBegin();
+        const RectangleCorners * corners = bank_.corners();
+        const float * weights = bank_.weights();
+        const float * means = bank_.means();
+        const float * normalization = bank_.normalization();
+        const double maxPixel = std::numeric_limits<unsigned char>::max();
+        const double maxCoefficient = std::numeric_limits<short>::max();
+        const double maxAccumulator = std::numeric_limits<int>::max();
+
+        coefficients_.resize(bank_.rectangles());
+        scales_.resize(bank_.size());
+        constants_.resize(bank_.size());
+        errorBounds_.resize(bank_.size());
+
+        for (unsigned int w = 0; w < bank_.size(); ++w)
+        {
+            //The largest rectangle sum is maxPixel * area, so the accumulator is bounded by
+            //sum_r(|q_r| * maxPixel * area_r) <= sum_r((|c_r| / s + 0.5) * maxPixel * area_r)
+            double largest = 0.0, total = 0.0, range = 0.0, constant = 0.0;
+            for (unsigned int r = begin[w]; r < begin[w + 1]; ++r)
+            {
+                const double c = (double)weights[r] * normalization[r];
+                const double maxSum = maxPixel * area(corners[r]);
+                largest = std::max(largest, std::abs(c));
+                total += std::abs(c) * maxSum;
+                range += maxSum;
+                if (means)
+                {
+                    constant += (double)weights[r] * means[r];
+                }
+            }
+
+            if (0.5 * range >= maxAccumulator)
+            {
+                throw 38;
+            }
+            double s = std::max(largest / maxCoefficient, total / (maxAccumulator - 0.5 * range));
+            if (s == 0.0)
+            {
+                s = 1.0;
+            }
+            scales_[w] = s * (1.0 + std::numeric_limits<float>::epsilon()); //never rounded below s
+            s = scales_[w]; //quantize against the scale actually used by the evaluation
+
+            double bound = 0.0;
+            for (unsigned int r = begin[w]; r < begin[w + 1]; ++r)
+            {
+                const double c = (double)weights[r] * normalization[r];
+                const double q = std::max(-maxCoefficient, std::min(maxCoefficient, (double)cvRound(c / s)));
+                coefficients_.data()[r] = (short)q;
+                bound += std::abs(q * s - c) * maxPixel * area(corners[r]);
+            }
+            constants_[w] = constant;
+            errorBounds_[w] = bound + std::abs(constant - constants_[w]);
+        }
+    }
+
+    static double area(const RectangleCorners & c)
+    {
+        return (double)(c.right - c.left) * (c.bottom - c.top);
+    }
+
+    CompiledWaveletBank bank_;
+    AlignedBuffer<short> coefficients_;
+    std::vector<float> scales_;
+    std::vector<float> constants_;
+    std::vector<float> errorBounds_;
+    PreparedWaveletBank prepared_; //points to bank_
+};
+
+
+
+namespace scanner
+{
+
+#if defined(__SSE2__)
+/**
+ * The low 32 bits of the products of the lanes of a and b. SSE2 has no 32 bit multiplication, so without SSE4.1
+ * the even and odd lanes are multiplied into 64 bits and their low halves put back together.
+ */
+inline __m128i multiplyLow(const __m128i a, const __m128i b)
+{
+#if defined(__SSE4_1__)
+    return _mm_mullo_epi32(a, b);
+#else
+    const __m128i even = _mm_mul_epu32(a, b);
+    const __m128i odd  = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd,  _MM_SHUFFLE(0, 0, 2, 0)));
+#endif
+}
+#endif
+
+/**
+ * Adds q * (sum of the rectangle o) to acc[x] for each of the count windows of a row, in 32 bit integer arithmetic.
+ * The x-th window of the row has its top-left corner at row + x * stride. With stride 1, 16 (AVX-512), 8 (AVX2) or
+ * 4 (SSE2, which every x86-64 processor has) windows are processed per instruction.
+ */
+inline void accumulateQuantized(const int * row,
+                                const RectangleOffsets & o,
+                                const int stride,
+                                const int count,
+                                const int q,
+                                int * acc)
+{
+    int x = 0;
+    if (stride == 1)
+    {
+#if defined(__AVX512F__)
+        const __m512i vq16 = _mm512_set1_epi32(q);
+        for (; x + 16 <= count; x += 16)
+        {
+            const int * p = row + x;
+            const __m512i v = _mm512_sub_epi32(_mm512_add_epi32(_mm512_loadu_si512(p + o.topLeft),  _mm512_loadu_si512(p + o.bottomRight)),
+                                               _mm512_add_epi32(_mm512_loadu_si512(p + o.topRight), _mm512_loadu_si512(p + o.bottomLeft)));
+            _mm512_storeu_si512(acc + x, _mm512_add_epi32(_mm512_loadu_si512(acc + x), _mm512_mullo_epi32(vq16, v)));
+        }
+#endif
+#if defined(__AVX2__)
+        const __m256i vq8 = _mm256_set1_epi32(q);
+        for (; x + 8 <= count; x += 8)
+        {
+            const int * p = row + x;
+            const __m256i v = _mm256_sub_epi32(_mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(p + o.topLeft)),
+                                                                _mm256_loadu_si256((const __m256i *)(p + o.bottomRight))),
+                                               _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(p + o.topRight)),
+                                                                _mm256_loadu_si256((const __m256i *)(p + o.bottomLeft))));
+            _mm256_storeu_si256((__m256i *)(acc + x), _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(acc + x)),
+                                                                       _mm256_mullo_epi32(vq8, v)));
+        }
+#endif
+#if defined(__SSE2__)
+        const __m128i vq4 = _mm_set1_epi32(q);
+        for (; x + 4 <= count; x += 4)
+        {
+            const int * p = row + x;
+            const __m128i v = _mm_sub_epi32(_mm_add_epi32(_mm_loadu_si128((const __m128i *)(p + o.topLeft)),
+                                                          _mm_loadu_si128((const __m128i *)(p + o.bottomRight))),
+                                            _mm_add_epi32(_mm_loadu_si128((const __m128i *)(p + o.topRight)),
+                                                          _mm_loadu_si128((const __m128i *)(p + o.bottomLeft))));
+            _mm_storeu_si128((__m128i *)(acc + x), _mm_add_epi32(_mm_loadu_si128((const __m128i *)(acc + x)),
+                                                                 multiplyLow(vq4, v)));
+        }
+#endif
+    }
+
+    for (; x < count; ++x)
+    {
+        acc[x] += q * rectangleSum(row + x * stride, o);
+    }
+}
+
+}
+
+
+
+#endif // HAARWAVELETQUANTIZED_H
@@ -0,0 +1,511 @@
+#ifndef HAARWAVELETSCANNER_H
+#define HAARWAVELETSCANNER_H
+
+#include <vector>
+#include <cmath>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "haarwavelet.h"
+#include "haarwaveletbank.h"
+#include "haarwaveletevaluators.h"
+#include "haarwaveletinstrumentation.h"
+#include "haarwaveletquantized.h"
+#include "haarwaveletstatistics.h"
+
+
+
+/**
+ * Functions that evaluate wavelets at every position of a sliding window over a whole integral image,
+ * producing dense response maps.
+ *
+ * The response of a wavelet is linear on the sums of its rectangles, so it is computed as
+ *     a * (sum_r(c_r * rect_r) - b * A) - M
+ * where c_r are per-rectangle coefficients (weight and SRFS normalization), A and M are per-wavelet constants and a
+ * and b depend only on the window (variance normalization, taken from a WindowStatisticsMap). Rectangle sums of
+ * consecutive window positions are contiguous in memory, so sum_r(c_r * rect_r) is computed for a whole row of
+ * windows at once, in SIMD lanes (AVX or SSE2, with a scalar fallback).
+ */
+namespace scanner
+{
+
+/**
+ * Size of the response maps of prepared, scanned over sum with the given stride. Throws 46 if stride < 1.
+ */
+inline cv::Size responseMapSize(const PreparedWaveletBank & prepared, const cv::Mat & sum, const int stride)
+{
+    if (stride < 1)
+    {
+        throw 46;
+    }
+    const cv::Size window = prepared.windowSize();
+    const int width  = sum.cols - 1 - window.width;
+    const int height = sum.rows - 1 - window.height;
+    if (width < 0 || height < 0)
+    {
+        return cv::Size(0, 0);
+    }
+    return cv::Size(width / stride + 1, height / stride + 1);
+}
+
+/**
+ * Does the actual scanning, once the kind of the bank and the type of the elements of sum are known, so that the
+ * per-rectangle and per-window branches on the kind compile away. See responseMaps() below.
+ */
+template <CompiledWaveletBank::Kind kind, typename integral_type>
+void responseMaps(const PreparedWaveletBank & prepared,
+                  const cv::Mat & sum,
+                  const WindowStatisticsMap * statistics,
+                  const int stride,
+                  const cv::Size & size,
+                  std::vector<cv::Mat> & maps)
+{
+    const CompiledWaveletBank & bank = prepared.bank();
+    const unsigned int * begin = bank.rectanglesBegin();
+    const RectangleOffsets * offsets = prepared.offsets();
+    const float * areas = prepared.areas();
+    const float * weights = bank.weights();
+    const float * weightsNegative = bank.weightsNegative();
+    const float * means = bank.means();
+    const float * normalization = bank.normalization();
+
+    const bool variance = statistics != 0;
+    AlignedBuffer<double> ones(size.width), zeros(size.width), positive(size.width), negative(size.width);
+    std::fill(ones.data(), ones.data() + size.width, 1.0);
+    std::fill(zeros.data(), zeros.data() + size.width, 0.0);
+
+    for (int y = 0; y < size.height; ++y)
+    {
+        const integral_type * row = sum.ptr<integral_type>(y * stride);
+
+        //Viola and Jones' variance normalization. See VarianceNormalizedWaveletEvaluator.
+        const double * a = variance ? statistics->factors().ptr<double>(y) : ones.data();
+        const double * b = variance ? statistics->means().ptr<double>(y) : zeros.data();
+
+        for (unsigned int w = 0; w < bank.size(); ++w)
+        {
+            std::fill(positive.data(), positive.data() + size.width, 0.0);
+            std::fill(negative.data(), negative.data() + size.width, 0.0);
+
+            double areaPositive = 0.0, areaNegative = 0.0, meansSum = 0.0;
+            for (unsigned int r = begin[w]; r < begin[w + 1]; ++r)
+            {
+                const double c = variance ? 1.0 : normalization[r];
+                accumulateRectangle(row, offsets[r], stride, size.width, weights[r] * c, positive.data());
+                areaPositive += weights[r] * areas[r];
+
+                if (kind == CompiledWaveletBank::DUAL_WEIGHT)
+                {
+                    accumulateRectangle(row, offsets[r], stride, size.width, weightsNegative[r] * c, negative.data());
+                    areaNegative += weightsNegative[r] * areas[r];
+                }
+                else if (kind == CompiledWaveletBank::MEANS)
+                {
+                    meansSum += weights[r] * means[r];
+                }
+            }
+
+            float * out = maps[w * bank.outputs()].ptr<float>(y);
+            for (int x = 0; x < size.width; ++x)
+            {
+                const double value = a[x] * (positive[x] - b[x] * areaPositive) - meansSum;
+                out[x] = kind == CompiledWaveletBank::MEANS ? std::abs(value) : value;
+            }
+
+            if (kind == CompiledWaveletBank::DUAL_WEIGHT)
+            {
+                out = maps[w * bank.outputs() + 1].ptr<float>(y);
+                for (int x = 0; x < size.width; ++x)
+                {
+                    out[x] = a[x] * (negative[x] - b[x] * areaNegative);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Dispatches once on the kind of the bank. See above.
+ */
+template <typename integral_type>
+void responseMaps(const PreparedWaveletBank & prepared,
+                  const cv::Mat & sum,
+                  const WindowStatisticsMap * statistics,
+                  const int stride,
+                  const cv::Size & size,
+                  std::vector<cv::Mat> & maps)
+{
+    switch (prepared.bank().kind())
+    {
+    case CompiledWaveletBank::PLAIN:
+        responseMaps<CompiledWaveletBank::PLAIN, integral_type>(prepared, sum, statistics, stride, size, maps);
+        break;
+    case CompiledWaveletBank::MEANS:
+        responseMaps<CompiledWaveletBank::MEANS, integral_type>(prepared, sum, statistics, stride, size, maps);
+        break;
+    case CompiledWaveletBank::DUAL_WEIGHT:
+        responseMaps<CompiledWaveletBank::DUAL_WEIGHT, integral_type>(prepared, sum, statistics, stride, size, maps);
+        break;
+    }
+}
+
+/**
+ * Validates the arguments and dispatches on the type of sum. If statistics is given, the windows are variance
+ * normalized (see VarianceNormalizedWaveletEvaluator), else they are intensity normalized.
+ */
+inline void responseMaps(const PreparedWaveletBank & prepared,
+                         const cv::Mat & sum,
+                         const WindowStatisticsMap * statistics,
+                         const int stride,
+                         std::vector<cv::Mat> & maps)
+{
+    const CompiledWaveletBank & bank = prepared.bank();
+    const cv::Size size = responseMapSize(prepared, sum, stride);
+
+    maps.resize(bank.size() * bank.outputs());
+    for (std::vector<cv::Mat>::iterator m = maps.begin(); m != maps.end(); ++m)
+    {
+        m->create(size, cv::DataType<float>::type);
+    }
+    if (!size.area())
+    {
+        return;
+    }
+
+    //Validate only the first and the last windows: all others lie between them.
+    const cv::Point last((size.width - 1) * stride, (size.height - 1) * stride);
+    WaveletEvaluator::checkIntegral(prepared, sum, cv::Point(0, 0));
+    WaveletEvaluator::checkIntegral(prepared, sum, last);
+    if (statistics)
+    {
+        VarianceNormalizedWaveletEvaluator::checkStatistics(prepared, *statistics);
+        if (statistics->stride() != stride || statistics->size() != size)
+        {
+            throw 36;
+        }
+    }
+
+    HAARCOMMON_TIME(EVALUATION_CYCLES);
+    HAARCOMMON_COUNT_WINDOWS(size.area(), bank.size(), bank.rectangles());
+    switch (sum.type())
+    {
+    case cv::DataType<int>::type:
+        responseMaps<int>(prepared, sum, statistics, stride, size, maps);
+        break;
+    case cv::DataType<float>::type:
+        responseMaps<float>(prepared, sum, statistics, stride, size, maps);
+        break;
+    default:
+        responseMaps<double>(prepared, sum, statistics, stride, size, maps);
+        break;
+    }
+}
+
+/**
+ * Same as responseMaps() above, for a QuantizedWaveletBank over an int integral image. The responses of a whole row
+ * of windows are accumulated in 32 bit integers (see accumulateQuantized()) and scaled once.
+ */
+inline void quantizedResponseMaps(const QuantizedWaveletBank & bank,
+                                  const cv::Mat & sum,
+                                  const int stride,
+                                  std::vector<cv::Mat> & maps)
+{
+    const PreparedWaveletBank & prepared = bank.prepared();
+    const cv::Size size = responseMapSize(prepared, sum, stride);
+
+    maps.resize(bank.size());
+    for (std::vector<cv::Mat>::iterator m = maps.begin(); m != maps.end(); ++m)
+    {
+        m->create(size, cv::DataType<float>::type);
+    }
+    if (!size.area())
+    {
+        return;
+    }
+
+    const cv::Point last((size.width - 1) * stride, (size.height - 1) * stride);
+    WaveletEvaluator::checkIntegral(prepared, sum, cv::Point(0, 0));
+    WaveletEvaluator::checkIntegral(prepared, sum, last);
+    if (sum.type() != cv::DataType<int>::type)
+    {
+        throw 31;
+    }
+
+    HAARCOMMON_TIME(EVALUATION_CYCLES);
+    HAARCOMMON_COUNT_WINDOWS(size.area(), bank.size(), bank.bank().rectangles());
+
+    const unsigned int * begin = bank.bank().rectanglesBegin();
+    const RectangleOffsets * offsets = prepared.offsets();
+    const short * coefficients = bank.coefficients();
+    AlignedBuffer<int> acc(size.width);
+
+    for (int y = 0; y < size.height; ++y)
+    {
+        const int * row = sum.ptr<int>(y * stride);
+        for (unsigned int w = 0; w < bank.size(); ++w)
+        {
+            std::fill(acc.data(), acc.data() + size.width, 0);
+            for (unsigned int r = begin[w]; r < begin[w + 1]; ++r)
+            {
+                accumulateQuantized(row, offsets[r], stride, size.width, coefficients[r], acc.data());
+            }
+
+            const double s = bank.scales()[w];
+            const double M = bank.constants()[w];
+            float * out = maps[w].ptr<float>(y);
+            for (int x = 0; x < size.width; ++x)
+            {
+                const double value = s * acc[x] - M;
+                out[x] = bank.absolute() ? std::abs(value) : value;
+            }
+        }
+    }
+}
+
+}
+
+
+
+/**
+ * Evaluates every wavelet of prepared at every window position of sum, moving the window by stride pixels.
+ * maps receives one CV_32F response map per output of the bank: the map of the o-th output of the w-th
+ * wavelet is maps[w * bank.outputs() + o]. Element (y, x) of a map is the response of the window whose
+ * top-left corner is (x * stride, y * stride). Throws 46 if stride < 1.
+ */
+inline void responseMaps(const IntensityNormalizedWaveletEvaluator &,
+                         const PreparedWaveletBank & prepared,
+                         const cv::Mat & sum,
+                         const cv::Mat &, //Not used here
+                         const int stride,
+                         std::vector<cv::Mat> & maps)
+{
+    scanner::responseMaps(prepared, sum, 0, stride, maps);
+}
+
+/**
+ * Same as above, with variance normalization of each window. The statistics of the windows are computed into
+ * statistics, whose maps are reused if they already have the right size.
+ */
+inline void responseMaps(const VarianceNormalizedWaveletEvaluator &,
+                         const PreparedWaveletBank & prepared,
+                         const cv::Mat & sum,
+                         const cv::Mat & squareSum,
+                         const int stride,
+                         WindowStatisticsMap & statistics,
+                         std::vector<cv::Mat> & maps)
+{
+    statistics.compute(sum, squareSum, prepared.windowSize(), stride);
+    scanner::responseMaps(prepared, sum, &statistics, stride, maps);
+}
+
+/**
+ * Same as above, with temporary statistics.
+ */
+inline void responseMaps(const VarianceNormalizedWaveletEvaluator & evaluator,
+                         const PreparedWaveletBank & prepared,
+                         const cv::Mat & sum,
+                         const cv::Mat & squareSum,
+                         const int stride,
+                         std::vector<cv::Mat> & maps)
+{
+    WindowStatisticsMap statistics;
+    responseMaps(evaluator, prepared, sum, squareSum, stride, statistics, maps);
+}
+
+/**
+ * Intensity normalization needs no statistics: same as the overload without them.
+ */
+inline void responseMaps(const IntensityNormalizedWaveletEvaluator & evaluator,
+                         const PreparedWaveletBank & prepared,
+                         const cv::Mat & sum,
+                         const cv::Mat & squareSum,
+                         const int stride,
+                         WindowStatisticsMap &, //Not used here
+                         std::vector<cv::Mat> & maps)
+{
+    responseMaps(evaluator, prepared, sum, squareSum, stride, maps);
+}
+
+/**
+ * Evaluates every wavelet of a prepared QuantizedWaveletBank at every window position of sum, which must hold int
+ * elements, in fixed point. See the PreparedWaveletBank overload for the layout of maps.
+ */
+inline void responseMaps(const IntensityNormalizedWaveletEvaluator &,
+                         const QuantizedWaveletBank & bank,
+                         const cv::Mat & sum,
+                         const cv::Mat &, //Not used here
+                         const int stride,
+                         std::vector<cv::Mat> & maps)
+{
+    scanner::quantizedResponseMaps(bank, sum, stride, maps);
+}
+
+/**
+ * Convenience for evaluating a single wavelet of any kind over the whole image.
+ * @param windowSize size of the detection window, before scaling.
+ */
+template <typename Evaluator, typename HaarWaveletType>
+void responseMaps(const Evaluator & evaluator,
+                  const HaarWaveletType & wavelet,
+                  const cv::Mat & sum,
+                  const cv::Mat & squareSum,
+                  const cv::Size & windowSize,
+                  const int stride,
+                  std::vector<cv::Mat> & maps,
+                  const float scale = 1.0)
+{
+    const CompiledWaveletBank bank(std::vector<HaarWaveletType>(1, wavelet));
+    const PreparedWaveletBank prepared(bank, sum.step1(), windowSize, scale);
+    responseMaps(evaluator, prepared, sum, squareSum, stride, maps);
+}
+
+
+
+
+/**
+ * @brief The MultiScaleScanner class scans frames with a wavelet bank at several scales.
+ *
+ * A rescaled copy of the bank (see CompiledWaveletBank::scaled()) is built once per scale, when the scanner is
+ * constructed, and prepared for the step of the integral images the first time a frame is scanned. Both are
+ * reused for all following frames with the same step. Scales are scanned in parallel.
+ */
+class MultiScaleScanner
+{
+public:
+    /**
+     * @param bank the wavelet bank. It is copied.
+     * @param windowSize size of the detection window at scale 1.
+     * @param scales scales to scan.
+     */
+    MultiScaleScanner(const CompiledWaveletBank & bank, const cv::Size & windowSize, const std::vector<float> & scales)
+        : scales_(scales),
+          banks_(scales.size()),
+          prepared_(scales.size()),
+          statistics_(scales.size()),
+          windowSizes_(scales.size()),
+          step_(0)
+    {
+        for (unsigned int i = 0; i < scales_.size(); ++i)
+        {
+            banks_[i] = bank.scaled(scales_[i]);
+            windowSizes_[i].width  = cvRound(windowSize.width * scales_[i]);
+            windowSizes_[i].height = cvRound(windowSize.height * scales_[i]);
+        }
+    }
+
+    const std::vector<float> & scales() const
+    {
+        return scales_;
+    }
+
+    /**
+     * Size of the detection window at the scaleIndex'th scale.
+     */
+    cv::Size windowSize(const unsigned int scaleIndex) const
+    {
+        return windowSizes_[scaleIndex];
+    }
+
+    /**
+     * The stride used at the scaleIndex'th scale when scanning with a base stride of stride: the window moves
+     * proportionally to its size.
+     */
+    int stride(const unsigned int scaleIndex, const int stride) const
+    {
+        return std::max(cvRound(stride * scales_[scaleIndex]), 1);
+    }
+
+    /**
+     * Computes the integral images of frame and scans them. See the other overload.
+     * The integral images are kept and reused for the next frame.
+     */
+    template <typename Evaluator>
+    void scan(const Evaluator & evaluator,
+              const cv::Mat & frame,
+              const int stride,
+              std::vector< std::vector<cv::Mat> > & maps)
+    {
+        {
+            HAARCOMMON_TIME(INTEGRAL_CYCLES);
+            cv::integral(frame, sum_, squareSum_, cv::DataType<double>::type);
+        }
+        scan(evaluator, sum_, squareSum_, stride, maps);
+    }
+
+    /**
+     * Scans the integral images at all scales. maps[i] receives the response maps of the i-th scale, as
+     * returned by responseMaps(), with the stride given by stride(i, stride).
+     */
+    template <typename Evaluator>
+    void scan(const Evaluator & evaluator,
+              const cv::Mat & sum,
+              const cv::Mat & squareSum,
+              const int stride,
+              std::vector< std::vector<cv::Mat> > & maps)
+    {
+        if (sum.step1() != step_)
+        {
+            step_ = sum.step1();
+            for (unsigned int i = 0; i < scales_.size(); ++i)
+            {
+                prepared_[i] = PreparedWaveletBank(banks_[i], step_, windowSizes_[i]);
+            }
+        }
+
+        maps.resize(scales_.size());
+        cv::parallel_for_(cv::Range(0, scales_.size()),
+                          ScaleBody<Evaluator>(*this, evaluator, sum, squareSum, stride, maps),
+                          scales_.size());
+    }
+
+private:
+    //Prepared banks point to banks_, so scanners can't be copied
+    MultiScaleScanner(const MultiScaleScanner &);
+    MultiScaleScanner & operator=(const MultiScaleScanner &);
+
+    template <typename Evaluator>
+    class ScaleBody : public cv::ParallelLoopBody
+    {
+    public:
+        ScaleBody(const MultiScaleScanner & scanner_,
+                  const Evaluator & evaluator_,
+                  const cv::Mat & sum_,
+                  const cv::Mat & squareSum_,
+                  const int stride_,
+                  std::vector< std::vector<cv::Mat> > & maps_) : scanner(scanner_),
+                                                                 evaluator(evaluator_),
+                                                                 sum(sum_),
+                                                                 squareSum(squareSum_),
+                                                                 stride(stride_),
+                                                                 maps(maps_) {}
+
+        void operator()(const cv::Range & range) const
+        {
+            for (int i = range.start; i < range.end; ++i)
+            {
+                responseMaps(evaluator, scanner.prepared_[i], sum, squareSum, scanner.stride(i, stride), scanner.statistics_[i], maps[i]);
+            }
+        }
+
+    private:
+        const MultiScaleScanner & scanner;
+        const Evaluator & evaluator;
+        const cv::Mat & sum;
+        const cv::Mat & squareSum;
+        const int stride;
+        std::vector< std::vector<cv::Mat> > & maps;
+    };
+
+    std::vector<float> scales_;
+    std::vector<CompiledWaveletBank> banks_;
+    std::vector<PreparedWaveletBank> prepared_;
+    mutable std::vector<WindowStatisticsMap> statistics_; //one per scale, each written only by the task of its scale
+    std::vector<cv::Size> windowSizes_;
+    size_t step_;
+    cv::Mat sum_, squareSum_;
+};
+
+
+
+#endif // HAARWAVELETSCANNER_H
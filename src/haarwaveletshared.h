@@ -0,0 +1,136 @@
+#ifndef HAARWAVELETSHARED_H
+#define HAARWAVELETSHARED_H
+
+#include <vector>
+#include <map>
+
+#include <opencv2/core/core.hpp>
+
+#include "haarwavelet.h"
+#include "haarwaveletbank.h"
+
+
+
+/**
+ * @brief The SharedRectangleBank class evaluates banks in which many wavelets share the same rectangles, as
+ * exhaustively generated banks do. Each distinct rectangle is summed and normalized only once per window; the
+ * responses are then the product of the sparse matrix of weights (one row per wavelet, one column per distinct
+ * rectangle) by the vector of rectangle values. Means and dual weights are applied as in CompiledWaveletBank.
+ *
+ * The distinct rectangles are kept as a CompiledWaveletBank with a single wavelet, so they are prepared for
+ * windowed evaluation by PreparedWaveletBank. The bank must be prepared before being evaluated at a window.
+ */
+class SharedRectangleBank
+{
+public:
+    SharedRectangleBank() {}
+
+    explicit SharedRectangleBank(const CompiledWaveletBank & bank) : bank_(bank)
+    {
+        std::map<Key, unsigned int> indices;
+        std::vector<cv::Rect> rects;
+        columns_.resize(bank.rectangles());
+
+        const RectangleCorners * corners = bank.corners();
+        for (unsigned int r = 0; r < bank.rectangles(); ++r)
+        {
+            const Key key(std::make_pair(corners[r].left, corners[r].top),
+                          std::make_pair(corners[r].right, corners[r].bottom));
+            const std::pair<std::map<Key, unsigned int>::iterator, bool> inserted = indices.insert(std::make_pair(key, rects.size()));
+            if (inserted.second)
+            {
+                rects.push_back(cv::Rect(corners[r].left, corners[r].top,
+                                         corners[r].right - corners[r].left, corners[r].bottom - corners[r].top));
+            }
+            columns_[r] = inserted.first->second;
+        }
+
+        if (!rects.empty())
+        {
+            rectangles_ = CompiledWaveletBank(std::vector<HaarWavelet>(1, HaarWavelet(rects, std::vector<float>(rects.size(), 1.0f))));
+        }
+    }
+
+    SharedRectangleBank(const SharedRectangleBank & other)
+    {
+        *this = other;
+    }
+
+    SharedRectangleBank & operator=(const SharedRectangleBank & other)
+    {
+        if (this != &other)
+        {
+            bank_ = other.bank_;
+            rectangles_ = other.rectangles_;
+            columns_ = other.columns_;
+            prepared_ = PreparedWaveletBank();
+            if (other.prepared_.step())
+            {
+                prepare(other.prepared_.step(), other.windowSize_, other.prepared_.scale());
+            }
+        }
+        return *this;
+    }
+
+    /**
+     * Prepares the distinct rectangles for integral images whose step (in elements) is step.
+     * @param windowSize size of the detection window, before scaling. Used by the variance normalization.
+     */
+    void prepare(const size_t step, const cv::Size & windowSize, const float scale = 1.0)
+    {
+        windowSize_ = windowSize;
+        prepared_ = PreparedWaveletBank(rectangles_, step, windowSize, scale);
+    }
+
+    /**
+     * The wavelets, with their weights, means and the layout of their responses.
+     */
+    const CompiledWaveletBank & bank() const
+    {
+        return bank_;
+    }
+
+    /**
+     * The distinct rectangles of bank(), as the rectangles of the only wavelet of a bank.
+     * Their normalization is that of bank().
+     */
+    const CompiledWaveletBank & rectangles() const
+    {
+        return rectangles_;
+    }
+
+    unsigned int uniqueRectangles() const
+    {
+        return rectangles_.rectangles();
+    }
+
+    /**
+     * For each rectangle of bank(), the index of the equal rectangle in rectangles().
+     */
+    const unsigned int * columns() const
+    {
+        return columns_.data();
+    }
+
+    /**
+     * The distinct rectangles, prepared.
+     */
+    const PreparedWaveletBank & prepared() const
+    {
+        return prepared_;
+    }
+
+private:
+    typedef std::pair< std::pair<int, int>, std::pair<int, int> > Key;
+
+    CompiledWaveletBank bank_;
+    CompiledWaveletBank rectangles_;
+    AlignedBuffer<unsigned int> columns_;
+
+    cv::Size windowSize_;
+    PreparedWaveletBank prepared_; //points to rectangles_
+};
+
+
+
+#endif // HAARWAVELETSHARED_H
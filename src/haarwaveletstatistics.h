@@ -0,0 +1,297 @@
+#ifndef HAARWAVELETSTATISTICS_H
+#define HAARWAVELETSTATISTICS_H
+
+#include <cmath>
+
+#include <opencv2/core/core.hpp>
+
+#include "haarwaveletbank.h"
+#include "haarwaveletinstrumentation.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+
+
+namespace scanner
+{
+
+/**
+ * Adds c * (sum of the rectangle o) to acc[x] for each of the count windows of a row. The x-th window
+ * of the row has its top-left corner at row + x * stride.
+ */
+template <typename integral_type>
+inline void accumulateRectangle(const integral_type * row,
+                                const RectangleOffsets & o,
+                                const int stride,
+                                const int count,
+                                const double c,
+                                double * acc)
+{
+    for (int x = 0; x < count; ++x)
+    {
+        const integral_type * p = row + x * stride;
+        acc[x] += c * (((double)p[o.topLeft] + p[o.bottomRight]) - ((double)p[o.topRight] + p[o.bottomLeft]));
+    }
+}
+
+template <>
+inline void accumulateRectangle<double>(const double * row,
+                                        const RectangleOffsets & o,
+                                        const int stride,
+                                        const int count,
+                                        const double c,
+                                        double * acc)
+{
+    int x = 0;
+    if (stride == 1)
+    {
+#if defined(__AVX__)
+        const __m256d vc = _mm256_set1_pd(c);
+        for (; x + 4 <= count; x += 4)
+        {
+            const double * p = row + x;
+            const __m256d v = _mm256_sub_pd(_mm256_add_pd(_mm256_loadu_pd(p + o.topLeft),  _mm256_loadu_pd(p + o.bottomRight)),
+                                            _mm256_add_pd(_mm256_loadu_pd(p + o.topRight), _mm256_loadu_pd(p + o.bottomLeft)));
+            _mm256_storeu_pd(acc + x, _mm256_add_pd(_mm256_loadu_pd(acc + x), _mm256_mul_pd(vc, v)));
+        }
+#endif
+#if defined(__SSE2__)
+        const __m128d vc2 = _mm_set1_pd(c);
+        for (; x + 2 <= count; x += 2)
+        {
+            const double * p = row + x;
+            const __m128d v = _mm_sub_pd(_mm_add_pd(_mm_loadu_pd(p + o.topLeft),  _mm_loadu_pd(p + o.bottomRight)),
+                                         _mm_add_pd(_mm_loadu_pd(p + o.topRight), _mm_loadu_pd(p + o.bottomLeft)));
+            _mm_storeu_pd(acc + x, _mm_add_pd(_mm_loadu_pd(acc + x), _mm_mul_pd(vc2, v)));
+        }
+#endif
+    }
+
+    for (; x < count; ++x)
+    {
+        const double * p = row + x * stride;
+        acc[x] += c * ((p[o.topLeft] + p[o.bottomRight]) - (p[o.topRight] + p[o.bottomLeft]));
+    }
+}
+
+/**
+ * Rectangle sums of int integral images are exact in 32 bit arithmetic (even if the integral image itself
+ * overflows), so four windows are summed per SSE2 instruction and only then converted to double.
+ */
+template <>
+inline void accumulateRectangle<int>(const int * row,
+                                     const RectangleOffsets & o,
+                                     const int stride,
+                                     const int count,
+                                     const double c,
+                                     double * acc)
+{
+    int x = 0;
+#if defined(__SSE2__)
+    if (stride == 1)
+    {
+        const __m128d vc = _mm_set1_pd(c);
+        for (; x + 4 <= count; x += 4)
+        {
+            const int * p = row + x;
+            const __m128i v = _mm_sub_epi32(_mm_add_epi32(_mm_loadu_si128((const __m128i *)(p + o.topLeft)),
+                                                          _mm_loadu_si128((const __m128i *)(p + o.bottomRight))),
+                                            _mm_add_epi32(_mm_loadu_si128((const __m128i *)(p + o.topRight)),
+                                                          _mm_loadu_si128((const __m128i *)(p + o.bottomLeft))));
+            const __m128d low  = _mm_cvtepi32_pd(v);
+            const __m128d high = _mm_cvtepi32_pd(_mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+            _mm_storeu_pd(acc + x,     _mm_add_pd(_mm_loadu_pd(acc + x),     _mm_mul_pd(vc, low)));
+            _mm_storeu_pd(acc + x + 2, _mm_add_pd(_mm_loadu_pd(acc + x + 2), _mm_mul_pd(vc, high)));
+        }
+    }
+#endif
+
+    for (; x < count; ++x)
+    {
+        acc[x] += c * rectangleSum(row + x * stride, o);
+    }
+}
+
+}
+
+
+
+/**
+ * @brief The WindowStatisticsMap class holds the statistics used by the variance normalization (see
+ * VarianceNormalizedWaveletEvaluator) of every position of a sliding window over an image: the mean of the pixels of
+ * the window and 1 / (2 * standard deviation), or 0 if the standard deviation is 0. Element (y, x) of the maps belongs
+ * to the window whose top-left corner is (x * stride(), y * stride()), as in the response maps of the scanner.
+ *
+ * All windows are computed in a single pass over the integral images, a row of windows at a time in SIMD lanes.
+ * The maps are reused by the next compute() of the same size.
+ */
+class WindowStatisticsMap
+{
+public:
+    WindowStatisticsMap() : stride_(0) {}
+
+    /**
+     * Computes the statistics of every window of sum and squareSum.
+     * @param windowSize size of the window, before scaling.
+     * @param scale scale of the window. The scaled size is truncated, as in PreparedWaveletBank.
+     *
+     * Throws 46 if stride < 1.
+     */
+    void compute(const cv::Mat & sum, const cv::Mat & squareSum, const cv::Size & windowSize, const int stride = 1, const float scale = 1.0)
+    {
+        if (stride < 1)
+        {
+            throw 46;
+        }
+
+        windowSize_.width  = windowSize.width * scale;
+        windowSize_.height = windowSize.height * scale;
+        stride_ = stride;
+
+        const int width  = std::min(sum.cols, squareSum.cols) - 1 - windowSize_.width;
+        const int height = std::min(sum.rows, squareSum.rows) - 1 - windowSize_.height;
+        const cv::Size size = width < 0 || height < 0 ? cv::Size(0, 0) : cv::Size(width / stride + 1, height / stride + 1);
+
+        means_.create(size, cv::DataType<double>::type);
+        factors_.create(size, cv::DataType<double>::type);
+        if (!size.area())
+        {
+            return;
+        }
+
+        HAARCOMMON_TIME(STATISTICS_CYCLES);
+        HAARCOMMON_COUNT(STATISTICS, size.area());
+
+        const RectangleOffsets window = offsets(sum.step1()), squareWindow = offsets(squareSum.step1());
+        const double area = windowSize_.area();
+        AlignedBuffer<double> squares(size.width);
+
+        for (int y = 0; y < size.height; ++y)
+        {
+            double * mean = means_.ptr<double>(y);
+            double * factor = factors_.ptr<double>(y);
+
+            std::fill(mean, mean + size.width, 0.0);
+            std::fill(squares.data(), squares.data() + size.width, 0.0);
+            windowSums(sum, window, y * stride, size.width, mean);
+            windowSums(squareSum, squareWindow, y * stride, size.width, squares.data());
+
+            int x = 0;
+#if defined(__SSE2__)
+            const __m128d vArea = _mm_set1_pd(area), half = _mm_set1_pd(0.5), zero = _mm_setzero_pd();
+            const __m128d signMask = _mm_set1_pd(-0.0);
+            for (; x + 2 <= size.width; x += 2)
+            {
+                const __m128d m = _mm_div_pd(_mm_loadu_pd(mean + x), vArea);
+                const __m128d variance = _mm_andnot_pd(signMask, _mm_sub_pd(_mm_div_pd(_mm_loadu_pd(squares.data() + x), vArea),
+                                                                            _mm_mul_pd(m, m)));
+                const __m128d stdDev = _mm_sqrt_pd(variance);
+                _mm_storeu_pd(mean + x, m);
+                _mm_storeu_pd(factor + x, _mm_and_pd(_mm_div_pd(half, stdDev), _mm_cmpneq_pd(stdDev, zero)));
+            }
+#endif
+            for (; x < size.width; ++x)
+            {
+                mean[x] /= area;
+                const double stdDev = std::sqrt(std::abs(squares[x] / area - mean[x] * mean[x]));
+                factor[x] = stdDev ? 0.5 / stdDev : 0.0;
+            }
+        }
+    }
+
+    /**
+     * Size of the window, after scaling.
+     */
+    cv::Size windowSize() const
+    {
+        return windowSize_;
+    }
+
+    int stride() const
+    {
+        return stride_;
+    }
+
+    /**
+     * Amount of window positions in each direction.
+     */
+    cv::Size size() const
+    {
+        return means_.size();
+    }
+
+    /**
+     * CV_64F map of the means of the pixels of each window.
+     */
+    const cv::Mat & means() const
+    {
+        return means_;
+    }
+
+    /**
+     * CV_64F map of 1 / (2 * standard deviation of the pixels) of each window, or 0 where the standard deviation is 0.
+     */
+    const cv::Mat & factors() const
+    {
+        return factors_;
+    }
+
+    /**
+     * Position in the maps of the window whose top-left corner is origin. Throws if there is no such window.
+     */
+    cv::Point position(const cv::Point & origin) const
+    {
+        if (!stride_ || origin.x < 0 || origin.y < 0 || origin.x % stride_ || origin.y % stride_
+                || origin.x / stride_ >= means_.cols || origin.y / stride_ >= means_.rows)
+        {
+            throw 33;
+        }
+        return cv::Point(origin.x / stride_, origin.y / stride_);
+    }
+
+private:
+    RectangleOffsets offsets(const size_t step) const
+    {
+        RectangleOffsets o;
+        o.topLeft     = 0;
+        o.topRight    = windowSize_.width;
+        o.bottomLeft  = windowSize_.height * step;
+        o.bottomRight = windowSize_.height * step + windowSize_.width;
+        return o;
+    }
+
+    /**
+     * Adds the sums of count windows of the integral image s, starting at row y, to acc.
+     */
+    void windowSums(const cv::Mat & s, const RectangleOffsets & window, const int y, const int count, double * acc) const
+    {
+        switch (s.type())
+        {
+        case cv::DataType<int>::type:
+            scanner::accumulateRectangle(s.ptr<int>(y), window, stride_, count, 1.0, acc);
+            break;
+        case cv::DataType<float>::type:
+            scanner::accumulateRectangle(s.ptr<float>(y), window, stride_, count, 1.0, acc);
+            break;
+        case cv::DataType<double>::type:
+            scanner::accumulateRectangle(s.ptr<double>(y), window, stride_, count, 1.0, acc);
+            break;
+        default:
+            throw 31;
+        }
+    }
+
+    cv::Size windowSize_;
+    int stride_;
+    cv::Mat means_;
+    cv::Mat factors_;
+};
+
+
+
+#endif // HAARWAVELETSTATISTICS_H
@@ -0,0 +1,764 @@
+#include "haarwavelettext.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+#include <locale.h>
+
+#include "haarwaveletinstrumentation.h"
+
+
+
+namespace
+{
+
+/**
+ * Makes the calling thread use the "C" locale while in scope, so that strtof and snprintf read and write floats
+ * with a '.' whatever LC_NUMERIC is. The locale is created once.
+ */
+class ScopedCLocale
+{
+public:
+    ScopedCLocale() : previous_(uselocale(locale())) {}
+
+    ~ScopedCLocale()
+    {
+        uselocale(previous_);
+    }
+
+private:
+    ScopedCLocale(const ScopedCLocale &);
+    ScopedCLocale & operator=(const ScopedCLocale &);
+
+    static locale_t locale()
+    {
+        static const locale_t c = newlocale(LC_ALL_MASK, "C", (locale_t) 0);
+        return c;
+    }
+
+    const locale_t previous_;
+};
+
+/**
+ * Reads the fields of one record at a time, keeping track of the position for error messages.
+ */
+class Parser
+{
+public:
+    Parser(const char *begin, const char *end) : position_(begin), end_(end), line_(1), lineBegin_(begin) {}
+
+    /**
+     * Skips blank lines. Returns false at the end of the input.
+     */
+    bool nextRecord()
+    {
+        while (position_ != end_)
+        {
+            skipSpaces();
+            if (position_ == end_)
+            {
+                break;
+            }
+            if (*position_ != '\n')
+            {
+                return true;
+            }
+            newLine();
+        }
+        return false;
+    }
+
+    /**
+     * Consumes the end of the current record. Fails if something other than blanks follows it.
+     */
+    bool endRecord()
+    {
+        skipSpaces();
+        if (position_ == end_)
+        {
+            return true;
+        }
+        if (*position_ != '\n')
+        {
+            return fail("unexpected data after the end of the wavelet");
+        }
+        newLine();
+        return true;
+    }
+
+    bool readInt(int &value)
+    {
+        const char *token = startToken();
+        const char *p = token;
+        const bool negative = p != end_ && *p == '-';
+        if (p != end_ && (*p == '-' || *p == '+'))
+        {
+            ++p;
+        }
+        long long result = 0;
+        const char *digits = p;
+        while (p != end_ && *p >= '0' && *p <= '9' && p - digits < 10)
+        {
+            result = result * 10 + (*p - '0');
+            ++p;
+        }
+        if (p == digits || !delimited(p) || result > 2147483647ll + negative)
+        {
+            return fail("expected an integer");
+        }
+        value = (int) (negative ? -result : result);
+        position_ = p;
+        return true;
+    }
+
+    bool readFloat(float &value)
+    {
+        const char *p = startToken();
+        const bool negative = p != end_ && *p == '-';
+        if (p != end_ && (*p == '-' || *p == '+'))
+        {
+            ++p;
+        }
+        const char *number = p;
+
+        //Infinities and NaNs, as appendFloat() writes them
+        if (end_ - p >= 3 && (std::equal(p, p + 3, "inf") || std::equal(p, p + 3, "nan")) && delimited(p + 3))
+        {
+            value = *p == 'i' ? std::numeric_limits<float>::infinity() : std::numeric_limits<float>::quiet_NaN();
+            if (negative)
+            {
+                value = -value;
+            }
+            position_ = p + 3;
+            return true;
+        }
+
+        //Accumulates up to 19 significant digits; the fast path below only uses exact mantissas.
+        unsigned long long mantissa = 0;
+        int digits = 0, exponent = 0;
+        bool exact = true, any = false;
+        for (; p != end_ && *p >= '0' && *p <= '9'; ++p, any = true)
+        {
+            accumulate(*p, mantissa, digits, exponent, exact, false);
+        }
+        if (p != end_ && *p == '.')
+        {
+            for (++p; p != end_ && *p >= '0' && *p <= '9'; ++p, any = true)
+            {
+                accumulate(*p, mantissa, digits, exponent, exact, true);
+            }
+        }
+        if (!any)
+        {
+            return fail("expected a number");
+        }
+        if (p != end_ && (*p == 'e' || *p == 'E'))
+        {
+            ++p;
+            const bool negativeExponent = p != end_ && *p == '-';
+            if (p != end_ && (*p == '-' || *p == '+'))
+            {
+                ++p;
+            }
+            int e = 0;
+            const char *expDigits = p;
+            for (; p != end_ && *p >= '0' && *p <= '9'; ++p)
+            {
+                e = e < 100000 ? e * 10 + (*p - '0') : e;
+            }
+            if (p == expDigits)
+            {
+                return fail("expected a number");
+            }
+            exponent += negativeExponent ? -e : e;
+        }
+        if (!delimited(p))
+        {
+            return fail("expected a number");
+        }
+
+        //Both the mantissa and the power of ten are exact in a float, so a single, correctly rounded operation
+        //gives the nearest float. Otherwise strtof does the rounding, in the "C" locale, and must read the whole
+        //number as validated above.
+        static const float powers[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+        if (exact && mantissa <= (1ull << 24) && exponent >= -10 && exponent <= 10)
+        {
+            value = exponent < 0 ? (float) mantissa / powers[-exponent] : (float) mantissa * powers[exponent];
+        }
+        else
+        {
+            char buffer[64];
+            std::string longNumber;
+            const size_t length = p - number;
+            const char *text = buffer;
+            if (length < sizeof(buffer))
+            {
+                std::memcpy(buffer, number, length);
+                buffer[length] = '\0';
+            }
+            else
+            {
+                longNumber.assign(number, p);
+                text = longNumber.c_str();
+            }
+
+            const ScopedCLocale locale;
+            char *parsed = 0;
+            value = strtof(text, &parsed);
+            if (parsed != text + length)
+            {
+                return fail("expected a number");
+            }
+        }
+        if (negative)
+        {
+            value = -value;
+        }
+        position_ = p;
+        return true;
+    }
+
+    bool fail(const char *message)
+    {
+        error_.line = line_;
+        error_.column = position_ - lineBegin_ + 1;
+        error_.message = message;
+        return false;
+    }
+
+    const TextFormatError & error() const
+    {
+        return error_;
+    }
+
+    /**
+     * Counts the lines left, to reserve space for the wavelets.
+     */
+    size_t lines() const
+    {
+        size_t count = 0;
+        for (const char *p = position_; (p = static_cast<const char *>(std::memchr(p, '\n', end_ - p))); ++p)
+        {
+            ++count;
+        }
+        return count + 1;
+    }
+
+private:
+    static void accumulate(const char c, unsigned long long &mantissa, int &digits, int &exponent,
+                           bool &exact, const bool fraction)
+    {
+        if (digits < 19)
+        {
+            if (mantissa || c != '0')
+            {
+                mantissa = mantissa * 10 + (c - '0');
+                ++digits;
+            }
+            exponent -= fraction;
+        }
+        else
+        {
+            exact = exact && c == '0';
+            exponent += !fraction;
+        }
+    }
+
+    const char * startToken()
+    {
+        skipSpaces();
+        return position_;
+    }
+
+    bool delimited(const char *p) const
+    {
+        return p == end_ || *p == ' ' || *p == '\t' || *p == '\r' || *p == '\n';
+    }
+
+    void skipSpaces()
+    {
+        while (position_ != end_ && (*position_ == ' ' || *position_ == '\t' || *position_ == '\r'))
+        {
+            ++position_;
+        }
+    }
+
+    void newLine()
+    {
+        ++position_;
+        ++line_;
+        lineBegin_ = position_;
+    }
+
+    const char *position_;
+    const char *end_;
+    unsigned int line_;
+    const char *lineBegin_;
+    TextFormatError error_;
+};
+
+
+
+/**
+ * Reads the rectangle count and the rectangles of a record, with values floats after each rectangle.
+ */
+bool readRectangles(Parser &parser, std::vector<cv::Rect> &rects, std::vector<float> *values[], const int valueCount)
+{
+    int rectangles;
+    if (!parser.readInt(rectangles))
+    {
+        return false;
+    }
+    if (rectangles <= 0)
+    {
+        return parser.fail("a wavelet needs at least one rectangle");
+    }
+
+    rects.resize(rectangles);
+    for (int v = 0; v < valueCount; ++v)
+    {
+        values[v]->resize(rectangles);
+    }
+
+    for (int i = 0; i < rectangles; ++i)
+    {
+        cv::Rect &r = rects[i];
+        if (!parser.readInt(r.x) || !parser.readInt(r.y) || !parser.readInt(r.width) || !parser.readInt(r.height))
+        {
+            return false;
+        }
+        if (r.width <= 0 || r.height <= 0)
+        {
+            return parser.fail("rectangles must have positive width and height");
+        }
+        for (int v = 0; v < valueCount; ++v)
+        {
+            if (!parser.readFloat((*values[v])[i]))
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Vectors reused by all records to hold the fields of the one being parsed.
+ */
+struct Fields
+{
+    std::vector<cv::Rect> rects;
+    std::vector<float> weights;
+    std::vector<float> second; //means or negative weights
+};
+
+/**
+ * Reads the fields of one wavelet and appends it to wavelets.
+ */
+bool readWavelet(Parser &parser, Fields &fields, std::vector<HaarWavelet> &wavelets)
+{
+    std::vector<float> *values[] = {&fields.weights};
+    if (!readRectangles(parser, fields.rects, values, 1))
+    {
+        return false;
+    }
+    wavelets.push_back(HaarWavelet(fields.rects, fields.weights));
+    return true;
+}
+
+bool readWavelet(Parser &parser, Fields &fields, std::vector<MyHaarWavelet> &wavelets)
+{
+    std::vector<float> *values[] = {&fields.weights};
+    if (!readRectangles(parser, fields.rects, values, 1))
+    {
+        return false;
+    }
+    fields.second.resize(fields.rects.size());
+    for (unsigned int i = 0; i < fields.second.size(); ++i)
+    {
+        if (!parser.readFloat(fields.second[i]))
+        {
+            return false;
+        }
+    }
+    wavelets.push_back(MyHaarWavelet(fields.rects, fields.weights, fields.second));
+    return true;
+}
+
+bool readWavelet(Parser &parser, Fields &fields, std::vector<DualWeightHaarWavelet> &wavelets)
+{
+    std::vector<float> *values[] = {&fields.weights, &fields.second};
+    if (!readRectangles(parser, fields.rects, values, 2))
+    {
+        return false;
+    }
+    wavelets.push_back(DualWeightHaarWavelet(fields.rects, fields.weights, fields.second));
+    return true;
+}
+
+template <typename HaarWaveletType>
+bool parse(const char *begin, const char *end, std::vector<HaarWaveletType> &wavelets, TextFormatError *error)
+{
+    HAARCOMMON_TIME(PARSING_CYCLES);
+    HAARCOMMON_COUNT(BYTES_PARSED, end - begin);
+
+    const size_t previousSize = wavelets.size();
+    Parser parser(begin, end);
+    wavelets.reserve(previousSize + parser.lines());
+    Fields fields;
+
+    while (parser.nextRecord())
+    {
+        if (!readWavelet(parser, fields, wavelets) || !parser.endRecord())
+        {
+            wavelets.resize(previousSize);
+            if (error)
+            {
+                *error = parser.error();
+            }
+            return false;
+        }
+    }
+    HAARCOMMON_COUNT(WAVELETS_PARSED, wavelets.size() - previousSize);
+    return true;
+}
+
+
+
+/**
+ * 10^exponent. Exact for exponents up to 22.
+ */
+double power(const int exponent)
+{
+    static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    return exponent >= 0 && exponent <= 22 ? powers[exponent] : std::pow(10.0, exponent);
+}
+
+void appendInt(std::string &output, const int value)
+{
+    char buffer[16];
+    char *p = buffer + sizeof(buffer);
+    unsigned int u = value < 0 ? 0u - (unsigned int) value : (unsigned int) value;
+    do
+    {
+        *--p = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    if (value < 0)
+    {
+        *--p = '-';
+    }
+    output.append(p, buffer + sizeof(buffer));
+}
+
+/**
+ * Appends the shortest representation of value that parses back to it. Candidates with increasing amounts of
+ * significant digits are generated with double arithmetic; the chosen one is then verified with strtof, falling
+ * back to 9 digits (always enough for a float) in the unlikely case the double arithmetic misled the search. Both
+ * are done in the "C" locale. Zeros, infinities and NaNs are written as 0, inf and nan, with their sign.
+ */
+void appendFloat(std::string &output, const float value)
+{
+    char buffer[32];
+    if (value == 0 || value != value || value - value != 0) //zero, NaN or infinity
+    {
+        if (std::signbit(value))
+        {
+            output += '-';
+        }
+        output += value == 0 ? "0" : value != value ? "nan" : "inf";
+        return;
+    }
+
+    const double magnitude = std::abs((double) value);
+    int exponent = (int) std::floor(std::log10(magnitude));
+    if (power(exponent) > magnitude)
+    {
+        --exponent;
+    }
+    else if (power(exponent + 1) <= magnitude)
+    {
+        ++exponent;
+    }
+
+    long long digits = 0;
+    int scale = 0; //value = digits * 10^scale
+    bool exact = false;
+    for (int precision = 1; precision <= 9; ++precision)
+    {
+        scale = exponent - precision + 1;
+        const double scaled = scale < 0 ? magnitude * power(-scale) : magnitude / power(scale);
+        digits = (long long) scaled;
+        digits += scaled - digits >= .5;
+
+        //Within the parser's fast path the check is a single, correctly rounded float operation.
+        exact = digits <= (1ll << 24) && scale >= -10 && scale <= 10;
+        const float parsed = exact ? (scale < 0 ? (float) digits / (float) power(-scale) : (float) digits * (float) power(scale))
+                                   : (float) (scale < 0 ? digits / power(-scale) : digits * power(scale));
+        if (parsed == (float) magnitude)
+        {
+            break;
+        }
+    }
+    while (digits % 10 == 0)
+    {
+        digits /= 10;
+        ++scale;
+    }
+
+    char digitsText[24];
+    char *end = digitsText + sizeof(digitsText);
+    char *begin = end;
+    for (long long d = digits; d; d /= 10)
+    {
+        *--begin = '0' + d % 10;
+    }
+    const int length = end - begin;
+    std::copy(begin, end, digitsText);
+    const int point = length + scale; //position of the decimal point within digitsText
+
+    char *p = buffer;
+    if (value < 0)
+    {
+        *p++ = '-';
+    }
+    if (scale >= 0 && point <= 9)
+    {
+        p = std::copy(digitsText, digitsText + length, p);
+        std::fill_n(p, scale, '0');
+        p += scale;
+    }
+    else if (scale < 0 && point > 0)
+    {
+        p = std::copy(digitsText, digitsText + point, p);
+        *p++ = '.';
+        p = std::copy(digitsText + point, digitsText + length, p);
+    }
+    else if (scale < 0 && point > -4)
+    {
+        *p++ = '0';
+        *p++ = '.';
+        std::fill_n(p, -point, '0');
+        p -= point;
+        p = std::copy(digitsText, digitsText + length, p);
+    }
+    else
+    {
+        *p++ = digitsText[0];
+        if (length > 1)
+        {
+            *p++ = '.';
+            p = std::copy(digitsText + 1, digitsText + length, p);
+        }
+        p += snprintf(p, buffer + sizeof(buffer) - p, "e%d", point - 1);
+    }
+    *p = '\0';
+
+    if (!exact)
+    {
+        const ScopedCLocale locale;
+        if (strtof(buffer, 0) != value)
+        {
+            output.append(buffer, snprintf(buffer, sizeof(buffer), "%.9g", value));
+            return;
+        }
+    }
+    output.append(buffer, p);
+}
+
+void appendRectangle(std::string &output, const cv::Rect &r)
+{
+    output += ' ';
+    appendInt(output, r.x);
+    output += ' ';
+    appendInt(output, r.y);
+    output += ' ';
+    appendInt(output, r.width);
+    output += ' ';
+    appendInt(output, r.height);
+    output += ' ';
+}
+
+void appendWavelet(std::string &output, const HaarWavelet &w)
+{
+    appendInt(output, w.dimensions());
+    for (unsigned int i = 0; i < w.dimensions(); ++i)
+    {
+        appendRectangle(output, w.rect(i));
+        appendFloat(output, w.weight(i));
+    }
+}
+
+void appendWavelet(std::string &output, const MyHaarWavelet &w)
+{
+    appendWavelet(output, static_cast<const HaarWavelet &>(w));
+    for (std::vector<float>::const_iterator it = w.means_begin(); it != w.means_end(); ++it)
+    {
+        output += ' ';
+        appendFloat(output, *it);
+    }
+}
+
+void appendWavelet(std::string &output, const DualWeightHaarWavelet &w)
+{
+    appendInt(output, w.dimensions());
+    std::vector<float>::const_iterator positive = w.weightsPositive_begin();
+    std::vector<float>::const_iterator negative = w.weightsNegative_begin();
+    for (std::vector<cv::Rect>::const_iterator r = w.rects_begin(); r != w.rects_end(); ++r, ++positive, ++negative)
+    {
+        appendRectangle(output, *r);
+        appendFloat(output, *positive);
+        output += ' ';
+        appendFloat(output, *negative);
+    }
+}
+
+template <typename HaarWaveletType>
+void format(const std::vector<HaarWaveletType> &wavelets, std::string &output)
+{
+    //a rough guess of 24 bytes per rectangle
+    size_t rectangles = 0;
+    for (typename std::vector<HaarWaveletType>::const_iterator it = wavelets.begin(); it != wavelets.end(); ++it)
+    {
+        rectangles += it->dimensions();
+    }
+    output.reserve(output.size() + wavelets.size() * 4 + rectangles * 24);
+
+    for (typename std::vector<HaarWaveletType>::const_iterator it = wavelets.begin(); it != wavelets.end(); ++it)
+    {
+        if (it->dimensions() == 0) //won't store a meaningless wavelet
+        {
+            continue;
+        }
+        appendWavelet(output, *it);
+        output += '\n';
+    }
+}
+
+
+
+template <typename HaarWaveletType>
+bool load(const std::string &filename, std::vector<HaarWaveletType> &wavelets, TextFormatError *error)
+{
+    std::ifstream ifs;
+    ifs.open(filename.c_str(), std::ifstream::in | std::ifstream::binary);
+
+    if (!ifs.is_open())
+    {
+        if (error)
+        {
+            *error = TextFormatError();
+            error->message = "couldn't open the file";
+        }
+        return false;
+    }
+
+    ifs.seekg(0, std::ifstream::end);
+    const std::streamoff size = ifs.tellg();
+    ifs.seekg(0, std::ifstream::beg);
+
+    std::vector<char> buffer(size > 0 ? size : 0);
+    if (size > 0 && !ifs.read(&buffer[0], size))
+    {
+        if (error)
+        {
+            *error = TextFormatError();
+            error->message = "couldn't read the file";
+        }
+        return false;
+    }
+    ifs.close();
+
+    const char *begin = buffer.empty() ? 0 : &buffer[0];
+    return parse(begin, begin + buffer.size(), wavelets, error);
+}
+
+template <typename HaarWaveletType>
+bool write(const std::string &filename, const std::vector<HaarWaveletType> &wavelets)
+{
+    std::string buffer;
+    format(wavelets, buffer);
+
+    std::ofstream ofs;
+    ofs.open(filename.c_str(), std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+
+    if (!ofs.is_open())
+    {
+        return false;
+    }
+
+    ofs.write(buffer.data(), buffer.size());
+    ofs.close();
+
+    return !ofs.fail();
+}
+
+}
+
+
+
+bool parseHaarWavelets(const char *begin, const char *end, std::vector<HaarWavelet> &wavelets, TextFormatError *error)
+{
+    return parse(begin, end, wavelets, error);
+}
+
+bool parseHaarWavelets(const char *begin, const char *end, std::vector<MyHaarWavelet> &wavelets, TextFormatError *error)
+{
+    return parse(begin, end, wavelets, error);
+}
+
+bool parseHaarWavelets(const char *begin, const char *end, std::vector<DualWeightHaarWavelet> &wavelets, TextFormatError *error)
+{
+    return parse(begin, end, wavelets, error);
+}
+
+void formatHaarWavelets(const std::vector<HaarWavelet> &wavelets, std::string &output)
+{
+    format(wavelets, output);
+}
+
+void formatHaarWavelets(const std::vector<MyHaarWavelet> &wavelets, std::string &output)
+{
+    format(wavelets, output);
+}
+
+void formatHaarWavelets(const std::vector<DualWeightHaarWavelet> &wavelets, std::string &output)
+{
+    format(wavelets, output);
+}
+
+bool loadHaarWaveletsStrict(const std::string &filename, std::vector<HaarWavelet> &wavelets, TextFormatError *error)
+{
+    return load(filename, wavelets, error);
+}
+
+bool loadHaarWaveletsStrict(const std::string &filename, std::vector<MyHaarWavelet> &wavelets, TextFormatError *error)
+{
+    return load(filename, wavelets, error);
+}
+
+bool loadHaarWaveletsStrict(const std::string &filename, std::vector<DualWeightHaarWavelet> &wavelets, TextFormatError *error)
+{
+    return load(filename, wavelets, error);
+}
+
+bool writeHaarWaveletsFast(const std::string &filename, const std::vector<HaarWavelet> &wavelets)
+{
+    return write(filename, wavelets);
+}
+
+bool writeHaarWaveletsFast(const std::string &filename, const std::vector<MyHaarWavelet> &wavelets)
+{
+    return write(filename, wavelets);
+}
+
+bool writeHaarWaveletsFast(const std::string &filename, const std::vector<DualWeightHaarWavelet> &wavelets)
+{
+    return write(filename, wavelets);
+}
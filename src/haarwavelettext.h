@@ -0,0 +1,66 @@
+#ifndef HAARWAVELETTEXT_H
+#define HAARWAVELETTEXT_H
+
+#include <string>
+#include <vector>
+
+#include "haarwavelet.h"
+
+
+
+/**
+ * @brief The TextFormatError struct describes the first malformed record found by parseHaarWavelets.
+ */
+struct TextFormatError
+{
+    TextFormatError() : line(0), column(0) {}
+
+    unsigned int line;   //1-based; 0 if the file couldn't be read
+    unsigned int column; //1-based, in bytes
+    std::string message;
+};
+
+
+
+/**
+ * Parses wavelets stored in the text format of HaarWavelet::write (respectively MyHaarWavelet::write and
+ * DualWeightHaarWavelet::write), one per line, appending them to wavelets. Unlike HaarWavelet::read, parsing is
+ * strict and independent of the locale: each non-blank line must hold exactly one complete wavelet with at least
+ * one rectangle of positive size. On failure, wavelets is left as it was, error (if given) describes the problem
+ * and false is returned.
+ */
+bool parseHaarWavelets(const char *begin, const char *end, std::vector<HaarWavelet> &wavelets,
+                       TextFormatError *error = 0);
+bool parseHaarWavelets(const char *begin, const char *end, std::vector<MyHaarWavelet> &wavelets,
+                       TextFormatError *error = 0);
+bool parseHaarWavelets(const char *begin, const char *end, std::vector<DualWeightHaarWavelet> &wavelets,
+                       TextFormatError *error = 0);
+
+/**
+ * Appends wavelets to output in the text format, one per line. Floats are written with the fewest digits that
+ * parse back to exactly the same value. Wavelets without rectangles are skipped, as HaarWavelet::write does.
+ */
+void formatHaarWavelets(const std::vector<HaarWavelet> &wavelets, std::string &output);
+void formatHaarWavelets(const std::vector<MyHaarWavelet> &wavelets, std::string &output);
+void formatHaarWavelets(const std::vector<DualWeightHaarWavelet> &wavelets, std::string &output);
+
+/**
+ * Reads the whole file into memory, then parses it with parseHaarWavelets.
+ */
+bool loadHaarWaveletsStrict(const std::string &filename, std::vector<HaarWavelet> &wavelets,
+                            TextFormatError *error = 0);
+bool loadHaarWaveletsStrict(const std::string &filename, std::vector<MyHaarWavelet> &wavelets,
+                            TextFormatError *error = 0);
+bool loadHaarWaveletsStrict(const std::string &filename, std::vector<DualWeightHaarWavelet> &wavelets,
+                            TextFormatError *error = 0);
+
+/**
+ * Formats the wavelets into a single buffer with formatHaarWavelets, then writes it at once.
+ */
+bool writeHaarWaveletsFast(const std::string &filename, const std::vector<HaarWavelet> &wavelets);
+bool writeHaarWaveletsFast(const std::string &filename, const std::vector<MyHaarWavelet> &wavelets);
+bool writeHaarWaveletsFast(const std::string &filename, const std::vector<DualWeightHaarWavelet> &wavelets);
+
+
+
+#endif // HAARWAVELETTEXT_H
@@ -0,0 +1,362 @@
+#include "haarwavelettraining.h"
+
+#include <algorithm>
+#include <limits>
+
+
+
+namespace
+{
+
+/**
+ * Orders sample indices by response, then by index.
+ */
+class ResponseOrder
+{
+public:
+    explicit ResponseOrder(const float * values_) : values(values_) {}
+
+    bool operator()(const unsigned int a, const unsigned int b) const
+    {
+        return values[a] < values[b] || (values[a] == values[b] && a < b);
+    }
+
+private:
+    const float * values;
+};
+
+unsigned int zigzag(const int delta)
+{
+    return ((unsigned int)delta << 1) ^ (unsigned int)(delta >> 31);
+}
+
+int unzigzag(const unsigned int value)
+{
+    return (int)(value >> 1) ^ -(int)(value & 1);
+}
+
+/**
+ * Readers of the encodings of the sorted orders. next() returns the index of the next sample.
+ */
+struct Direct16Reader
+{
+    explicit Direct16Reader(const unsigned char * data) : p(reinterpret_cast<const unsigned short *>(data)) {}
+    unsigned int next() { return *p++; }
+    const unsigned short * p;
+};
+
+struct Delta16Reader
+{
+    explicit Delta16Reader(const unsigned char * data) : p(reinterpret_cast<const unsigned short *>(data)), last(0) {}
+    unsigned int next() { return last += unzigzag(*p++); }
+    const unsigned short * p;
+    unsigned int last;
+};
+
+struct Direct32Reader
+{
+    explicit Direct32Reader(const unsigned char * data) : p(reinterpret_cast<const unsigned int *>(data)) {}
+    unsigned int next() { return *p++; }
+    const unsigned int * p;
+};
+
+}
+
+
+
+class SortedFeatureIndex::SortBody : public cv::ParallelLoopBody
+{
+public:
+    explicit SortBody(SortedFeatureIndex & index_) : index(index_) {}
+
+    void operator()(const cv::Range & range) const
+    {
+        for (int f = range.start; f < range.end; ++f)
+        {
+            index.sort(f);
+        }
+    }
+
+private:
+    SortedFeatureIndex & index;
+};
+
+class SortedFeatureIndex::SearchBody : public cv::ParallelLoopBody
+{
+public:
+    SearchBody(const SortedFeatureIndex & index_,
+               const std::vector<float> & weights_,
+               const std::vector<int> & labels_,
+               std::vector<DecisionStump> & stumps_) : index(index_),
+                                                       weights(weights_),
+                                                       labels(labels_),
+                                                       stumps(stumps_) {}
+
+    void operator()(const cv::Range & range) const
+    {
+        for (int f = range.start; f < range.end; ++f)
+        {
+            stumps[f] = index.bestStump(f, weights, labels);
+        }
+    }
+
+private:
+    const SortedFeatureIndex & index;
+    const std::vector<float> & weights;
+    const std::vector<int> & labels;
+    std::vector<DecisionStump> & stumps;
+};
+
+
+
+SortedFeatureIndex::SortedFeatureIndex() : outputs_(1) {}
+
+SortedFeatureIndex::SortedFeatureIndex(const cv::Mat & features, const bool columns, const unsigned int outputs)
+{
+    build(features, columns, outputs);
+}
+
+unsigned int SortedFeatureIndex::features() const
+{
+    return values_.rows;
+}
+
+unsigned int SortedFeatureIndex::samples() const
+{
+    return values_.cols;
+}
+
+unsigned int SortedFeatureIndex::outputs() const
+{
+    return outputs_;
+}
+
+const cv::Mat & SortedFeatureIndex::values() const
+{
+    return values_;
+}
+
+SortedFeatureIndex::Encoding SortedFeatureIndex::encoding(const unsigned int feature) const
+{
+    return (Encoding)encodings_[feature];
+}
+
+void SortedFeatureIndex::order(const unsigned int feature, unsigned int * order) const
+{
+    const unsigned char * data = orders_[feature].data();
+    switch (encodings_[feature])
+    {
+    case DIRECT16:
+    {
+        Direct16Reader reader(data);
+        for (unsigned int i = 0; i < samples(); ++i)
+        {
+            order[i] = reader.next();
+        }
+        break;
+    }
+    case DELTA16:
+    {
+        Delta16Reader reader(data);
+        for (unsigned int i = 0; i < samples(); ++i)
+        {
+            order[i] = reader.next();
+        }
+        break;
+    }
+    default:
+    {
+        Direct32Reader reader(data);
+        for (unsigned int i = 0; i < samples(); ++i)
+        {
+            order[i] = reader.next();
+        }
+        break;
+    }
+    }
+}
+
+size_t SortedFeatureIndex::bytes() const
+{
+    size_t total = 0;
+    for (std::vector< AlignedBuffer<unsigned char> >::const_iterator it = orders_.begin(); it != orders_.end(); ++it)
+    {
+        total += it->size();
+    }
+    return total;
+}
+
+DecisionStump SortedFeatureIndex::bestStump(const unsigned int feature, const std::vector<float> & weights, const std::vector<int> & labels) const
+{
+    check(weights, labels);
+    if (feature >= features())
+    {
+        throw 42;
+    }
+
+    const unsigned char * data = orders_[feature].data();
+    switch (encodings_[feature])
+    {
+    case DIRECT16:
+        return search(feature, Direct16Reader(data), &weights[0], &labels[0]);
+    case DELTA16:
+        return search(feature, Delta16Reader(data), &weights[0], &labels[0]);
+    default:
+        return search(feature, Direct32Reader(data), &weights[0], &labels[0]);
+    }
+}
+
+DecisionStump SortedFeatureIndex::bestStump(const std::vector<float> & weights, const std::vector<int> & labels) const
+{
+    check(weights, labels);
+
+    std::vector<DecisionStump> stumps(features());
+    cv::parallel_for_(cv::Range(0, features()), SearchBody(*this, weights, labels, stumps));
+
+    DecisionStump best;
+    best.error = std::numeric_limits<double>::infinity();
+    for (std::vector<DecisionStump>::const_iterator it = stumps.begin(); it != stumps.end(); ++it)
+    {
+        if (it->error < best.error)
+        {
+            best = *it;
+        }
+    }
+    return best;
+}
+
+void SortedFeatureIndex::build(const cv::Mat & features, const bool columns, const unsigned int outputs)
+{
+    if (features.type() != cv::DataType<float>::type || !outputs)
+    {
+        throw 42;
+    }
+    outputs_ = outputs;
+
+    if (columns)
+    {
+        values_ = features.clone();
+    }
+    else
+    {
+        values_.create(features.cols, features.rows, cv::DataType<float>::type);
+        for (int i = 0; i < features.rows; ++i)
+        {
+            const float * row = features.ptr<float>(i);
+            for (int f = 0; f < features.cols; ++f)
+            {
+                values_.at<float>(f, i) = row[f];
+            }
+        }
+    }
+
+    encodings_.assign(values_.rows, DIRECT32);
+    orders_.assign(values_.rows, AlignedBuffer<unsigned char>());
+    cv::parallel_for_(cv::Range(0, values_.rows), SortBody(*this));
+}
+
+void SortedFeatureIndex::sort(const unsigned int feature)
+{
+    const unsigned int n = samples();
+    std::vector<unsigned int> order(n);
+    for (unsigned int i = 0; i < n; ++i)
+    {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), ResponseOrder(values_.ptr<float>(feature)));
+
+    Encoding encoding = n <= 65536u ? DIRECT16 : DELTA16;
+    for (unsigned int i = 0, last = 0; i < n && encoding == DELTA16; last = order[i++])
+    {
+        if (zigzag((int)(order[i] - last)) > std::numeric_limits<unsigned short>::max())
+        {
+            encoding = DIRECT32;
+        }
+    }
+
+    AlignedBuffer<unsigned char> & buffer = orders_[feature];
+    encodings_[feature] = encoding;
+    if (encoding == DIRECT32)
+    {
+        buffer.resize(n * sizeof(unsigned int));
+        std::copy(order.begin(), order.end(), reinterpret_cast<unsigned int *>(buffer.data()));
+        return;
+    }
+
+    buffer.resize(n * sizeof(unsigned short));
+    unsigned short * p = reinterpret_cast<unsigned short *>(buffer.data());
+    for (unsigned int i = 0, last = 0; i < n; last = order[i++])
+    {
+        p[i] = encoding == DIRECT16 ? order[i] : zigzag((int)(order[i] - last));
+    }
+}
+
+void SortedFeatureIndex::check(const std::vector<float> & weights, const std::vector<int> & labels) const
+{
+    if (weights.size() != samples() || labels.size() != samples() || !samples())
+    {
+        throw 42;
+    }
+}
+
+/**
+ * With the samples sorted by response, the k lowest ones are below the threshold that lies between the k-th and the
+ * (k+1)-th, so the error of every threshold follows from the weights of the positives and negatives seen so far.
+ * Thresholds are only taken between different responses, and are the response of the first sample above them.
+ */
+template <typename Reader>
+DecisionStump SortedFeatureIndex::search(const unsigned int feature, Reader reader, const float * weights, const int * labels) const
+{
+    const float * values = values_.ptr<float>(feature);
+    const unsigned int n = samples();
+
+    double positives = 0.0, negatives = 0.0;
+    for (unsigned int i = 0; i < n; ++i)
+    {
+        (labels[i] ? positives : negatives) += weights[i];
+    }
+
+    DecisionStump best;
+    best.feature = feature;
+    best.wavelet = feature / outputs_;
+    best.output = feature % outputs_;
+    best.error = std::numeric_limits<double>::infinity();
+
+    double positivesBelow = 0.0, negativesBelow = 0.0;
+    float previous = 0;
+    for (unsigned int k = 0; k <= n; ++k)
+    {
+        unsigned int i = 0;
+        float value = std::numeric_limits<float>::infinity();
+        if (k < n)
+        {
+            i = reader.next();
+            value = values[i];
+        }
+
+        if (k == 0 || k == n || previous < value)
+        {
+            const double positiveBelow = (positives - positivesBelow) + negativesBelow;
+            const double positiveAbove = positivesBelow + (negatives - negativesBelow);
+            if (positiveBelow < best.error)
+            {
+                best.error = positiveBelow;
+                best.threshold = value;
+                best.positiveBelow = true;
+            }
+            if (positiveAbove < best.error)
+            {
+                best.error = positiveAbove;
+                best.threshold = value;
+                best.positiveBelow = false;
+            }
+        }
+
+        if (k < n)
+        {
+            (labels[i] ? positivesBelow : negativesBelow) += weights[i];
+            previous = value;
+        }
+    }
+    return best;
+}
@@ -0,0 +1,137 @@
+#ifndef HAARWAVELETTRAINING_H
+#define HAARWAVELETTRAINING_H
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "haarwaveletbank.h"
+#include "haarwaveletdataset.h"
+
+
+
+/**
+ * @brief The DecisionStump struct is the best single threshold found for a feature: samples whose response is below
+ * threshold are classified as positive if positiveBelow, else as negative, and the other way round.
+ */
+struct DecisionStump
+{
+    DecisionStump() : feature(0), wavelet(0), output(0), threshold(0), positiveBelow(false), error(0) {}
+
+    unsigned int feature; //wavelet * outputs + output
+    unsigned int wavelet;
+    unsigned int output;  //0, or 1 for the negative weights of a DualWeightHaarWavelet
+    float threshold;
+    bool positiveBelow;
+    double error;         //weight of the misclassified samples
+};
+
+
+
+/**
+ * @brief The SortedFeatureIndex class holds the responses of a bank to a set of samples together with, for each
+ * feature, the samples sorted by response. Sorting is done once, when the index is built, so that each boosting
+ * round only needs one linear pass per feature to find its best threshold for the current sample weights.
+ *
+ * Features are the outputs of the bank: one per HaarWavelet or MyHaarWavelet, two per DualWeightHaarWavelet
+ * (positive and negative weights), in the order of the results of the evaluators.
+ *
+ * The sorted order of each feature is stored in the narrowest of these encodings:
+ * - DIRECT16: 16 bit sample indices (up to 65536 samples),
+ * - DELTA16: 16 bit differences between consecutive sample indices, zigzag encoded, when they all fit,
+ * - DIRECT32: 32 bit sample indices.
+ * Sample sets whose order is partly preserved by the features (e.g. sorted by label or by source image) thus stay
+ * at 16 bits per sample past 65536 samples.
+ *
+ * Mismatched weights or labels throw 42.
+ */
+class SortedFeatureIndex
+{
+public:
+    enum Encoding
+    {
+        DIRECT16,
+        DELTA16,
+        DIRECT32
+    };
+
+    SortedFeatureIndex();
+
+    /**
+     * Evaluates bank over the samples whose integral images are sums and squareSums (see extractFeatures()) and
+     * sorts the responses of each feature, in parallel.
+     */
+    template <typename Evaluator>
+    SortedFeatureIndex(const Evaluator & evaluator,
+                       const CompiledWaveletBank & bank,
+                       const std::vector<cv::Mat> & sums,
+                       const std::vector<cv::Mat> & squareSums)
+    {
+        cv::Mat features;
+        extractFeatures(evaluator, bank, sums, squareSums, features);
+        build(features, false, bank.outputs());
+    }
+
+    /**
+     * Sorts the responses of each feature, in parallel.
+     * @param features CV_32F matrix of responses. Row i holds the responses of all features to the i-th sample
+     * (as produced by extractFeatures()) unless columns is true, in which case row i holds the responses of the i-th
+     * feature to all samples (as produced from a WaveletGenerator).
+     * @param outputs amount of features of each wavelet.
+     */
+    SortedFeatureIndex(const cv::Mat & features, const bool columns, const unsigned int outputs = 1);
+
+    unsigned int features() const;
+    unsigned int samples() const;
+    unsigned int outputs() const;
+
+    /**
+     * Responses of the features to the samples, one row per feature.
+     */
+    const cv::Mat & values() const;
+
+    Encoding encoding(const unsigned int feature) const;
+
+    /**
+     * Writes the indices of the samples, from the lowest response of feature to the highest, to order, which must
+     * hold samples() elements. Samples with the same response are sorted by index.
+     */
+    void order(const unsigned int feature, unsigned int * order) const;
+
+    /**
+     * Memory used by the sorted orders, in bytes.
+     */
+    size_t bytes() const;
+
+    /**
+     * Finds the threshold of feature with the lowest weighted error in a single pass over its sorted order.
+     * @param weights weight of each sample.
+     * @param labels non-zero for positive samples.
+     */
+    DecisionStump bestStump(const unsigned int feature, const std::vector<float> & weights, const std::vector<int> & labels) const;
+
+    /**
+     * Same as above, over all features, in parallel. Ties go to the lowest feature.
+     */
+    DecisionStump bestStump(const std::vector<float> & weights, const std::vector<int> & labels) const;
+
+private:
+    class SortBody;
+    class SearchBody;
+
+    void build(const cv::Mat & features, const bool columns, const unsigned int outputs);
+    void sort(const unsigned int feature);
+    void check(const std::vector<float> & weights, const std::vector<int> & labels) const;
+
+    template <typename Reader>
+    DecisionStump search(const unsigned int feature, Reader reader, const float * weights, const int * labels) const;
+
+    unsigned int outputs_;
+    cv::Mat values_;
+    std::vector<unsigned char> encodings_;
+    std::vector< AlignedBuffer<unsigned char> > orders_;
+};
+
+
+
+#endif // HAARWAVELETTRAINING_H
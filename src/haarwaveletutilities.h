@@ -6,6 +6,22 @@
 #include <fstream>
 
 #include "haarwavelet.h"
+#include "haarwaveletbinary.h"
+#include "haarwaveletinstrumentation.h"
+
+
+
+/**
+ * Size of the file read by is, whose position is left unchanged. Only used to count the bytes parsed.
+ */
+inline unsigned long long streamSize(std::istream & is)
+{
+    const std::streampos position = is.tellg();
+    is.seekg(0, std::ios::end);
+    const std::streampos end = is.tellg();
+    is.seekg(position);
+    return end > position ? (unsigned long long)(end - position) : 0;
+}
 
 
 
@@ -20,6 +36,9 @@ bool loadHaarWavelets(const std::string &filename, std::vector<HaarWaveletType>
         return false;
     }
 
+    HAARCOMMON_TIME(PARSING_CYCLES);
+    HAARCOMMON_COUNT(BYTES_PARSED, streamSize(ifs));
+
     do
     {
         HaarWaveletType wavelet;
@@ -27,6 +46,7 @@ bool loadHaarWavelets(const std::string &filename, std::vector<HaarWaveletType>
         if ( !ifs.eof() )
         {
             wavelets.push_back(wavelet);
+            HAARCOMMON_COUNT(WAVELETS_PARSED, 1);
         }
         else
         {
@@ -66,4 +86,15 @@ bool writeHaarWavelets(const std::string &filename, const std::vector<HaarWavele
 
 
 
+/**
+ * Writes wavelets in the binary format, which can be read back with MappedWaveletBank.
+ */
+template <typename HaarWaveletType>
+bool writeBinaryHaarWavelets(const std::string &filename, const std::vector<HaarWaveletType> &wavelets)
+{
+    return writeBinaryWaveletBank(filename, CompiledWaveletBank(wavelets));
+}
+
+
+
 #endif // HAARWAVELETUTILITIES_H
@@ -0,0 +1,83 @@
+#include "allocationcounter.h"
+
+#include <cstdlib>
+#include <new>
+
+#include "haarwaveletinstrumentation.h"
+
+//Counts every allocation made through operator new, so tests can check that hot paths don't allocate. Threads of
+//the library allocate too, hence the atomic increment. All the forms of new and delete are replaced together, in a
+//translation unit of their own, so that every allocation is counted and freed by the matching function.
+namespace
+{
+
+unsigned long newCalls = 0;
+
+void * allocate(const std::size_t size)
+{
+    __atomic_add_fetch(&newCalls, 1, __ATOMIC_RELAXED);
+    return std::malloc(size ? size : 1);
+}
+
+}
+
+void * operator new(std::size_t size)
+{
+    void * p = allocate(size);
+    if (!p)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void * operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void * operator new(std::size_t size, const std::nothrow_t &) throw()
+{
+    return allocate(size);
+}
+
+void * operator new[](std::size_t size, const std::nothrow_t &) throw()
+{
+    return allocate(size);
+}
+
+void operator delete(void * p) throw()
+{
+    std::free(p);
+}
+
+void operator delete[](void * p) throw()
+{
+    std::free(p);
+}
+
+void operator delete(void * p, const std::nothrow_t &) throw()
+{
+    std::free(p);
+}
+
+void operator delete[](void * p, const std::nothrow_t &) throw()
+{
+    std::free(p);
+}
+
+void operator delete(void * p, std::size_t) throw()
+{
+    std::free(p);
+}
+
+void operator delete[](void * p, std::size_t) throw()
+{
+    std::free(p);
+}
+
+unsigned long allocations()
+{
+    HAARCOMMON_COUNT(ALLOCATIONS, 0); //creates the counters of this thread, which allocates, before they are read
+    return __atomic_load_n(&newCalls, __ATOMIC_RELAXED) + instrumentation::snapshot().counters[instrumentation::ALLOCATIONS];
+}
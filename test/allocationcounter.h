@@ -0,0 +1,10 @@
+#ifndef ALLOCATIONCOUNTER_H
+#define ALLOCATIONCOUNTER_H
+
+/**
+ * Allocations made so far through operator new and, when built with HAARCOMMON_INSTRUMENTATION, through
+ * cv::fastMalloc by AlignedBuffer (which operator new doesn't see).
+ */
+unsigned long allocations();
+
+#endif // ALLOCATIONCOUNTER_H
@@ -2,11 +2,31 @@
 #include <boost/test/unit_test.hpp>
 
 #include <vector>
+#include <set>
+#include <cstdio>
+#include <cmath>
+#include <clocale>
+#include <limits>
+#include <fstream>
+#include <sstream>
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 
 #include "haarwavelet.h"
+#include "haarwaveletbatch.h"
+#include "haarwaveletcascade.h"
+#include "haarwaveletdataset.h"
 #include "haarwaveletevaluators.h"
+#include "haarwaveletgenerator.h"
+#include "haarwaveletincremental.h"
+#include "haarwaveletinstrumentation.h"
+#include "haarwaveletpipeline.h"
+#include "haarwaveletscanner.h"
+#include "haarwavelettext.h"
+#include "haarwavelettraining.h"
+#include "haarwaveletutilities.h"
+
+#include "allocationcounter.h"
 
 
 
@@ -45,6 +65,65 @@ const cv::Mat getMockImage()
 
 
 
+/**
+ * A deterministic image without flat areas, different for each seed.
+ */
+const cv::Mat getSyntheticImage(const cv::Size & size, const int seed = 0)
+{
+    cv::Mat image(size, cv::DataType<unsigned char>::type);
+    for (int y = 0; y < image.rows; ++y)
+    {
+        for (int x = 0; x < image.cols; ++x)
+        {
+            image.at<unsigned char>(y, x) = (x * 37 + y * 91 + seed * 101 + x * y * (13 + seed)) % 256;
+        }
+    }
+    return image;
+}
+
+
+
+/**
+ * The int integral image sum shifted so that its elements wrap around 2^31. Rectangle sums don't change.
+ */
+const cv::Mat getWrappedIntegral(const cv::Mat & sum)
+{
+    cv::Mat wrapped = sum.clone();
+    for (int y = 0; y < wrapped.rows; ++y)
+    {
+        for (int x = 0; x < wrapped.cols; ++x)
+        {
+            wrapped.at<int>(y, x) = (int)((unsigned int)wrapped.at<int>(y, x) + std::numeric_limits<int>::max() - 100u);
+        }
+    }
+    return wrapped;
+}
+
+
+
+/**
+ * Checks if the integral images of integral are the ones of frame.
+ */
+void checkIncrementalIntegral(const IncrementalIntegralImage & integral, const cv::Mat & frame, const int sdepth)
+{
+    cv::Mat expectedSum, expectedSquare;
+    cv::integral(frame, expectedSum, expectedSquare, sdepth);
+    for (int y = 0; y < expectedSum.rows; ++y)
+    {
+        for (int x = 0; x < expectedSum.cols; ++x)
+        {
+            const double sum = sdepth == cv::DataType<int>::type ? integral.sum().at<int>(y, x)
+                                                                 : integral.sum().at<double>(y, x);
+            const double expected = sdepth == cv::DataType<int>::type ? expectedSum.at<int>(y, x)
+                                                                      : expectedSum.at<double>(y, x);
+            BOOST_REQUIRE_EQUAL(sum, expected);
+            BOOST_REQUIRE_EQUAL(integral.squareSum().at<double>(y, x), expectedSquare.at<double>(y, x));
+        }
+    }
+}
+
+
+
 const HaarWavelet getHaarWavelet()
 {
     std::vector<cv::Rect> rects(2);
@@ -132,3 +211,1554 @@ BOOST_AUTO_TEST_CASE(VarianceNormalizedWaveletEvaluatorTest)
 //        BOOST_CHECK_CLOSE( evaluator(wavelet, integralSum, integralSquare), 0.664229572f, 0.0001f);
 //    }
 }
+
+
+
+BOOST_AUTO_TEST_CASE(BatchEvaluationTest)
+{
+    const cv::Mat image = getMockImage();
+    cv::Mat integralSum(6, 6, cv::DataType<double>::type),
+            integralSquare(6, 6, cv::DataType<double>::type);
+    cv::integral(image, integralSum, integralSquare, cv::DataType<double>::type);
+
+    std::vector<HaarWavelet> wavelets(3, getHaarWavelet());
+    wavelets[1].weight(0, .5);
+    wavelets[2].weight(1, 2);
+    std::vector<MyHaarWavelet> myWavelets(2, getMyWavelet());
+
+    IntensityNormalizedWaveletEvaluator intensity;
+    VarianceNormalizedWaveletEvaluator variance;
+    std::vector<float> results(wavelets.size());
+
+    intensity(wavelets, integralSum, integralSquare, &results[0]);
+    for (unsigned int i = 0; i < wavelets.size(); ++i)
+    {
+        BOOST_CHECK_EQUAL(results[i], intensity(wavelets[i], integralSum, integralSquare));
+    }
+
+    variance(wavelets, integralSum, integralSquare, &results[0]);
+    for (unsigned int i = 0; i < wavelets.size(); ++i)
+    {
+        BOOST_CHECK_EQUAL(results[i], variance(wavelets[i], integralSum, integralSquare));
+    }
+
+    variance(myWavelets, integralSum, integralSquare, &results[0]);
+    for (unsigned int i = 0; i < myWavelets.size(); ++i)
+    {
+        BOOST_CHECK_EQUAL(results[i], variance(myWavelets[i], integralSum, integralSquare));
+    }
+}
+
+
+
+BOOST_AUTO_TEST_CASE(CompiledWaveletBankTest)
+{
+    const cv::Mat image = getMockImage();
+    cv::Mat integralSum(6, 6, cv::DataType<double>::type),
+            integralSquare(6, 6, cv::DataType<double>::type);
+    cv::integral(image, integralSum, integralSquare, cv::DataType<double>::type);
+
+    std::vector<HaarWavelet> wavelets(2, getHaarWavelet());
+    wavelets[1].weight(0, .5);
+    std::vector<MyHaarWavelet> myWavelets(1, getMyWavelet());
+
+    const CompiledWaveletBank bank(wavelets), myBank(myWavelets);
+    BOOST_CHECK_EQUAL(bank.size(), 2u);
+    BOOST_CHECK_EQUAL(bank.rectangles(), 4u);
+
+    IntensityNormalizedWaveletEvaluator intensity;
+    VarianceNormalizedWaveletEvaluator variance;
+    float results[2];
+
+    intensity(bank, integralSum, integralSquare, results);
+    BOOST_CHECK_CLOSE(results[0], intensity(wavelets[0], integralSum, integralSquare), 0.0001);
+    BOOST_CHECK_CLOSE(results[1], intensity(wavelets[1], integralSum, integralSquare), 0.0001);
+
+    variance(bank, integralSum, integralSquare, results);
+    BOOST_CHECK_CLOSE(results[0], variance(wavelets[0], integralSum, integralSquare), 0.0001);
+    BOOST_CHECK_CLOSE(results[1], variance(wavelets[1], integralSum, integralSquare), 0.0001);
+
+    variance(myBank, integralSum, integralSquare, results);
+    BOOST_CHECK_CLOSE(results[0], variance(myWavelets[0], integralSum, integralSquare), 0.0001);
+}
+
+
+
+BOOST_AUTO_TEST_CASE(PreparedWaveletBankTest)
+{
+    const cv::Mat image = getMockImage();
+    cv::Mat integralSum(6, 6, cv::DataType<double>::type),
+            integralSquare(6, 6, cv::DataType<double>::type);
+    cv::integral(image, integralSum, integralSquare, cv::DataType<double>::type);
+
+    std::vector<HaarWavelet> wavelets(1, getHaarWavelet());
+    const CompiledWaveletBank bank(wavelets);
+    const PreparedWaveletBank prepared(bank, integralSum.step1(), image.size());
+
+    IntensityNormalizedWaveletEvaluator intensity;
+    VarianceNormalizedWaveletEvaluator variance;
+    float result;
+
+    intensity(prepared, integralSum, integralSquare, cv::Point(0, 0), &result);
+    BOOST_CHECK_CLOSE(result, -.009803921569, 0.0001);
+
+    variance(prepared, integralSum, integralSquare, cv::Point(0, 0), &result);
+    BOOST_CHECK_CLOSE(result, -0.0703412294, 0.0001);
+
+    //rectangles must lie inside the (scaled) window
+    BOOST_CHECK_NO_THROW(PreparedWaveletBank(bank, integralSum.step1(), cv::Size(5, 5), 1.5f));
+    BOOST_CHECK_THROW(PreparedWaveletBank(bank, integralSum.step1(), cv::Size(4, 5)), int);
+    std::vector<HaarWavelet> outside(1, HaarWavelet(std::vector<cv::Rect>(1, cv::Rect(-1, 1, 2, 2)),
+                                                    std::vector<float>(1, 1)));
+    const CompiledWaveletBank outsideBank(outside);
+    BOOST_CHECK_THROW(PreparedWaveletBank(outsideBank, integralSum.step1(), image.size()), int);
+}
+
+
+
+BOOST_AUTO_TEST_CASE(ResponseMapsTest)
+{
+    const cv::Mat image = getSyntheticImage(cv::Size(13, 10));
+    cv::Mat integralSum, integralSquare;
+    cv::integral(image, integralSum, integralSquare, cv::DataType<double>::type);
+
+    std::vector<MyHaarWavelet> wavelets(1, getMyWavelet());
+    const CompiledWaveletBank bank(wavelets);
+    const PreparedWaveletBank prepared(bank, integralSum.step1(), cv::Size(5, 5));
+
+    IntensityNormalizedWaveletEvaluator intensity;
+    VarianceNormalizedWaveletEvaluator variance;
+    std::vector<cv::Mat> intensityMaps, varianceMaps;
+    for (int stride = 1; stride <= 2; ++stride)
+    {
+        responseMaps(intensity, prepared, integralSum, integralSquare, stride, intensityMaps);
+        responseMaps(variance, prepared, integralSum, integralSquare, stride, varianceMaps);
+        BOOST_REQUIRE_EQUAL(intensityMaps.size(), 1u);
+        BOOST_CHECK_EQUAL(intensityMaps[0].cols, 8 / stride + 1);
+        BOOST_CHECK_EQUAL(intensityMaps[0].rows, 5 / stride + 1);
+
+        for (int y = 0; y < intensityMaps[0].rows; ++y)
+        {
+            for (int x = 0; x < intensityMaps[0].cols; ++x)
+            {
+                const cv::Point origin(x * stride, y * stride);
+                float expected;
+                intensity(prepared, integralSum, integralSquare, origin, &expected);
+                BOOST_CHECK_SMALL(intensityMaps[0].at<float>(y, x) - expected, 1e-5f);
+                variance(prepared, integralSum, integralSquare, origin, &expected);
+                BOOST_CHECK_SMALL(varianceMaps[0].at<float>(y, x) - expected, 1e-5f);
+            }
+        }
+    }
+
+    BOOST_CHECK_THROW(responseMaps(intensity, prepared, integralSum, integralSquare, 0, intensityMaps), int);
+}
+
+
+
+BOOST_AUTO_TEST_CASE(MultiScaleScannerTest)
+{
+    const cv::Mat image = getSyntheticImage(cv::Size(24, 20));
+
+    std::vector<HaarWavelet> wavelets(1, getHaarWavelet());
+    const CompiledWaveletBank bank(wavelets);
+    std::vector<float> scales;
+    scales.push_back(1);
+    scales.push_back(2);
+    MultiScaleScanner scanner(bank, cv::Size(5, 5), scales);
+    BOOST_CHECK_EQUAL(scanner.windowSize(1).width, 10);
+
+    IntensityNormalizedWaveletEvaluator evaluator;
+    std::vector< std::vector<cv::Mat> > maps;
+    scanner.scan(evaluator, image, 1, maps);
+    BOOST_REQUIRE_EQUAL(maps.size(), 2u);
+    BOOST_CHECK_EQUAL(maps[1][0].cols, (24 - 10) / 2 + 1);
+
+    //At scale 2, the window at (2, 4) covers the same pixels as a 10x10 image cut out at the same place,
+    //scanned at scale 1 with a bank scaled by 2.
+    const std::vector<HaarWavelet> scaledWavelets(1, HaarWavelet(std::vector<cv::Rect>(1, cv::Rect(2, 2, 4, 4)), std::vector<float>(1, 1)));
+    cv::Mat sum, squareSum;
+    cv::integral(image(cv::Rect(2, 4, 10, 10)), sum, squareSum, cv::DataType<double>::type);
+    std::vector< std::vector<cv::Mat> > scaledMaps;
+    MultiScaleScanner single(CompiledWaveletBank(scaledWavelets), cv::Size(10, 10), std::vector<float>(1, 1));
+    single.scan(evaluator, sum, squareSum, 1, scaledMaps);
+
+    std::vector<HaarWavelet> firstRectangle(1, HaarWavelet(std::vector<cv::Rect>(1, cv::Rect(1, 1, 2, 2)), std::vector<float>(1, 1)));
+    MultiScaleScanner scaled(CompiledWaveletBank(firstRectangle), cv::Size(5, 5), scales);
+    scaled.scan(evaluator, image, 1, maps);
+    BOOST_CHECK_CLOSE(maps[1][0].at<float>(2, 1), scaledMaps[0][0].at<float>(0, 0), 0.0001);
+}
+
+
+
+BOOST_AUTO_TEST_CASE(ExtractFeaturesTest)
+{
+    std::vector<cv::Mat> images(150), sums(images.size()), squareSums(images.size());
+    for (unsigned int i = 0; i < images.size(); ++i)
+    {
+        images[i] = getSyntheticImage(cv::Size(6, 6), i);
+        cv::integral(images[i], sums[i], squareSums[i], cv::DataType<double>::type);
+    }
+
+    std::vector<HaarWavelet> wavelets(2, getHaarWavelet());
+    wavelets[1].weight(1, .25);
+    const CompiledWaveletBank bank(wavelets);
+
+    VarianceNormalizedWaveletEvaluator evaluator;
+    cv::Mat features, featuresFromIntegrals;
+    extractFeatures(evaluator, bank, images, features);
+    extractFeatures(evaluator, bank, sums, squareSums, featuresFromIntegrals);
+    BOOST_REQUIRE_EQUAL(features.rows, 150);
+    BOOST_REQUIRE_EQUAL(features.cols, 2);
+
+    for (unsigned int i = 0; i < images.size(); ++i)
+    {
+        for (unsigned int j = 0; j < wavelets.size(); ++j)
+        {
+            BOOST_CHECK_SMALL(features.at<float>(i, j) - evaluator(wavelets[j], sums[i], squareSums[i]), 1e-5f);
+            BOOST_CHECK_EQUAL(features.at<float>(i, j), featuresFromIntegrals.at<float>(i, j));
+        }
+    }
+
+    squareSums.pop_back();
+    BOOST_CHECK_THROW(extractFeatures(evaluator, bank, sums, squareSums, featuresFromIntegrals), int);
+}
+
+
+
+BOOST_AUTO_TEST_CASE(IntegralTypesTest)
+{
+    const cv::Mat image = getMockImage();
+    cv::Mat integralSum, integralSquare;
+    cv::integral(image, integralSum, integralSquare, cv::DataType<int>::type);
+
+    cv::Mat floatSum, floatSquare;
+    integralSum.convertTo(floatSum, cv::DataType<float>::type);
+    integralSquare.convertTo(floatSquare, cv::DataType<float>::type);
+
+    const cv::Mat sums[] = {integralSum, floatSum};
+    const cv::Mat squareSums[] = {integralSquare, floatSquare};
+
+    IntensityNormalizedWaveletEvaluator intensity;
+    VarianceNormalizedWaveletEvaluator variance;
+    const HaarWavelet wavelet = getHaarWavelet();
+    const MyHaarWavelet myWavelet = getMyWavelet();
+    const CompiledWaveletBank bank(std::vector<HaarWavelet>(1, wavelet));
+    for (int i = 0; i < 2; ++i)
+    {
+        BOOST_CHECK_CLOSE(intensity(wavelet, sums[i], squareSums[i]), -.009803921569, 0.0001);
+        BOOST_CHECK_SMALL(intensity(myWavelet, sums[i], squareSums[i]), 0.00001f);
+        BOOST_CHECK_CLOSE(variance(wavelet, sums[i], squareSums[i]), -0.0703412294, 0.0001);
+
+        const PreparedWaveletBank prepared(bank, sums[i].step1(), image.size());
+        float result;
+        intensity(prepared, sums[i], squareSums[i], cv::Point(0, 0), &result);
+        BOOST_CHECK_CLOSE(result, -.009803921569, 0.0001);
+        variance(prepared, sums[i], squareSums[i], cv::Point(0, 0), &result);
+        BOOST_CHECK_CLOSE(result, -0.0703412294, 0.0001);
+
+        std::vector<cv::Mat> maps;
+        responseMaps(variance, prepared, sums[i], squareSums[i], 1, maps);
+        BOOST_CHECK_CLOSE(maps[0].at<float>(0, 0), -0.0703412294, 0.01);
+    }
+}
+
+
+
+BOOST_AUTO_TEST_CASE(AllocationFreeEvaluationTest)
+{
+    const cv::Mat image = getMockImage();
+    cv::Mat integralSum, integralSquare;
+    cv::integral(image, integralSum, integralSquare, cv::DataType<double>::type);
+
+    const HaarWavelet wavelet = getHaarWavelet();
+    const MyHaarWavelet myWavelet = getMyWavelet();
+    const std::vector<HaarWavelet> wavelets(3, wavelet);
+    const CompiledWaveletBank bank(wavelets);
+    const PreparedWaveletBank prepared(bank, integralSum.step1(), image.size());
+
+    IntensityNormalizedWaveletEvaluator intensity;
+    VarianceNormalizedWaveletEvaluator variance;
+    float scratch[4], results[3];
+
+    const unsigned long before = allocations();
+    for (int i = 0; i < 10; ++i)
+    {
+        BOOST_CHECK_CLOSE(intensity(wavelet, integralSum, integralSquare, scratch, 4), -.009803921569, 0.0001);
+        BOOST_CHECK_CLOSE(variance(wavelet, integralSum, integralSquare, scratch, 4), -0.0703412294, 0.0001);
+        variance(myWavelet, integralSum, integralSquare, scratch, 4);
+        intensity(wavelets, integralSum, integralSquare, results);
+        variance(bank, integralSum, integralSquare, results);
+        variance(prepared, integralSum, integralSquare, cv::Point(0, 0), results);
+    }
+    BOOST_CHECK_EQUAL(allocations(), before);
+
+    BOOST_CHECK_THROW(intensity(wavelet, integralSum, integralSquare, scratch, 1), int);
+
+    //same responses as without scratch
+    BOOST_CHECK_EQUAL(intensity(myWavelet, integralSum, integralSquare, scratch, 4),
+                      intensity(myWavelet, integralSum, integralSquare));
+    BOOST_CHECK_EQUAL(variance(myWavelet, integralSum, integralSquare, scratch, 4),
+                      variance(myWavelet, integralSum, integralSquare));
+    const DualWeightHaarWavelet dual(std::vector<cv::Rect>(wavelet.rects_begin(), wavelet.rects_end()),
+                                     std::vector<float>(2, .5f), std::vector<float>(2, -.25f));
+    BOOST_CHECK(variance(dual, integralSum, integralSquare, scratch, 4) == variance(dual, integralSum, integralSquare));
+}
+
+
+
+BOOST_AUTO_TEST_CASE(FixedWaveletBankTest)
+{
+    const cv::Mat image = getMockImage();
+    cv::Mat integralSum, integralSquare;
+    cv::integral(image, integralSum, integralSquare, cv::DataType<double>::type);
+
+    std::vector<cv::Rect> rects(3, cv::Rect(0, 0, 2, 2));
+    rects[1] = cv::Rect(2, 0, 2, 2);
+    rects[2] = cv::Rect(1, 2, 3, 2);
+    std::vector<float> weights(3, 1);
+    weights[1] = -2;
+
+    std::vector<HaarWavelet> wavelets;
+    wavelets.push_back(HaarWavelet(std::vector<cv::Rect>(1, rects[2]), std::vector<float>(1, 1))); //generic
+    wavelets.push_back(getHaarWavelet());
+    wavelets.push_back(HaarWavelet(rects, weights));
+
+    FixedWaveletBank bank(wavelets);
+    BOOST_CHECK_EQUAL(bank.pairs().size(), 1u);
+    BOOST_CHECK_EQUAL(bank.triples().size(), 1u);
+    BOOST_CHECK_EQUAL(bank.otherIndices().size(), 1u);
+    bank.prepare(integralSum.step1(), image.size());
+
+    IntensityNormalizedWaveletEvaluator intensity;
+    VarianceNormalizedWaveletEvaluator variance;
+    float results[3];
+
+    intensity(bank, integralSum, integralSquare, cv::Point(0, 0), results);
+    for (unsigned int i = 0; i < wavelets.size(); ++i)
+    {
+        BOOST_CHECK_CLOSE(results[i], intensity(wavelets[i], integralSum, integralSquare), 0.01);
+    }
+
+    variance(bank, integralSum, integralSquare, cv::Point(0, 0), results);
+    for (unsigned int i = 0; i < wavelets.size(); ++i)
+    {
+        BOOST_CHECK_CLOSE(results[i], variance(wavelets[i], integralSum, integralSquare), 0.01);
+    }
+
+    const FixedWaveletBank myBank(std::vector<MyHaarWavelet>(1, getMyWavelet()));
+    FixedWaveletBank copy(myBank);
+    copy.prepare(integralSum.step1(), image.size());
+    intensity(copy, integralSum, integralSquare, cv::Point(0, 0), results);
+    BOOST_CHECK_SMALL(results[0], 0.00001f);
+}
+
+
+
+BOOST_AUTO_TEST_CASE(BinaryWaveletBankTest)
+{
+    const cv::Mat image = getMockImage();
+    cv::Mat integralSum, integralSquare;
+    cv::integral(image, integralSum, integralSquare, cv::DataType<double>::type);
+
+    std::vector<HaarWavelet> wavelets(2, getHaarWavelet());
+    wavelets[1].weight(0, .5);
+    std::vector<MyHaarWavelet> myWavelets(1, getMyWavelet());
+
+    const std::string filename = "binarywaveletbanktest.bin", myFilename = "binarywaveletbanktest.my.bin";
+    BOOST_REQUIRE(writeBinaryHaarWavelets(filename, wavelets));
+    BOOST_REQUIRE(writeBinaryHaarWavelets(myFilename, myWavelets));
+
+    IntensityNormalizedWaveletEvaluator intensity;
+    VarianceNormalizedWaveletEvaluator variance;
+    float results[2];
+
+    {
+        MappedWaveletBank mapped;
+        BOOST_REQUIRE(mapped.open(filename));
+        BOOST_CHECK_EQUAL(mapped.bank().kind(), CompiledWaveletBank::PLAIN);
+        BOOST_CHECK_EQUAL(mapped.bank().size(), 2u);
+        BOOST_CHECK_EQUAL(mapped.bank().rectangles(), 4u);
+
+        variance(mapped.bank(), integralSum, integralSquare, results);
+        BOOST_CHECK_CLOSE(results[0], variance(wavelets[0], integralSum, integralSquare), 0.0001);
+        BOOST_CHECK_CLOSE(results[1], variance(wavelets[1], integralSum, integralSquare), 0.0001);
+
+        //copies are independent of the mapping
+        const CompiledWaveletBank copy = mapped.bank().scaled(2);
+        mapped.close();
+        BOOST_CHECK_EQUAL(copy.rectangles(), 4u);
+        BOOST_CHECK_EQUAL(copy.corners()[0].right, 6);
+
+        BOOST_REQUIRE(mapped.open(myFilename));
+        BOOST_CHECK_EQUAL(mapped.bank().kind(), CompiledWaveletBank::MEANS);
+        intensity(mapped.bank(), integralSum, integralSquare, results);
+        BOOST_CHECK_SMALL(results[0] - intensity(myWavelets[0], integralSum, integralSquare), 0.00001f);
+    }
+
+    //corrupt a corner, then the beginning of the second wavelet
+    {
+        std::fstream fs(filename.c_str(), std::fstream::in | std::fstream::out | std::fstream::binary);
+        fs.seekp(2 * BinaryBankHeader::ALIGNMENT);
+        fs.put(42);
+    }
+    MappedWaveletBank corrupt;
+    BOOST_CHECK(!corrupt.open(filename));
+    BOOST_CHECK(!corrupt.isOpen());
+    BOOST_CHECK(corrupt.open(filename, false));
+    {
+        std::fstream fs(filename.c_str(), std::fstream::in | std::fstream::out | std::fstream::binary);
+        fs.seekp(sizeof(BinaryBankHeader) + 4);
+        fs.put(42);
+    }
+    BOOST_CHECK(!corrupt.open(filename, false));
+
+    std::remove(filename.c_str());
+    std::remove(myFilename.c_str());
+}
+
+
+
+BOOST_AUTO_TEST_CASE(StrictTextFormatTest)
+{
+    cv::RNG rng(42);
+    std::vector<MyHaarWavelet> wavelets;
+    for (int i = 0; i < 100; ++i)
+    {
+        std::vector<cv::Rect> rects(1 + i % 4);
+        std::vector<float> weights(rects.size()), means(rects.size());
+        for (unsigned int j = 0; j < rects.size(); ++j)
+        {
+            rects[j] = cv::Rect(rng.uniform(0, 20), rng.uniform(0, 20), rng.uniform(1, 20), rng.uniform(1, 20));
+            weights[j] = j % 2 ? rng.uniform(-1e6f, 1e6f) : (float) rng.uniform(-2, 3);
+            means[j] = rng.uniform(0.f, 1.f) * std::pow(10.f, (float) rng.uniform(-30, 30));
+        }
+        wavelets.push_back(MyHaarWavelet(rects, weights, means));
+    }
+
+    std::string text;
+    formatHaarWavelets(wavelets, text);
+    std::vector<MyHaarWavelet> parsed;
+    BOOST_REQUIRE(parseHaarWavelets(text.data(), text.data() + text.size(), parsed));
+    BOOST_REQUIRE_EQUAL(parsed.size(), wavelets.size());
+    for (unsigned int i = 0; i < wavelets.size(); ++i)
+    {
+        BOOST_REQUIRE_EQUAL(parsed[i].dimensions(), wavelets[i].dimensions());
+        for (unsigned int j = 0; j < wavelets[i].dimensions(); ++j)
+        {
+            BOOST_CHECK(parsed[i].rect(j) == wavelets[i].rect(j));
+            BOOST_CHECK_EQUAL(parsed[i].weight(j), wavelets[i].weight(j));
+            BOOST_CHECK_EQUAL(parsed[i].means_begin()[j], wavelets[i].means_begin()[j]);
+        }
+    }
+
+    //compatible with the stream based format, blank lines included
+    std::vector<HaarWavelet> plain;
+    const std::string valid = "2 1 1 2 2 1 3 3 2 2 -1\n\n1 0 0 5 5 .5e1\r\n";
+    BOOST_REQUIRE(parseHaarWavelets(valid.data(), valid.data() + valid.size(), plain));
+    BOOST_REQUIRE_EQUAL(plain.size(), 2u);
+    BOOST_CHECK_EQUAL(plain[0].weight(1), -1);
+    BOOST_CHECK_EQUAL(plain[1].weight(0), 5);
+
+    std::vector<DualWeightHaarWavelet> dual;
+    const std::string dualText = "1 0 0 2 2 0.25 -0.75\n";
+    BOOST_REQUIRE(parseHaarWavelets(dualText.data(), dualText.data() + dualText.size(), dual));
+    std::string dualOutput;
+    formatHaarWavelets(dual, dualOutput);
+    BOOST_CHECK_EQUAL(dualOutput, dualText);
+
+    //non-finite values and signed zeros round trip, long numbers are read in full
+    std::vector<float> special(4);
+    special[0] = std::numeric_limits<float>::infinity();
+    special[1] = -std::numeric_limits<float>::infinity();
+    special[2] = std::numeric_limits<float>::quiet_NaN();
+    special[3] = -0.f;
+    std::vector<MyHaarWavelet> specialWavelets(1, MyHaarWavelet(std::vector<cv::Rect>(4, cv::Rect(0, 0, 2, 2)),
+                                                                special, special));
+    std::string specialText;
+    formatHaarWavelets(specialWavelets, specialText);
+    BOOST_CHECK_EQUAL(specialText, "4 0 0 2 2 inf 0 0 2 2 -inf 0 0 2 2 nan 0 0 2 2 -0 inf -inf nan -0\n");
+    std::vector<MyHaarWavelet> specialParsed;
+    BOOST_REQUIRE(parseHaarWavelets(specialText.data(), specialText.data() + specialText.size(), specialParsed));
+    BOOST_REQUIRE_EQUAL(specialParsed.size(), 1u);
+    BOOST_CHECK_EQUAL(specialParsed[0].weight(0), special[0]);
+    BOOST_CHECK_EQUAL(specialParsed[0].weight(1), special[1]);
+    BOOST_CHECK(specialParsed[0].weight(2) != specialParsed[0].weight(2));
+    BOOST_CHECK(std::signbit(specialParsed[0].means_begin()[3]));
+
+    const std::string longNumber = "1 0 0 2 2 .117647058824 -12345678901234567890123456789e-30\n";
+    specialParsed.clear();
+    BOOST_REQUIRE(parseHaarWavelets(longNumber.data(), longNumber.data() + longNumber.size(), specialParsed));
+    BOOST_REQUIRE_EQUAL(specialParsed.size(), 1u);
+    BOOST_CHECK_EQUAL(specialParsed[0].weight(0), .117647058824f);
+    BOOST_CHECK_EQUAL(specialParsed[0].means_begin()[0], -12345678901234567890123456789e-30f);
+
+    //a locale with a decimal comma does not change the format
+    if (setlocale(LC_NUMERIC, "de_DE.UTF-8") || setlocale(LC_NUMERIC, "fr_FR.UTF-8"))
+    {
+        std::string localized;
+        formatHaarWavelets(wavelets, localized);
+        parsed.clear();
+        const bool localizedParsed = parseHaarWavelets(localized.data(), localized.data() + localized.size(), parsed);
+        setlocale(LC_NUMERIC, "C");
+        BOOST_CHECK_EQUAL(localized, text);
+        BOOST_CHECK(localizedParsed);
+        BOOST_CHECK_EQUAL(parsed.size(), wavelets.size());
+    }
+
+    //truncated record on line 2
+    const std::string truncated = "1 0 0 2 2 1\n2 1 1 2 2 1 3 3\n";
+    TextFormatError error;
+    BOOST_CHECK(!parseHaarWavelets(truncated.data(), truncated.data() + truncated.size(), plain, &error));
+    BOOST_CHECK_EQUAL(plain.size(), 2u);
+    BOOST_CHECK_EQUAL(error.line, 2u);
+    BOOST_CHECK_EQUAL(error.column, 16u);
+
+    const std::string garbage = "1 0 0 2 2 1x\n";
+    BOOST_CHECK(!parseHaarWavelets(garbage.data(), garbage.data() + garbage.size(), plain, &error));
+    BOOST_CHECK_EQUAL(error.line, 1u);
+    BOOST_CHECK_EQUAL(error.column, 11u);
+
+    const std::string filename = "stricttextformattest.txt";
+    BOOST_REQUIRE(writeHaarWaveletsFast(filename, wavelets));
+    parsed.clear();
+    BOOST_REQUIRE(loadHaarWaveletsStrict(filename, parsed));
+    BOOST_CHECK_EQUAL(parsed.size(), wavelets.size());
+    std::remove(filename.c_str());
+}
+
+
+
+BOOST_AUTO_TEST_CASE(SharedRectangleBankTest)
+{
+    const cv::Mat image = getMockImage();
+    cv::Mat integralSum, integralSquare;
+    cv::integral(image, integralSum, integralSquare, cv::DataType<double>::type);
+
+    std::vector<cv::Rect> rects(3, cv::Rect(0, 0, 2, 2));
+    rects[1] = cv::Rect(2, 0, 2, 2);
+    rects[2] = cv::Rect(1, 2, 3, 2);
+    std::vector<float> weights(3, 1), negative(3, -.5);
+    weights[1] = -2;
+
+    std::vector<HaarWavelet> wavelets(1, getHaarWavelet());
+    wavelets.push_back(HaarWavelet(rects, weights));
+    wavelets.push_back(HaarWavelet(std::vector<cv::Rect>(rects.begin(), rects.begin() + 2),
+                                   std::vector<float>(weights.begin() + 1, weights.end())));
+    wavelets.push_back(getHaarWavelet());
+
+    const SharedRectangleBank shared((CompiledWaveletBank(wavelets)));
+    BOOST_CHECK_EQUAL(shared.bank().rectangles(), 9u);
+    BOOST_CHECK_EQUAL(shared.uniqueRectangles(), 5u);
+
+    IntensityNormalizedWaveletEvaluator intensity;
+    VarianceNormalizedWaveletEvaluator variance;
+    float scratch[5], results[4], expected[4];
+
+    intensity(shared, integralSum, integralSquare, scratch, 5, results);
+    intensity(shared.bank(), integralSum, integralSquare, expected);
+    BOOST_CHECK_EQUAL_COLLECTIONS(results, results + 4, expected, expected + 4);
+
+    variance(shared, integralSum, integralSquare, scratch, 5, results);
+    variance(shared.bank(), integralSum, integralSquare, expected);
+    BOOST_CHECK_EQUAL_COLLECTIONS(results, results + 4, expected, expected + 4);
+
+    BOOST_CHECK_THROW(variance(shared, integralSum, integralSquare, scratch, 4, results), int);
+
+    //windowed evaluation, also through a copy
+    SharedRectangleBank prepared(shared);
+    prepared.prepare(integralSum.step1(), cv::Size(5, 5));
+    const SharedRectangleBank copy(prepared);
+    const PreparedWaveletBank reference(shared.bank(), integralSum.step1(), cv::Size(5, 5));
+
+    variance(copy, integralSum, integralSquare, cv::Point(0, 0), scratch, 5, results);
+    variance(reference, integralSum, integralSquare, cv::Point(0, 0), expected);
+    BOOST_CHECK_EQUAL_COLLECTIONS(results, results + 4, expected, expected + 4);
+
+    //means and dual weights
+    std::vector<MyHaarWavelet> myWavelets(2, getMyWavelet());
+    myWavelets.push_back(MyHaarWavelet(rects, weights, std::vector<float>(3, .1f)));
+    const SharedRectangleBank myShared((CompiledWaveletBank(myWavelets)));
+    BOOST_CHECK_EQUAL(myShared.uniqueRectangles(), 5u);
+    intensity(myShared, integralSum, integralSquare, scratch, 5, results);
+    intensity(myShared.bank(), integralSum, integralSquare, expected);
+    BOOST_CHECK_EQUAL_COLLECTIONS(results, results + 3, expected, expected + 3);
+
+    std::vector<DualWeightHaarWavelet> dualWavelets(2, DualWeightHaarWavelet(rects, weights, negative));
+    const SharedRectangleBank dualShared((CompiledWaveletBank(dualWavelets)));
+    BOOST_CHECK_EQUAL(dualShared.uniqueRectangles(), 3u);
+    variance(dualShared, integralSum, integralSquare, scratch, 5, results);
+    variance(dualShared.bank(), integralSum, integralSquare, expected);
+    BOOST_CHECK_EQUAL_COLLECTIONS(results, results + 4, expected, expected + 4);
+}
+
+
+
+BOOST_AUTO_TEST_CASE(WindowStatisticsMapTest)
+{
+    cv::Mat image = getSyntheticImage(cv::Size(13, 10));
+    image.at<unsigned char>(0, 0) = 0; //a window with no variance
+    image.at<unsigned char>(0, 1) = 0;
+    image.at<unsigned char>(1, 0) = 0;
+    image.at<unsigned char>(1, 1) = 0;
+    cv::Mat integralSum, integralSquare, intSum;
+    cv::integral(image, integralSum, integralSquare, cv::DataType<double>::type);
+    integralSum.convertTo(intSum, cv::DataType<int>::type);
+
+    VarianceNormalizedWaveletEvaluator variance;
+    WindowStatisticsMap statistics;
+    statistics.compute(intSum, integralSquare, cv::Size(2, 2), 2, 1.5); //3x3 windows
+    BOOST_CHECK(statistics.windowSize() == cv::Size(3, 3));
+    BOOST_CHECK(statistics.size() == cv::Size(6, 4));
+
+    for (int y = 0; y < statistics.size().height; ++y)
+    {
+        for (int x = 0; x < statistics.size().width; ++x)
+        {
+            double mean, stdDev;
+            variance.windowStatistics(integralSum, integralSquare, cv::Rect(x * 2, y * 2, 3, 3), mean, stdDev);
+            BOOST_CHECK_CLOSE(statistics.means().at<double>(y, x), mean, 0.0001);
+            BOOST_CHECK_CLOSE(statistics.factors().at<double>(y, x), stdDev ? 1 / (2 * stdDev) : 0, 0.0001);
+        }
+    }
+
+    //evaluation with the map
+    std::vector<MyHaarWavelet> wavelets(1, getMyWavelet());
+    const CompiledWaveletBank bank(wavelets);
+    const PreparedWaveletBank prepared(bank, intSum.step1(), cv::Size(5, 5));
+    statistics.compute(intSum, integralSquare, cv::Size(5, 5), 2);
+    for (int y = 0; y < statistics.size().height; ++y)
+    {
+        for (int x = 0; x < statistics.size().width; ++x)
+        {
+            float result, expected;
+            variance(prepared, intSum, statistics, cv::Point(x * 2, y * 2), &result);
+            variance(prepared, intSum, integralSquare, cv::Point(x * 2, y * 2), &expected);
+            BOOST_CHECK_CLOSE(result, expected, 0.0001);
+        }
+    }
+    float result;
+    BOOST_CHECK_THROW(variance(prepared, intSum, statistics, cv::Point(1, 0), &result), int);
+    statistics.compute(intSum, integralSquare, cv::Size(4, 4), 2);
+    BOOST_CHECK_THROW(variance(prepared, intSum, statistics, cv::Point(0, 0), &result), int);
+    BOOST_CHECK_THROW(WindowStatisticsMap().compute(intSum, integralSquare, cv::Size(4, 4), 0), int);
+
+    //int integral images that wrap around give the same sums
+    WindowStatisticsMap wrappedStatistics;
+    wrappedStatistics.compute(getWrappedIntegral(intSum), integralSquare, cv::Size(4, 4), 2);
+    for (int y = 0; y < statistics.size().height; ++y)
+    {
+        for (int x = 0; x < statistics.size().width; ++x)
+        {
+            BOOST_CHECK_EQUAL(wrappedStatistics.means().at<double>(y, x), statistics.means().at<double>(y, x));
+        }
+    }
+}
+
+
+
+BOOST_AUTO_TEST_CASE(WaveletCascadeTest)
+{
+    const cv::Mat image = getSyntheticImage(cv::Size(13, 10));
+    cv::Mat integralSum, integralSquare;
+    cv::integral(image, integralSum, integralSquare, cv::DataType<double>::type);
+
+    CascadeStage<HaarWavelet> first, second;
+    first.wavelets.push_back(getHaarWavelet());
+    first.thresholds.push_back(0);
+    first.below.push_back(-1);
+    first.above.push_back(1);
+    first.threshold = 0;
+    second = first;
+    second.wavelets.push_back(HaarWavelet(std::vector<cv::Rect>(1, cv::Rect(0, 0, 2, 3)), std::vector<float>(1, 1)));
+    second.thresholds.push_back(.5);
+    second.below.push_back(-.5);
+    second.above.push_back(.75);
+    second.threshold = 1.5;
+
+    WaveletCascade<HaarWavelet> cascade;
+    cascade.addStage(first);
+    cascade.addStage(second);
+    cascade.prepare(integralSum.step1(), cv::Size(5, 5));
+    BOOST_CHECK_EQUAL(cascade.maxStageSize(), 2u);
+
+    second.below.pop_back();
+    BOOST_CHECK_THROW(cascade.addStage(second), int);
+
+    IntensityNormalizedWaveletEvaluator intensity;
+    VarianceNormalizedWaveletEvaluator variance;
+    const CompiledWaveletBank secondBank(cascade.stage(1).wavelets);
+    const PreparedWaveletBank secondPrepared(secondBank, integralSum.step1(), cv::Size(5, 5));
+
+    std::vector<cv::Point> expected, detected;
+    for (int y = 0; y + 5 < integralSum.rows; y += 2)
+    {
+        for (int x = 0; x + 5 < integralSum.cols; x += 2)
+        {
+            float responses[2], scratch[2], score;
+            variance(secondPrepared, integralSum, integralSquare, cv::Point(x, y), responses);
+            const bool passesFirst = responses[0] >= 0;
+            const float secondSum = (responses[0] < 0 ? -1 : 1) + (responses[1] < .5 ? -.5f : .75f);
+            const unsigned int passed = passesFirst ? (secondSum >= 1.5 ? 2 : 1) : 0;
+
+            BOOST_CHECK_EQUAL(cascade.evaluate(variance, integralSum, integralSquare, cv::Point(x, y), scratch, 2, &score), passed);
+            if (passed == 2)
+            {
+                expected.push_back(cv::Point(x, y));
+            }
+        }
+    }
+    BOOST_CHECK(!expected.empty());
+
+    cascade.detect(variance, integralSum, integralSquare, 2, detected);
+    BOOST_CHECK(detected == expected);
+
+    //save and load
+    const std::string filename = "wavelet_cascade_test.txt";
+    BOOST_REQUIRE(writeWaveletCascade(filename, cascade));
+    WaveletCascade<HaarWavelet> loaded;
+    BOOST_REQUIRE(loadWaveletCascade(filename, loaded));
+    std::remove(filename.c_str());
+    BOOST_REQUIRE_EQUAL(loaded.stages(), 2u);
+    BOOST_CHECK_EQUAL(loaded.stage(1).threshold, 1.5f);
+    BOOST_CHECK_EQUAL(loaded.stage(1).above[1], .75f);
+
+    //corrupt amounts of wavelets or of rectangles fail instead of allocating for them
+    const std::string corrupt[] = {"1\n4294967295 1\n.5 0 1 1 0 0 2 2 1\n", "1\n1 1\n.5 0 1 2147483647 0 0 2 2 1\n"};
+    for (int i = 0; i < 2; ++i)
+    {
+        {
+            std::ofstream ofs(filename.c_str());
+            ofs << corrupt[i];
+        }
+        BOOST_CHECK(!loadWaveletCascade(filename, loaded));
+        std::remove(filename.c_str());
+    }
+    BOOST_CHECK_EQUAL(loaded.stages(), 2u);
+
+    loaded.prepare(integralSum.step1(), cv::Size(5, 5));
+    std::vector<cv::Point> intensityDetected, loadedDetected;
+    cascade.detect(intensity, integralSum, integralSquare, 1, intensityDetected);
+    loaded.detect(intensity, integralSum, integralSquare, 1, loadedDetected);
+    BOOST_CHECK(intensityDetected == loadedDetected);
+
+    //an empty cascade can be neither evaluated nor scanned
+    WaveletCascade<HaarWavelet> empty;
+    empty.prepare(integralSum.step1(), cv::Size(5, 5));
+    float scratch[2];
+    BOOST_CHECK_THROW(empty.evaluate(variance, integralSum, integralSquare, cv::Point(0, 0), scratch, 2), int);
+    BOOST_CHECK_THROW(empty.detect(variance, integralSum, integralSquare, 1, detected), int);
+}
+
+
+
+BOOST_AUTO_TEST_CASE(QuantizedWaveletBankTest)
+{
+    const cv::Mat image = getSyntheticImage(cv::Size(27, 20));
+    cv::Mat integralSum, integralSquare, intSum;
+    cv::integral(image, integralSum, integralSquare, cv::DataType<double>::type);
+    integralSum.convertTo(intSum, cv::DataType<int>::type);
+
+    std::vector<cv::Rect> rects;
+    rects.push_back(cv::Rect(0, 0, 12, 12)); //the whole window
+    rects.push_back(cv::Rect(2, 3, 5, 4));
+    rects.push_back(cv::Rect(7, 1, 1, 9));
+    std::vector<float> weights;
+    weights.push_back(.3f);
+    weights.push_back(-1.7f);
+    weights.push_back(.0123f);
+    std::vector<HaarWavelet> wavelets(1, getHaarWavelet());
+    wavelets.push_back(HaarWavelet(rects, weights));
+    std::vector<MyHaarWavelet> myWavelets(1, getMyWavelet());
+    myWavelets.push_back(MyHaarWavelet(rects, weights, std::vector<float>(3, .4f)));
+
+    IntensityNormalizedWaveletEvaluator intensity;
+    for (int kind = 0; kind < 2; ++kind)
+    {
+        const CompiledWaveletBank bank = kind ? CompiledWaveletBank(myWavelets) : CompiledWaveletBank(wavelets);
+        const PreparedWaveletBank prepared(bank, integralSum.step1(), cv::Size(12, 12));
+        QuantizedWaveletBank quantized(bank);
+        quantized.prepare(intSum.step1(), cv::Size(12, 12));
+        for (unsigned int w = 0; w < quantized.size(); ++w)
+        {
+            BOOST_CHECK(quantized.errorBounds()[w] < 1e-4f);
+        }
+
+        //stride 1 goes through the SIMD kernels (SSE2 at least, on x86), stride 2 through the scalar one
+        for (int stride = 1; stride <= 2; ++stride)
+        {
+            std::vector<cv::Mat> maps;
+            responseMaps(intensity, quantized, intSum, integralSquare, stride, maps);
+            BOOST_REQUIRE_EQUAL(maps.size(), 2u);
+            for (int y = 0; y < maps[0].rows; ++y)
+            {
+                for (int x = 0; x < maps[0].cols; ++x)
+                {
+                    const cv::Point origin(x * stride, y * stride);
+                    float expected[2], result[2];
+                    intensity(prepared, integralSum, integralSquare, origin, expected);
+                    intensity(quantized, intSum, integralSquare, origin, result);
+                    for (unsigned int w = 0; w < 2; ++w)
+                    {
+                        //tolerance: the quantization bound plus float rounding
+                        BOOST_CHECK_SMALL(result[w] - expected[w], quantized.errorBounds()[w] + 1e-6f);
+                        BOOST_CHECK_SMALL(maps[w].at<float>(y, x) - result[w], 1e-6f);
+                    }
+                }
+            }
+
+            //int integral images that wrap around give the same responses
+            std::vector<cv::Mat> wrappedMaps;
+            responseMaps(intensity, quantized, getWrappedIntegral(intSum), integralSquare, stride, wrappedMaps);
+            BOOST_REQUIRE_EQUAL(wrappedMaps.size(), 2u);
+            for (unsigned int w = 0; w < 2; ++w)
+            {
+                cv::Mat difference;
+                cv::absdiff(wrappedMaps[w], maps[w], difference);
+                BOOST_CHECK_EQUAL(cv::countNonZero(difference), 0);
+            }
+        }
+    }
+
+    float result[2];
+    const CompiledWaveletBank bank(wavelets);
+    QuantizedWaveletBank quantized(bank);
+    quantized.prepare(integralSum.step1(), cv::Size(12, 12));
+    BOOST_CHECK_THROW(intensity(quantized, integralSum, integralSquare, cv::Point(0, 0), result), int);
+    const std::vector<DualWeightHaarWavelet> dual(1);
+    BOOST_CHECK_THROW(QuantizedWaveletBank(CompiledWaveletBank(dual)), int);
+}
+
+
+
+BOOST_AUTO_TEST_CASE(IncrementalIntegralImageTest)
+{
+    const cv::Mat frame = getSyntheticImage(cv::Size(41, 30));
+
+    std::vector<MyHaarWavelet> wavelets(1, getMyWavelet());
+    const CompiledWaveletBank bank(wavelets);
+    VarianceNormalizedWaveletEvaluator variance;
+
+    const int depths[] = {cv::DataType<int>::type, cv::DataType<double>::type};
+    for (int d = 0; d < 2; ++d)
+    {
+        IncrementalIntegralImage integral(depths[d]);
+        cv::Mat current = frame.clone();
+        integral.update(current);
+        BOOST_REQUIRE_EQUAL(integral.dirty().size(), 1u);
+        const PreparedWaveletBank prepared(bank, integral.sum().step1(), cv::Size(5, 5));
+        std::vector<cv::Mat> maps;
+        updateResponseMaps(variance, prepared, integral, 2, maps);
+
+        for (int step = 0; step < 3; ++step)
+        {
+            //a moving blob, and a pixel changed by less than the threshold
+            current(cv::Rect(3 + step * 7, 4 + step * 5, 6, 5)).setTo(step * 60);
+            current.at<unsigned char>(25, 40) += 1;
+            if (step == 1)
+            {
+                integral.update(current, std::vector<cv::Rect>(1, cv::Rect(3 + step * 7, 4 + step * 5, 6, 5)));
+                current.at<unsigned char>(25, 40) -= 1;
+            }
+            else
+            {
+                integral.update(current, 1, 8);
+            }
+            BOOST_CHECK(!integral.dirty().empty());
+            BOOST_CHECK(integral.dirty().size() <= 4u);
+
+            cv::Mat stale = current.clone();
+            stale.at<unsigned char>(25, 40) = integral.frame().at<unsigned char>(25, 40);
+            checkIncrementalIntegral(integral, stale, depths[d]);
+
+            std::vector<cv::Mat> expectedMaps;
+            updateResponseMaps(variance, prepared, integral, 2, maps);
+            responseMaps(variance, prepared, integral.sum(), integral.squareSum(), 2, expectedMaps);
+            for (int y = 0; y < maps[0].rows; ++y)
+            {
+                for (int x = 0; x < maps[0].cols; ++x)
+                {
+                    BOOST_CHECK_SMALL(maps[0].at<float>(y, x) - expectedMaps[0].at<float>(y, x), 1e-5f);
+                }
+            }
+        }
+
+        //overlapping rectangles are applied in a single pass, and only once where they overlap
+        current = getSyntheticImage(frame.size(), 1);
+        std::vector<cv::Rect> overlapping;
+        overlapping.push_back(cv::Rect(20, 12, 10, 8));
+        overlapping.push_back(cv::Rect(25, 15, 16, 15));
+        overlapping.push_back(cv::Rect(22, 14, 3, 3));
+        const cv::Mat previous = integral.frame().clone();
+        integral.update(current, overlapping);
+        BOOST_CHECK_EQUAL(integral.dirty().size(), 3u);
+        cv::Mat expected = previous.clone();
+        for (unsigned int r = 0; r < overlapping.size(); ++r)
+        {
+            cv::Mat target = expected(overlapping[r]);
+            current(overlapping[r]).copyTo(target);
+        }
+        checkIncrementalIntegral(integral, expected, depths[d]);
+
+        //a change near the top-left corner costs more than a rebuild
+        integral.update(current, std::vector<cv::Rect>(1, cv::Rect(0, 0, 41, 30)));
+        BOOST_CHECK_EQUAL(integral.dirty().size(), 1u);
+        checkIncrementalIntegral(integral, current, depths[d]);
+
+        std::vector<cv::Rect> regions;
+        integral.update(current, std::vector<cv::Rect>(1, cv::Rect(10, 10, 1, 1)));
+        integral.dirtyWindows(cv::Size(5, 5), 2, regions);
+        BOOST_REQUIRE_EQUAL(regions.size(), 1u);
+        BOOST_CHECK(regions[0] == cv::Rect(3, 3, 3, 3)); //windows at 6, 8 and 10
+    }
+
+    IncrementalIntegralImage integral;
+    integral.update(frame);
+    BOOST_CHECK_THROW(integral.update(frame(cv::Rect(0, 0, 10, 10)).clone()), int);
+    BOOST_CHECK_THROW(integral.update(frame, 0, 0), int);
+    std::vector<cv::Rect> regions;
+    BOOST_CHECK_THROW(integral.dirtyWindows(cv::Size(5, 5), 0, regions), int);
+}
+
+
+
+/**
+ * An evaluator whose response maps always fail, to check how FramePipeline reports errors.
+ */
+struct FailingEvaluator {};
+
+void responseMaps(const FailingEvaluator &,
+                  const PreparedWaveletBank &,
+                  const cv::Mat &,
+                  const cv::Mat &,
+                  const int,
+                  WindowStatisticsMap &,
+                  std::vector<cv::Mat> &)
+{
+    throw 36;
+}
+
+BOOST_AUTO_TEST_CASE(FramePipelineTest)
+{
+    const int total = 12;
+    std::vector<cv::Mat> frames;
+    for (int i = 0; i < total; ++i)
+    {
+        frames.push_back(getSyntheticImage(cv::Size(19, 16), i));
+    }
+
+    std::vector<MyHaarWavelet> wavelets(1, getMyWavelet());
+    const CompiledWaveletBank bank(wavelets);
+    VarianceNormalizedWaveletEvaluator variance;
+    FramePipeline<VarianceNormalizedWaveletEvaluator> pipeline(variance, bank, cv::Size(5, 5), frames[0].size(), 2, 2, 3);
+    BOOST_CHECK_EQUAL(pipeline.workers(), 2u);
+    BOOST_CHECK_EQUAL(pipeline.capacity(), 3u);
+
+    int pushed = 0, popped = 0;
+    while (popped < total)
+    {
+        while (pushed < total && pipeline.tryPush(frames[pushed]))
+        {
+            ++pushed;
+        }
+        BOOST_CHECK(pushed - popped <= 3); //backpressure
+
+        const PipelineFrame & frame = pipeline.pop();
+        BOOST_CHECK_EQUAL(frame.index, (unsigned long)popped);
+        BOOST_CHECK_EQUAL(frame.error, 0);
+
+        cv::Mat sum, squareSum;
+        std::vector<cv::Mat> expected;
+        cv::integral(frames[popped], sum, squareSum, cv::DataType<double>::type);
+        const PreparedWaveletBank prepared(bank, sum.step1(), cv::Size(5, 5));
+        responseMaps(variance, prepared, sum, squareSum, 2, expected);
+        BOOST_REQUIRE_EQUAL(frame.maps.size(), 1u);
+        BOOST_REQUIRE(frame.maps[0].size() == expected[0].size());
+        for (int y = 0; y < expected[0].rows; ++y)
+        {
+            for (int x = 0; x < expected[0].cols; ++x)
+            {
+                BOOST_CHECK_EQUAL(frame.maps[0].at<float>(y, x), expected[0].at<float>(y, x));
+            }
+        }
+        BOOST_CHECK(frame.latency.total >= frame.latency.evaluation);
+        BOOST_CHECK(frame.latency.evaluation >= 0);
+
+        pipeline.release(frame);
+        ++popped;
+    }
+
+    BOOST_CHECK(!pipeline.tryPop());
+    BOOST_CHECK_EQUAL(pipeline.statistics().frames, (unsigned long)total);
+    BOOST_CHECK(pipeline.statistics().max.total >= pipeline.statistics().mean.total);
+    BOOST_CHECK_THROW(pipeline.push(frames[0](cv::Rect(0, 0, 10, 10))), int);
+
+    //codes thrown by the workers are reported on the frame, and the pipeline goes on
+    FramePipeline<FailingEvaluator> failing(FailingEvaluator(), bank, cv::Size(5, 5), frames[0].size(), 2, 3, 2);
+    for (int i = 0; i < 3; ++i)
+    {
+        failing.push(frames[i]);
+        const PipelineFrame & frame = failing.pop();
+        BOOST_CHECK_EQUAL(frame.index, (unsigned long)i);
+        BOOST_CHECK_EQUAL(frame.error, 36);
+        failing.release(frame);
+    }
+
+    typedef FramePipeline<VarianceNormalizedWaveletEvaluator> Pipeline;
+    BOOST_CHECK_THROW(Pipeline(variance, bank, cv::Size(5, 5), frames[0].size(), 0), int);
+}
+
+
+
+BOOST_AUTO_TEST_CASE(PolicyWaveletEvaluatorTest)
+{
+    const cv::Mat image = getMockImage();
+    cv::Mat integralSum, integralSquare;
+    cv::integral(image, integralSum, integralSquare, cv::DataType<double>::type);
+
+    const HaarWavelet wavelet = getHaarWavelet();
+    const MyHaarWavelet myWavelet = getMyWavelet();
+    std::vector<float> negative(2, .5f);
+    const DualWeightHaarWavelet dualWavelet(std::vector<cv::Rect>(wavelet.rects_begin(), wavelet.rects_end()),
+                                            std::vector<float>(wavelet.weights_begin(), wavelet.weights_end()),
+                                            negative);
+
+    IntensityNormalizedWaveletEvaluator intensity;
+    VarianceNormalizedWaveletEvaluator variance;
+    const StaticWaveletEvaluator<IntensityNormalization, HaarWavelet>::type intensityPlain;
+    const StaticWaveletEvaluator<VarianceNormalization, HaarWavelet>::type variancePlain;
+    const PolicyWaveletEvaluator<VarianceNormalization, MeansKind> varianceMeans;
+    const PolicyWaveletEvaluator<IntensityNormalization, DualWeightKind> intensityDual;
+    const PolicyWaveletEvaluator<NoNormalization, PlainKind> raw;
+
+    const unsigned long before = allocations();
+    BOOST_CHECK_CLOSE(intensityPlain(wavelet, integralSum, integralSquare), -.009803921569, 0.0001);
+    BOOST_CHECK_CLOSE(variancePlain(wavelet, integralSum, integralSquare), -0.0703412294, 0.0001);
+    BOOST_CHECK_EQUAL(varianceMeans(myWavelet, integralSum, integralSquare), variance(myWavelet, integralSum, integralSquare));
+    BOOST_CHECK_EQUAL(allocations(), before);
+
+    const std::pair<float, float> dual = intensityDual(dualWavelet, integralSum, integralSquare);
+    BOOST_CHECK_EQUAL(dual.first, intensity(dualWavelet, integralSum, integralSquare).first);
+    BOOST_CHECK_EQUAL(dual.second, intensity(dualWavelet, integralSum, integralSquare).second);
+
+    //sums of the pixels of the rectangles, without normalization
+    BOOST_CHECK_EQUAL(raw(wavelet, integralSum, integralSquare),
+                      intensity.singleRectangleValue(wavelet.rect(0), integralSum) - intensity.singleRectangleValue(wavelet.rect(1), integralSum));
+
+    std::vector<MyHaarWavelet> wavelets(2, myWavelet);
+    float results[2];
+    varianceMeans(wavelets, integralSum, integralSquare, results);
+    BOOST_CHECK_EQUAL(results[1], variance(myWavelet, integralSum, integralSquare));
+}
+
+
+
+BOOST_AUTO_TEST_CASE(CompactWaveletBankTest)
+{
+    BOOST_CHECK_EQUAL(half::toFloat(half::fromFloat(1.0f)), 1.0f);
+    BOOST_CHECK_EQUAL(half::toFloat(half::fromFloat(-0.5f)), -0.5f);
+    BOOST_CHECK_EQUAL(half::toFloat(half::fromFloat(65504.0f)), 65504.0f);
+    BOOST_CHECK_EQUAL(half::toFloat(half::fromFloat(std::ldexp(1.0f, -24))), std::ldexp(1.0f, -24)); //smallest subnormal
+    BOOST_CHECK_EQUAL(half::toFloat(half::fromFloat(1.0f + std::ldexp(1.0f, -11))), 1.0f); //tie to even
+    BOOST_CHECK(half::exact(0.25f));
+    BOOST_CHECK(!half::exact(0.1f));
+
+    const cv::Mat image = getMockImage();
+    cv::Mat integralSum, integralSquare;
+    cv::integral(image, integralSum, integralSquare, cv::DataType<double>::type);
+
+    const HaarWavelet wavelet = getHaarWavelet();
+    const MyHaarWavelet myWavelet = getMyWavelet();
+    const std::vector<cv::Rect> rects(wavelet.rects_begin(), wavelet.rects_end());
+    std::vector<float> negative(2, .5f);
+
+    std::vector<HaarWavelet> plain(2, wavelet);
+    std::vector<MyHaarWavelet> means(1, myWavelet);
+    std::vector<DualWeightHaarWavelet> dual(1, DualWeightHaarWavelet(rects, std::vector<float>(wavelet.weights_begin(), wavelet.weights_end()), negative));
+    negative[1] = 0.1f; //not a half
+    dual.push_back(DualWeightHaarWavelet(rects, std::vector<float>(wavelet.weights_begin(), wavelet.weights_end()), negative));
+
+    const cv::Size window(5, 5);
+    const CompactWaveletBank compactPlain(plain, window);
+    const CompactWaveletBank compactMeans(means, window);
+    const CompactWaveletBank compactDual(dual, window);
+    BOOST_CHECK_EQUAL(compactPlain.coordinateWidth(), CompactWaveletBank::BYTE);
+    BOOST_CHECK_EQUAL(compactPlain.weightWidth(), CompactWaveletBank::HALF);
+    BOOST_CHECK_EQUAL(compactDual.weightWidth(), CompactWaveletBank::SINGLE);
+    BOOST_CHECK_EQUAL(compactPlain.bytes(), 2u + 4u * 4u + 4u * 2u);
+    BOOST_CHECK_EQUAL(CompactWaveletBank(plain, cv::Size(300, 5)).coordinateWidth(), CompactWaveletBank::HALF);
+
+    //lossless round trips
+    std::vector<HaarWavelet> plainBack;
+    compactPlain.wavelets(plainBack);
+    BOOST_REQUIRE_EQUAL(plainBack.size(), plain.size());
+    for (unsigned int i = 0; i < plain.size(); ++i)
+    {
+        BOOST_CHECK(std::equal(plain[i].rects_begin(), plain[i].rects_end(), plainBack[i].rects_begin()));
+        BOOST_CHECK(std::equal(plain[i].weights_begin(), plain[i].weights_end(), plainBack[i].weights_begin()));
+    }
+    std::vector<MyHaarWavelet> meansBack;
+    compactMeans.wavelets(meansBack);
+    BOOST_REQUIRE_EQUAL(meansBack.size(), 1u);
+    BOOST_CHECK(std::equal(myWavelet.means_begin(), myWavelet.means_end(), meansBack[0].means_begin()));
+    std::vector<DualWeightHaarWavelet> dualBack;
+    compactDual.wavelets(dualBack);
+    BOOST_REQUIRE_EQUAL(dualBack.size(), 2u);
+    BOOST_CHECK(std::equal(dual[1].weightsNegative_begin(), dual[1].weightsNegative_end(), dualBack[1].weightsNegative_begin()));
+    BOOST_CHECK_THROW(compactDual.wavelets(plainBack), int);
+
+    //same results as the prepared banks
+    cv::integral(getSyntheticImage(cv::Size(8, 8)), integralSum, integralSquare, cv::DataType<double>::type);
+
+    IntensityNormalizedWaveletEvaluator intensity;
+    VarianceNormalizedWaveletEvaluator variance;
+    const CompactWaveletBank * compact[] = {&compactPlain, &compactMeans, &compactDual};
+    const CompiledWaveletBank compiled[] = {CompiledWaveletBank(plain), CompiledWaveletBank(means), CompiledWaveletBank(dual)};
+    for (int i = 0; i < 3; ++i)
+    {
+        const PreparedWaveletBank prepared(compiled[i], integralSum.step1(), window);
+        float expected[4], results[4];
+
+        intensity(prepared, integralSum, integralSquare, cv::Point(1, 0), expected);
+        intensity(*compact[i], integralSum, integralSquare, cv::Point(1, 0), results);
+        BOOST_CHECK(std::equal(expected, expected + compiled[i].size() * compiled[i].outputs(), results));
+
+        variance(prepared, integralSum, integralSquare, cv::Point(2, 3), expected);
+        variance(*compact[i], integralSum, integralSquare, cv::Point(2, 3), results);
+        BOOST_CHECK(std::equal(expected, expected + compiled[i].size() * compiled[i].outputs(), results));
+
+        BOOST_CHECK_EQUAL(compact[i]->kind(), compiled[i].kind());
+        BOOST_CHECK_THROW(intensity(*compact[i], integralSum, integralSquare, cv::Point(4, 0), results), int);
+    }
+
+    BOOST_CHECK_THROW(CompactWaveletBank(plain, cv::Size(2, 2)), int);
+
+    //lossy half precision, within the reported bounds
+    BOOST_CHECK_EQUAL(compactDual.errorBounds()[1], 0.0f);
+    std::vector<MyHaarWavelet> roundedMeans(1, myWavelet); //means that aren't halves
+    const CompactWaveletBank lossyDual(dual, window, true), lossyMeans(roundedMeans, window, true);
+    BOOST_CHECK_EQUAL(lossyDual.weightWidth(), CompactWaveletBank::HALF);
+    BOOST_CHECK_EQUAL(lossyDual.errorBounds()[0], 0.0f);
+    BOOST_CHECK(lossyDual.errorBounds()[1] > 0.0f);
+    BOOST_CHECK(lossyMeans.errorBounds()[0] > 0.0f);
+    const CompactWaveletBank * lossy[] = {&lossyDual, &lossyMeans};
+    const CompiledWaveletBank exact[] = {CompiledWaveletBank(dual), CompiledWaveletBank(roundedMeans)};
+    for (int i = 0; i < 2; ++i)
+    {
+        const PreparedWaveletBank prepared(exact[i], integralSum.step1(), window);
+        for (int y = 0; y + window.height < integralSum.rows; ++y)
+        {
+            for (int x = 0; x + window.width < integralSum.cols; ++x)
+            {
+                float expected[4], results[4];
+                intensity(prepared, integralSum, integralSquare, cv::Point(x, y), expected);
+                intensity(*lossy[i], integralSum, integralSquare, cv::Point(x, y), results);
+                for (unsigned int j = 0; j < exact[i].size() * exact[i].outputs(); ++j)
+                {
+                    BOOST_CHECK_SMALL(results[j] - expected[j], lossy[i]->errorBounds()[j / exact[i].outputs()] + 1e-6f);
+                }
+            }
+        }
+    }
+    negative[1] = 1e6f;
+    BOOST_CHECK_THROW(CompactWaveletBank(std::vector<DualWeightHaarWavelet>(1, DualWeightHaarWavelet(rects, negative, negative)), window, true), int);
+}
+
+
+
+BOOST_AUTO_TEST_CASE(WaveletGeneratorTest)
+{
+    const WaveletGenerator violaJones(cv::Size(24, 24), WaveletTemplate::violaJones());
+    BOOST_CHECK_EQUAL(violaJones.size(), 162336u);
+    BOOST_CHECK_EQUAL(violaJones.maxRectangles(), 4u);
+    BOOST_CHECK_EQUAL(violaJones.templateIndex(43199), 0u);
+    BOOST_CHECK_EQUAL(violaJones.templateIndex(43200), 1u);
+    BOOST_CHECK_EQUAL(violaJones.templateIndex(162335), 4u);
+    BOOST_CHECK_THROW(violaJones.wavelet(162336), int);
+
+    const HaarWavelet first = violaJones.wavelet(0);
+    BOOST_REQUIRE_EQUAL(first.dimensions(), 2);
+    BOOST_CHECK(first.rect(0) == cv::Rect(0, 0, 1, 1));
+    BOOST_CHECK(first.rect(1) == cv::Rect(1, 0, 1, 1));
+    BOOST_CHECK(violaJones.wavelet(1).rect(0) == cv::Rect(1, 0, 1, 1));
+
+    const HaarWavelet last = violaJones.wavelet(162335);
+    BOOST_REQUIRE_EQUAL(last.dimensions(), 4);
+    BOOST_CHECK(last.rect(3) == cv::Rect(12, 12, 12, 12));
+    BOOST_CHECK_EQUAL(last.weight(1), -1);
+
+    //every wavelet is distinct and fits in the window
+    const WaveletGenerator small(cv::Size(6, 6), WaveletTemplate::violaJones());
+    std::vector<HaarWavelet> wavelets;
+    small.wavelets(0, small.size(), wavelets);
+    BOOST_REQUIRE_EQUAL(wavelets.size(), small.size());
+    std::set< std::vector<int> > distinct;
+    for (unsigned int i = 0; i < wavelets.size(); ++i)
+    {
+        std::vector<int> key(1, small.templateIndex(i));
+        for (std::vector<cv::Rect>::const_iterator r = wavelets[i].rects_begin(); r != wavelets[i].rects_end(); ++r)
+        {
+            BOOST_CHECK(r->x >= 0 && r->y >= 0 && r->x + r->width <= 6 && r->y + r->height <= 6);
+            key.push_back(r->x);
+            key.push_back(r->y);
+            key.push_back(r->width);
+            key.push_back(r->height);
+        }
+        distinct.insert(key);
+    }
+    BOOST_CHECK_EQUAL(distinct.size(), wavelets.size());
+
+    const CompiledWaveletBank generated(small, 3, 40);
+    const CompiledWaveletBank built(std::vector<HaarWavelet>(wavelets.begin() + 3, wavelets.begin() + 40));
+    BOOST_REQUIRE_EQUAL(generated.size(), built.size());
+    BOOST_REQUIRE_EQUAL(generated.rectangles(), built.rectangles());
+    BOOST_CHECK(std::equal(generated.rectanglesBegin(), generated.rectanglesBegin() + generated.size() + 1, built.rectanglesBegin()));
+    BOOST_CHECK(std::equal(generated.weights(), generated.weights() + generated.rectangles(), built.weights()));
+    BOOST_CHECK(std::equal(generated.normalization(), generated.normalization() + generated.rectangles(), built.normalization()));
+    BOOST_CHECK_EQUAL(generated.corners()[generated.rectangles() - 1].bottom, built.corners()[built.rectangles() - 1].bottom);
+    BOOST_CHECK_THROW(CompiledWaveletBank(small, 40, 3), int);
+
+    std::vector<float> edge(2, 1);
+    edge[1] = -1;
+    std::vector<WaveletTemplate> sparse(1, WaveletTemplate(2, 1, edge, cv::Size(2, 2), cv::Size(4, 0), 2, 2));
+    BOOST_CHECK_EQUAL(WaveletGenerator(cv::Size(8, 8), sparse).size(), (3u + 1u) * (4u + 3u + 2u + 1u)); //widths 2 and 4, heights 2 to 8
+    sparse[0].weights.pop_back();
+    BOOST_CHECK_THROW(WaveletGenerator(cv::Size(8, 8), sparse), int);
+
+    //feature columns, straight from the indices
+    std::vector<cv::Mat> sums(70), squareSums(sums.size());
+    for (unsigned int i = 0; i < sums.size(); ++i)
+    {
+        cv::integral(getSyntheticImage(cv::Size(6, 6), i), sums[i], squareSums[i], cv::DataType<double>::type);
+    }
+
+    VarianceNormalizedWaveletEvaluator evaluator;
+    cv::Mat columns;
+    extractFeatures(evaluator, small, 10, small.size(), sums, squareSums, columns);
+    BOOST_REQUIRE_EQUAL(columns.rows, (int)small.size() - 10);
+    BOOST_REQUIRE_EQUAL(columns.cols, 70);
+    for (int j = 0; j < columns.rows; j += 7)
+    {
+        for (unsigned int i = 0; i < sums.size(); ++i)
+        {
+            BOOST_CHECK_SMALL(columns.at<float>(j, i) - evaluator(wavelets[j + 10], sums[i], squareSums[i]), 1e-5f);
+        }
+    }
+
+    sums.push_back(cv::Mat::zeros(8, 8, cv::DataType<double>::type));
+    squareSums.push_back(sums.back());
+    BOOST_CHECK_THROW(extractFeatures(evaluator, small, 0, 1, sums, squareSums, columns), int);
+    sums.pop_back();
+    BOOST_CHECK_THROW(extractFeatures(evaluator, small, 0, 1, sums, squareSums, columns), int);
+}
+
+
+
+BOOST_AUTO_TEST_CASE(SortedFeatureIndexTest)
+{
+    std::vector<cv::Mat> sums(60), squareSums(sums.size());
+    std::vector<float> weights(sums.size());
+    std::vector<int> labels(sums.size());
+    for (unsigned int i = 0; i < sums.size(); ++i)
+    {
+        cv::integral(getSyntheticImage(cv::Size(6, 6), i), sums[i], squareSums[i], cv::DataType<double>::type);
+        weights[i] = 1.0f + i % 7;
+        labels[i] = i % 3 == 0;
+    }
+
+    const HaarWavelet wavelet = getHaarWavelet();
+    std::vector<float> negative(2, .5f);
+    negative[1] = -2;
+    const std::vector<DualWeightHaarWavelet> wavelets(2, DualWeightHaarWavelet(std::vector<cv::Rect>(wavelet.rects_begin(), wavelet.rects_end()),
+                                                                             std::vector<float>(wavelet.weights_begin(), wavelet.weights_end()),
+                                                                             negative));
+    const CompiledWaveletBank bank(wavelets);
+    IntensityNormalizedWaveletEvaluator evaluator;
+    const SortedFeatureIndex index(evaluator, bank, sums, squareSums);
+    BOOST_REQUIRE_EQUAL(index.features(), 4u);
+    BOOST_REQUIRE_EQUAL(index.samples(), 60u);
+    BOOST_CHECK_EQUAL(index.encoding(1), SortedFeatureIndex::DIRECT16);
+    BOOST_CHECK_EQUAL(index.bytes(), 4u * 60u * 2u);
+
+    std::vector<unsigned int> order(index.samples());
+    for (unsigned int f = 0; f < index.features(); ++f)
+    {
+        index.order(f, &order[0]);
+        const float * values = index.values().ptr<float>(f);
+        for (unsigned int k = 1; k < order.size(); ++k)
+        {
+            BOOST_CHECK(values[order[k - 1]] <= values[order[k]]);
+        }
+
+        //brute force over all thresholds
+        double bestError = std::numeric_limits<double>::infinity();
+        for (unsigned int k = 0; k <= order.size(); ++k)
+        {
+            const float threshold = k < order.size() ? values[order[k]] : std::numeric_limits<float>::infinity();
+            double below = 0, above = 0;
+            for (unsigned int i = 0; i < order.size(); ++i)
+            {
+                const bool positiveBelow = values[i] < threshold;
+                below += (positiveBelow != (labels[i] != 0)) ? weights[i] : 0;
+                above += (positiveBelow == (labels[i] != 0)) ? weights[i] : 0;
+            }
+            bestError = std::min(bestError, std::min(below, above));
+        }
+
+        const DecisionStump stump = index.bestStump(f, weights, labels);
+        BOOST_CHECK_EQUAL(stump.wavelet, f / 2);
+        BOOST_CHECK_EQUAL(stump.output, f % 2);
+        BOOST_CHECK_CLOSE(stump.error, bestError, 1e-9);
+
+        double error = 0;
+        for (unsigned int i = 0; i < order.size(); ++i)
+        {
+            error += ((values[i] < stump.threshold) == stump.positiveBelow) != (labels[i] != 0) ? weights[i] : 0;
+        }
+        BOOST_CHECK_CLOSE(stump.error, error, 1e-9);
+    }
+    const DecisionStump best = index.bestStump(weights, labels);
+    BOOST_CHECK_EQUAL(best.error, index.bestStump(best.feature, weights, labels).error);
+    BOOST_CHECK_THROW(index.bestStump(std::vector<float>(3, 1), labels), int);
+
+    //past 65536 samples, orders that follow the samples stay at 16 bits
+    cv::Mat columns(2, 70000, cv::DataType<float>::type);
+    for (int i = 0; i < columns.cols; ++i)
+    {
+        columns.at<float>(0, i) = i / 2;
+        columns.at<float>(1, i) = (i * 7919) % 70000;
+    }
+    const SortedFeatureIndex large(columns, true);
+    BOOST_CHECK_EQUAL(large.encoding(0), SortedFeatureIndex::DELTA16);
+    BOOST_CHECK_EQUAL(large.encoding(1), SortedFeatureIndex::DIRECT32);
+    BOOST_CHECK_EQUAL(large.bytes(), 70000u * 6u);
+    order.resize(columns.cols);
+    large.order(0, &order[0]);
+    BOOST_CHECK_EQUAL(order[69999], 69999u);
+    large.order(1, &order[0]);
+    BOOST_CHECK_EQUAL((order[1] * 7919) % 70000, 1u);
+}
+
+
+
+BOOST_AUTO_TEST_CASE(MultiHeadHaarWaveletTest)
+{
+    const cv::Mat image = getMockImage();
+    cv::Mat integralSum, integralSquare;
+    cv::integral(image, integralSum, integralSquare, cv::DataType<double>::type);
+
+    const HaarWavelet wavelet = getHaarWavelet();
+    const MyHaarWavelet myWavelet = getMyWavelet();
+    const std::vector<cv::Rect> rects(wavelet.rects_begin(), wavelet.rects_end());
+
+    //heads: the weights of wavelet, then of a dual weight wavelet
+    std::vector<float> weights(wavelet.weights_begin(), wavelet.weights_end());
+    std::vector<float> negative(2, .5f);
+    negative[1] = -3;
+    weights.insert(weights.end(), negative.begin(), negative.end());
+    const MultiHeadHaarWavelet multi(rects, 2, weights);
+    const DualWeightHaarWavelet dual(rects, std::vector<float>(wavelet.weights_begin(), wavelet.weights_end()), negative);
+
+    std::vector<float> myWeights(myWavelet.weights_begin(), myWavelet.weights_end());
+    std::vector<float> myMeans(myWavelet.means_begin(), myWavelet.means_end());
+    myWeights.insert(myWeights.end(), myWeights.begin(), myWeights.end());
+    myMeans.insert(myMeans.end(), 2, .25f);
+    const MultiHeadHaarWavelet withMeans(rects, 2, myWeights, myMeans);
+    BOOST_CHECK_THROW(MultiHeadHaarWavelet(rects, 3, myWeights), int);
+    BOOST_CHECK_THROW(MultiHeadHaarWavelet(rects, 2, myWeights, negative), int);
+    const MyHaarWavelet second(rects, std::vector<float>(myWavelet.weights_begin(), myWavelet.weights_end()), std::vector<float>(2, .25f));
+
+    IntensityNormalizedWaveletEvaluator intensity;
+    VarianceNormalizedWaveletEvaluator variance;
+    float results[2], scratch[2];
+
+    intensity(multi, integralSum, integralSquare, results);
+    BOOST_CHECK_EQUAL(results[0], intensity(dual, integralSum, integralSquare).first);
+    BOOST_CHECK_EQUAL(results[1], intensity(dual, integralSum, integralSquare).second);
+
+    const unsigned long before = allocations();
+    variance(multi, integralSum, integralSquare, scratch, 2, results);
+    BOOST_CHECK_EQUAL(allocations(), before);
+    BOOST_CHECK_EQUAL(results[0], variance(wavelet, integralSum, integralSquare));
+    BOOST_CHECK_EQUAL(results[1], variance(dual, integralSum, integralSquare).second);
+
+    variance(withMeans, integralSum, integralSquare, results);
+    BOOST_CHECK_EQUAL(results[0], variance(myWavelet, integralSum, integralSquare));
+    BOOST_CHECK_EQUAL(results[1], variance(second, integralSum, integralSquare));
+    BOOST_CHECK_THROW(variance(withMeans, integralSum, integralSquare, scratch, 1, results), int);
+
+    std::stringstream stream;
+    BOOST_REQUIRE(withMeans.write(stream));
+    MultiHeadHaarWavelet read;
+    read.read(stream);
+    BOOST_CHECK_EQUAL(read.heads(), 2u);
+    BOOST_CHECK(read.hasMeans());
+    BOOST_CHECK(std::equal(read.means_begin(1), read.means_end(1), myMeans.begin() + 2));
+    BOOST_CHECK(std::equal(read.weights_begin(0), read.weights_end(0), myWeights.begin()));
+    BOOST_CHECK(*(read.rects_begin() + 1) == rects[1]);
+}
+
+
+
+BOOST_AUTO_TEST_CASE(IntegralBatchTest)
+{
+    std::vector<cv::Mat> patches(37), sums(patches.size()), squareSums(patches.size());
+    for (unsigned int i = 0; i < patches.size(); ++i)
+    {
+        patches[i] = getSyntheticImage(cv::Size(7, 6), i);
+        if (i == 5) //no variance in patch 5
+        {
+            patches[i].convertTo(patches[i], cv::DataType<unsigned char>::type, 0, 9);
+        }
+        cv::integral(patches[i], sums[i], squareSums[i], cv::DataType<double>::type);
+    }
+
+    IntegralBatch batch(patches);
+    BOOST_CHECK_EQUAL(batch.size(), 37u);
+    BOOST_CHECK_EQUAL(batch.stride(), 48u);
+    for (unsigned int i = 0; i < patches.size(); ++i) //every lane of the SIMD kernels (SSE2 at least, on x86)
+    {
+        for (int y = 0; y <= 6; ++y)
+        {
+            for (int x = 0; x <= 7; ++x)
+            {
+                BOOST_CHECK_EQUAL(batch.sum(i, y, x), sums[i].at<double>(y, x));
+                BOOST_CHECK_EQUAL(batch.squareSum(i, y, x), squareSums[i].at<double>(y, x));
+            }
+        }
+    }
+
+    const HaarWavelet wavelet = getHaarWavelet();
+    const std::vector<cv::Rect> rects(wavelet.rects_begin(), wavelet.rects_end());
+    std::vector<float> negative(2, .5f);
+    std::vector<HaarWavelet> plain(2, wavelet);
+    plain[1].weight(1, .25);
+    const std::vector<MyHaarWavelet> means(1, getMyWavelet());
+    const std::vector<DualWeightHaarWavelet> dual(1, DualWeightHaarWavelet(rects, std::vector<float>(wavelet.weights_begin(), wavelet.weights_end()), negative));
+    const CompiledWaveletBank banks[] = {CompiledWaveletBank(plain), CompiledWaveletBank(means), CompiledWaveletBank(dual)};
+
+    IntensityNormalizedWaveletEvaluator intensity;
+    VarianceNormalizedWaveletEvaluator variance;
+    for (int b = 0; b < 3; ++b)
+    {
+        cv::Mat intensityResults, varianceResults;
+        intensity(banks[b], batch, intensityResults);
+        variance(banks[b], batch, varianceResults);
+        BOOST_REQUIRE_EQUAL(intensityResults.rows, (int)(banks[b].size() * banks[b].outputs()));
+        BOOST_REQUIRE_EQUAL(varianceResults.cols, 37);
+
+        for (unsigned int i = 0; i < patches.size(); ++i)
+        {
+            float expected[2];
+            intensity(banks[b], sums[i], squareSums[i], expected);
+            for (int j = 0; j < intensityResults.rows; ++j)
+            {
+                BOOST_CHECK_EQUAL(intensityResults.at<float>(j, i), expected[j]);
+            }
+            variance(banks[b], sums[i], squareSums[i], expected);
+            for (int j = 0; j < varianceResults.rows; ++j)
+            {
+                BOOST_CHECK_EQUAL(varianceResults.at<float>(j, i), expected[j]);
+            }
+        }
+    }
+
+    cv::Mat results;
+    patches.push_back(cv::Mat::zeros(7, 7, cv::DataType<unsigned char>::type));
+    BOOST_CHECK_THROW(batch.assign(patches), int);
+    std::vector<cv::Mat> small(3, cv::Mat::zeros(4, 4, cv::DataType<unsigned char>::type));
+    batch.assign(small);
+    BOOST_CHECK_THROW(intensity(banks[0], batch, results), int);
+}
+
+
+
+//Evaluates a prepared bank once, in a thread of its own.
+struct InstrumentedEvaluation
+{
+    const PreparedWaveletBank * prepared;
+    const cv::Mat * sum;
+    float results[3];
+};
+
+void * instrumentedEvaluation(void * argument)
+{
+    InstrumentedEvaluation & e = *static_cast<InstrumentedEvaluation *>(argument);
+    IntensityNormalizedWaveletEvaluator()(*e.prepared, *e.sum, *e.sum, cv::Point(1, 1), e.results);
+    return 0;
+}
+
+BOOST_AUTO_TEST_CASE(InstrumentationTest)
+{
+    const cv::Mat image = getSyntheticImage(cv::Size(9, 9));
+    cv::Mat sum, squareSum;
+    cv::integral(image, sum, squareSum, cv::DataType<double>::type);
+
+    const std::vector<HaarWavelet> wavelets(3, getHaarWavelet());
+    const CompiledWaveletBank bank(wavelets);
+    const PreparedWaveletBank prepared(bank, sum.step1(), cv::Size(5, 5));
+    const std::string filename = "instrumentationtest.txt";
+    BOOST_REQUIRE(writeHaarWavelets(filename, wavelets));
+    const unsigned long long fileSize = std::ifstream(filename.c_str(), std::ifstream::binary | std::ifstream::ate).tellg();
+
+    instrumentation::reset();
+    instrumentation::Snapshot s = instrumentation::snapshot();
+    for (int i = 0; i < instrumentation::COUNTERS; ++i)
+    {
+        BOOST_CHECK_EQUAL(s.counters[i], 0u);
+    }
+
+    IntensityNormalizedWaveletEvaluator intensity;
+    VarianceNormalizedWaveletEvaluator variance;
+    float results[3];
+    intensity(prepared, sum, squareSum, cv::Point(0, 0), results);
+    intensity(prepared, sum, squareSum, cv::Point(4, 4), results);
+    variance(prepared, sum, squareSum, cv::Point(2, 2), results);
+
+    std::vector<cv::Mat> maps;
+    responseMaps(variance, prepared, sum, squareSum, 1, maps);
+
+    InstrumentedEvaluation evaluation = {&prepared, &sum, {0, 0, 0}};
+    pthread_t thread;
+    BOOST_REQUIRE_EQUAL(pthread_create(&thread, 0, instrumentedEvaluation, &evaluation), 0);
+    pthread_join(thread, 0);
+
+    std::vector<HaarWavelet> loaded;
+    BOOST_REQUIRE(loadHaarWavelets(filename, loaded));
+    std::remove(filename.c_str());
+
+    s = instrumentation::snapshot();
+    BOOST_CHECK_EQUAL(std::string(instrumentation::name(instrumentation::RECTANGLES)), "rectangles");
+    BOOST_CHECK_EQUAL(std::string(instrumentation::name(instrumentation::PARSING_CYCLES)), "parsing");
+    if (!instrumentation::enabled())
+    {
+        for (int i = 0; i < instrumentation::COUNTERS; ++i)
+        {
+            BOOST_CHECK_EQUAL(s.counters[i], 0u);
+        }
+        for (int i = 0; i < instrumentation::TIMERS; ++i)
+        {
+            BOOST_CHECK_EQUAL(s.calls[i], 0u);
+        }
+        return;
+    }
+
+    //3 windows, the 25 windows of the maps and the window of the thread, which finished
+    BOOST_CHECK_EQUAL(s.counters[instrumentation::WINDOWS], 29u);
+    BOOST_CHECK_EQUAL(s.counters[instrumentation::WAVELETS], 29u * 3);
+    BOOST_CHECK_EQUAL(s.counters[instrumentation::RECTANGLES], 29u * 6);
+    BOOST_CHECK_EQUAL(s.counters[instrumentation::STATISTICS], 26u);
+    BOOST_CHECK(s.counters[instrumentation::ALLOCATIONS] > 0);
+    BOOST_CHECK_EQUAL(s.counters[instrumentation::BYTES_PARSED], fileSize);
+    BOOST_CHECK_EQUAL(s.counters[instrumentation::WAVELETS_PARSED], 3u);
+    BOOST_CHECK_EQUAL(s.calls[instrumentation::STATISTICS_CYCLES], 1u);
+    BOOST_CHECK_EQUAL(s.calls[instrumentation::EVALUATION_CYCLES], 1u);
+    BOOST_CHECK_EQUAL(s.calls[instrumentation::PARSING_CYCLES], 1u);
+    BOOST_CHECK_EQUAL(s.calls[instrumentation::INTEGRAL_CYCLES], 0u);
+    BOOST_CHECK(s.cycles[instrumentation::EVALUATION_CYCLES] > 0);
+
+    instrumentation::reset();
+    s = instrumentation::snapshot();
+    BOOST_CHECK_EQUAL(s.counters[instrumentation::WINDOWS], 0u);
+    BOOST_CHECK_EQUAL(s.calls[instrumentation::EVALUATION_CYCLES], 0u);
+}